@@ -32,6 +32,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <OSL/oslversion.h>
 #include <OSL/oslconfig.h>
 
+#include <memory>
+#include <string>
 #include <vector>
 
 #ifdef LLVM_NAMESPACE
@@ -65,6 +67,42 @@ namespace pvt {   // OSL::pvt
 
 
 
+/// Content-addressed cache of JITed object code, kept as files in a
+/// directory so that it persists across runs.  A module whose identifier
+/// (see LLVM_Util::jit_cache_key) matches an object compiled earlier will
+/// have that object loaded by the JIT instead of being compiled again.
+class OSLEXECPUBLIC JITObjectCache {
+public:
+    JITObjectCache (const std::string &dir);
+    ~JITObjectCache ();
+
+    /// The directory holding the cached objects.
+    const std::string &dir () const;
+
+    /// Read the object stored for the module's identifier (its key), if
+    /// there is one, and hold it for the JIT to use when it compiles that
+    /// module.  Return false if there is none, or the identifier isn't a
+    /// key (see LLVM_Util::jit_cache_key); the module must then be
+    /// optimized and compiled as usual.  An object the JIT doesn't claim
+    /// is released when the LLVM_Util that made the module finalizes or
+    /// discards it.
+    bool fetch_object (const llvm::Module *module);
+
+    /// Statistics: objects found in / missing from the cache, modules
+    /// that could not be cached, and the total bytes read from and
+    /// written to it.
+    long long hits () const;
+    long long misses () const;
+    long long uncacheable () const;
+    long long bytes_read () const;
+    long long bytes_written () const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+    friend class LLVM_Util;
+};
+
 
 
 /// Wrapper class around LLVM functionality.  This handles all the
@@ -106,6 +144,22 @@ public:
                                        const std::string &name=std::string(),
                                        std::string *err=NULL);
 
+    /// Create a new module holding declarations (but not definitions) of
+    /// the functions in bitcode[0..size-1], and global variables.  The
+    /// bitcode is parsed only once per thread and shared by all modules
+    /// made from it, so it must remain valid for the life of the process.
+    /// Function bodies are copied in afterwards by
+    /// link_shared_functions(), only for functions that are used.
+    llvm::Module *module_from_shared_bitcode (const char *bitcode, size_t size,
+                                              const std::string &name=std::string(),
+                                              std::string *err=NULL);
+
+    /// For a module made by module_from_shared_bitcode, copy into it the
+    /// definitions of all the shared functions reachable from the given
+    /// functions.  Return the number of function bodies copied.
+    int link_shared_functions (const std::vector<llvm::Function*> &roots,
+                               std::string *err=NULL);
+
     /// Create a new function (that will later be populated with
     /// instructions) with up to 4 args.
     llvm::Function *make_function (const std::string &name, bool fastcall,
@@ -162,6 +216,42 @@ public:
     /// current one).
     void execengine (llvm::ExecutionEngine *exec);
 
+    /// Memory holding JITed code and data.  By default the JIT puts code
+    /// in memory shared by all LLVM_Util's of a thread, which is never
+    /// freed; memory from private_jit_memory() is freed as soon as nobody
+    /// holds a reference to it.
+    class JITMemory;
+    typedef std::shared_ptr<JITMemory> JITMemoryRef;
+
+    /// Have JIT execution engines made subsequently put their code and
+    /// data in memory of their own, and return a reference to it.  The
+    /// caller must keep the reference for as long as the code may run.
+    JITMemoryRef private_jit_memory ();
+
+    /// Bytes of JITed code and data in the given memory.
+    static size_t jit_memory_size (const JITMemoryRef &mem);
+
+    /// Set the object cache that JIT execution engines made subsequently
+    /// will consult before generating code (NULL for none).
+    void object_cache (JITObjectCache *cache) { m_object_cache = cache; }
+    JITObjectCache *object_cache () const { return m_object_cache; }
+
+    /// Compute a key for a JITObjectCache from the IR of the given
+    /// functions (which must be all the code generated into the module
+    /// that isn't library code identified by salt) plus the JIT target.
+    /// Return an empty string if the code can't be cached because it
+    /// holds absolute addresses (such as those made by constant_ptr),
+    /// which would mean nothing to another process.
+    std::string jit_cache_key (const std::vector<llvm::Function*> &funcs,
+                               const std::string &salt);
+
+    /// If true, ustring constants are emitted as references to named
+    /// external symbols that are resolved when the code is linked, rather
+    /// than as raw addresses, so that the generated object code does not
+    /// depend on where this process happened to allocate its strings.
+    void relocatable_strings (bool r) { m_relocatable_strings = r; }
+    bool relocatable_strings () const { return m_relocatable_strings; }
+
     /// Change symbols in the module that are marked as having external
     /// linkage to an alternate linkage that allows them to be discarded if
     /// not used within the module. Only do this for functions that start
@@ -171,9 +261,16 @@ public:
                                        const std::vector<std::string> &exceptions,
                                        const std::vector<std::string> &moreexceptions);
 
-    /// Setup LLVM optimization passes.
+    /// Setup LLVM optimization passes. An optlevel of 1-3 means the same
+    /// passes as clang -O1..-O3, and a negative optlevel means the bare
+    /// minimum, for the fastest possible compile.
     void setup_optimization_passes (int optlevel);
 
+    /// Set whether execution engines subsequently created should favor
+    /// compile speed over code quality in the code generator.
+    void fast_codegen (bool fast) { m_fast_codegen = fast; }
+    bool fast_codegen () const { return m_fast_codegen; }
+
     /// Run the optimization passes.
     void do_optimize (std::string *err = NULL);
 
@@ -310,6 +407,12 @@ public:
     /// Return an llvm::Value for a void* variable with value NULL.
     llvm::Value *void_ptr_null ();
 
+    /// Return a void* to a read-only, module-private global holding a
+    /// copy of the given bytes.  The data must not contain pointers if
+    /// the code is to be cached or relocated.
+    llvm::Value *constant_data (const void *data, size_t size,
+                                const std::string &name=std::string());
+
     /// Cast the pointer variable specified by val to the kind of pointer
     /// described by type (as an llvm pointer type).
     llvm::Value *ptr_cast (llvm::Value* val, llvm::Type *type);
@@ -347,6 +450,12 @@ public:
         return op_alloca ((llvm::Type *)llvmtype, n, name);
     }
 
+    /// Like op_alloca, but place the allocation at the start of the
+    /// current function's entry block, so that it happens once per call
+    /// even if the code using it is inside a loop.
+    llvm::Value *op_alloca_entry (llvm::Type *llvmtype, int n=1,
+                                  const std::string &name=std::string());
+
     /// Generate an alloca instruction to allocate space for n copies of the
     /// given type, and return its pointer.
     llvm::Value *op_alloca (const OIIO::TypeDesc &type, int n=1,
@@ -496,11 +605,13 @@ public:
 
     std::string func_name (llvm::Function *f);
 
+    /// Total bytes of JITed code and data still held, by all threads.
     static size_t total_jit_memory_held ();
 
 private:
     class MemoryManager;
     class IRBuilder;
+    struct SharedModuleMap;
 
     void SetupLLVM ();
     IRBuilder& builder();
@@ -510,11 +621,15 @@ private:
     llvm::LLVMContext *m_llvm_context;
     llvm::Module *m_llvm_module;
     IRBuilder *m_builder;
-    llvm::SectionMemoryManager *m_llvm_jitmm;
+    JITMemoryRef m_jit_memory;
     llvm::Function *m_current_function;
     llvm::legacy::PassManager *m_llvm_module_passes;
     llvm::legacy::FunctionPassManager *m_llvm_func_passes;
     llvm::ExecutionEngine *m_llvm_exec;
+    JITObjectCache *m_object_cache;
+    bool m_relocatable_strings;
+    bool m_fast_codegen;
+    SharedModuleMap *m_shared_map;  // maps shared module to m_llvm_module
     std::vector<llvm::BasicBlock *> m_return_block;     // stack for func call
     std::vector<llvm::BasicBlock *> m_loop_after_block; // stack for break
     std::vector<llvm::BasicBlock *> m_loop_step_block;  // stack for continue
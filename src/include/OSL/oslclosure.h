@@ -67,6 +67,7 @@ public:
 struct ClosureComponent;
 struct ClosureMul;
 struct ClosureAdd;
+struct ClosureList;
 
 /// ClosureColor is the base class for a lightweight tree representation
 /// of OSL closures for the sake of the executing OSL shader.
@@ -87,9 +88,10 @@ struct ClosureAdd;
 ///
 /// The base class ClosureColor just provides the type, and it's
 /// definitely one of the three kinds of subclasses: ClosureComponent,
-/// ClosureMul, ClosureAdd.
+/// ClosureMul, ClosureAdd -- or, if the ShadingSystem's "flat_closures"
+/// option is set, a ClosureList instead of the latter two.
 struct OSLEXECPUBLIC ClosureColor {
-    enum ClosureID { COMPONENT_BASE_ID = 0, MUL = -1, ADD = -2 };
+    enum ClosureID { COMPONENT_BASE_ID = 0, MUL = -1, ADD = -2, LIST = -3 };
 
     int id;
 
@@ -107,6 +109,11 @@ struct OSLEXECPUBLIC ClosureColor {
         OSL_DASSERT(id == ADD);
         return reinterpret_cast<const ClosureAdd*>(this);
     }
+
+    OSL_HOSTDEVICE const ClosureList* as_list() const {
+        OSL_DASSERT(id == LIST);
+        return reinterpret_cast<const ClosureList*>(this);
+    }
 };
 
 
@@ -159,4 +166,37 @@ struct OSLEXECPUBLIC ClosureAdd : public ClosureColor
     const ClosureColor *closureB;
 };
 
+
+/// ClosureList is a subclass of ClosureColor that holds an already
+/// flattened sum of closure components, each with its weight fully
+/// accumulated.  It is only made when the ShadingSystem's "flat_closures"
+/// option is set, in which case every closure a shader produces is NULL,
+/// a single ClosureComponent, or a ClosureList, so a renderer just loops
+/// over the components:
+///
+///     if (c->id == ClosureColor::LIST) {
+///         for (auto comp : *c->as_list())
+///             ... comp->id, comp->w, comp->data() ...
+///     }
+///
+/// Lists built by adding to one another may share the array of
+/// component pointers, each seeing only its own first ncomps of it.
+struct OSLEXECPUBLIC ClosureList : public ClosureColor
+{
+    int ncomps;                 ///< Number of components
+    const ClosureComponent* const* comps;   ///< The components
+
+    OSL_HOSTDEVICE int size () const { return ncomps; }
+
+    OSL_HOSTDEVICE const ClosureComponent* const* begin () const {
+        return comps;
+    }
+    OSL_HOSTDEVICE const ClosureComponent* const* end () const {
+        return begin() + ncomps;
+    }
+    OSL_HOSTDEVICE const ClosureComponent* operator[] (int i) const {
+        return begin()[i];
+    }
+};
+
 OSL_NAMESPACE_EXIT
@@ -28,6 +28,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <functional>
 #include <memory>
 
 #include <OSL/oslconfig.h>
@@ -38,6 +39,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <OpenImageIO/ustring.h>
 
 
+OIIO_NAMESPACE_BEGIN
+class thread_pool;
+OIIO_NAMESPACE_END
+
+
 OSL_NAMESPACE_ENTER
 
 class RendererServices;
@@ -103,7 +109,12 @@ public:
     ///    int buffer_printf      Buffer printf output from shaders and
     ///                              output atomically, to prevent threads
     ///                              from interleaving lines. (1)
-    ///    int profile            Perform some rudimentary profiling (0)
+    ///    int profile            Perform some rudimentary profiling (0).
+    ///                              At 2 or more, shaders compiled from then
+    ///                              on also time each layer and each call
+    ///                              to texture, noise, getattribute,
+    ///                              pointcloud, trace, dictionary, and regex
+    ///                              functions (see profile_report()).
     ///    int no_noise           Replace noise with constant value. (0)
     ///    int no_pointcloud      Skip pointcloud lookups. (0)
     ///    int exec_repeat        How many times to run each group (1).
@@ -139,6 +150,61 @@ public:
     ///                              isconnected()? (0)
     ///    int greedyjit          Optimize and compile all shaders up front,
     ///                              versus only as needed (0).
+    ///    int async_jit          Rather than stall the executing thread,
+    ///                              queue a group that is not yet compiled
+    ///                              for JIT in the background, and have
+    ///                              execute()/execute_init() return false
+    ///                              until it is ready (0). The group
+    ///                              attribute "ready" tells whether it is.
+    ///    int tiered_jit         If nonzero, first compile each group as
+    ///                              quickly as possible (minimal LLVM
+    ///                              optimization), then recompile it in the
+    ///                              background at full llvm_optimize once it
+    ///                              has executed this many times (0).
+    ///    int jit_memory_budget  If nonzero, the most megabytes of JITed
+    ///                              code to keep. Beyond it, the code of
+    ///                              the groups executed least recently is
+    ///                              freed, and JITed again if they are
+    ///                              executed again. Groups then keep their
+    ///                              optimized instance code so they can be
+    ///                              recompiled (0).
+    ///    int getattribute_cache  When the same getattribute() lookup (with
+    ///                              constant names) appears more than once
+    ///                              in a group, even in different layers,
+    ///                              ask the renderer only the first time
+    ///                              per execution and reuse the answer.
+    ///                              Only correct if the renderer's answers
+    ///                              don't depend on globals that shaders
+    ///                              modify (0).
+    ///    int flat_closures      Make closure arithmetic build flat lists
+    ///                              of components with their weights
+    ///                              already multiplied through (see
+    ///                              ClosureList), rather than trees of
+    ///                              ClosureAdd and ClosureMul. Must be set
+    ///                              before shaders are compiled (0).
+    ///    int opt_share_groups   Groups identical to one already optimized
+    ///                              (same shaders, parameter values and
+    ///                              connections) use its optimized code
+    ///                              rather than compiling their own.  Not
+    ///                              done for groups with lockgeom=0 params,
+    ///                              with tiered_jit or jit_memory_budget,
+    ///                              or with profile >= 2.  Runtime errors
+    ///                              of a sharing group name the group it
+    ///                              shares with, so it is off by default
+    ///                              (0).
+    ///    int opt_specialization_cache  How many group specializations
+    ///                              (the results of runtime optimization)
+    ///                              to keep, so that groups identical to
+    ///                              one optimized before, but which can't
+    ///                              share its code, skip straight to JIT.
+    ///                              Groups whose optimization folded in
+    ///                              answers from the renderer (attributes,
+    ///                              texture info, named matrices, point
+    ///                              clouds) are never kept, since those
+    ///                              answers may change.
+    ///                              The cache's memory is reported as
+    ///                              stat:mem_specializations_current.
+    ///                              0 turns it off (0).
     ///    int lockgeom           Default 'lockgeom' value for shader params
     ///                              that don't specify it (1).  Lockgeom
     ///                              means a param CANNOT be overridden by
@@ -148,6 +214,14 @@ public:
     ///                              once, replacing former definition.
     ///    string archive_groupname  Name of a group to pickle and archive.
     ///    string archive_filename   Name of file to save the group archive.
+    ///    string jit_cache_dir   Directory in which to save the JITed machine
+    ///                              code for shader groups, so that later
+    ///                              runs compiling identical groups may skip
+    ///                              code generation.  Groups whose code
+    ///                              holds addresses in this process (such
+    ///                              as those using textures, closures or
+    ///                              getattribute) are not cached.
+    ///                              ("", meaning no cache)
     /// 3. Attributes that that are intended for developers debugging
     /// liboslexec itself:
     /// These attributes may be helpful for liboslexec developers or
@@ -162,7 +236,7 @@ public:
     ///         opt_peephole, opt_coalesce_temps, opt_assign, opt_mix
     ///         opt_merge_instances, opt_merge_instance_with_userdata,
     ///         opt_fold_getattribute, opt_middleman, opt_texture_handle
-    ///         opt_seed_bblock_aliases
+    ///         opt_seed_bblock_aliases, opt_message_slots
     ///    int opt_passes         Number of optimization passes per layer (10)
     ///    int llvm_optimize      Which of several LLVM optimize strategies (0)
     ///    int llvm_debug         Set LLVM extra debug level (0)
@@ -324,6 +398,13 @@ public:
     ///   int num_renderer_outputs   Number of named renderer outputs.
     ///   string renderer_outputs[]  List of renderer outputs.
     ///   int raytype_queries        Bit field of all possible rayquery
+    ///   int ready                  Nonzero if the group has been optimized
+    ///                                and JITed, and so will execute without
+    ///                                waiting on (or, with async_jit, being
+    ///                                skipped for) compilation.
+    ///   int64 jit_memory           Bytes of JITed code and data held for
+    ///                                the group (0 if it hasn't been JITed
+    ///                                or its code was evicted).
     ///   int num_entry_layers       Number of named entry point layers.
     ///   string entry_layers[]      List of entry point layers.
     ///   string pickle              Retrieves a serialized representation
@@ -595,6 +676,14 @@ public:
     ///
     std::string getstats (int level=1) const;
 
+    /// Return the detailed execution profile gathered (from all threads)
+    /// while the "profile" attribute is 2 or more: the time and count of
+    /// each layer of each group and each of their profiled calls.  The
+    /// format may be "text" (the summary included in getstats), "json",
+    /// or "trace" (Chrome trace event format, viewable in chrome://tracing
+    /// or Perfetto, with each group shown as a flame chart of its totals).
+    std::string profile_report (string_view format="json") const;
+
     void register_closure (string_view name, int id, const ClosureParam *params,
                            PrepareClosureFunc prepare, SetupClosureFunc setup);
 
@@ -638,7 +727,33 @@ public:
     /// If option "greedyjit" was set, this call will trigger all
     /// shader groups that have not yet been compiled to do so with the
     /// specified number of threads (0 means use all available HW cores).
-    void optimize_all_groups (int nthreads=0);
+    /// Groups are compiled most expensive first, each thread taking the
+    /// next group as soon as it finishes its last one. If pool is not
+    /// NULL, the work is done by the calling thread plus nthreads-1 tasks
+    /// run by the pool (0 meaning as many as the pool has threads),
+    /// rather than by newly spawned threads.
+    void optimize_all_groups (int nthreads=0, OIIO::thread_pool *pool=NULL);
+
+    /// Start compiling all shader groups that have not yet been compiled
+    /// in the background, using the threads of pool (NULL means OIIO's
+    /// default thread pool), and return immediately. If ready is
+    /// supplied, it is called, from the compiling thread, for each group
+    /// as soon as it can be executed without waiting for the JIT, along
+    /// with false if compiling it raised errors or left it with no code
+    /// to run. Groups may still be executed at any time; a group not yet
+    /// compiled is simply compiled by whichever thread gets to it first.
+    void optimize_all_groups_async (std::function<void(ShaderGroup*,bool ok)> ready = nullptr,
+                                    OIIO::thread_pool *pool=NULL);
+
+    /// Wait for all background compilation begun by
+    /// optimize_all_groups_async to finish.
+    void wait_for_jit ();
+
+    /// Forget all the XML documents read by dict_find, and the queries
+    /// cached on them, so that later lookups read them afresh.  Call this
+    /// after dictionary files have changed, e.g. between frames.  Shaders
+    /// running at the time finish with the documents they started with.
+    void invalidate_dictionaries ();
 
     /// Return a pointer to the TextureSystem being used.
     TextureSystem * texturesys () const;
@@ -231,6 +231,17 @@ private:
 
 
 
+/// Convert the contents of a text .oso file to the equivalent compact
+/// binary .oso, which the ShadingSystem and OSLQuery load without any
+/// text parsing (both still read text .oso as well, telling the two
+/// apart automatically).  Return true if successful, or false (with an
+/// explanation in errmessage) if the text could not be parsed.
+OSLQUERYPUBLIC bool oso_text_to_binary (const std::string &osotext,
+                                        std::string &binary,
+                                        std::string &errmessage);
+
+
+
 
 ////////// Implementation
 
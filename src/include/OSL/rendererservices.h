@@ -420,6 +420,23 @@ public:
             direction(1.0f,0.0f,0.0f), bandwidth(1.0f), impulses(16.0f) { }
     };
 
+    /// Search the same point cloud around each of many centers in one
+    /// call, so that the cloud is looked up only once.  For the i-th of
+    /// the npoints centers, up to max_points indices (and distances, if
+    /// out_distances is not NULL) are stored starting at
+    /// out_indices[i*max_points] (and out_distances[i*max_points]), and
+    /// the number found is stored in out_counts[i].  No derivatives are
+    /// computed.
+    ///
+    /// Return the total number of points found for all the centers.
+    virtual int pointcloud_search_batch (ShaderGlobals *sg,
+                                         ustring filename, int npoints,
+                                         const OSL::Vec3 *centers,
+                                         float radius, int max_points,
+                                         bool sort, size_t *out_indices,
+                                         float *out_distances,
+                                         int *out_counts);
+
 protected:
     TextureSystem *m_texturesys;   // A place to hold a TextureSystem
 };
@@ -29,7 +29,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <fstream>
+#include <ctime>
+#include <cctype>
 #include <cstdio>
 #include <streambuf>
 #include <cstdio>
@@ -109,6 +115,158 @@ namespace pvt {   // OSL::pvt
 OSLCompilerImpl *oslcompiler = nullptr;
 static std::mutex oslcompiler_mutex;
 
+
+
+namespace {
+
+// Preprocessing -- mostly of stdosl.h -- dominates the cost of compiling
+// a typical shader.  A single PreprocessCache is shared by every compiler
+// in the process.  It holds the contents of each header the preprocessor
+// has pulled in, so that compiling many shaders in one process (e.g.,
+// "oslc -j") reads each header from disk only once, and it remembers the
+// output of recent preprocessor runs keyed by their full input (source,
+// file name, defines, include paths), so that recompiling an unchanged
+// shader skips the preprocessor entirely.  Every entry records the size
+// and modification time of the files it was made from and is discarded
+// as soon as any of them changes.
+class PreprocessCache {
+public:
+    typedef std::shared_ptr<const std::string> StringRef;
+
+    /// Return the (possibly cached) contents of each header we have seen
+    /// so far, dropping any that have changed or disappeared.  The
+    /// returned pairs are (path, contents).
+    std::vector<std::pair<std::string,StringRef>> headers () {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        std::vector<std::pair<std::string,StringRef>> result;
+        for (auto h = m_headers.begin(); h != m_headers.end(); ) {
+            if (h->second.stamp.current()) {
+                result.emplace_back (h->first, h->second.contents);
+                ++h;
+            } else {
+                h = m_headers.erase (h);
+            }
+        }
+        return result;
+    }
+
+    /// Remember the contents of each of the given header files.
+    void add_headers (const std::vector<std::string> &files) {
+        for (auto&& f : files) {
+            {
+                std::lock_guard<std::mutex> lock (m_mutex);
+                if (m_headers.find(f) != m_headers.end())
+                    continue;
+            }
+            Header h;
+            h.stamp = FileStamp (f);
+            std::string contents;
+            if (! OIIO::Filesystem::read_text_file (f, contents))
+                continue;
+            h.contents = std::make_shared<const std::string>(std::move(contents));
+            std::lock_guard<std::mutex> lock (m_mutex);
+            m_headers.emplace (f, std::move(h));
+        }
+    }
+
+    /// Look up the preprocessor output for the given input key.
+    bool find_result (const std::string &key, std::string &result) {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        auto found = m_results.find (key);
+        if (found == m_results.end())
+            return false;
+        for (auto&& dep : found->second.deps) {
+            if (! dep.current()) {
+                m_results.erase (found);
+                return false;
+            }
+        }
+        result = *found->second.text;
+        return true;
+    }
+
+    /// Remember the preprocessor output for the given input key, along
+    /// with the files it depends on.
+    void add_result (const std::string &key, const std::string &result,
+                     const std::vector<std::string> &files) {
+        Result r;
+        r.text = std::make_shared<const std::string>(result);
+        for (auto&& f : files)
+            r.deps.emplace_back (f);
+        std::lock_guard<std::mutex> lock (m_mutex);
+        if (! m_results.emplace (key, std::move(r)).second)
+            return;
+        m_result_order.push_back (key);
+        while (m_result_order.size() > max_results) {
+            m_results.erase (m_result_order.front());
+            m_result_order.pop_front ();
+        }
+    }
+
+private:
+    // Enough to identify whether a file has changed since we read it.
+    struct FileStamp {
+        FileStamp () {}
+        FileStamp (const std::string &path)
+            : path(path), size(OIIO::Filesystem::file_size(path)),
+              mtime(OIIO::Filesystem::last_write_time(path)) {}
+        bool current () const {
+            return OIIO::Filesystem::file_size(path) == size &&
+                   OIIO::Filesystem::last_write_time(path) == mtime;
+        }
+        std::string path;
+        uint64_t size = 0;
+        std::time_t mtime = 0;
+    };
+    struct Header {
+        FileStamp stamp;
+        StringRef contents;
+    };
+    struct Result {
+        StringRef text;
+        std::vector<FileStamp> deps;
+    };
+    // Preprocessed results contain all of stdosl.h, so only keep a
+    // bounded number of them, oldest discarded first.
+    static const size_t max_results = 64;
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string,Header> m_headers;
+    std::unordered_map<std::string,Result> m_results;
+    std::deque<std::string> m_result_order;
+};
+
+static PreprocessCache preprocess_cache;
+
+
+
+// Return the files named by the line markers ('# 12 "file.h"') that
+// the preprocessor leaves in its output, excluding pseudo-files like
+// "<built-in>".
+static std::vector<std::string>
+preprocessed_files (string_view preprocessed)
+{
+    std::set<std::string> files;
+    while (preprocessed.size()) {
+        string_view line = preprocessed.substr (0, preprocessed.find('\n'));
+        preprocessed.remove_prefix (std::min (line.size()+1, preprocessed.size()));
+        if (line.size() < 5 || line[0] != '#' || line[1] != ' '
+            || ! isdigit((unsigned char)line[2]))
+            continue;
+        size_t q0 = line.find ('\"');
+        size_t q1 = line.rfind ('\"');
+        if (q0 == string_view::npos || q1 <= q0 + 1)
+            continue;
+        string_view f = line.substr (q0 + 1, q1 - q0 - 1);
+        if (f[0] == '<')
+            continue;
+        files.insert (OIIO::Strutil::unescape_chars (f));
+    }
+    return std::vector<std::string> (files.begin(), files.end());
+}
+
+}  // anonymous namespace
+
 static ustring op_for("for");
 static ustring op_while("while");
 static ustring op_dowhile("dowhile");
@@ -188,6 +346,19 @@ OSLCompilerImpl::preprocess_buffer (const std::string &buffer,
         instring = "\n";
     }
     instring += buffer;
+
+    // The preprocessor output depends only on the source, the options,
+    // and the contents of the files it includes, so an identical
+    // recompile can reuse an earlier result.
+    std::string cachekey = filename + '\n' + stdoslpath + '\n';
+    for (auto&& d : defines)
+        cachekey += d + '\n';
+    for (auto&& inc : includepaths)
+        cachekey += "-I" + inc + '\n';
+    cachekey += instring;
+    if (preprocess_cache.find_result (cachekey, result))
+        return true;
+
     std::unique_ptr<llvm::MemoryBuffer> mbuf (llvm::MemoryBuffer::getMemBuffer(instring, filename));
 
     clang::CompilerInstance inst;
@@ -203,9 +374,10 @@ OSLCompilerImpl::preprocess_buffer (const std::string &buffer,
         new clang::DiagnosticsEngine(diagIDs, diagOptions, diagPrinter);
     inst.setDiagnostics(diagEngine);
 
+    static const std::string default_triple = llvm::sys::getDefaultTargetTriple();
     const std::shared_ptr<clang::TargetOptions> targetopts =
           std::make_shared<clang::TargetOptions>(inst.getTargetOpts());
-    targetopts->Triple = llvm::sys::getDefaultTargetTriple();
+    targetopts->Triple = default_triple;
     clang::TargetInfo *target =
         clang::TargetInfo::CreateTargetInfo(inst.getDiagnostics(), targetopts);
 
@@ -254,6 +426,15 @@ OSLCompilerImpl::preprocess_buffer (const std::string &buffer,
             preprocOpts.addMacroUndef (d.c_str()+2);
     }
 
+    // Serve headers we've already read from memory rather than from
+    // disk.  The buffers don't own their text; 'headers' keeps it alive
+    // until preprocessing is done.
+    auto headers = preprocess_cache.headers ();
+    preprocOpts.RetainRemappedFileBuffers = false;
+    for (auto&& h : headers)
+        preprocOpts.addRemappedFile (h.first,
+            llvm::MemoryBuffer::getMemBuffer (*h.second, h.first).release());
+
     inst.getLangOpts().LineComment = 1;
     inst.createPreprocessor(clang::TU_Prefix);
 
@@ -270,6 +451,13 @@ OSLCompilerImpl::preprocess_buffer (const std::string &buffer,
         errorf(ustring(), -1, "%s", preproc_errors);
         return false;
     }
+
+    ostream.flush ();
+    auto files = preprocessed_files (result);
+    files.erase (std::remove (files.begin(), files.end(), filename),
+                 files.end());
+    preprocess_cache.add_headers (files);
+    preprocess_cache.add_result (cachekey, result, files);
     return true;
 }
 
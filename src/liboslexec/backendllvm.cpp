@@ -98,6 +98,7 @@ BackendLLVM::BackendLLVM (ShadingSystemImpl &shadingsys,
     check_cwd (shadingsys);
 #endif
     m_use_optix = shadingsys.renderer()->supports ("OptiX");
+    m_llvm_optimize = shadingsys.llvm_optimize();
 }
 
 
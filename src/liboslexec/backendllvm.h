@@ -69,6 +69,16 @@ public:
     /// What LLVM debug level are we at?
     int llvm_debug() const;
 
+    /// LLVM optimization level to compile at (defaults to the shading
+    /// system's llvm_optimize; negative means compile as fast as possible).
+    int llvm_optimize () const { return m_llvm_optimize; }
+    void llvm_optimize (int opt) { m_llvm_optimize = opt; }
+
+    /// When recompiling a group whose code may be running (tiering up),
+    /// did the new code lay out the groupdata differently? If so, run()
+    /// kept the old code.
+    bool groupdata_layout_changed () const { return m_groupdata_layout_changed; }
+
     /// Set up a bunch of static things we'll need for the whole group.
     ///
     void initialize_llvm_group ();
@@ -330,6 +340,26 @@ public:
     /// stored for the specified userdata index.
     llvm::Value *userdata_initialized_ref (int userdata_index=0);
 
+    /// Decide which messages get a fixed MessageSlot in the group data:
+    /// if every setmessage and getmessage in the used layers names its
+    /// message (and source) with a constant, each message name that is
+    /// always used with the same type gets a slot.  Otherwise (or with
+    /// OptiX, or opt_message_slots off) no message gets one and they all
+    /// go through the ShadingContext's MessageList.
+    void find_message_slots ();
+
+    /// Return a void* to the group data MessageSlot of the named message,
+    /// or NULL if that message has no slot.
+    llvm::Value *message_slot (ustring name);
+
+    /// The type a message holding Data is stored as: closures are kept
+    /// as pointers.
+    static TypeDesc message_type (const Symbol &Data) {
+        if (Data.typespec().is_closure_based())
+            return TypeDesc (TypeDesc::PTR, Data.typespec().arraylength());
+        return Data.typespec().simpletype();
+    }
+
     /// Generate LLVM code to zero out the variable (including derivs)
     ///
     void llvm_assign_zero (const Symbol &sym);
@@ -446,6 +476,14 @@ public:
     /// Return whether or not we are compiling for an OptiX-based renderer.
     bool use_optix() { return m_use_optix; }
 
+    /// Are we instrumenting layers and expensive ops for the detailed
+    /// execution profile?
+    bool profiling() { return shadingsys().profile() >= 2 && ! use_optix(); }
+
+    /// Should closure arithmetic build flat ClosureLists rather than
+    /// trees of ClosureAdd/ClosureMul?
+    bool flat_closures() { return shadingsys().m_flat_closures && ! use_optix(); }
+
     /// Return the userdata index for the given Symbol.  Return -1 if the Symbol
     /// is not an input parameter or is constant and therefore doesn't have an
     /// entry in the groupdata struct.
@@ -467,6 +505,9 @@ private:
     // LLVM stuff
     AllocationMap m_named_values;
     std::map<const Symbol*,int> m_param_order_map;
+    std::unordered_map<ustring,int,ustringHash> m_message_slots; ///< name -> offset
+    int m_message_slots_size = 0;       ///< Bytes of all message slots
+    int m_message_slots_field = -1;     ///< Group data field of the slots
     llvm::Value *m_llvm_shaderglobals_ptr;
     llvm::Value *m_llvm_groupdata_ptr;
     llvm::BasicBlock * m_exit_instance_block;  // exit point for the instance
@@ -486,6 +527,8 @@ private:
     std::map<std::string,std::string>           m_varname_map;
 
     bool m_use_optix;                   ///< Compile for OptiX?
+    int m_llvm_optimize;                ///< LLVM optimization level
+    bool m_groupdata_layout_changed = false; ///< Differs from the old code?
 
     friend class ShadingSystemImpl;
 };
@@ -138,6 +138,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 DECL (osl_add_closure_closure, "CXCC")
 DECL (osl_mul_closure_float, "CXCf")
 DECL (osl_mul_closure_color, "CXCc")
+DECL (osl_add_closure_closure_flat, "CXCC")
+DECL (osl_mul_closure_float_flat, "CXCf")
+DECL (osl_mul_closure_color_flat, "CXCc")
 DECL (osl_allocate_closure_component, "CXii")
 DECL (osl_allocate_weighted_closure_component, "CXiiX")
 DECL (osl_closure_to_string, "sXC")
@@ -148,6 +151,8 @@ DECL (osl_error, "xXs*")
 DECL (osl_warning, "xXs*")
 DECL (osl_split, "isXsii")
 DECL (osl_incr_layers_executed, "xX")
+DECL (osl_profile_begin, "xXi")
+DECL (osl_profile_end, "xX")
 
 NOISE_IMPL(cellnoise)
 //NOISE_DERIV_IMPL(cellnoise)
@@ -201,6 +206,8 @@ DECL (osl_splineinverse_dfdff, "xXXXXii")
 DECL (osl_splineinverse_dffdf, "xXXXXii")
 DECL (osl_setmessage, "xXsLXisi")
 DECL (osl_getmessage, "iXssLXiisi")
+DECL (osl_setmessage_slot, "xXXssi")
+DECL (osl_getmessage_slot, "iXXsisi")
 DECL (osl_pointcloud_search, "iXsXfiiXXii*")
 DECL (osl_pointcloud_get, "iXsXisLX")
 DECL (osl_pointcloud_write, "iXsXiXXX")
@@ -235,6 +242,7 @@ DECL (osl_range_check_err, "iiiXXXiXiXX")
 DECL (osl_naninf_check, "xiXiXXiXiiX")
 DECL (osl_uninit_check, "xLXXXiXiXXiXiXii")
 DECL (osl_get_attribute, "iXiXXiiXX")
+DECL (osl_get_attribute_shared, "iXiiXXiiXX")
 DECL (osl_bind_interpolated_param, "iXXLiXiXiXi")
 DECL (osl_get_texture_options, "XX");
 DECL (osl_get_noise_options, "XX");
@@ -385,6 +393,8 @@ DECL (osl_texture_set_subimage, "xXi")
 DECL (osl_texture_set_subimagename, "xXs")
 DECL (osl_texture_set_missingcolor_arena, "xXX")
 DECL (osl_texture_set_missingcolor_alpha, "xXif")
+DECL (osl_texture_decode_wrapmode, "is")
+DECL (osl_texture_decode_interpmode, "is")
 DECL (osl_texture, "iXXXXffffffiXXXXXXX")
 DECL (osl_texture3d, "iXXXXXXXiXXXXXXX")
 DECL (osl_environment, "iXXXXXXXiXXXXXXX")
@@ -122,6 +122,10 @@ print_closure (std::ostream &out, const ClosureColor *closure, ShadingSystemImpl
             print_closure(out, closure->as_add()->closureA, ss, w, first);
             print_closure(out, closure->as_add()->closureB, ss, w, first);
             break;
+        case ClosureColor::LIST:
+            for (auto comp : *closure->as_list())
+                print_closure(out, comp, ss, w, first);
+            break;
         default:
             if (!first)
                 out << "\n\t+ ";
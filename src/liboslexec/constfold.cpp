@@ -1477,7 +1477,8 @@ DECLFOLDER(constfold_substr)
 
 DECLFOLDER(constfold_regex_search)
 {
-    // Try to turn R=regex_search(subj,reg) into R=C
+    // Try to turn R=regex_search(subj,reg) or R=regex_match(subj,reg)
+    // into R=C
     Opcode &op (rop.inst()->ops()[opnum]);
     Symbol &Subj (*rop.inst()->argsymbol(op.firstarg()+1));
     Symbol &Reg (*rop.inst()->argsymbol(op.firstarg()+2));
@@ -1486,10 +1487,15 @@ DECLFOLDER(constfold_regex_search)
         OSL_DASSERT(Subj.typespec().is_string() && Reg.typespec().is_string());
         const ustring &s (*(ustring *)Subj.data());
         const ustring &r (*(ustring *)Reg.data());
-        regex reg (r.string());
-        int result = regex_search (s.string(), reg);
+        static ustring u_regex_match ("regex_match");
+        bool fullmatch = (op.opname() == u_regex_match);
+        // Use the shared cache, since the same pattern will very likely
+        // be needed again at runtime.
+        const CompiledRegex &reg (rop.shadingsys().find_regex (r));
+        int result = reg.match (s, fullmatch);
         int cind = rop.add_constant (result);
-        rop.turn_into_assign (op, cind, "const fold regex_search");
+        rop.turn_into_assign (op, cind, fullmatch ? "const fold regex_match"
+                                                  : "const fold regex_search");
         return 1;
     }
     return 0;
@@ -2039,6 +2045,7 @@ DECLFOLDER(constfold_matrix)
         // But whatever spaces are left *may* be optimizable if they are
         // not time-varying.
         RendererServices *rs = rop.shadingsys().renderer();
+        rop.renderer_fold ();
         Matrix44 Mfrom, Mto;
         bool ok = true;
         if (from == Strings::common || from == commonsyn)
@@ -2131,6 +2138,7 @@ DECLFOLDER(constfold_getmatrix)
     // But whatever spaces are left *may* be optimizable if they are
     // not time-varying.
     RendererServices *rs = rop.shadingsys().renderer();
+    rop.renderer_fold ();
     Matrix44 Mfrom, Mto;
     bool ok = true;
     if (from == Strings::common || from == commonsyn || from == to)
@@ -2352,6 +2360,7 @@ DECLFOLDER(constfold_getattribute)
         if (obj_name.empty())
             return 0;
 
+        rop.renderer_fold ();
         found = array_lookup
             ? rop.renderer()->get_array_attribute (NULL, false,
                                                    obj_name, attr_type, attr_name,
@@ -2409,6 +2418,7 @@ DECLFOLDER(constfold_gettextureinfo)
         // FIXME(ptex) -- exclude folding of ptex, since these things
         // can vary per face.
         ustring errormessage;
+        rop.renderer_fold ();
         int result = rop.renderer()->get_texture_info (filename, nullptr,
                                                        rop.shadingcontext()->texture_thread_info(),
                                                        rop.shadingcontext(),
@@ -2651,10 +2661,12 @@ DECLFOLDER(constfold_pointcloud_search)
     ustring filename = *(ustring *)Filename.data();
     int count = 0;
     if (! filename.empty()) {
+        rop.renderer_fold ();
         count = rop.renderer()->pointcloud_search (rop.shaderglobals(), filename,
                              *(Vec3 *)Center.data(), *(float *)Radius.data(),
                              maxpoints, false, indices, distances, 0);
-        rop.shadingsys().pointcloud_stats (1, 0, count);
+        rop.shadingsys().pointcloud_stats (rop.shadingcontext()->thread_info(),
+                                           1, 0, count);
     }
 
     // If it returns few enough results (256 points or less), just fold
@@ -2712,7 +2724,8 @@ DECLFOLDER(constfold_pointcloud_search)
             bool ok = rop.renderer()->pointcloud_get (rop.shaderglobals(),
                                           filename, indices, count,
                                           names[i], const_valtype, const_data);
-            rop.shadingsys().pointcloud_stats (0, 1, 0);
+            rop.shadingsys().pointcloud_stats (rop.shadingcontext()->thread_info(),
+                                               0, 1, 0);
             if (! ok) {
                 count = 0;  // Make it look like an error in the end
                 break;
@@ -2773,11 +2786,13 @@ DECLFOLDER(constfold_pointcloud_get)
 
     TypeDesc valtype = Data.typespec().simpletype();
     std::vector<char> data (valtype.size());
+    rop.renderer_fold ();
     int ok = rop.renderer()->pointcloud_get (rop.shaderglobals(), filename,
                                              indices, count,
                                              *(ustring *)Attr_name.data(),
                                              valtype, &data[0]);
-    rop.shadingsys().pointcloud_stats (0, 1, 0);
+    rop.shadingsys().pointcloud_stats (rop.shadingcontext()->thread_info(),
+                                       0, 1, 0);
 
     rop.turn_into_assign (op, rop.add_constant (TypeDesc::TypeInt, &ok),
                           "Folded constant pointcloud_get");
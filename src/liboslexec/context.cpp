@@ -29,6 +29,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <string>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
 
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/timer.h>
@@ -45,11 +47,12 @@ static mutex buffered_errors_mutex;
 ShadingContext::ShadingContext (ShadingSystemImpl &shadingsys,
                                 PerThreadInfo *threadinfo)
     : m_shadingsys(shadingsys), m_renderer(m_shadingsys.renderer()),
-      m_group(NULL), m_max_warnings(shadingsys.max_warnings_per_thread()), m_dictionary(NULL)
+      m_group(NULL), m_max_warnings(shadingsys.max_warnings_per_thread())
 {
     m_shadingsys.m_stat_contexts += 1;
     m_threadinfo = threadinfo ? threadinfo : shadingsys.get_perthread_info ();
     m_texture_thread_info = NULL;
+    m_shadingsys.register_context (this);
 }
 
 
@@ -57,12 +60,18 @@ ShadingContext::ShadingContext (ShadingSystemImpl &shadingsys,
 ShadingContext::~ShadingContext ()
 {
     process_errors ();
+    m_shadingsys.unregister_context (this);
     m_shadingsys.m_stat_contexts -= 1;
-    free_dict_resources ();
 }
 
 
 
+// How many executions of fast tier groups each context counts before
+// adding them to the group's count.
+static const int tier_count_interval = 16;
+
+
+
 bool
 ShadingContext::execute_init (ShaderGroup &sgroup, ShaderGlobals &ssg, bool run)
 {
@@ -70,10 +79,25 @@ ShadingContext::execute_init (ShaderGroup &sgroup, ShaderGlobals &ssg, bool run)
         execute_cleanup ();
     m_group = &sgroup;
     m_ticks = 0;
+    m_dictionary_checked = false;
 
     // Optimize if we haven't already
     if (sgroup.nlayers()) {
         sgroup.start_running ();
+        // N.B. Pin before checking whether it's optimized, so that the
+        // code can't be evicted between the check and running it.
+        if (shadingsys().m_jit_memory_budget)
+            pin_group (sgroup);
+        if (! sgroup.optimized() && shadingsys().m_async_jit) {
+            // Don't stall this thread on the JIT: have the group compiled
+            // in the background, and report that nothing ran this time.
+            shadingsys().optimize_group_async (sgroup);
+            if (! sgroup.optimized()) {
+                thread_info()->stats.add (ThreadStats::async_jit_not_ready, 1);
+                unpin_group ();
+                return false;
+            }
+        }
         if (! sgroup.optimized()) {
             auto ctx = shadingsys().get_context(thread_info());
             shadingsys().optimize_group (sgroup, ctx);
@@ -83,8 +107,23 @@ ShadingContext::execute_init (ShaderGroup &sgroup, ShaderGlobals &ssg, bool run)
             }
             shadingsys().release_context(ctx);
         }
-        if (sgroup.does_nothing())
+        if (sgroup.does_nothing()) {
+            unpin_group ();
             return false;
+        }
+        // With tiered JIT, count executions of groups compiled at the fast
+        // tier, and have busy ones recompiled at full optimization. So
+        // that threads running the same group don't all contend for its
+        // counter, each context adds to it only every so many executions
+        // of fast tier groups, all of them at once.
+        if (run && sgroup.m_jit_tier == 1) {
+            int every = std::min (tier_count_interval, shadingsys().m_tiered_jit);
+            if (++m_tier_executions >= every) {
+                m_tier_executions = 0;
+                if ((sgroup.m_tier_executions += every) >= shadingsys().m_tiered_jit)
+                    shadingsys().tier_up_group_async (sgroup);
+            }
+        }
     } else {
        // empty shader - nothing to do!
        return false;
@@ -111,6 +150,11 @@ ShadingContext::execute_init (ShaderGroup &sgroup, ShaderGlobals &ssg, bool run)
     // Clear the message blackboard
     m_messages.clear ();
 
+    // Forget the shared getattribute results of the last execution
+    m_getattribute_state.assign (sgroup.getattribute_lookups().size(), 0);
+    if (m_getattribute_cache.size() < sgroup.getattribute_cache_size())
+        m_getattribute_cache.resize (sgroup.getattribute_cache_size());
+
     // Clear miscellaneous scratch space
     m_scratch_pool.clear ();
 
@@ -119,8 +163,10 @@ ShadingContext::execute_init (ShaderGroup &sgroup, ShaderGlobals &ssg, bool run)
 
     if (run) {
         RunLLVMGroupFunc run_func = sgroup.llvm_compiled_init();
-        if (!run_func)
+        if (!run_func) {
+            unpin_group ();
             return false;
+        }
         ssg.context = this;
         ssg.renderer = renderer();
         ssg.Ci = NULL;
@@ -170,16 +216,31 @@ ShadingContext::execute_cleanup ()
     process_errors ();
 
     if (shadingsys().m_profile) {
-        record_runtime_stats ();   // Transfer runtime stats to the shadingsys
-        shadingsys().m_stat_total_shading_time_ticks += m_ticks;
+        record_runtime_stats ();   // Transfer runtime stats to our thread
         group()->m_stat_total_shading_time_ticks += m_ticks;
     }
 
+    unpin_group ();
     return true;
 }
 
 
 
+void
+ShadingContext::pin_group (ShaderGroup &group)
+{
+    m_pinned_group = &group;
+    // Only touch the shared timestamp and LRU when the epoch changes,
+    // which is rare.
+    long long epoch = shadingsys().m_jit_epoch;
+    if (group.m_jit_last_used != epoch) {
+        group.m_jit_last_used = epoch;
+        shadingsys().jit_lru_touch (group);
+    }
+}
+
+
+
 bool
 ShadingContext::execute (ShaderGroup &sgroup, ShaderGlobals &ssg, bool run)
 {
@@ -219,9 +280,43 @@ ShadingContext::execute (ShaderGroup &sgroup, ShaderGlobals &ssg, bool run)
 
 void
 ShadingContext::record_error (ErrorHandler::ErrCode code,
-                              const std::string &text) const
+                              string_view text) const
 {
-    m_buffered_errors.emplace_back(code,text);
+    m_buffered_text.append (text.data(), text.size());
+    end_record (code);
+}
+
+
+
+void
+ShadingContext::record_vprintf (ErrorHandler::ErrCode code, const char *fmt,
+                                va_list args) const
+{
+    // Format into the spare capacity of the buffer, and only if that
+    // wasn't enough, grow it and format again.
+    size_t start = m_buffered_text.size();
+    size_t room = std::max (m_buffered_text.capacity() - start, size_t(256));
+    m_buffered_text.resize (start + room);
+    va_list argscopy;
+    va_copy (argscopy, args);
+    int n = vsnprintf (&m_buffered_text[start], room, fmt, argscopy);
+    va_end (argscopy);
+    if (n >= 0 && size_t(n) >= room) {
+        m_buffered_text.resize (start + n + 1);
+        vsnprintf (&m_buffered_text[start], n + 1, fmt, args);
+    }
+    m_buffered_text.resize (start + std::max (n, 0));
+    end_record (code);
+}
+
+
+
+void
+ShadingContext::end_record (ErrorHandler::ErrCode code) const
+{
+    if (code == ErrorHandler::EH_ERROR || code == ErrorHandler::EH_SEVERE)
+        ++m_errors_recorded;
+    m_buffered_errors.push_back ({ code, m_buffered_text.size() });
     // If we aren't buffering, just process immediately
     if (! shadingsys().m_buffer_printf)
         process_errors ();
@@ -238,30 +333,38 @@ ShadingContext::process_errors () const
 
     // Use a mutex to make sure output from different threads stays
     // together, at least for one shader invocation, rather than being
-    // interleaved with other threads.
-    lock_guard lock (buffered_errors_mutex);
-
-    for (size_t i = 0;  i < nerrors;  ++i) {
-        switch (m_buffered_errors[i].first) {
+    // interleaved with other threads.  Unbuffered, each message is passed
+    // on alone as soon as it's recorded, so there's nothing to keep
+    // together and no need to make every printf contend for the lock.
+    std::unique_lock<mutex> lock (buffered_errors_mutex, std::defer_lock);
+    if (shadingsys().m_buffer_printf)
+        lock.lock ();
+
+    size_t begin = 0;
+    for (auto&& e : m_buffered_errors) {
+        std::string text (m_buffered_text, begin, e.end - begin);
+        begin = e.end;
+        switch (e.code) {
         case ErrorHandler::EH_MESSAGE :
         case ErrorHandler::EH_DEBUG :
-           shadingsys().message (m_buffered_errors[i].second);
+            shadingsys().message (text);
             break;
         case ErrorHandler::EH_INFO :
-            shadingsys().info (m_buffered_errors[i].second);
+            shadingsys().info (text);
             break;
         case ErrorHandler::EH_WARNING :
-            shadingsys().warning (m_buffered_errors[i].second);
+            shadingsys().warning (text);
             break;
         case ErrorHandler::EH_ERROR :
         case ErrorHandler::EH_SEVERE :
-            shadingsys().error (m_buffered_errors[i].second);
+            shadingsys().error (text);
             break;
         default:
             break;
         }
     }
     m_buffered_errors.clear();
+    m_buffered_text.clear();
 }
 
 
@@ -297,17 +400,82 @@ ShadingContext::symbol_data (const Symbol &sym) const
 
 
 
-const regex &
+const ClosureColor *
+ShadingContext::closure_mul_flat (const Color3 &w, const ClosureColor *c)
+{
+    // Components may be shared with other closures, so scale copies.
+    // Ones the registry doesn't know (which the compiler can't make) are
+    // dropped, since we can't tell how big they are.
+    auto scaled = [&](const ClosureComponent *comp) -> const ClosureComponent * {
+        const ClosureRegistry::ClosureEntry *clentry = shadingsys().find_closure (comp->id);
+        if (! clentry) {
+            errorf ("Unknown closure id %d", comp->id);
+            return nullptr;
+        }
+        size_t size = clentry->struct_size;
+        ClosureComponent *r = closure_component_allot (comp->id, size, comp->w * w);
+        memcpy (r->data(), comp->data(), size);
+        return r;
+    };
+    if (c->id != ClosureColor::LIST)
+        return scaled (c->as_comp());
+    const ClosureList *list = c->as_list();
+    ClosureListStorage *storage = closure_list_storage_allot (list->size());
+    const ClosureComponent **comps = storage->comps();
+    for (auto comp : *list)
+        if (const ClosureComponent *s = scaled (comp))
+            comps[storage->used++] = s;
+    if (! storage->used)
+        return nullptr;
+    return closure_list_allot (storage->used, comps);
+}
+
+
+
+const ClosureColor *
+ShadingContext::closure_add_flat (const ClosureColor *a, const ClosureColor *b)
+{
+    int na = a->id == ClosureColor::LIST ? a->as_list()->size() : 1;
+    int nb = b->id == ClosureColor::LIST ? b->as_list()->size() : 1;
+
+    // Accumulating (Ci += ...) keeps adding to the newest list, so append
+    // to a's components in place when nothing has been added after them
+    // and there's room.  Otherwise copy into new storage with room to
+    // spare, so that a run of adds costs amortized constant time each.
+    ClosureListStorage *storage = nullptr;
+    if (a->id == ClosureColor::LIST) {
+        ClosureListStorage *s = ClosureListStorage::of (a->as_list()->begin());
+        if (s->used == na && s->capacity - s->used >= nb)
+            storage = s;
+    }
+    if (! storage) {
+        storage = closure_list_storage_allot (std::max (2 * (na + nb), 8));
+        if (a->id == ClosureColor::LIST)
+            for (auto comp : *a->as_list())
+                storage->comps()[storage->used++] = comp;
+        else
+            storage->comps()[storage->used++] = a->as_comp();
+    }
+    if (b->id == ClosureColor::LIST)
+        for (auto comp : *b->as_list())
+            storage->comps()[storage->used++] = comp;
+    else
+        storage->comps()[storage->used++] = b->as_comp();
+    return closure_list_allot (storage->used, storage->comps());
+}
+
+
+
+const CompiledRegex &
 ShadingContext::find_regex (ustring r)
 {
     RegexMap::const_iterator found = m_regex_map.find (r);
     if (found != m_regex_map.end())
         return *found->second;
-    // otherwise, it wasn't found, add it
-    m_regex_map[r].reset (new regex(r.c_str()));
-    m_shadingsys.m_stat_regexes += 1;
-    // std::cerr << "Made new regex for " << r << "\n";
-    return *m_regex_map[r];
+    // otherwise, it wasn't found, get it from the shared cache
+    const CompiledRegex &reg (m_shadingsys.find_regex (r));
+    m_regex_map[r] = &reg;
+    return reg;
 }
 
 
@@ -319,10 +487,8 @@ ShadingContext::osl_get_attribute (ShaderGlobals *sg, void *objdata,
                                    int array_lookup, int index,
                                    TypeDesc attr_type, void *attr_dest)
 {
-#if 0
-    // Change the #if's below if you want to
-    OIIO::Timer timer;
-#endif
+    int profile = shadingsys().m_profile;
+    OIIO::Timer timer (profile ? OIIO::Timer::StartNow : OIIO::Timer::DontStartNow);
     bool ok;
 
     if (array_lookup)
@@ -334,19 +500,48 @@ ShadingContext::osl_get_attribute (ShaderGlobals *sg, void *objdata,
                                         obj_name, attr_type,
                                         attr_name, attr_dest);
 
-#if 0
-    double time = timer();
-    shadingsys().m_stat_getattribute_time += time;
-    if (!ok)
-        shadingsys().m_stat_getattribute_fail_time += time;
-    shadingsys().m_stat_getattribute_calls += 1;
-#endif
+    if (profile) {
+        long long ticks = timer.ticks();
+        m_stat_getattribute_ticks += ticks;
+        if (!ok)
+            m_stat_getattribute_fail_ticks += ticks;
+    }
+    ++m_stat_getattribute_calls;
 //    std::cout << "getattribute! '" << obj_name << "' " << attr_name << ' ' << attr_type.c_str() << " ok=" << ok << ", objdata was " << objdata << "\n";
     return ok;
 }
 
 
 
+bool
+ShadingContext::osl_get_attribute_shared (ShaderGlobals *sg, int slot,
+                                          int dest_derivs, ustring obj_name,
+                                          ustring attr_name, int array_lookup,
+                                          int index, TypeDesc attr_type,
+                                          void *attr_dest)
+{
+    OSL_DASSERT (slot >= 0 && slot < (int)m_getattribute_state.size());
+    const AttributeLookup &lookup (group()->getattribute_lookups()[slot]);
+    char *cached = &m_getattribute_cache[lookup.offset];
+    char &state (m_getattribute_state[slot]);
+    if (state) {
+        // Already asked during this execution
+        ++m_stat_getattribute_cache_hits;
+        if (state == 1)
+            memcpy (attr_dest, cached, lookup.size());
+        return state == 1;
+    }
+    bool ok = osl_get_attribute (sg, sg->objdata, dest_derivs, obj_name,
+                                 attr_name, array_lookup, index,
+                                 attr_type, attr_dest);
+    if (ok)
+        memcpy (cached, attr_dest, lookup.size());
+    state = ok ? 1 : 2;
+    return ok;
+}
+
+
+
 OSL_SHADEOP void
 osl_incr_layers_executed (ShaderGlobals *sg)
 {
@@ -355,4 +550,20 @@ osl_incr_layers_executed (ShaderGlobals *sg)
 }
 
 
+
+OSL_SHADEOP void
+osl_profile_begin (ShaderGlobals *sg, int site)
+{
+    sg->context->thread_info()->profile_begin (site);
+}
+
+
+
+OSL_SHADEOP void
+osl_profile_end (ShaderGlobals *sg)
+{
+    sg->context->thread_info()->profile_end ();
+}
+
+
 OSL_NAMESPACE_EXIT
@@ -32,8 +32,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <cstdlib>
 #include <cctype>
 #include <unordered_map>
+#include <atomic>
+#include <memory>
 
 #include <OpenImageIO/strutil.h>
+#include <OpenImageIO/filesystem.h>
 
 #include <pugixml.hpp>
 
@@ -68,21 +71,37 @@ namespace pvt {   // OSL::pvt
 // particular query to return a string is a totally different cache
 // entry than asking for it to be converted to a matrix, say.
 //
+// There is one Dictionary per ShadingSystem, shared by all contexts and
+// threads, so each document is read and parsed only once -- until
+// ShadingSystem::invalidate_dictionaries replaces it with a fresh one
+// (contexts still holding the old one switch at their next execution,
+// and the last to let go frees it).  Documents are never modified after
+// parsing, so concurrent (read-only) xpath queries on them are safe.
+// Nodes live in an append-only table whose entries never move, so
+// looking up a node ID needs no lock.  The query cache is split into
+// shards, each with its own lock, so that threads doing unrelated
+// queries rarely contend.
+//
 class Dictionary {
 public:
-    Dictionary (ShadingContext *ctx) : m_context(ctx)
+    Dictionary (ShadingSystemImpl &shadingsys)
+        : m_shadingsys(shadingsys), m_nnodes(0)
     {
+        m_node_chunks.reset (new std::atomic<Node *>[MaxNodeChunks]);
+        for (int i = 0;  i < MaxNodeChunks;  ++i)
+            m_node_chunks[i] = nullptr;
         // Create placeholder element 0 == 'not found'
-        m_nodes.emplace_back(0, pugi::xml_node());
+        Node notfound (0, pugi::xml_node());
+        add_nodes (&notfound, 1);
     }
     ~Dictionary () {
-        // Free all the documents.
-        for (auto& doc : m_documents)
-            delete doc;
+        for (int i = 0;  i < MaxNodeChunks && m_node_chunks[i];  ++i)
+            delete [] m_node_chunks[i].load();
+        m_shadingsys.m_stat_dict_memory -= m_memory.load();
     }
 
-    int dict_find (ustring dictionaryname, ustring query);
-    int dict_find (int nodeID, ustring query);
+    int dict_find (ShadingContext *ctx, ustring dictionaryname, ustring query);
+    int dict_find (ShadingContext *ctx, int nodeID, ustring query);
     int dict_next (int nodeID);
     int dict_value (int nodeID, ustring attribname, TypeDesc type, void *data);
 
@@ -111,9 +130,10 @@ private:
     };
 
     // The cached query result is mostly just a 'valueoffset', which is
-    // the index into floatdata/intdata/stringdata (depending on the type
-    // being asked for) at which the decoded data live, or a node ID
-    // if the query was for a node rather than for an attribute.
+    // the index into floatdata/intdata/stringdata (of the query's shard,
+    // depending on the type being asked for) at which the decoded data
+    // live, or a node ID if the query was for a node rather than for an
+    // attribute.
     struct QueryResult {
         int valueoffset;  // Offset into one of the 'data' vectors, or nodeID
         bool is_valid;    // true: query found
@@ -128,168 +148,234 @@ private:
         int document;         // which document the node belongs to
         pugi::xml_node node;  // which node within the dictionary
         int next;             // next node for the same query
-        Node (int d, const pugi::xml_node &n)
+        Node (int d=0, const pugi::xml_node &n=pugi::xml_node())
             : document(d), node(n), next(0) { }
     };
 
     typedef std::unordered_map <Query, QueryResult, QueryHash> QueryMap;
     typedef std::unordered_map<ustring, int, ustringHash> DocMap;
 
-    ShadingContext *m_context;  // back-pointer to shading context
+    // One shard of the query cache.  m_floatdata, m_intdata, and
+    // m_stringdata hold the decoded data results (including type
+    // conversion) of the shard's cached queries.
+    struct QueryShard {
+        spin_mutex mutex;
+        QueryMap cache;
+        std::vector<float>   floatdata;
+        std::vector<int>     intdata;
+        std::vector<ustring> stringdata;
+    };
+    static constexpr int NumQueryShards = 32;
+    QueryShard &shard (const Query &q) {
+        return m_shards[QueryHash()(q) % NumQueryShards];
+    }
+
+    // Node storage: fixed-size chunks that are allocated as needed and
+    // never freed or moved until the Dictionary is destroyed.
+    static constexpr int NodeChunkBits = 12;
+    static constexpr int NodeChunkSize = 1 << NodeChunkBits;
+    static constexpr int MaxNodeChunks = 1 << 14;  // 64M nodes
+
+    ShadingSystemImpl &m_shadingsys;  // back-pointer to shading system
+    std::atomic<long long> m_memory {0};  // our share of stat_dict_memory
 
-    // List of XML documents we've read in.
-    std::vector<pugi::xml_document *> m_documents;
+    void add_memory (long long bytes) {
+        m_memory += bytes;
+        m_shadingsys.m_stat_dict_memory += bytes;
+    }
 
-    // Map xml strings and/or filename to indices in m_documents.
+    // List of XML documents we've read in, and the map from xml strings
+    // and/or filenames to indices in m_documents (-1 for ones that failed
+    // to parse), both protected by m_document_mutex.
+    std::vector<std::unique_ptr<pugi::xml_document> > m_documents;
     DocMap m_document_map;
+    spin_mutex m_document_mutex;
 
     // Cache of fully resolved queries.
-    Dictionary::QueryMap m_cache;  // query cache
+    QueryShard m_shards[NumQueryShards];
 
-    // List of all the nodes we've found by queries.
-    std::vector<Dictionary::Node> m_nodes;
-
-    // m_floatdata, m_intdata, and m_stringdata hold the decoded data
-    // results (including type conversion) of cached queries.
-    std::vector<float>   m_floatdata;
-    std::vector<int>     m_intdata;
-    std::vector<ustring> m_stringdata;
+    // All the nodes we've found by queries.  Only the first m_nnodes
+    // entries are valid; appending is serialized by m_node_mutex.
+    std::unique_ptr<std::atomic<Node *>[]> m_node_chunks;
+    std::atomic<int> m_nnodes;
+    spin_mutex m_node_mutex;
 
     // Helper function: return the document index given dictionary name.
-    int get_document_index (ustring dictionaryname);
+    int get_document_index (ShadingContext *ctx, ustring dictionaryname);
+
+    // Return the document at the given index.
+    const pugi::xml_document *document (int dindex) {
+        spin_lock lock (m_document_mutex);
+        return m_documents[dindex].get();
+    }
+
+    // Return the node with the given ID, or NULL if there's no such node.
+    const Node *node (int nodeID) const {
+        if (nodeID <= 0 || nodeID >= m_nnodes.load (std::memory_order_acquire))
+            return NULL;     // invalid node ID
+        return &m_node_chunks[nodeID >> NodeChunkBits].load(std::memory_order_relaxed)
+                             [nodeID & (NodeChunkSize-1)];
+    }
+
+    // Append n nodes (already linked to each other by their 'next'
+    // fields, relative to the first) and return the ID of the first.
+    int add_nodes (Node *nodes, int n);
+
+    // Run an xpath query rooted at the given node (or the whole document)
+    // and cache the list of matching nodes.
+    int find_and_cache (ShadingContext *ctx, const Query &q,
+                        const pugi::xpath_node &root);
 };
 
 
 
 int
-Dictionary::get_document_index (ustring dictionaryname)
+Dictionary::get_document_index (ShadingContext *ctx, ustring dictionaryname)
 {
-    DocMap::iterator dm = m_document_map.find(dictionaryname);
-    int dindex;
-    if (dm == m_document_map.end()) {
-        dindex = m_documents.size();
-        m_document_map[dictionaryname] = dindex;
-        pugi::xml_document *doc = new pugi::xml_document;
-        m_documents.push_back (doc);
-        pugi::xml_parse_result parse_result;
-        if (Strutil::ends_with (dictionaryname.string(), ".xml")) {
-            // xml file -- read it
-            parse_result = doc->load_file (dictionaryname.c_str());
-        } else {
-            // load xml directly from the string
-            parse_result = doc->load_buffer (dictionaryname.c_str(),
-                                             dictionaryname.length());
-        }
-        if (! parse_result) {
-            m_context->errorf("XML parsed with errors: %s, at offset %d",
-                              parse_result.description(),
-                              parse_result.offset);
-            m_document_map[dictionaryname] = -1;
-            return -1;
-        }
+    {
+        spin_lock lock (m_document_mutex);
+        DocMap::iterator dm = m_document_map.find(dictionaryname);
+        if (dm != m_document_map.end())
+            return dm->second;
+    }
+
+    // Read and parse without holding the lock, since that may be slow.
+    std::unique_ptr<pugi::xml_document> doc (new pugi::xml_document);
+    pugi::xml_parse_result parse_result;
+    size_t bytes = 0;
+    if (Strutil::ends_with (dictionaryname.string(), ".xml")) {
+        // xml file -- read it
+        parse_result = doc->load_file (dictionaryname.c_str());
+        bytes = (size_t) OIIO::Filesystem::file_size (dictionaryname.string());
     } else {
-        dindex = dm->second;
+        // load xml directly from the string
+        parse_result = doc->load_buffer (dictionaryname.c_str(),
+                                         dictionaryname.length());
+        bytes = dictionaryname.length();
+    }
+    if (! parse_result) {
+        ctx->errorf("XML parsed with errors: %s, at offset %d",
+                    parse_result.description(),
+                    parse_result.offset);
     }
 
-    OSL_DASSERT(dindex < (int)m_documents.size());
+    spin_lock lock (m_document_mutex);
+    DocMap::iterator dm = m_document_map.find(dictionaryname);
+    if (dm != m_document_map.end())
+        return dm->second;   // Another thread beat us to it
+    int dindex = -1;
+    if (parse_result) {
+        dindex = (int) m_documents.size();
+        m_documents.emplace_back (std::move(doc));
+        m_shadingsys.m_stat_dict_documents += 1;
+        // The parsed DOM is roughly proportional to the size of the xml.
+        add_memory ((long long) bytes);
+    }
+    m_document_map[dictionaryname] = dindex;
     return dindex;
 }
 
 
 
 int
-Dictionary::dict_find (ustring dictionaryname, ustring query)
+Dictionary::add_nodes (Node *nodes, int n)
 {
-    int dindex = get_document_index (dictionaryname);
-    if (dindex < 0)
-        return dindex;
-
-    Query q (dindex, 0, query);
-    QueryMap::iterator qfound = m_cache.find (q);
-    if (qfound != m_cache.end()) {
-        return qfound->second.valueoffset;
+    spin_lock lock (m_node_mutex);
+    int first = m_nnodes.load (std::memory_order_relaxed);
+    if ((long long)first + n > (long long)MaxNodeChunks * NodeChunkSize)
+        return 0;   // Full; treat as not found
+    for (int i = 0;  i < n;  ++i) {
+        int id = first + i;
+        int c = id >> NodeChunkBits;
+        Node *chunk = m_node_chunks[c].load (std::memory_order_relaxed);
+        if (! chunk) {
+            chunk = new Node[NodeChunkSize];
+            m_node_chunks[c].store (chunk, std::memory_order_relaxed);
+            add_memory (NodeChunkSize * sizeof(Node));
+        }
+        Node &dst (chunk[id & (NodeChunkSize-1)]);
+        dst = nodes[i];
+        if (dst.next)
+            dst.next += first;
     }
+    // Publish the new nodes (and any new chunks) to readers.
+    m_nnodes.store (first + n, std::memory_order_release);
+    m_shadingsys.m_stat_dict_nodes += n;
+    return first;
+}
+
 
-    pugi::xml_document *doc = m_documents[dindex];
+
+int
+Dictionary::find_and_cache (ShadingContext *ctx, const Query &q,
+                            const pugi::xpath_node &root)
+{
+    QueryShard &qs (shard (q));
+    {
+        spin_lock lock (qs.mutex);
+        QueryMap::iterator qfound = qs.cache.find (q);
+        if (qfound != qs.cache.end())
+            return qfound->second.valueoffset;
+    }
 
     // Query was not found.  Do the expensive lookup and cache it
     pugi::xpath_node_set matches;
-
     try {
-        matches = doc->select_nodes (query.c_str());
+        matches = root.node() ? root.node().select_nodes (q.name.c_str())
+                              : document(q.document)->select_nodes (q.name.c_str());
     }
     catch (const pugi::xpath_exception& e) {
-        m_context->errorf("Invalid dict_find query '%s': %s",
-                          query.c_str(), e.what());
+        ctx->errorf("Invalid dict_find query '%s': %s",
+                    q.name.c_str(), e.what());
         return 0;
     }
 
-    if (matches.empty()) {
-        m_cache[q] = QueryResult (false);  // mark invalid
-        return 0;   // Not found
-    }
-    int firstmatch = (int) m_nodes.size();
-    int last = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(dindex, m.node());
-        int nodeid = (int) m_nodes.size()-1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult (true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
+    int firstmatch = 0;
+    if (! matches.empty()) {
+        std::vector<Node> found;
+        found.reserve (matches.size());
+        for (auto&& m : matches) {
+            // Link each match to the next one; add_nodes makes these
+            // relative links absolute.
+            if (found.size())
+                found.back().next = (int) found.size();
+            found.emplace_back (q.document, m.node());
         }
-        last = nodeid;
+        firstmatch = add_nodes (found.data(), (int) found.size());
     }
-    return firstmatch;
+
+    spin_lock lock (qs.mutex);
+    // If another thread raced us to the same query, keep its answer.
+    // Any nodes we added are merely unreferenced.
+    auto inserted = qs.cache.emplace (q, firstmatch ? QueryResult (true /* it's a node */, firstmatch)
+                                                    : QueryResult (false) /* mark invalid */);
+    if (inserted.second)
+        m_shadingsys.m_stat_dict_queries += 1;
+    return inserted.first->second.valueoffset;
 }
 
 
 
 int
-Dictionary::dict_find (int nodeID, ustring query)
+Dictionary::dict_find (ShadingContext *ctx, ustring dictionaryname,
+                       ustring query)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
-        return 0;     // invalid node ID
+    int dindex = get_document_index (ctx, dictionaryname);
+    if (dindex < 0)
+        return dindex;
+    return find_and_cache (ctx, Query (dindex, 0, query), pugi::xpath_node());
+}
 
-    int document = m_nodes[nodeID].document;
-    Query q (document, nodeID, query);
-    QueryMap::iterator qfound = m_cache.find (q);
-    if (qfound != m_cache.end()) {
-        return qfound->second.valueoffset;
-    }
 
-    // Query was not found.  Do the expensive lookup and cache it
-    pugi::xpath_node_set matches;
-    try {
-        matches = m_nodes[nodeID].node.select_nodes (query.c_str());
-    }
-    catch (const pugi::xpath_exception& e) {
-        m_context->errorf("Invalid dict_find query '%s': %s",
-                          query.c_str(), e.what());
-        return 0;
-    }
 
-    if (matches.empty()) {
-        m_cache[q] = QueryResult (false);  // mark invalid
-        return 0;   // Not found
-    }
-    int firstmatch = (int) m_nodes.size();
-    int last = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(document, m.node());
-        int nodeid = (int) m_nodes.size()-1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult (true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
-        }
-        last = nodeid;
-    }
-    return firstmatch;
+int
+Dictionary::dict_find (ShadingContext *ctx, int nodeID, ustring query)
+{
+    const Node *n = node (nodeID);
+    if (! n)
+        return 0;     // invalid node ID
+    return find_and_cache (ctx, Query (n->document, nodeID, query),
+                           pugi::xpath_node (n->node));
 }
 
 
@@ -297,9 +383,10 @@ Dictionary::dict_find (int nodeID, ustring query)
 int
 Dictionary::dict_next (int nodeID)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+    const Node *n = node (nodeID);
+    if (! n)
         return 0;     // invalid node ID
-    return m_nodes[nodeID].next;
+    return n->next;
 }
 
 
@@ -308,35 +395,39 @@ int
 Dictionary::dict_value (int nodeID, ustring attribname,
                         TypeDesc type, void *data)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+    const Node *nodeptr = node (nodeID);
+    if (! nodeptr)
         return 0;     // invalid node ID
 
-    const Dictionary::Node &node (m_nodes[nodeID]);
+    const Dictionary::Node &node (*nodeptr);
     Dictionary::Query q (node.document, nodeID, attribname, type);
-    Dictionary::QueryMap::iterator qfound = m_cache.find (q);
-    if (qfound != m_cache.end()) {
+    QueryShard &qs (shard (q));
+    spin_lock lock (qs.mutex);
+    Dictionary::QueryMap::iterator qfound = qs.cache.find (q);
+    if (qfound != qs.cache.end()) {
         // previously found
         int offset = qfound->second.valueoffset;
         int n = type.numelements() * type.aggregate;
         if (type.basetype == TypeDesc::STRING) {
             OSL_DASSERT (n == 1 && "no string arrays in XML");
-            ((ustring *)data)[0] = m_stringdata[offset];
+            ((ustring *)data)[0] = qs.stringdata[offset];
             return 1;
         }
         if (type.basetype == TypeDesc::INT) {
             for (int i = 0;  i < n;  ++i)
-                ((int *)data)[i] = m_intdata[offset++];
+                ((int *)data)[i] = qs.intdata[offset++];
             return 1;
         }
         if (type.basetype == TypeDesc::FLOAT) {
             for (int i = 0;  i < n;  ++i)
-                ((float *)data)[i] = m_floatdata[offset++];
+                ((float *)data)[i] = qs.floatdata[offset++];
             return 1;
         }
         return 0;  // Unknown type
     }
 
-    // OK, the entry wasn't in the cache, we need to decode it and cache it.
+    // OK, the entry wasn't in the cache, we need to decode it and cache
+    // it.  Decoding is cheap, so just do it while holding the shard lock.
 
     const char *val = NULL;
     if (attribname.empty()) {
@@ -356,37 +447,43 @@ Dictionary::dict_value (int nodeID, ustring attribname,
     Dictionary::QueryResult r (false, 0);
     int n = type.numelements() * type.aggregate;
     if (type.basetype == TypeDesc::STRING && n == 1) {
-        r.valueoffset = (int) m_stringdata.size();
+        r.valueoffset = (int) qs.stringdata.size();
         ustring s (val);
-        m_stringdata.push_back (s);
+        qs.stringdata.push_back (s);
         ((ustring *)data)[0] = s;
-        m_cache[q] = r;
+        qs.cache[q] = r;
+        m_shadingsys.m_stat_dict_queries += 1;
+        add_memory (sizeof(ustring));
         return 1;
     }
     if (type.basetype == TypeDesc::INT) {
-        r.valueoffset = (int) m_intdata.size();
+        r.valueoffset = (int) qs.intdata.size();
         string_view valstr (val);
         for (int i = 0;  i < n;  ++i) {
             int v;
             OIIO::Strutil::parse_int (valstr, v);
             OIIO::Strutil::parse_char (valstr, ',');
-            m_intdata.push_back (v);
+            qs.intdata.push_back (v);
             ((int *)data)[i] = v;
         }
-        m_cache[q] = r;
+        qs.cache[q] = r;
+        m_shadingsys.m_stat_dict_queries += 1;
+        add_memory (n * sizeof(int));
         return 1;
     }
     if (type.basetype == TypeDesc::FLOAT) {
-        r.valueoffset = (int) m_floatdata.size();
+        r.valueoffset = (int) qs.floatdata.size();
         string_view valstr (val);
         for (int i = 0;  i < n;  ++i) {
             float v;
             OIIO::Strutil::parse_float (valstr, v);
             OIIO::Strutil::parse_char (valstr, ',');
-            m_floatdata.push_back (v);
+            qs.floatdata.push_back (v);
             ((float *)data)[i] = v;
         }
-        m_cache[q] = r;
+        qs.cache[q] = r;
+        m_shadingsys.m_stat_dict_queries += 1;
+        add_memory (n * sizeof(float));
         return 1;
     }
 
@@ -395,57 +492,85 @@ Dictionary::dict_value (int nodeID, ustring attribname,
 }
 
 
+
+std::shared_ptr<Dictionary>
+ShadingSystemImpl::dictionary (int &generation)
+{
+    spin_lock lock (m_dictionary_mutex);
+    if (! m_dictionary)
+        m_dictionary = std::make_shared<Dictionary> (*this);
+    generation = m_dictionary_generation.load (std::memory_order_relaxed);
+    return m_dictionary;
+}
+
+
+
+void
+ShadingSystemImpl::invalidate_dictionaries ()
+{
+    std::shared_ptr<Dictionary> old;   // freed after unlocking
+    spin_lock lock (m_dictionary_mutex);
+    old.swap (m_dictionary);
+    m_dictionary_generation.fetch_add (1, std::memory_order_release);
+}
+
+
+
+void
+ShadingSystemImpl::free_dict_resources ()
+{
+    spin_lock lock (m_dictionary_mutex);
+    m_dictionary.reset ();
+}
+
+
 }; // namespace pvt
 
 
 
-int
-ShadingContext::dict_find (ustring dictionaryname, ustring query)
+Dictionary *
+ShadingContext::dictionary ()
 {
-    if (! m_dictionary) {
-        m_dictionary = new Dictionary (this);
+    if (! m_dictionary_checked) {
+        if (! m_dictionary ||
+              m_dictionary_generation != shadingsys().dictionary_generation())
+            m_dictionary = shadingsys().dictionary (m_dictionary_generation);
+        m_dictionary_checked = true;
     }
-    return m_dictionary->dict_find (dictionaryname, query);
+    return m_dictionary.get();
 }
 
 
 
 int
-ShadingContext::dict_find (int nodeID, ustring query)
+ShadingContext::dict_find (ustring dictionaryname, ustring query)
 {
-    if (! m_dictionary) {
-        m_dictionary = new Dictionary (this);
-    }
-    return m_dictionary->dict_find (nodeID, query);
+    return dictionary()->dict_find (this, dictionaryname, query);
 }
 
 
 
 int
-ShadingContext::dict_next (int nodeID)
+ShadingContext::dict_find (int nodeID, ustring query)
 {
-    if (! m_dictionary)
-        return 0;
-    return m_dictionary->dict_next (nodeID);
+    return dictionary()->dict_find (this, nodeID, query);
 }
 
 
 
 int
-ShadingContext::dict_value (int nodeID, ustring attribname,
-                            TypeDesc type, void *data)
+ShadingContext::dict_next (int nodeID)
 {
-    if (! m_dictionary)
-        return 0;
-    return m_dictionary->dict_value (nodeID, attribname, type, data);
+    return dictionary()->dict_next (nodeID);
 }
 
 
 
-void
-ShadingContext::free_dict_resources ()
+int
+ShadingContext::dict_value (int nodeID, ustring attribname,
+                            TypeDesc type, void *data)
 {
-    delete m_dictionary;
+    return dictionary()->dict_value (nodeID, attribname, type, data);
 }
 
 
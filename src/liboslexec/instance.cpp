@@ -32,6 +32,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <algorithm>
 
 #include <OpenImageIO/strutil.h>
+#include <OpenImageIO/hash.h>
 
 #include "oslexec_pvt.h"
 
@@ -531,6 +532,100 @@ ShaderInstance::copy_code_from_master (ShaderGroup &group)
 
 
 
+// Point the symbols whose data is in the param values 'from' at the same
+// values in 'to'.
+template<class T>
+static void
+rebase_param_data (SymbolVec &symbols, const std::vector<T> &from,
+                   std::vector<T> &to)
+{
+    if (from.empty())
+        return;
+    const T *begin = from.data(), *end = from.data() + from.size();
+    for (auto&& s : symbols) {
+        const T *d = (const T *)s.data();
+        if (d >= begin && d < end)
+            s.data (to.data() + (d - begin));
+    }
+}
+
+
+
+void
+ShaderInstance::save_specialization (GroupSpecialization::Layer &layer) const
+{
+    layer.master = m_master;
+    layer.symbols = m_instsymbols;
+    layer.ops = m_instops;
+    layer.args = m_instargs;
+    layer.iparams = m_iparams;
+    layer.fparams = m_fparams;
+    layer.sparams = m_sparams;
+    // The optimized symbols may point to our param values, which will
+    // change or go away; point them to the saved copy.
+    rebase_param_data (layer.symbols, m_iparams, layer.iparams);
+    rebase_param_data (layer.symbols, m_fparams, layer.fparams);
+    rebase_param_data (layer.symbols, m_sparams, layer.sparams);
+    layer.connections = m_connections;
+    layer.firstparam = m_firstparam;
+    layer.lastparam = m_lastparam;
+    layer.maincodebegin = m_maincodebegin;
+    layer.maincodeend = m_maincodeend;
+    layer.Psym = m_Psym;
+    layer.Nsym = m_Nsym;
+    layer.writes_globals = m_writes_globals;
+    layer.userdata_params = m_userdata_params;
+    layer.outgoing_connections = m_outgoing_connections;
+    layer.renderer_outputs = m_renderer_outputs;
+    layer.merged_unused = m_merged_unused;
+}
+
+
+
+void
+ShaderInstance::restore_specialization (const GroupSpecialization::Layer &layer)
+{
+    OSL_ASSERT (m_instsymbols.empty() && m_instops.empty() &&
+                layer.master == m_master);
+    off_t symmem = -vectorbytes (m_instoverrides);
+    off_t connectionmem = -vectorbytes (m_connections);
+    m_instsymbols = layer.symbols;
+    m_instops = layer.ops;
+    m_instargs = layer.args;
+    m_iparams = layer.iparams;
+    m_fparams = layer.fparams;
+    m_sparams = layer.sparams;
+    rebase_param_data (m_instsymbols, layer.iparams, m_iparams);
+    rebase_param_data (m_instsymbols, layer.fparams, m_fparams);
+    rebase_param_data (m_instsymbols, layer.sparams, m_sparams);
+    m_connections = layer.connections;
+    m_firstparam = layer.firstparam;
+    m_lastparam = layer.lastparam;
+    m_maincodebegin = layer.maincodebegin;
+    m_maincodeend = layer.maincodeend;
+    m_Psym = layer.Psym;
+    m_Nsym = layer.Nsym;
+    m_writes_globals = layer.writes_globals;
+    m_userdata_params = layer.userdata_params;
+    m_outgoing_connections = layer.outgoing_connections;
+    m_renderer_outputs = layer.renderer_outputs;
+    m_merged_unused = layer.merged_unused;
+    SymOverrideInfoVec().swap (m_instoverrides);  // free it
+
+    // adjust stats
+    symmem += vectorbytes (m_instsymbols);
+    connectionmem += vectorbytes (m_connections);
+    {
+        spin_lock lock (shadingsys().m_stat_mutex);
+        shadingsys().m_stat_mem_inst_syms += symmem;
+        shadingsys().m_stat_mem_inst_connections += connectionmem;
+        shadingsys().m_stat_mem_inst += symmem + connectionmem;
+        shadingsys().m_stat_memory += symmem + connectionmem;
+    }
+}
+
+
+
 std::string
 ConnectedParam::str (const ShaderInstance *inst)
 {
@@ -724,6 +819,49 @@ ShaderInstance::mergeable (const ShaderInstance &b, const ShaderGroup& /*g*/) co
 }
 
 
+
+size_t
+ShaderInstance::merge_hash () const
+{
+    // Only hash what mergeable() requires to be identical for both
+    // instances, never what it lets differ.
+    size_t hash = std::hash<const void*>()(master());
+    hash = hash * 31 + size_t(run_lazily());
+    for (auto&& con : m_connections)
+        hash = ((hash * 31 + size_t(con.srclayer)) * 31
+                + size_t(con.src.param)) * 31 + size_t(con.dst.param);
+
+    bool optimized = (m_instsymbols.size() != 0 || m_instops.size() != 0);
+    if (! optimized) {
+        // Before optimization, mergeable() compares the values of the
+        // params used in the group.  (After optimization, which params
+        // it compares depends on which instance it asks, so leave them
+        // out; the code below already tells the instances apart.)
+        for (int i = firstparam();  i < lastparam();  ++i) {
+            const Symbol *sym = mastersymbol(i);
+            if (! sym->everused_in_group() || sym->typespec().is_closure())
+                continue;
+            if (sym->valuesource() == Symbol::InstanceVal ||
+                sym->valuesource() == Symbol::DefaultVal)
+                hash = hash * 31 + OIIO::farmhash::Hash (
+                           (const char *)param_storage(i),
+                           sym->typespec().simpletype().size());
+        }
+        return hash;
+    }
+
+    hash = hash * 31 + m_instsymbols.size();
+    for (auto&& op : m_instops)
+        hash = ((hash * 31 + op.opname().hash()) * 31
+                + size_t(op.firstarg())) * 31 + size_t(op.nargs());
+    for (int a : m_instargs)
+        hash = hash * 31 + size_t(a);
+    hash = ((hash * 31 + size_t(m_maincodebegin)) * 31
+            + size_t(m_maincodeend)) * 31 + size_t(m_lastparam);
+    return hash;
+}
+
+
 }; // namespace pvt
 
 
@@ -752,6 +890,8 @@ ShaderGroup::ShaderGroup (const ShaderGroup &g, string_view name)
 
 ShaderGroup::~ShaderGroup ()
 {
+    if (m_jit_lru_owner)
+        m_jit_lru_owner->jit_lru_remove (*this);
 #if 0
     if (m_layers.size()) {
         ustring name = m_layers.back()->layername();
@@ -818,11 +958,19 @@ ShaderGroup::mark_entry_layer (int layer)
 
 std::string
 ShaderGroup::serialize () const
+{
+    lock_guard lock (m_mutex);
+    return serialize_locked ();
+}
+
+
+
+std::string
+ShaderGroup::serialize_locked () const
 {
     std::ostringstream out;
     out.imbue (std::locale::classic());  // force C locale
     out.precision (9);
-    lock_guard lock (m_mutex);
     for (int i = 0, nl = nlayers(); i < nl; ++i) {
         const ShaderInstance *inst = m_layers[i].get();
 
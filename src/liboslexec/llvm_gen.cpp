@@ -26,7 +26,11 @@ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <initializer_list>
+#include <new>
 
 #include <OpenImageIO/fmath.h>
 
@@ -481,7 +485,9 @@ LLVMGEN (llvm_gen_add)
             rop.llvm_load_value (A),
             rop.llvm_load_value (B)
         };
-        llvm::Value *res = rop.ll.call_function ("osl_add_closure_closure", valargs);
+        llvm::Value *res = rop.ll.call_function (rop.flat_closures()
+                                                     ? "osl_add_closure_closure_flat"
+                                                     : "osl_add_closure_closure", valargs);
         rop.llvm_store_value (res, Result, 0, NULL, 0);
         return true;
     }
@@ -589,8 +595,10 @@ LLVMGEN (llvm_gen_mul)
             valargs[1] = rop.llvm_load_value (B);
             valargs[2] = tfloat ? rop.llvm_load_value (A) : rop.llvm_void_ptr(A);
         }
-        llvm::Value *res = tfloat ? rop.ll.call_function ("osl_mul_closure_float", valargs)
-                                  : rop.ll.call_function ("osl_mul_closure_color", valargs);
+        const char *func = tfloat ? "osl_mul_closure_float" : "osl_mul_closure_color";
+        if (rop.flat_closures())
+            func = tfloat ? "osl_mul_closure_float_flat" : "osl_mul_closure_color_flat";
+        llvm::Value *res = rop.ll.call_function (func, valargs);
         rop.llvm_store_value (res, Result, 0, NULL, 0);
         return true;
     }
@@ -2180,11 +2188,15 @@ LLVMGEN (llvm_gen_loopmod_op)
 
 
 
+// Generate the TextureOpt for a texture lookup by calling the
+// osl_texture_set_* shadeops on the context's texture options, one call
+// per optional argument.  Only used for OptiX, whose texture options are
+// laid out differently from TextureOpt.
 static llvm::Value *
-llvm_gen_texture_options (BackendLLVM &rop, int opnum,
-                          int first_optional_arg, bool tex3d, int nchans,
-                          llvm::Value* &alpha, llvm::Value* &dalphadx,
-                          llvm::Value* &dalphady, llvm::Value* &errormessage)
+llvm_gen_texture_options_calls (BackendLLVM &rop, int opnum,
+                                int first_optional_arg, bool tex3d, int nchans,
+                                llvm::Value* &alpha, llvm::Value* &dalphadx,
+                                llvm::Value* &dalphady, llvm::Value* &errormessage)
 {
     llvm::Value* opt = rop.ll.call_function ("osl_get_texture_options",
                                              rop.sg_void_ptr());
@@ -2392,6 +2404,266 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
 
 
 
+// Generate the TextureOpt for a texture lookup.  Options whose values
+// are known now are applied directly to a prototype TextureOpt, which
+// the generated code copies (as a constant blob) into a TextureOpt on the
+// stack; options that depend on runtime values are then stored straight
+// into the fields of that copy.  No calls are made except to decode
+// wrap or interpolation mode names that aren't constant.
+static llvm::Value *
+llvm_gen_texture_options (BackendLLVM &rop, int opnum,
+                          int first_optional_arg, bool tex3d, int nchans,
+                          llvm::Value* &alpha, llvm::Value* &dalphadx,
+                          llvm::Value* &dalphady, llvm::Value* &errormessage)
+{
+    if (rop.use_optix())
+        return llvm_gen_texture_options_calls (rop, opnum, first_optional_arg,
+                                               tex3d, nchans, alpha, dalphadx,
+                                               dalphady, errormessage);
+
+    static_assert (sizeof(TextureOpt::Wrap) == sizeof(int) &&
+                   sizeof(TextureOpt::InterpMode) == sizeof(int),
+                   "TextureOpt enums are assumed to be int sized");
+
+    // A store of a runtime value into one TextureOpt field.  If
+    // 'if_nonneg' is set, negative values (unrecognized names) leave the
+    // field as it was.
+    struct FieldStore {
+        size_t offset;
+        llvm::Type *ptrtype;
+        llvm::Value *val;
+        bool if_nonneg;
+    };
+    // The prototype is copied byte for byte into the IR, so build it in
+    // zeroed storage: its padding would otherwise be indeterminate, and
+    // the IR (and the JIT cache key derived from it) would vary from run
+    // to run.
+    alignas(TextureOpt) char protomem[sizeof(TextureOpt)];
+    memset (protomem, 0, sizeof(protomem));
+    TextureOpt &proto (*new (protomem) TextureOpt);
+    std::vector<FieldStore> stores;
+    auto forget_stores = [&](size_t offset) {
+        stores.erase (std::remove_if (stores.begin(), stores.end(),
+                          [=](const FieldStore &f){ return f.offset == offset; }),
+                      stores.end());
+    };
+    auto set_int = [&](size_t offset, int val) {
+        forget_stores (offset);
+        memcpy ((char *)&proto + offset, &val, sizeof(val));
+    };
+    auto set_float = [&](size_t offset, float val) {
+        forget_stores (offset);
+        memcpy ((char *)&proto + offset, &val, sizeof(val));
+    };
+    auto store = [&](size_t offset, llvm::Type *ptrtype, llvm::Value *val,
+                     bool if_nonneg=false) {
+        if (! if_nonneg)
+            forget_stores (offset);
+        stores.push_back (FieldStore { offset, ptrtype, val, if_nonneg });
+    };
+    llvm::Type *int_ptr = rop.ll.type_int_ptr();
+    llvm::Type *float_ptr = rop.ll.type_float_ptr();
+
+    llvm::Value* missingcolor = NULL;
+    bool subimage_set = false;
+
+    Opcode &op (rop.inst()->ops()[opnum]);
+    for (int a = first_optional_arg;  a < op.nargs();  ++a) {
+        Symbol &Name (*rop.opargsym(op,a));
+        OSL_DASSERT (Name.typespec().is_string() &&
+                     "optional texture token must be a string");
+        OSL_DASSERT (a+1 < op.nargs() && "malformed argument list for texture");
+        ustring name = *(ustring *)Name.data();
+        ++a;  // advance to next argument
+
+        if (name.empty())    // skip empty string param name
+            continue;
+
+        Symbol &Val (*rop.opargsym(op,a));
+        TypeDesc valtype = Val.typespec().simpletype ();
+        bool is_int = (valtype == TypeDesc::INT);
+
+        // Set float fields (of which there may be several, e.g. "blur"
+        // sets sblur and tblur) from a float or int argument.
+        auto set_floats = [&](std::initializer_list<size_t> offsets) {
+            if (Val.is_constant()) {
+                float f = is_int ? float(*(const int *)Val.data())
+                                 : *(const float *)Val.data();
+                for (size_t offset : offsets)
+                    set_float (offset, f);
+            } else {
+                llvm::Value *val = rop.llvm_load_value (Val);
+                if (is_int)
+                    val = rop.ll.op_int_to_float (val);
+                for (size_t offset : offsets)
+                    store (offset, float_ptr, val);
+            }
+        };
+        // Set wrap mode fields from a wrap mode name.
+        auto set_wraps = [&](std::initializer_list<size_t> offsets) {
+            if (Val.is_constant()) {
+                int mode = TextureOpt::decode_wrapmode (*(ustring *)Val.data());
+                if (mode >= 0)
+                    for (size_t offset : offsets)
+                        set_int (offset, mode);
+            } else {
+                llvm::Value *mode = rop.ll.call_function (
+                        "osl_texture_decode_wrapmode", rop.llvm_load_value (Val));
+                for (size_t offset : offsets)
+                    store (offset, int_ptr, mode);
+            }
+        };
+
+        // Field offsets, taken from the prototype itself (TextureOpt may
+        // not be standard layout, so offsetof isn't safe to use on it).
+#define TEXOPT(field) size_t((char *)&proto.field - (char *)&proto)
+
+        if ((name == Strings::width || name == Strings::blur) &&
+            (valtype == TypeDesc::FLOAT || is_int)) {
+            if (name == Strings::width) {
+                if (tex3d)
+                    set_floats ({ TEXOPT(swidth), TEXOPT(twidth), TEXOPT(rwidth) });
+                else
+                    set_floats ({ TEXOPT(swidth), TEXOPT(twidth) });
+            } else {
+                if (tex3d)
+                    set_floats ({ TEXOPT(sblur), TEXOPT(tblur), TEXOPT(rblur) });
+                else
+                    set_floats ({ TEXOPT(sblur), TEXOPT(tblur) });
+            }
+            continue;
+        }
+        if (valtype == TypeDesc::FLOAT || is_int) {
+            size_t offset = 0;
+            if      (name == Strings::swidth) offset = TEXOPT(swidth);
+            else if (name == Strings::twidth) offset = TEXOPT(twidth);
+            else if (name == Strings::rwidth) offset = TEXOPT(rwidth);
+            else if (name == Strings::sblur)  offset = TEXOPT(sblur);
+            else if (name == Strings::tblur)  offset = TEXOPT(tblur);
+            else if (name == Strings::rblur)  offset = TEXOPT(rblur);
+            else if (name == Strings::fill)   offset = TEXOPT(fill);
+            else if (name == Strings::time)   offset = TEXOPT(time);
+            if (offset) {
+                set_floats ({ offset });
+                continue;
+            }
+        }
+        if (is_int && (name == Strings::firstchannel ||
+                       name == Strings::subimage)) {
+            size_t offset = (name == Strings::firstchannel)
+                          ? TEXOPT(firstchannel) : TEXOPT(subimage);
+            if (Val.is_constant())
+                set_int (offset, *(const int *)Val.data());
+            else
+                store (offset, int_ptr, rop.llvm_load_value (Val));
+            continue;
+        }
+
+        if (valtype == TypeDesc::STRING) {
+            if (name == Strings::wrap) {
+                if (tex3d)
+                    set_wraps ({ TEXOPT(swrap), TEXOPT(twrap), TEXOPT(rwrap) });
+                else
+                    set_wraps ({ TEXOPT(swrap), TEXOPT(twrap) });
+                continue;
+            }
+            if (name == Strings::swrap) { set_wraps ({ TEXOPT(swrap) }); continue; }
+            if (name == Strings::twrap) { set_wraps ({ TEXOPT(twrap) }); continue; }
+            if (name == Strings::rwrap) { set_wraps ({ TEXOPT(rwrap) }); continue; }
+
+            if (name == Strings::subimage) {
+                if (Val.is_constant() && ((ustring *)Val.data())->empty()
+                    && ! subimage_set)
+                    continue;     // Ignore nulls unless they are overrides
+                // The name is always stored at runtime, even if constant,
+                // so that the prototype holds no string pointers.
+                store (TEXOPT(subimagename),
+                       rop.ll.type_ptr (rop.ll.type_string()),
+                       rop.llvm_load_value (Val));
+                subimage_set = true;
+                continue;
+            }
+
+            if (name == Strings::interp) {
+                if (Val.is_constant()) {
+                    int mode = tex_interp_to_code (*(ustring *)Val.data());
+                    if (mode >= 0)
+                        set_int (TEXOPT(interpmode), mode);
+                } else {
+                    llvm::Value *mode = rop.ll.call_function (
+                            "osl_texture_decode_interpmode",
+                            rop.llvm_load_value (Val));
+                    store (TEXOPT(interpmode), int_ptr, mode, true);
+                }
+                continue;
+            }
+        }
+
+        if (name == Strings::alpha && valtype == TypeDesc::FLOAT) {
+            alpha = rop.llvm_get_pointer (Val);
+            if (Val.has_derivs()) {
+                dalphadx = rop.llvm_get_pointer (Val, 1);
+                dalphady = rop.llvm_get_pointer (Val, 2);
+                // NO z derivs!  dalphadz = rop.llvm_get_pointer (Val, 3);
+            }
+            continue;
+        }
+        if (name == Strings::errormessage && valtype == TypeDesc::STRING) {
+            errormessage = rop.llvm_get_pointer (Val);
+            continue;
+        }
+        if ((name == Strings::missingcolor &&
+             equivalent(valtype,TypeDesc::TypeColor)) ||
+            (name == Strings::missingalpha && valtype == TypeDesc::FLOAT)) {
+            if (! missingcolor) {
+                // If not already done, allocate enough storage for the
+                // missingcolor value (4 floats), and point the
+                // TextureOpt.missingcolor to it.
+                missingcolor = rop.ll.op_alloca_entry (rop.ll.type_float(), 4);
+                store (TEXOPT(missingcolor),
+                       rop.ll.type_ptr (rop.ll.type_float_ptr()),
+                       missingcolor);
+            }
+            if (name == Strings::missingcolor) {
+                rop.ll.op_memcpy (rop.ll.void_ptr(missingcolor),
+                                  rop.llvm_void_ptr(Val), (int)sizeof(Color3));
+            } else {
+                rop.ll.op_store (rop.llvm_load_value (Val),
+                                 rop.ll.GEP (missingcolor, nchans));
+            }
+            continue;
+        }
+#undef TEXOPT
+
+        rop.shadingcontext()->errorf("Unknown texture%s optional argument: \"%s\", <%s> (%s:%d)",
+                                     tex3d ? "3d" : "", name, valtype,
+                                     op.sourcefile(), op.sourceline());
+    }
+
+    // Copy the prototype into a TextureOpt on the stack -- the texture
+    // system may write to it, so it can't be used in place -- then fill
+    // in the fields that are only known at runtime.
+    const int nwords = (sizeof(TextureOpt) + sizeof(void*) - 1) / sizeof(void*);
+    llvm::Value *opt = rop.ll.op_alloca_entry (rop.ll.type_void_ptr(), nwords,
+                                               "textureopt");
+    opt = rop.ll.void_ptr (opt);
+    rop.ll.op_memcpy (opt, (int)sizeof(void*),
+                      rop.ll.constant_data (&proto, sizeof(TextureOpt)), 1,
+                      (int)sizeof(TextureOpt));
+    for (auto&& f : stores) {
+        llvm::Value *ptr = rop.ll.ptr_cast (rop.ll.GEP (opt, (int)f.offset),
+                                            f.ptrtype);
+        llvm::Value *val = f.val;
+        if (f.if_nonneg)
+            val = rop.ll.op_select (rop.ll.op_ge (val, rop.ll.constant(0)),
+                                    val, rop.ll.op_load (ptr));
+        rop.ll.op_store (val, ptr);
+    }
+    return opt;
+}
+
+
+
 LLVMGEN (llvm_gen_texture)
 {
     Opcode &op (rop.inst()->ops()[opnum]);
@@ -2936,6 +3208,14 @@ LLVMGEN (llvm_gen_getattribute)
     // necessary conversions from its internal format to OSL's.
     const TypeDesc* dest_type = &Destination.typespec().simpletype();
 
+    // If the same lookup is made elsewhere in the group, only ask the
+    // renderer the first time it's executed.
+    int slot = -1;
+    AttributeLookup lookup;
+    if (rop.group().getattribute_lookups().size() && ! rop.use_optix() &&
+          rop.getattribute_lookup (op, lookup))
+        slot = rop.group().find_getattribute_lookup (lookup);
+
     llvm::Value * args[] = {
             rop.sg_void_ptr(),
             rop.ll.constant ((int)Destination.has_derivs()),
@@ -2946,7 +3226,16 @@ LLVMGEN (llvm_gen_getattribute)
             rop.ll.constant_ptr ((void *) dest_type),
             rop.llvm_void_ptr (Destination),
     };
-    llvm::Value *r = rop.ll.call_function ("osl_get_attribute", args);
+    llvm::Value *r;
+    if (slot >= 0) {
+        llvm::Value * shared_args[] = {
+            args[0], rop.ll.constant (slot), args[1], args[2], args[3],
+            args[4], args[5], args[6], args[7]
+        };
+        r = rop.ll.call_function ("osl_get_attribute_shared", shared_args);
+    } else {
+        r = rop.ll.call_function ("osl_get_attribute", args);
+    }
     rop.llvm_store_value (r, Result);
 
     return true;
@@ -3020,6 +3309,55 @@ LLVMGEN (llvm_gen_getmessage)
     OSL_DASSERT(Result.typespec().is_int() && Name.typespec().is_string());
     OSL_DASSERT(has_source == 0 || Source.typespec().is_string());
 
+    // A message with a slot in the group data is read directly from it
+    // if it's been set by this layer or an earlier one.  Anything else
+    // (not set yet, set by a later layer) goes to osl_getmessage_slot,
+    // which records the query or reports the error.  Messages from the
+    // "trace" source come from the renderer, even if the group also sets
+    // a message of the same name, so they never use the slot.
+    static ustring ktrace ("trace");
+    bool local = ! has_source || (Source.is_constant() &&
+                                  *(ustring *)Source.data() != ktrace);
+    llvm::Value *slot = (local && Name.is_constant())
+                      ? rop.message_slot (*(ustring *)Name.data()) : NULL;
+    if (slot) {
+        TypeDesc type = BackendLLVM::message_type (Data);
+        llvm::Value *state = rop.ll.op_load (rop.ll.offset_ptr (slot,
+                                 offsetof(MessageSlot, state), rop.ll.type_int_ptr()));
+        llvm::Value *setter = rop.ll.op_load (rop.ll.offset_ptr (slot,
+                                 offsetof(MessageSlot, layeridx), rop.ll.type_int_ptr()));
+        llvm::Value *found = rop.ll.op_and (
+                rop.ll.op_eq (state, rop.ll.constant ((int)MessageSlot::Set)),
+                rop.ll.op_le (setter, rop.ll.constant (rop.inst()->id())));
+        llvm::BasicBlock *found_block = rop.ll.new_basic_block ("getmessage_slot");
+        llvm::BasicBlock *notfound_block = rop.ll.new_basic_block ("getmessage_noslot");
+        llvm::BasicBlock *after_block = rop.ll.new_basic_block ("");
+        rop.ll.op_branch (found, found_block, notfound_block);
+
+        // Found it: copy the value (derivs are not stored, so zero them)
+        rop.ll.op_memcpy (rop.llvm_void_ptr (Data),
+                          rop.ll.offset_ptr (slot, sizeof(MessageSlot)),
+                          (int)type.size(), (int)type.basesize());
+        if (Data.has_derivs())
+            rop.llvm_zero_derivs (Data);
+        rop.llvm_store_value (rop.ll.constant (1), Result);
+        rop.ll.op_branch (after_block);
+
+        rop.ll.set_insert_point (notfound_block);
+        llvm::Value *args[] = {
+            rop.sg_void_ptr(),
+            slot,
+            rop.ll.constant (*(ustring *)Name.data()),
+            rop.ll.constant (rop.inst()->id()),
+            rop.ll.constant (op.sourcefile()),
+            rop.ll.constant (op.sourceline())
+        };
+        llvm::Value *r = rop.ll.call_function ("osl_getmessage_slot", args);
+        rop.llvm_store_value (r, Result);
+        rop.ll.op_branch (after_block);
+        return true;
+    }
+
     llvm::Value *args[9];
     args[0] = rop.sg_void_ptr();
     args[1] = has_source ? rop.llvm_load_value(Source) 
@@ -3058,6 +3396,50 @@ LLVMGEN (llvm_gen_setmessage)
     Symbol& Data   = *rop.opargsym (op, 1);
     OSL_DASSERT(Name.typespec().is_string());
 
+    // A message with a slot in the group data is stored directly into it
+    // if it hasn't been set or queried yet; otherwise osl_setmessage_slot
+    // reports the error.
+    llvm::Value *slot = Name.is_constant() ? rop.message_slot (*(ustring *)Name.data())
+                                           : NULL;
+    if (slot) {
+        TypeDesc type = BackendLLVM::message_type (Data);
+        llvm::Value *state_ptr = rop.ll.offset_ptr (slot,
+                                    offsetof(MessageSlot, state), rop.ll.type_int_ptr());
+        llvm::Value *empty = rop.ll.op_eq (rop.ll.op_load (state_ptr),
+                                           rop.ll.constant ((int)MessageSlot::Empty));
+        llvm::BasicBlock *set_block = rop.ll.new_basic_block ("setmessage_slot");
+        llvm::BasicBlock *again_block = rop.ll.new_basic_block ("setmessage_again");
+        llvm::BasicBlock *after_block = rop.ll.new_basic_block ("");
+        rop.ll.op_branch (empty, set_block, again_block);
+
+        rop.ll.op_memcpy (rop.ll.offset_ptr (slot, sizeof(MessageSlot)),
+                          rop.llvm_void_ptr (Data),
+                          (int)type.size(), (int)type.basesize());
+        rop.ll.op_store (rop.ll.constant ((int)MessageSlot::Set), state_ptr);
+        rop.ll.op_store (rop.ll.constant (rop.inst()->id()),
+                         rop.ll.offset_ptr (slot, offsetof(MessageSlot, layeridx),
+                                            rop.ll.type_int_ptr()));
+        rop.ll.op_store (rop.ll.constant (op.sourceline()),
+                         rop.ll.offset_ptr (slot, offsetof(MessageSlot, sourceline),
+                                            rop.ll.type_int_ptr()));
+        rop.ll.op_store (rop.ll.constant (op.sourcefile()),
+                         rop.ll.offset_ptr (slot, offsetof(MessageSlot, sourcefile),
+                                            rop.ll.type_ptr (rop.ll.type_string())));
+        rop.ll.op_branch (after_block);
+
+        rop.ll.set_insert_point (again_block);
+        llvm::Value *args[] = {
+            rop.sg_void_ptr(),
+            slot,
+            rop.ll.constant (*(ustring *)Name.data()),
+            rop.ll.constant (op.sourcefile()),
+            rop.ll.constant (op.sourceline())
+        };
+        rop.ll.call_function ("osl_setmessage_slot", args);
+        rop.ll.op_branch (after_block);
+        return true;
+    }
+
     llvm::Value *args[7];
     args[0] = rop.sg_void_ptr();
     args[1] = rop.llvm_load_value (Name);
@@ -3477,8 +3859,8 @@ LLVMGEN (llvm_gen_pointcloud_search)
     static ustring errorfmt("Arrays too small for pointcloud lookup at (%s:%d)");
     llvm::Value *err_args[] = {
         rop.sg_void_ptr(),
-        rop.ll.constant_ptr ((void *)errorfmt.c_str()),
-        rop.ll.constant_ptr ((void *)op.sourcefile().c_str()),
+        rop.ll.constant (errorfmt),
+        rop.ll.constant (op.sourcefile()),
         rop.ll.constant (op.sourceline()),
     };
     rop.ll.call_function ("osl_error", err_args);
@@ -3537,8 +3919,8 @@ LLVMGEN (llvm_gen_pointcloud_get)
     static ustring errorfmt("Arrays too small for pointcloud attribute get at (%s:%d)");
     llvm::Value *err_args[] = {
         rop.sg_void_ptr(),
-        rop.ll.constant_ptr ((void *)errorfmt.c_str()),
-        rop.ll.constant_ptr ((void *)op.sourcefile().c_str()),
+        rop.ll.constant (errorfmt),
+        rop.ll.constant (op.sourcefile()),
         rop.ll.constant (op.sourceline()),
     };
     rop.ll.call_function ("osl_error", err_args);
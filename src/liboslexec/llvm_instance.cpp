@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <cmath>
+#include <cstddef>
 #include <iostream>
 #include <unordered_map>
 #include <unordered_set>
@@ -37,6 +38,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/hash.h>
 
 #include "oslexec_pvt.h"
 #include "../liboslcomp/oslcomp_pvt.h"
@@ -72,6 +74,9 @@ Schematically, we want to create code that resembles the following:
         // interpolated from the geom, or are connected to other layers.
         float param_0_foo;   // number is layer ID
         float param_1_bar;
+        // Fixed slots for messages whose names are known at compile
+        // time (see MessageSlot), if any.
+        MessageSlot msg_0;  char msg_0_data[sizeof(color)];
     };
 
     // Name of layer entry is $layer_ID
@@ -127,6 +132,8 @@ static spin_mutex llvm_mutex;
 
 static ustring op_end("end");
 static ustring op_nop("nop");
+static ustring op_setmessage("setmessage");
+static ustring op_getmessage("getmessage");
 static ustring op_aassign("aassign");
 static ustring op_compassign("compassign");
 static ustring op_aref("aref");
@@ -134,6 +141,24 @@ static ustring op_compref("compref");
 static ustring op_useparam("useparam");
 
 
+// Is this one of the ops that the detailed profile times individually?
+static bool
+profiled_op (ustring opname)
+{
+    static const std::set<ustring> ops {
+        ustring("texture"), ustring("texture3d"), ustring("environment"),
+        ustring("gettextureinfo"), ustring("noise"), ustring("snoise"),
+        ustring("pnoise"), ustring("psnoise"), ustring("cellnoise"),
+        ustring("hashnoise"), ustring("getattribute"),
+        ustring("pointcloud_search"), ustring("pointcloud_get"),
+        ustring("pointcloud_write"), ustring("trace"),
+        ustring("dict_find"), ustring("dict_next"), ustring("dict_value"),
+        ustring("regex_search"), ustring("regex_match")
+    };
+    return ops.find (opname) != ops.end();
+}
+
+
 struct HelperFuncRecord {
     const char *argtypes;
     void (*function)();
@@ -243,6 +268,10 @@ BackendLLVM::llvm_type_groupdata ()
     std::vector<llvm::Type*> fields;
     int offset = 0;
     int order = 0;
+    // When tiering up, other threads may be running the old code, so
+    // check that the offsets are the same rather than changing them.
+    bool relayout = group().m_jit_tier != 0;
+    m_groupdata_layout_changed = false;
 
     if (llvm_debug() >= 2)
         std::cout << "Group param struct:\n";
@@ -288,7 +317,10 @@ BackendLLVM::llvm_type_groupdata ()
             if (llvm_debug() >= 2)
                 std::cout << "  userdata " << names[i] << ' ' << type
                           << ", field " << order << ", offset " << offset << "\n";
-            offsets[i] = offset;
+            if (! relayout)
+                offsets[i] = offset;
+            else if (offsets[i] != offset)
+                m_groupdata_layout_changed = true;
             offset += int(type.size());
             ++order;
         }
@@ -322,14 +354,34 @@ BackendLLVM::llvm_type_groupdata ()
                           << " " << ts.c_str() << ", field " << order 
                           << ", size " << derivSize * int(sym.size())
                           << ", offset " << offset << std::endl;
-            sym.dataoffset ((int)offset);
+            if (! relayout)
+                sym.dataoffset ((int)offset);
+            else if (sym.dataoffset() != (int)offset)
+                m_groupdata_layout_changed = true;
             offset += derivSize* int(sym.size());
 
             m_param_order_map[&sym] = order;
             ++order;
         }
     }
-    group().llvm_groupdata_size (offset);
+    // Last, the fixed slots for messages whose names we know.
+    if (m_message_slots_size) {
+        offset = OIIO::round_to_multiple_of_pow2 (offset, int(alignof(MessageSlot)));
+        if (llvm_debug() >= 2)
+            std::cout << "  message slots: " << m_message_slots.size()
+                      << ", field " << order << ", offset " << offset
+                      << ", size " << m_message_slots_size << "\n";
+        fields.push_back (ll.type_array (ll.type_longlong(),
+                              m_message_slots_size / int(sizeof(long long))));
+        m_message_slots_field = order;
+        offset += m_message_slots_size;
+        ++order;
+    }
+
+    if (! relayout)
+        group().llvm_groupdata_size (offset);
+    else if (group().llvm_groupdata_size() != size_t(offset))
+        m_groupdata_layout_changed = true;
     if (llvm_debug() >= 2)
         std::cout << " Group struct had " << order << " fields, total size "
                   << offset << "\n\n";
@@ -343,6 +395,75 @@ BackendLLVM::llvm_type_groupdata ()
 
 
 
+void
+BackendLLVM::find_message_slots ()
+{
+    m_message_slots.clear ();
+    m_message_slots_size = 0;
+    m_message_slots_field = -1;
+    if (! shadingsys().m_opt_message_slots || use_optix())
+        return;
+
+    // Gather the type of each message name, in order of first use (so
+    // that the layout is deterministic).  A name used with two different
+    // types is left to the MessageList, which reports the mismatch.
+    static ustring ktrace ("trace");
+    std::vector<std::pair<ustring,TypeDesc>> messages;
+    std::set<ustring> mismatched;
+    for (int layer = 0;  layer < group().nlayers();  ++layer) {
+        if (m_layer_remap[layer] == -1)
+            continue;
+        ShaderInstance *inst = group()[layer];
+        for (auto&& op : inst->ops()) {
+            bool is_set = (op.opname() == op_setmessage);
+            if (! is_set && op.opname() != op_getmessage)
+                continue;
+            int has_source = (! is_set && op.nargs() == 4);
+            if (has_source) {
+                Symbol &Source (*inst->argsymbol (op.firstarg()+1));
+                if (! Source.is_constant())
+                    return;   // might look up any name at runtime
+                if (*(ustring *)Source.data() == ktrace)
+                    continue; // answered by the renderer, not a message
+            }
+            Symbol &Name (*inst->argsymbol (op.firstarg() + (is_set ? 0 : 1+has_source)));
+            Symbol &Data (*inst->argsymbol (op.firstarg() + (is_set ? 1 : 2+has_source)));
+            if (! Name.is_constant())
+                return;       // might set or get any name at runtime
+            ustring name = *(ustring *)Name.data();
+            TypeDesc type = message_type (Data);
+            auto found = std::find_if (messages.begin(), messages.end(),
+                [name](const std::pair<ustring,TypeDesc> &m){ return m.first == name; });
+            if (found == messages.end())
+                messages.emplace_back (name, type);
+            else if (found->second != type)
+                mismatched.insert (name);
+        }
+    }
+
+    for (auto&& m : messages) {
+        if (mismatched.count (m.first))
+            continue;
+        m_message_slots[m.first] = m_message_slots_size;
+        m_message_slots_size += MessageSlot::slot_size (m.second);
+    }
+}
+
+
+
+llvm::Value *
+BackendLLVM::message_slot (ustring name)
+{
+    auto found = m_message_slots.find (name);
+    if (found == m_message_slots.end())
+        return NULL;
+    OSL_DASSERT (m_message_slots_field >= 0);
+    return ll.offset_ptr (groupdata_field_ptr (m_message_slots_field),
+                          found->second);
+}
+
+
+
 llvm::Type *
 BackendLLVM::llvm_type_groupdata_ptr ()
 {
@@ -699,9 +820,16 @@ BackendLLVM::build_llvm_code (int beginop, int endop, llvm::BasicBlock *bb)
                 llvm_generate_debug_uninit (op);
             if (shadingsys().llvm_debug_ops())
                 llvm_generate_debug_op_printf (op);
+            // Time the ops that call out to expensive services
+            bool profiled = profiling() && profiled_op (op.opname());
+            if (profiled)
+                ll.call_function ("osl_profile_begin", sg_void_ptr(),
+                                  ll.constant (shadingsys().profile_site (group(), layer(), opnum)));
             bool ok = (*opd->llvmgen) (*this, opnum);
             if (! ok)
                 return false;
+            if (profiled)
+                ll.call_function ("osl_profile_end", sg_void_ptr());
             if (shadingsys().debug_nan() /* debug NaN/Inf */
                 && op.farthest_jump() < 0 /* Jumping ops don't need it */) {
                 llvm_generate_debugnan (op);
@@ -761,6 +889,13 @@ BackendLLVM::build_llvm_init ()
         int sz = (num_userdata + 3) & (~3);  // round up to 32 bits
         ll.op_memset (ll.void_ptr(userdata_initialized_ref(0)), 0, sz, 4 /*align*/);
     }
+    // ... and marks all the message slots empty.
+    for (auto&& m : m_message_slots) {
+        llvm::Value *state = ll.offset_ptr (message_slot (m.first),
+                                            offsetof(MessageSlot, state),
+                                            ll.type_int_ptr());
+        ll.op_store (ll.constant ((int)MessageSlot::Empty), state);
+    }
 
     // Group init also needs to allot space for ALL layers' params
     // that are closures (to avoid weird order of layer eval problems).
@@ -854,6 +989,9 @@ BackendLLVM::build_llvm_instance (bool groupentry)
         if (shadingsys().countlayerexecs())
             ll.call_function ("osl_incr_layers_executed", sg_void_ptr());
     }
+    if (profiling())
+        ll.call_function ("osl_profile_begin", sg_void_ptr(),
+                          ll.constant (shadingsys().profile_site (group(), layer(), -1)));
 
     // Setup the symbols
     m_named_values.clear ();
@@ -1009,6 +1147,8 @@ BackendLLVM::build_llvm_instance (bool groupentry)
     if (shadingsys().llvm_debug_layers())
         llvm_gen_debug_printf (Strutil::sprintf("exit layer %d %s %s",
                                this->layer(), inst()->layername(), inst()->shadername()));
+    if (profiling())
+        ll.call_function ("osl_profile_end", sg_void_ptr());
     ll.op_return();
 
     if (llvm_debug())
@@ -1026,7 +1166,7 @@ BackendLLVM::build_llvm_instance (bool groupentry)
 void
 BackendLLVM::initialize_llvm_group ()
 {
-    ll.setup_optimization_passes (shadingsys().llvm_optimize());
+    ll.setup_optimization_passes (llvm_optimize());
 
     // Clear the shaderglobals and groupdata types -- they will be
     // created on demand.
@@ -1088,6 +1228,22 @@ static void empty_group_func (void*, void*)
 
 
 
+// Return a string identifying the shadeop library code, which is part of
+// every JITed group and so must be part of the JIT object cache key.
+static const std::string &
+llvm_ops_identity ()
+{
+#ifdef OSL_LLVM_NO_BITCODE
+    static std::string ident (OSL_LIBRARY_VERSION_STRING);
+#else
+    static std::string ident = OIIO::SHA1 (osl_llvm_compiled_ops_block,
+                                           osl_llvm_compiled_ops_size).digest();
+#endif
+    return ident;
+}
+
+
+
 void
 BackendLLVM::run ()
 {
@@ -1102,6 +1258,17 @@ BackendLLVM::run ()
     OIIO::Timer timer;
     std::string err;
 
+    // If there is a JIT object cache, generate relocatable string
+    // references so that the machine code may be reused by later runs.
+    std::shared_ptr<JITObjectCache> jitcache;
+    if (! use_optix())
+        jitcache = shadingsys().jit_cache();
+    if (jitcache) {
+        ll.object_cache (jitcache.get());
+        ll.relocatable_strings (true);
+    }
+    ll.fast_codegen (llvm_optimize() < 0);
+
     {
 #ifdef OSL_LLVM_NO_BITCODE
     // I don't know which exact part has thread safety issues, but it
@@ -1116,9 +1283,11 @@ BackendLLVM::run ()
     ll.module (ll.new_module ("llvm_ops"));
 #else
     if (! use_optix()) {
-        ll.module (ll.module_from_bitcode ((char*)osl_llvm_compiled_ops_block,
-                                           osl_llvm_compiled_ops_size,
-                                           "llvm_ops", &err));
+        // The shadeop library is parsed once per thread and shared; the
+        // group's module starts with only its declarations.
+        ll.module (ll.module_from_shared_bitcode ((char*)osl_llvm_compiled_ops_block,
+                                                  osl_llvm_compiled_ops_size,
+                                                  "llvm_ops", &err));
     } else {
 #ifdef OSL_LLVM_CUDA_BITCODE
         ll.module (ll.module_from_bitcode ((char*)osl_llvm_compiled_ops_cuda_block,
@@ -1134,7 +1303,11 @@ BackendLLVM::run ()
 #endif
 
     // Create the ExecutionEngine. We don't create an ExecutionEngine in the
-    // OptiX case, because we are using the NVPTX backend and not MCJIT
+    // OptiX case, because we are using the NVPTX backend and not MCJIT.
+    // The code goes in memory of its own, which the group holds, so that
+    // it's freed along with the group (or when evicted).
+    if (! use_optix())
+        group().add_jit_memory (ll.private_jit_memory ());
     if (! use_optix() && ! ll.make_jit_execengine (&err)) {
         shadingcontext()->errorf("Failed to create engine: %s\n", err);
         OSL_ASSERT (0);
@@ -1167,9 +1340,17 @@ BackendLLVM::run ()
             m_layer_remap[layer] = m_num_used_layers++;
         }
     }
-    shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
+    if (! group().m_jit_tier)   // don't count again when tiering up
+        shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
 
+    find_message_slots ();
     initialize_llvm_group ();
+    llvm_type_groupdata ();
+    if (m_groupdata_layout_changed) {
+        shadingcontext()->errorf("Shader group \"%s\" can't be recompiled at full optimization: its groupdata layout changed",
+                                 group().name());
+        return;
+    }
 
     // Generate the LLVM IR for each layer.  Skip unused layers.
     m_llvm_local_mem = 0;
@@ -1185,6 +1366,16 @@ BackendLLVM::run ()
         }
     }
     // llvm::Function* entry_func = group().num_entry_layers() ? NULL : funcs[m_num_used_layers-1];
+
+    // Pull in the bodies of just those shadeop library functions that the
+    // group can actually call.
+    if (! use_optix()) {
+        std::vector<llvm::Function*> roots (funcs);
+        roots.push_back (init_func);
+        ll.link_shared_functions (roots, &err);
+        if (err.length())
+            shadingcontext()->errorf("Failed to load shadeop functions: %s\n", err);
+    }
     m_stat_llvm_irgen_time += timer.lap();
 
     if (shadingsys().m_max_local_mem_KB &&
@@ -1227,8 +1418,27 @@ BackendLLVM::run ()
         }
     }
 
-    // Optimize the LLVM IR unless it's a do-nothing group.
-    if (! group().does_nothing())
+    // Key the JIT object cache on the generated (unoptimized) IR. Anything
+    // that differs between runs changes the key, so a cached object is
+    // only ever used for code that is identical to what we would have
+    // compiled.  Code with baked-in addresses (texture handles, closure
+    // functions, the renderer, ...) gets no key, and is never cached.
+    bool jit_cached = false;
+    if (jitcache) {
+        std::vector<llvm::Function*> keyfuncs (funcs);
+        keyfuncs.push_back (init_func);
+        std::string salt = Strutil::sprintf ("%s %s %d", OSL_LIBRARY_VERSION_STRING,
+                                             llvm_ops_identity(),
+                                             llvm_optimize());
+        std::string key = ll.jit_cache_key (keyfuncs, salt);
+        if (key.size())
+            ll.module()->setModuleIdentifier (key);
+        jit_cached = jitcache->fetch_object (ll.module());
+    }
+
+    // Optimize the LLVM IR unless it's a do-nothing group, or we already
+    // have the compiled machine code for it.
+    if (! group().does_nothing() && ! jit_cached)
         ll.do_optimize();
 
     m_stat_llvm_opt_time += timer.lap();
@@ -27,9 +27,17 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 
+#include <atomic>
 #include <memory>
 #include <cinttypes>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <OpenImageIO/thread.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/hash.h>
 #include <boost/thread/tss.hpp>   /* for thread_specific_ptr */
 
 #include <OSL/oslconfig.h>
@@ -60,14 +68,18 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/Host.h>
 #include <llvm/Support/PrettyStackTrace.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 #include <llvm/Transforms/Utils/UnifyFunctionExitNodes.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
@@ -121,21 +133,52 @@ static DefaultMMapper llvm_default_mapper;
 static OIIO::spin_mutex llvm_global_mutex;
 static bool setup_done = false;
 static boost::thread_specific_ptr<LLVM_Util::PerThreadInfo> perthread_infos;
-static std::vector<std::shared_ptr<LLVMMemoryManager> > jitmm_hold;
+static std::atomic<size_t> jit_memory_held (0);
+static std::vector<LLVM_Util::JITMemoryRef> jitmm_hold;
+
+// Module identifiers produced by jit_cache_key() all start with this, so
+// that the object cache never mistakes some other module for a key.
+static const char *jit_cache_key_prefix = "osljit-";
+
+// Name prefix of the external symbols that stand in for ustring constants
+// when relocatable_strings is on.
+static const std::string relocatable_string_prefix ("osl.ustring.");
 };
 
 
 
 
+/// The real memory manager that JITed code goes into, and the tally of
+/// how much it holds.  Freeing it frees the code.
+class LLVM_Util::JITMemory {
+public:
+    JITMemory () : mm(&llvm_default_mapper) {}
+    ~JITMemory () {
+        mm.deregisterEHFrames ();
+        jit_memory_held -= bytes;
+    }
+    void allocated (size_t size) {
+        bytes += size;
+        jit_memory_held += size;
+    }
+
+    LLVMMemoryManager mm;
+    std::atomic<size_t> bytes { 0 };
+};
+
+
+
 // We hold certain things (LLVM context and custom JIT memory manager)
 // per thread and retained across LLVM_Util invocations.  We are
 // intentionally "leaking" them.
 struct LLVM_Util::PerThreadInfo {
-    PerThreadInfo () : llvm_context(NULL), llvm_jitmm(NULL) {}
+    PerThreadInfo () : llvm_context(NULL) {}
     ~PerThreadInfo () {
+        for (auto &m : shared_modules)
+            delete m.second;
         delete llvm_context;
-        // N.B. Do NOT delete the jitmm -- another thread may need the
-        // code! Don't worry, we stashed a pointer in jitmm_hold.
+        // N.B. Do NOT free the jitmm -- another thread may need the
+        // code! Don't worry, jitmm_hold still refers to it.
     }
     static void destroy (PerThreadInfo *threadinfo) { delete threadinfo; }
     static PerThreadInfo *get () {
@@ -148,7 +191,19 @@ struct LLVM_Util::PerThreadInfo {
     }
 
     llvm::LLVMContext *llvm_context;
-    LLVMMemoryManager *llvm_jitmm;
+    JITMemoryRef llvm_jitmm;
+    // Lazily parsed bitcode modules shared by module_from_shared_bitcode,
+    // keyed by the bitcode buffer they came from.
+    std::map<const char *, llvm::Module *> shared_modules;
+};
+
+
+
+// Correspondence between a per-thread shared module and the current
+// module that module_from_shared_bitcode cloned from it.
+struct LLVM_Util::SharedModuleMap {
+    llvm::Module *shared;           // The shared module (not owned)
+    llvm::ValueToValueMapTy vmap;   // Shared values -> current module
 };
 
 
@@ -157,9 +212,24 @@ struct LLVM_Util::PerThreadInfo {
 size_t
 LLVM_Util::total_jit_memory_held ()
 {
-    size_t jitmem = 0;
-    OIIO::spin_lock lock (llvm_global_mutex);
-    return jitmem;
+    return jit_memory_held;
+}
+
+
+
+LLVM_Util::JITMemoryRef
+LLVM_Util::private_jit_memory ()
+{
+    m_jit_memory = std::make_shared<JITMemory>();
+    return m_jit_memory;
+}
+
+
+
+size_t
+LLVM_Util::jit_memory_size (const JITMemoryRef &mem)
+{
+    return mem ? size_t(mem->bytes) : 0;
 }
 
 
@@ -169,10 +239,12 @@ LLVM_Util::total_jit_memory_held ()
 /// dummy is destroyed.  Also, we don't pass along any deallocations.
 class LLVM_Util::MemoryManager : public LLVMMemoryManager {
 protected:
+    JITMemoryRef mem;       // keeps the real one alive
     LLVMMemoryManager *mm;  // the real one
 public:
 
-    MemoryManager(LLVMMemoryManager *realmm) : mm(realmm) {}
+    MemoryManager(const JITMemoryRef &realmem)
+        : mem(realmem), mm(&realmem->mm) {}
     
     virtual void notifyObjectLoaded(llvm::ExecutionEngine *EE, const llvm::object::ObjectFile &oi) {
         mm->notifyObjectLoaded (EE, oi);
@@ -203,11 +275,13 @@ public:
     }
     virtual uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
                              unsigned SectionID, llvm::StringRef SectionName) {
+        mem->allocated (Size);
         return mm->allocateCodeSection(Size, Alignment, SectionID, SectionName);
     }
     virtual uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
                              unsigned SectionID, llvm::StringRef SectionName,
                              bool IsReadOnly) {
+        mem->allocated (Size);
         return mm->allocateDataSection(Size, Alignment, SectionID,
                                        SectionName, IsReadOnly);
     }
@@ -219,6 +293,15 @@ public:
     }
 
     virtual uint64_t getSymbolAddress(const std::string &Name) {
+        // Symbols standing in for relocatable ustring constants resolve
+        // to the address of the characters of that ustring. Allow for the
+        // leading underscore that some platforms' mangling adds.
+        size_t start = (Name.size() && Name[0] == '_') ? 1 : 0;
+        if (Name.compare (start, relocatable_string_prefix.size(),
+                          relocatable_string_prefix) == 0) {
+            ustring s (Name, start + relocatable_string_prefix.size());
+            return (uint64_t) s.c_str();
+        }
         return mm->getSymbolAddress (Name);
     }
     virtual bool finalizeMemory(std::string *ErrMsg = 0) {
@@ -228,6 +311,138 @@ public:
 
 
 
+/// The llvm::ObjectCache that the JIT actually consults. Each object is
+/// stored as <dir>/<key>.o, where the key is the module identifier.
+class JITObjectCache::Impl : public llvm::ObjectCache {
+public:
+    Impl (const std::string &dir) : m_dir(dir) {}
+
+    std::string path (const std::string &key) const {
+        return m_dir + "/" + key + ".o";
+    }
+
+    static bool is_key (const std::string &id) {
+        return OIIO::Strutil::starts_with (id, jit_cache_key_prefix);
+    }
+
+    virtual void notifyObjectCompiled (const llvm::Module *M,
+                                       llvm::MemoryBufferRef obj) {
+        const std::string &key (M->getModuleIdentifier());
+        if (! is_key (key))
+            return;
+        // Write to a temporary file and rename it into place, so that
+        // other threads or processes never see a partially written object.
+        std::string filename = path (key);
+        std::string tmpname = OIIO::Filesystem::unique_path (filename + ".%%%%%%%%");
+        std::string err;
+        {
+            std::ofstream out (tmpname, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (out.good())
+                out.write (obj.getBufferStart(), obj.getBufferSize());
+            if (! out.good()) {
+                out.close ();
+                OIIO::Filesystem::remove (tmpname, err);
+                return;
+            }
+        }
+        if (OIIO::Filesystem::rename (tmpname, filename, err))
+            m_bytes_written += (long long) obj.getBufferSize();
+        else
+            OIIO::Filesystem::remove (tmpname, err);
+    }
+
+    // Only hand the JIT an object that fetch() already read for this
+    // module.  Anything else -- including a file that appeared since -- is
+    // compiled, since the caller only skipped optimizing the IR if fetch()
+    // succeeded.
+    virtual std::unique_ptr<llvm::MemoryBuffer> getObject (const llvm::Module *M) {
+        OIIO::spin_lock lock (m_fetched_mutex);
+        auto found = m_fetched.find (M);
+        if (found == m_fetched.end() ||
+              found->second.first != M->getModuleIdentifier())
+            return nullptr;
+        std::unique_ptr<llvm::MemoryBuffer> buf = std::move (found->second.second);
+        m_fetched.erase (found);
+        return buf;
+    }
+
+    bool fetch (const llvm::Module *M) {
+        const std::string &key (M->getModuleIdentifier());
+        if (! is_key (key)) {
+            ++m_uncacheable;
+            return false;
+        }
+        auto buf = llvm::MemoryBuffer::getFile (path (key), -1, false);
+        if (! buf) {
+            ++m_misses;
+            return false;
+        }
+        ++m_hits;
+        m_bytes_read += (long long) (*buf)->getBufferSize();
+        OIIO::spin_lock lock (m_fetched_mutex);
+        m_fetched[M] = std::make_pair (key, std::move (*buf));
+        return true;
+    }
+
+    // Drop the object fetched for the module if the JIT never claimed it.
+    void release (const llvm::Module *M) {
+        OIIO::spin_lock lock (m_fetched_mutex);
+        m_fetched.erase (M);
+    }
+
+    std::string m_dir;
+    // Objects read by fetch() and not yet claimed by the JIT, by the
+    // module they were fetched for (several threads may be compiling
+    // identical groups at once), along with its identifier then.
+    std::unordered_map<const llvm::Module*,
+                       std::pair<std::string, std::unique_ptr<llvm::MemoryBuffer>>> m_fetched;
+    OIIO::spin_mutex m_fetched_mutex;
+    OIIO::atomic_ll m_hits { 0 };
+    OIIO::atomic_ll m_misses { 0 };
+    OIIO::atomic_ll m_uncacheable { 0 };
+    OIIO::atomic_ll m_bytes_read { 0 };
+    OIIO::atomic_ll m_bytes_written { 0 };
+};
+
+
+
+JITObjectCache::JITObjectCache (const std::string &dir)
+    : m_impl (new Impl (dir))
+{
+}
+
+
+
+JITObjectCache::~JITObjectCache ()
+{
+}
+
+
+
+const std::string &
+JITObjectCache::dir () const
+{
+    return m_impl->m_dir;
+}
+
+
+
+bool
+JITObjectCache::fetch_object (const llvm::Module *module)
+{
+    return m_impl->fetch (module);
+}
+
+
+
+long long JITObjectCache::hits () const { return m_impl->m_hits; }
+long long JITObjectCache::misses () const { return m_impl->m_misses; }
+long long JITObjectCache::uncacheable () const { return m_impl->m_uncacheable; }
+long long JITObjectCache::bytes_read () const { return m_impl->m_bytes_read; }
+long long JITObjectCache::bytes_written () const { return m_impl->m_bytes_written; }
+
+
+
 class LLVM_Util::IRBuilder : public llvm::IRBuilder<llvm::ConstantFolder,
                                                llvm::IRBuilderDefaultInserter> {
     typedef llvm::IRBuilder<llvm::ConstantFolder,
@@ -241,10 +456,12 @@ public:
 LLVM_Util::LLVM_Util (int debuglevel)
     : m_debug(debuglevel), m_thread(NULL),
       m_llvm_context(NULL), m_llvm_module(NULL),
-      m_builder(NULL), m_llvm_jitmm(NULL),
+      m_builder(NULL),
       m_current_function(NULL),
       m_llvm_module_passes(NULL), m_llvm_func_passes(NULL),
-      m_llvm_exec(NULL)
+      m_llvm_exec(NULL), m_object_cache(NULL),
+      m_relocatable_strings(false), m_fast_codegen(false),
+      m_shared_map(NULL)
 {
     SetupLLVM ();
     m_thread = PerThreadInfo::get();
@@ -256,12 +473,11 @@ LLVM_Util::LLVM_Util (int debuglevel)
             m_thread->llvm_context = new llvm::LLVMContext();
 
         if (! m_thread->llvm_jitmm) {
-            m_thread->llvm_jitmm = new LLVMMemoryManager(&llvm_default_mapper);
-            OSL_DASSERT (m_thread->llvm_jitmm);
-            jitmm_hold.emplace_back (m_thread->llvm_jitmm);
+            m_thread->llvm_jitmm = std::make_shared<JITMemory>();
+            jitmm_hold.push_back (m_thread->llvm_jitmm);
         }
         // Hold the REAL manager and use it as an argument later
-        m_llvm_jitmm = m_thread->llvm_jitmm;
+        m_jit_memory = m_thread->llvm_jitmm;
     }
 
     m_llvm_context = m_thread->llvm_context;
@@ -300,12 +516,15 @@ LLVM_Util::LLVM_Util (int debuglevel)
 
 LLVM_Util::~LLVM_Util ()
 {
+    if (m_object_cache && m_llvm_module)
+        m_object_cache->m_impl->release (m_llvm_module);
+    delete m_shared_map;
     execengine (NULL);
     delete m_llvm_module_passes;
     delete m_llvm_func_passes;
     delete m_builder;
     module (NULL);
-    // DO NOT delete m_llvm_jitmm;  // just the dummy wrapper around the real MM
+    // N.B. The JIT memory outlives us if anybody else refers to it.
 }
 
 
@@ -402,6 +621,106 @@ LLVM_Util::module_from_bitcode (const char *bitcode, size_t size,
 }
 
 
+
+llvm::Module *
+LLVM_Util::module_from_shared_bitcode (const char *bitcode, size_t size,
+                                       const std::string &name,
+                                       std::string *err)
+{
+    if (err)
+        err->clear();
+
+    // Parse the bitcode lazily, once per thread (the module belongs to
+    // this thread's context). Function bodies are only materialized as
+    // link_shared_functions discovers that they are needed, and remain
+    // materialized for the next module that needs them.
+    llvm::Module *shared = NULL;
+    auto found = m_thread->shared_modules.find (bitcode);
+    if (found != m_thread->shared_modules.end()) {
+        shared = found->second;
+    } else {
+        shared = module_from_bitcode (bitcode, size, name, err);
+        if (! shared)
+            return NULL;
+        if (error_string (shared->materializeMetadata(), err)) {
+            delete shared;
+            return NULL;
+        }
+        m_thread->shared_modules[bitcode] = shared;
+    }
+
+    // Clone just the global variables and the function declarations,
+    // which is far cheaper than parsing the bitcode again.
+    delete m_shared_map;
+    m_shared_map = new SharedModuleMap;
+    m_shared_map->shared = shared;
+    std::unique_ptr<llvm::Module> m = llvm::CloneModule (*shared,
+        m_shared_map->vmap, [](const llvm::GlobalValue *gv) {
+            return llvm::isa<llvm::GlobalVariable>(gv);
+        });
+    m->setModuleIdentifier (name);
+    return m.release();
+}
+
+
+
+int
+LLVM_Util::link_shared_functions (const std::vector<llvm::Function*> &roots,
+                                  std::string *err)
+{
+    if (err)
+        err->clear();
+    if (! m_shared_map)
+        return 0;
+
+    // Walk everything reachable from the roots. Any function we reach that
+    // is only a declaration here but has a body in the shared module gets
+    // that body cloned in, and is then walked in turn.
+    int nlinked = 0;
+    std::vector<const llvm::Constant *> worklist (roots.begin(), roots.end());
+    std::unordered_set<const llvm::Constant *> visited;
+    while (! worklist.empty()) {
+        const llvm::Constant *c = worklist.back();
+        worklist.pop_back();
+        if (! c || ! visited.insert(c).second)
+            continue;
+        if (const llvm::Function *cf = llvm::dyn_cast<llvm::Function>(c)) {
+            llvm::Function *func = const_cast<llvm::Function *>(cf);
+            if (func->isDeclaration()) {
+                llvm::Function *sf = m_shared_map->shared->getFunction (func->getName());
+                if (! sf || sf->isDeclaration())
+                    continue;   // truly external
+                if (error_string (sf->materialize(), err))
+                    return nlinked;
+                llvm::Function::arg_iterator arg = func->arg_begin();
+                for (const llvm::Argument &sarg : sf->args())
+                    m_shared_map->vmap[&sarg] = &*arg++;
+                llvm::SmallVector<llvm::ReturnInst *, 8> returns;
+                llvm::CloneFunctionInto (func, sf, m_shared_map->vmap,
+                                         true /*ModuleLevelChanges*/, returns);
+                func->setLinkage (sf->getLinkage());
+                ++nlinked;
+            }
+            for (const llvm::BasicBlock &bb : *func)
+                for (const llvm::Instruction &inst : bb)
+                    for (const llvm::Value *op : inst.operands())
+                        if (const llvm::Constant *k = llvm::dyn_cast<llvm::Constant>(op))
+                            worklist.push_back (k);
+        } else if (const llvm::GlobalVariable *gv = llvm::dyn_cast<llvm::GlobalVariable>(c)) {
+            if (gv->hasInitializer())
+                worklist.push_back (gv->getInitializer());
+        } else if (! llvm::isa<llvm::GlobalValue>(c)) {
+            // Constant expressions and aggregates may refer to globals
+            for (const llvm::Value *op : c->operands())
+                if (const llvm::Constant *k = llvm::dyn_cast<llvm::Constant>(op))
+                    worklist.push_back (k);
+        }
+    }
+    return nlinked;
+}
+
+
+
 void
 LLVM_Util::new_builder (llvm::BasicBlock *block)
 {
@@ -444,14 +763,18 @@ LLVM_Util::make_jit_execengine (std::string *err)
 
     // We are actually holding a LLVMMemoryManager
     engine_builder.setMCJITMemoryManager (std::unique_ptr<llvm::RTDyldMemoryManager>
-        (new MemoryManager(m_llvm_jitmm)));
+        (new MemoryManager(m_jit_memory)));
 
-    engine_builder.setOptLevel (llvm::CodeGenOpt::Default);
+    engine_builder.setOptLevel (m_fast_codegen ? llvm::CodeGenOpt::None
+                                               : llvm::CodeGenOpt::Default);
 
     m_llvm_exec = engine_builder.create();
     if (! m_llvm_exec)
         return NULL;
 
+    if (m_object_cache)
+        m_llvm_exec->setObjectCache (m_object_cache->m_impl.get());
+
     // These magic lines will make it so that enough symbol information
     // is injected so that running vtune will kinda tell you which shaders
     // you're in, and sometimes which function (only for functions that don't
@@ -488,6 +811,8 @@ LLVM_Util::getPointerToFunction (llvm::Function *func)
     OSL_DASSERT(func && "passed NULL to getPointerToFunction");
     llvm::ExecutionEngine *exec = execengine();
     exec->finalizeObject ();
+    if (m_object_cache)
+        m_object_cache->m_impl->release (func->getParent());
     void *f = exec->getPointerToFunction (func);
     OSL_ASSERT (f && "could not getPointerToFunction");
     return f;
@@ -495,6 +820,76 @@ LLVM_Util::getPointerToFunction (llvm::Function *func)
 
 
 
+std::string
+LLVM_Util::jit_cache_key (const std::vector<llvm::Function*> &funcs,
+                          const std::string &salt)
+{
+    OIIO::SHA1 sha;
+    // The same IR may become different machine code for another LLVM or
+    // another target.
+    std::string target = OIIO::Strutil::sprintf ("%s %s %s",
+                                                 OSL_LLVM_FULL_VERSION,
+                                                 llvm::sys::getProcessTriple(),
+                                                 llvm::sys::getHostCPUName().str());
+    sha.append (target.data(), target.size());
+    sha.append (salt.data(), salt.size());
+    // The function bodies only name the globals they use (such as the
+    // constant_data() blocks holding texture options), so also hash the
+    // definition and initializer of every global they reference.
+    // Pointers made from integer constants are addresses in this process,
+    // which may differ (or point to something else) in the next one, so
+    // code holding any of them can't be cached at all.
+    std::vector<const llvm::GlobalVariable*> globals;
+    std::unordered_set<const llvm::Value*> seen;
+    bool absolute = false;
+    std::function<void(const llvm::Value*)> find_globals =
+        [&](const llvm::Value *v) {
+            if (auto gv = llvm::dyn_cast<llvm::GlobalVariable>(v)) {
+                if (seen.insert (gv).second)
+                    globals.push_back (gv);
+            } else if (llvm::isa<llvm::Constant>(v) &&
+                       ! llvm::isa<llvm::GlobalValue>(v)) {
+                auto ce = llvm::dyn_cast<llvm::ConstantExpr>(v);
+                if (ce && ce->getOpcode() == llvm::Instruction::IntToPtr)
+                    absolute = true;
+                // Constant expressions and aggregates: look inside
+                auto c = llvm::cast<llvm::Constant>(v);
+                if (seen.insert (c).second)
+                    for (auto&& op : c->operands())
+                        find_globals (op.get());
+            }
+        };
+    for (auto f : funcs) {
+        if (f) {
+            std::string ir = bitcode_string (f);
+            sha.append (ir.data(), ir.size());
+            for (auto&& bb : *f)
+                for (auto&& inst : bb) {
+                    if (llvm::isa<llvm::IntToPtrInst>(inst) &&
+                          llvm::isa<llvm::Constant>(inst.getOperand(0)))
+                        absolute = true;
+                    for (auto&& op : inst.operands())
+                        find_globals (op.get());
+                }
+        }
+    }
+    if (absolute)
+        return std::string();
+    for (size_t i = 0;  i < globals.size();  ++i) {
+        // Initializers may in turn refer to other globals
+        if (globals[i]->hasInitializer())
+            find_globals (globals[i]->getInitializer());
+        std::string def;
+        llvm::raw_string_ostream stream (def);
+        globals[i]->print (stream);
+        stream.flush ();
+        sha.append (def.data(), def.size());
+    }
+    return jit_cache_key_prefix + sha.digest();
+}
+
+
+
 void
 LLVM_Util::InstallLazyFunctionCreator (void* (*P)(const std::string &))
 {
@@ -527,6 +922,10 @@ LLVM_Util::setup_optimization_passes (int optlevel)
         // builder.DisableUnrollLoops = true;
         builder.populateFunctionPassManager (fpm);
         builder.populateModulePassManager (mpm);
+    } else if (optlevel < 0) {
+        // Compile as fast as possible: just get values into registers,
+        // which costs little and saves the code generator a lot of work.
+        mpm.add (llvm::createPromoteMemoryToRegisterPass());
     } else {
         // Unknown choices for llvm_optimize: use the same basic
         // set of passes that we always have.
@@ -588,6 +987,8 @@ LLVM_Util::internalize_module_functions (const std::string &prefix,
 {
     for (llvm::Function& func : module()->getFunctionList()) {
         llvm::Function *sym = &func;
+        if (sym->isDeclaration())
+            continue;   // Only definitions can change linkage
         std::string symname = sym->getName();
         if (prefix.size() && ! OIIO::Strutil::starts_with(symname, prefix))
             continue;
@@ -933,6 +1334,8 @@ LLVM_Util::constant_ptr (void *p, llvm::PointerType *type)
 {
     if (! type)
         type = type_void_ptr();
+    if (! p)
+        return llvm::ConstantPointerNull::get (type);
     return builder().CreateIntToPtr (constant (size_t (p)), type, "const pointer");
 }
 
@@ -941,6 +1344,19 @@ LLVM_Util::constant_ptr (void *p, llvm::PointerType *type)
 llvm::Value *
 LLVM_Util::constant (ustring s)
 {
+    if (m_relocatable_strings && s.length() &&
+          s.length() == strlen (s.c_str())) {
+        // Refer to the string through an external symbol whose name
+        // encodes its characters. MemoryManager::getSymbolAddress will
+        // resolve it to the ustring's address when the code is linked.
+        std::string name = relocatable_string_prefix + s.string();
+        llvm::GlobalVariable *g = module()->getNamedGlobal (name);
+        if (! g)
+            g = new llvm::GlobalVariable (*module(), type_char(), true /*const*/,
+                                          llvm::GlobalValue::ExternalLinkage,
+                                          nullptr, name);
+        return g;
+    }
     // Create a const size_t with the ustring contents
     size_t bits = sizeof(size_t)*8;
     llvm::Value *str = llvm::ConstantInt::get (context(),
@@ -968,6 +1384,21 @@ LLVM_Util::void_ptr_null ()
 
 
 
+llvm::Value *
+LLVM_Util::constant_data (const void *data, size_t size,
+                          const std::string &name)
+{
+    llvm::Constant *init = llvm::ConstantDataArray::get (context(),
+                llvm::ArrayRef<uint8_t>((const uint8_t *)data, size));
+    llvm::GlobalVariable *g = new llvm::GlobalVariable (*module(),
+                init->getType(), true /*const*/,
+                llvm::GlobalValue::PrivateLinkage, init, name);
+    g->setUnnamedAddr (llvm::GlobalValue::UnnamedAddr::Global);
+    return void_ptr (g);
+}
+
+
+
 llvm::Value *
 LLVM_Util::ptr_to_cast (llvm::Value* val, llvm::Type *type)
 {
@@ -1071,6 +1502,18 @@ LLVM_Util::op_alloca (const TypeDesc &type, int n, const std::string &name)
 
 
 
+llvm::Value *
+LLVM_Util::op_alloca_entry (llvm::Type *llvmtype, int n,
+                            const std::string &name)
+{
+    llvm::BasicBlock &entry (current_function()->getEntryBlock());
+    llvm::IRBuilder<> entrybuilder (&entry, entry.begin());
+    llvm::ConstantInt* numalloc = (llvm::ConstantInt*)constant(n);
+    return entrybuilder.CreateAlloca (llvmtype, numalloc, name);
+}
+
+
+
 llvm::Value *
 LLVM_Util::call_function (llvm::Value *func, cspan<llvm::Value *> args)
 {
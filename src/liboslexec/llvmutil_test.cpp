@@ -26,15 +26,21 @@ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <fstream>
+#include <sstream>
+
 #include <OpenImageIO/typedesc.h>
 #include <OpenImageIO/ustring.h>
 
 #include <OpenImageIO/argparse.h>
+#include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/unittest.h>
 #include <OSL/llvm_util.h>
 
+#include <llvm/IR/Module.h>
+
 
 typedef int (*IntFuncOfTwoInts)(int,int);
 
@@ -181,6 +187,175 @@ test_triple_func ()
 
 
 
+// JIT the myadd function from test_int_func using the given object cache,
+// and return the result of calling it.
+static int
+jit_cached_int_func (OSL::pvt::JITObjectCache &cache)
+{
+    OSL::pvt::LLVM_Util ll;
+    ll.object_cache (&cache);
+    llvm::Function *func = ll.make_function ("myadd", false, ll.type_int(),
+                                             ll.type_int(), ll.type_int());
+    ll.current_function (func);
+    ll.op_return (ll.op_add (ll.current_function_arg (0),
+                             ll.current_function_arg (1)));
+
+    std::vector<llvm::Function*> funcs (1, func);
+    std::string key = ll.jit_cache_key (funcs, "llvmutil_test");
+    ll.module()->setModuleIdentifier (key);
+    if (! cache.fetch_object (ll.module())) {
+        ll.setup_optimization_passes (0);
+        ll.do_optimize ();
+    }
+    IntFuncOfTwoInts myadd = (IntFuncOfTwoInts) ll.getPointerToFunction (func);
+    return myadd (13, 29);
+}
+
+
+
+// Compile the same function twice with an object cache, verifying that
+// the second compile is satisfied from the cache.
+void
+test_object_cache ()
+{
+    std::string dir = OIIO::Filesystem::unique_path (
+        OIIO::Filesystem::temp_directory_path() + "/llvmutil_test_%%%%%%%%");
+    std::string err;
+    OIIO::Filesystem::create_directory (dir, err);
+    {
+        OSL::pvt::JITObjectCache cache (dir);
+        OIIO_CHECK_EQUAL (jit_cached_int_func (cache), 42);
+        OIIO_CHECK_EQUAL (cache.misses(), 1);
+        OIIO_CHECK_ASSERT (cache.bytes_written() > 0);
+    }
+    {
+        OSL::pvt::JITObjectCache cache (dir);
+        OIIO_CHECK_EQUAL (jit_cached_int_func (cache), 42);
+        OIIO_CHECK_EQUAL (cache.hits(), 1);
+        OIIO_CHECK_EQUAL (cache.misses(), 0);
+        OIIO_CHECK_ASSERT (cache.bytes_read() > 0);
+    }
+    OIIO::Filesystem::remove_all (dir, err);
+}
+
+
+
+// Return the JIT cache key of a function that returns a pointer to a
+// constant data block holding the given int.
+static std::string
+cache_key_with_data (int value)
+{
+    OSL::pvt::LLVM_Util ll;
+    llvm::Function *func = ll.make_function ("getdata", false,
+                                             ll.type_void_ptr());
+    ll.current_function (func);
+    ll.op_return (ll.void_ptr (ll.constant_data (&value, sizeof(value))));
+    std::vector<llvm::Function*> funcs (1, func);
+    return ll.jit_cache_key (funcs, "llvmutil_test");
+}
+
+
+
+// Functions that differ only in the contents of the constant globals they
+// reference must not share a cache key.
+void
+test_cache_key_globals ()
+{
+    OIIO_CHECK_EQUAL (cache_key_with_data (1), cache_key_with_data (1));
+    OIIO_CHECK_NE (cache_key_with_data (1), cache_key_with_data (2));
+}
+
+
+
+// Return the JIT cache key of a function that returns the given pointer
+// as a constant.
+static std::string
+cache_key_with_pointer (void *p)
+{
+    OSL::pvt::LLVM_Util ll;
+    llvm::Function *func = ll.make_function ("getptr", false,
+                                             ll.type_void_ptr());
+    ll.current_function (func);
+    ll.op_return (ll.constant_ptr (p));
+    std::vector<llvm::Function*> funcs (1, func);
+    return ll.jit_cache_key (funcs, "llvmutil_test");
+}
+
+
+
+// Code holding an address in this process can't be cached (its key is
+// empty), but a null pointer is fine.
+void
+test_cache_key_addresses ()
+{
+    int value = 42;
+    OIIO_CHECK_EQUAL (cache_key_with_pointer (&value), std::string());
+    OIIO_CHECK_NE (cache_key_with_pointer (nullptr), std::string());
+}
+
+
+
+// Build a little "library" module with two functions, and return its
+// bitcode.
+static std::string
+make_library_bitcode ()
+{
+    OSL::pvt::LLVM_Util ll;
+    for (const char *name : { "mylib_add", "mylib_unused" }) {
+        llvm::Function *func = ll.make_function (name, false, ll.type_int(),
+                                                 ll.type_int(), ll.type_int());
+        ll.current_function (func);
+        ll.op_return (ll.op_add (ll.current_function_arg (0),
+                                 ll.current_function_arg (1)));
+    }
+    std::string filename = OIIO::Filesystem::unique_path (
+        OIIO::Filesystem::temp_directory_path() + "/llvmutil_test_%%%%%%%%.bc");
+    ll.write_bitcode_file (filename.c_str());
+    std::ifstream in (filename, std::ios::in | std::ios::binary);
+    std::stringstream bitcode;
+    bitcode << in.rdbuf();
+    in.close ();
+    OIIO::Filesystem::remove (filename);
+    return bitcode.str();
+}
+
+
+
+// Make modules from shared library bitcode, verifying that only the
+// library functions that are called get linked in, and that the result
+// runs correctly.
+void
+test_shared_bitcode ()
+{
+    // N.B. The bitcode must outlive every module made from it.
+    static std::string bitcode = make_library_bitcode ();
+    OIIO_CHECK_ASSERT (bitcode.size());
+    for (int i = 0; i < 2; ++i) {
+        OSL::pvt::LLVM_Util ll;
+        std::string err;
+        ll.module (ll.module_from_shared_bitcode (bitcode.data(), bitcode.size(),
+                                                  "mylib", &err));
+        OIIO_CHECK_ASSERT (ll.module() && err.empty());
+
+        llvm::Function *func = ll.make_function ("mycall", false, ll.type_int(),
+                                                 ll.type_int(), ll.type_int());
+        ll.current_function (func);
+        ll.op_return (ll.call_function ("mylib_add", ll.current_function_arg (0),
+                                        ll.current_function_arg (1)));
+
+        // Only mylib_add is reachable, so only it should be linked in.
+        std::vector<llvm::Function*> roots (1, func);
+        OIIO_CHECK_EQUAL (ll.link_shared_functions (roots, &err), 1);
+
+        ll.setup_optimization_passes (0);
+        ll.do_optimize ();
+        IntFuncOfTwoInts mycall = (IntFuncOfTwoInts) ll.getPointerToFunction (func);
+        OIIO_CHECK_EQUAL (mycall (13, 29), 42);
+    }
+}
+
+
+
 // Make a crazy big function with lots of IR, having prototype:
 //      int mybig (int arg1, int arg2);
 //
@@ -244,6 +419,10 @@ main (int argc, char *argv[])
     // Test simple functions
     test_int_func();
     test_triple_func();
+    test_object_cache();
+    test_cache_key_globals();
+    test_cache_key_addresses();
+    test_shared_bitcode();
 
     if (memtest) {
         for (int i = 0; i < memtest; ++i) {
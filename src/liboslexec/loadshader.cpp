@@ -29,6 +29,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <string>
 #include <cstdio>
+#include <future>
 #include <cmath> // FIXME: used by timer.h - should be included there
 
 #include "oslexec_pvt.h"
@@ -60,6 +61,8 @@ public:
     virtual ~OSOReaderToMaster () { }
     virtual bool parse_file (const std::string &filename);
     virtual bool parse_memory (const std::string &oso);
+    // Parse oso text that was read from the named file.
+    bool parse_memory (const std::string &oso, const std::string &filename);
     virtual void version (const char *specid, int major, int minor);
     virtual void shader (const char *shadertype, const char *name);
     virtual void symbol (SymType symtype, TypeSpec typespec, const char *name);
@@ -116,7 +119,16 @@ OSOReaderToMaster::parse_file (const std::string &filename)
 bool
 OSOReaderToMaster::parse_memory (const std::string &oso)
 {
-    m_master->m_osofilename = "<none>";
+    return parse_memory (oso, "<none>");
+}
+
+
+
+bool
+OSOReaderToMaster::parse_memory (const std::string &oso,
+                                 const std::string &filename)
+{
+    m_master->m_osofilename = filename;
     m_master->m_maincodebegin = 0;
     m_master->m_maincodeend = 0;
     m_codesection.clear ();
@@ -554,6 +566,45 @@ OSOReaderToMaster::instruction_end ()
 
 
 
+void
+ShadingSystemImpl::master_load_begin ()
+{
+    spin_lock lock (m_stat_mutex);
+    if (m_masters_loading++ == 0)
+        m_stat_master_load_wall_timer.start ();
+}
+
+
+
+void
+ShadingSystemImpl::master_load_end (double loadtime)
+{
+    spin_lock lock (m_stat_mutex);
+    m_stat_master_load_time += loadtime;
+    if (--m_masters_loading == 0)
+        m_stat_master_load_wall_timer.stop ();
+}
+
+
+
+double
+ShadingSystemImpl::master_load_time () const
+{
+    spin_lock lock (m_stat_mutex);
+    return m_stat_master_load_time;
+}
+
+
+
+double
+ShadingSystemImpl::master_load_wall_time () const
+{
+    spin_lock lock (m_stat_mutex);
+    return m_stat_master_load_wall_timer();
+}
+
+
+
 ShaderMaster::ref
 ShadingSystemImpl::loadshader (string_view cname)
 {
@@ -565,13 +616,68 @@ ShadingSystemImpl::loadshader (string_view cname)
     }
     ++m_stat_shaders_requested;
     ustring name (cname);
-    lock_guard guard (m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find (name);
-    if (found != m_shader_masters.end()) {
-        // if (debug())
-        //     infof("Found %s in shader_masters", name);
-        // Already loaded this shader, return its reference
-        return (*found).second;
+
+    // Publishes the outcome of this call, at the latest when it goes out
+    // of scope, however that happens: records the master (unless the file
+    // just wasn't found, so that a later call may try again), stops
+    // listing it as in progress, and wakes any threads waiting for it.
+    // If another master was registered under this name in the meantime
+    // (by loadmemcompiled_shader), that one wins and is what's published.
+    struct LoadPublisher {
+        ShadingSystemImpl &ss;
+        ustring name;
+        std::promise<ShaderMaster::ref> promise;
+        ShaderMaster::ref master;
+        bool remember = false;
+        bool published = false;
+        LoadPublisher (ShadingSystemImpl &ss, ustring name)
+            : ss(ss), name(name) { }
+        ~LoadPublisher () {
+            if (! published)
+                publish ();
+        }
+        ShaderMaster::ref publish () {
+            {
+                lock_guard guard (ss.m_shader_masters_mutex);
+                if (remember) {
+                    auto ins = ss.m_shader_masters.emplace (name, master);
+                    if (! ins.second)
+                        master = ins.first->second;
+                }
+                ss.m_shader_masters_loading.erase (name);
+            }
+            published = true;
+            promise.set_value (master);
+            return master;
+        }
+    };
+
+    // If the master is already loaded, return it. If another thread is in
+    // the middle of loading it, wait for that. Otherwise, it's our job to
+    // load it, but we don't hold the lock while we do, so that loading
+    // different masters can proceed in parallel.
+    std::unique_ptr<LoadPublisher> publisher;
+    {
+        std::shared_future<ShaderMaster::ref> pending;
+        {
+            lock_guard guard (m_shader_masters_mutex);
+            ShaderNameMap::const_iterator found = m_shader_masters.find (name);
+            if (found != m_shader_masters.end()) {
+                // if (debug())
+                //     infof("Found %s in shader_masters", name);
+                // Already loaded this shader, return its reference
+                return (*found).second;
+            }
+            auto loading = m_shader_masters_loading.find (name);
+            if (loading != m_shader_masters_loading.end()) {
+                pending = loading->second;
+            } else {
+                publisher.reset (new LoadPublisher (*this, name));
+                m_shader_masters_loading[name] = publisher->promise.get_future().share();
+            }
+        }
+        if (pending.valid())
+            return pending.get();
     }
 
     // Not found in the map
@@ -582,23 +688,29 @@ ShadingSystemImpl::loadshader (string_view cname)
                                                         testcwd);
     if (filename.empty ()) {
         errorf("No .oso file could be found for shader \"%s\"", name);
-        return NULL;
+        return nullptr;
     }
+    // A failed parse is remembered too, so we don't keep retrying.
+    publisher->remember = true;
+    master_load_begin ();
     OIIO::Timer timer;
-    bool ok = oso.parse_file (filename);
-    ShaderMaster::ref r = ok ? oso.master() : nullptr;
-    m_shader_masters[name] = r;
-    double loadtime = timer();
-    {
-        spin_lock lock (m_stat_mutex);
-        m_stat_master_load_time += loadtime;
+    // Read the file before parsing, since only the parse itself
+    // must be serialized (the text oso parser is not reentrant).
+    // Binary oso is not parsed at all, and needs no lock.
+    std::string buffer (OIIO::Filesystem::file_size (filename), 0);
+    bool ok = OIIO::Filesystem::read_bytes (filename, &buffer[0], buffer.size()) == buffer.size()
+              && oso.parse_memory (buffer, filename);
+    if (ok) {
+        publisher->master = oso.master();
+        OSL_DASSERT (publisher->master);
+        publisher->master->resolve_syms ();
     }
+    double loadtime = timer();
+    master_load_end (loadtime);
     if (ok) {
         ++m_stat_shaders_loaded;
         infof("Loaded \"%s\" (took %s)", filename,
               Strutil::timeintervalformat(loadtime, 2));
-        OSL_DASSERT (r);
-        r->resolve_syms ();
         // if (debug()) {
         //     std::string s = r->print ();
         //     if (s.length())
@@ -607,8 +719,7 @@ ShadingSystemImpl::loadshader (string_view cname)
     } else {
         errorf("Unable to read \"%s\"", filename);
     }
-
-    return r;
+    return publisher->publish ();
 }
 
 
@@ -627,31 +738,47 @@ ShadingSystemImpl::LoadMemoryCompiledShader (string_view shadername,
     }
 
     ustring name (shadername);
-    lock_guard guard (m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find (name);
-    if (found != m_shader_masters.end() && ! allow_shader_replacement()) {
-        if (debug())
-            infof("Preload shader %s already exists in shader_masters", name);
+    // Refuse a name that is already taken.  The check that counts is the
+    // one made under the same lock as the insertion below, so that of
+    // several threads preloading the same name, exactly one succeeds.
+    auto name_taken = [&]() {
+        if (m_shader_masters.find (name) != m_shader_masters.end()
+              && ! allow_shader_replacement()) {
+            if (debug())
+                infof("Preload shader %s already exists in shader_masters", name);
+            return true;
+        }
         return false;
+    };
+    {
+        // Check early too, to skip parsing what can't be used.
+        lock_guard guard (m_shader_masters_mutex);
+        if (name_taken ())
+            return false;
     }
 
     // Not found in the map
     OSOReaderToMaster reader (*this);
+    master_load_begin ();
     OIIO::Timer timer;
     bool ok = reader.parse_memory (buffer);
     ShaderMaster::ref r = ok ? reader.master() : nullptr;
-    m_shader_masters[name] = r;
+    if (ok) {
+        OSL_DASSERT (r);
+        r->resolve_syms ();
+    }
     double loadtime = timer();
+    master_load_end (loadtime);
     {
-        spin_lock lock (m_stat_mutex);
-        m_stat_master_load_time += loadtime;
+        lock_guard guard (m_shader_masters_mutex);
+        if (name_taken ())
+            return false;
+        m_shader_masters[name] = r;
     }
     if (ok) {
         ++m_stat_shaders_loaded;
         infof("Loaded \"%s\" (took %s)", shadername,
               Strutil::timeintervalformat(loadtime, 2));
-        OSL_DASSERT (r);
-        r->resolve_syms ();
         // if (debug()) {
         //     std::string s = r->print ();
         //     if (s.length())
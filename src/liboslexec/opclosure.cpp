@@ -72,6 +72,43 @@ osl_mul_closure_float (ShaderGlobals *sg, ClosureColor *a, float w)
 }
 
 
+// Versions of the above for the "flat_closures" option, which never
+// make ClosureMul or ClosureAdd nodes.
+
+OSL_SHADEOP const ClosureColor *
+osl_add_closure_closure_flat (ShaderGlobals *sg,
+                              const ClosureColor *a, const ClosureColor *b)
+{
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+    return sg->context->closure_add_flat (a, b);
+}
+
+
+OSL_SHADEOP const ClosureColor *
+osl_mul_closure_color_flat (ShaderGlobals *sg, ClosureColor *a, const Color3 *w)
+{
+    if (a == NULL) return NULL;
+    if (w->x == 0.0f &&
+        w->y == 0.0f &&
+        w->z == 0.0f) return NULL;
+    if (w->x == 1.0f &&
+        w->y == 1.0f &&
+        w->z == 1.0f) return a;
+    return sg->context->closure_mul_flat (*w, a);
+}
+
+
+OSL_SHADEOP const ClosureColor *
+osl_mul_closure_float_flat (ShaderGlobals *sg, ClosureColor *a, float w)
+{
+    if (a == NULL) return NULL;
+    if (w == 0.0f) return NULL;
+    if (w == 1.0f) return a;
+    return sg->context->closure_mul_flat (Color3(w), a);
+}
+
+
 OSL_SHADEOP ClosureComponent *
 osl_allocate_closure_component (ShaderGlobals *sg, int id, int size)
 {
@@ -41,6 +41,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <OSL/device_string.h>
 
 #include <OpenImageIO/color.h>
+#include <OpenImageIO/thread.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
 
 #ifdef __CUDACC__
   #undef OIIO_HAS_COLORPROCESSOR
@@ -134,8 +139,14 @@ private:
 class OCIOColorSystem {
 #if OIIO_HAS_COLORPROCESSOR
 public:
-
-    OIIO::ColorProcessorHandle
+    OCIOColorSystem ();
+
+    /// Return the processor for the given pair of color spaces, or NULL
+    /// if OCIO doesn't know how to make that conversion.  Each pair is
+    /// kept once resolved (if threads race to resolve it, only one result
+    /// is kept); after that, lookups take no lock.  The processor lives as
+    /// long as the OCIOColorSystem.
+    const OIIO::ColorProcessor *
     load_transform(StringParam fromspace, StringParam tospace);
 
     const OIIO::ColorConfig& colorconfig () const { return m_colorconfig; }
@@ -144,10 +155,17 @@ private:
 
     OIIO::ColorConfig m_colorconfig; ///< OIIO/OCIO color configuration
 
-    // 1-item cache for the last requested custom color conversion processor
-    OIIO::ColorProcessorHandle m_last_colorproc;
-    ustring m_last_colorproc_fromspace;
-    ustring m_last_colorproc_tospace;
+    // Cache of custom color conversion processors.  Entries are added
+    // (under m_processors_mutex) but never changed or removed, so
+    // readers may probe m_processor_table without locking.
+    struct ProcessorEntry {
+        ustring fromspace, tospace;
+        OIIO::ColorProcessorHandle processor;  ///< NULL if unknown spaces
+    };
+    static const int ProcessorTableSize = 64;  // must be a power of 2
+    std::atomic<const ProcessorEntry *> m_processor_table[ProcessorTableSize];
+    std::vector<std::unique_ptr<ProcessorEntry> > m_processors;  ///< Owner
+    OIIO::spin_mutex m_processors_mutex;
 #endif
 };
 
@@ -36,6 +36,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // The messages are stored in a ParamValueList in the ShadingContext.
 // For simple types, just slurp them up into the PVL.
 //
+// When every message name in a group is a constant, the backend instead
+// gives each message a fixed MessageSlot in the group data and the JITed
+// code reads and writes it directly (see BackendLLVM::find_message_slots);
+// only the error paths come through the *_slot functions below.
+//
 // FIXME -- setmessage only stores message values, not derivs, so
 // getmessage only retrieves the values and has zero derivs.
 // We should come back and fix this later.
@@ -152,5 +157,58 @@ osl_getmessage (ShaderGlobals *sg, const char *source_, const char *name_,
 }
 
 
+
+// The JITed setmessage of a message with a fixed slot stores it directly
+// when the slot is empty; this is only called when it isn't.
+OSL_SHADEOP void
+osl_setmessage_slot (ShaderGlobals *sg, void *slot_, const char *name_,
+                     const char* sourcefile_, int sourceline)
+{
+    const MessageSlot &slot (*(const MessageSlot *)slot_);
+    const ustring &name (USTR(name_));
+    const ustring &sourcefile (USTR(sourcefile_));
+    if (slot.state == MessageSlot::Set)
+        sg->context->errorf(
+           "message \"%s\" already exists (created here: %s:%d)"
+           " cannot set again from %s:%d",
+           name, slot.sourcefile, slot.sourceline, sourcefile, sourceline);
+    else
+       sg->context->errorf(
+           "message \"%s\" was queried before being set (queried here: %s:%d)"
+           " setting it now (%s:%d) would lead to inconsistent results",
+           name, slot.sourcefile, slot.sourceline, sourcefile, sourceline);
+}
+
+
+
+// The JITed getmessage of a message with a fixed slot reads it directly
+// when it was set by this layer or an earlier one; this is called for
+// everything else, and always finds nothing.
+OSL_SHADEOP int
+osl_getmessage_slot (ShaderGlobals *sg, void *slot_, const char *name_,
+                     int layeridx, const char* sourcefile_, int sourceline)
+{
+    MessageSlot &slot (*(MessageSlot *)slot_);
+    if (slot.state == MessageSlot::Set) {
+        // found message, but was set by a layer deeper than the one querying the message
+        sg->context->errorf(
+            "message \"%s\" was set by layer #%d (%s:%d)"
+            " but is being queried by layer #%d (%s:%d)"
+            " - messages may only be transfered from nodes "
+            "that appear earlier in the shading network",
+            USTR(name_), slot.layeridx, slot.sourcefile, slot.sourceline,
+            layeridx, USTR(sourcefile_), sourceline);
+    } else if (slot.state == MessageSlot::Empty &&
+               sg->context->shadingsys().strict_messages()) {
+        // Record the query in case another layer tries to set it later on
+        slot.state = MessageSlot::Queried;
+        slot.layeridx = layeridx;
+        slot.sourcefile = sourcefile_;
+        slot.sourceline = sourceline;
+    }
+    return 0;
+}
+
+
 } // namespace pvt
 OSL_NAMESPACE_EXIT
@@ -916,7 +916,7 @@ OSL_SHADEOP void
 osl_count_noise (void *sg_)
 {
     ShaderGlobals *sg = (ShaderGlobals *)sg_;
-    sg->context->shadingsys().count_noise ();
+    sg->context->thread_info()->stats.add (ThreadStats::noise_calls, 1);
 }
 
 
@@ -35,6 +35,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /////////////////////////////////////////////////////////////////////////
 
 #include <cstdarg>
+#include <cctype>
+#include <cstring>
 
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/filesystem.h>
@@ -142,43 +144,161 @@ osl_substr_ssii (const char *s_, int start, int length)
 }
 
 
+CompiledRegex::CompiledRegex (ustring pattern)
+    : m_pattern(pattern), m_kind(General)
+{
+    // Recognize patterns consisting only of ordinary characters (or
+    // backslash-escaped metacharacters), optionally anchored at either end.
+    string_view p (pattern);
+    bool anchor_begin = false, anchor_end = false;
+    if (p.size() && p.front() == '^') {
+        anchor_begin = true;
+        p.remove_prefix (1);
+    }
+    if (p.size() && p.back() == '$'
+          && (p.size() < 2 || p[p.size()-2] != '\\')) {
+        anchor_end = true;
+        p.remove_suffix (1);
+    }
+    std::string literal;
+    bool is_literal = true;
+    for (size_t i = 0;  i < p.size() && is_literal;  ++i) {
+        char c = p[i];
+        if (c == '\\') {
+            // Only an escaped metacharacter is sure to be a literal in
+            // both regex engines: \d, \w, \b, etc. are classes or
+            // assertions, and so (for boost) are \<, \>, \` and \'.
+            if (i+1 < p.size() && p[i+1] && strchr ("\\.[]{}()*+?|^$/", p[i+1]))
+                literal += p[++i];
+            else
+                is_literal = false;
+        } else if (strchr (".[]{}()*+?|^$", c)) {
+            is_literal = false;
+        } else {
+            literal += c;
+        }
+    }
+#ifdef USE_BOOST_REGEX
+    // With boost, '^' and '$' also match at embedded newlines, which a
+    // comparison at the ends of the subject would not.
+    if (anchor_begin || anchor_end)
+        is_literal = false;
+#endif
+    if (is_literal) {
+        m_literal = std::move (literal);
+        m_kind = anchor_begin ? (anchor_end ? Exact : Prefix)
+                              : (anchor_end ? Suffix : Literal);
+    } else {
+        m_regex.reset (new regex (pattern.c_str()));
+    }
+}
+
+
+
+bool
+CompiledRegex::match_literal (string_view subject, bool fullmatch,
+                              size_t &begin) const
+{
+    if (fullmatch || m_kind == Exact) {
+        // A full match of a literal (anchors are implied) is equality.
+        begin = 0;
+        return subject == m_literal;
+    }
+    if (subject.size() < m_literal.size())
+        return false;
+    switch (m_kind) {
+    case Prefix:
+        begin = 0;
+        return subject.substr (0, m_literal.size()) == m_literal;
+    case Suffix:
+        begin = subject.size() - m_literal.size();
+        return subject.substr (begin) == m_literal;
+    default:
+        begin = subject.find (m_literal);
+        return begin != string_view::npos;
+    }
+}
+
+
+
+bool
+CompiledRegex::match (string_view subject, bool fullmatch) const
+{
+    if (m_kind != General) {
+        size_t begin;
+        return match_literal (subject, fullmatch, begin);
+    }
+    return fullmatch ? regex_match (subject.begin(), subject.end(), *m_regex)
+                     : regex_search (subject.begin(), subject.end(), *m_regex);
+}
+
+
+
+bool
+CompiledRegex::match (string_view subject, bool fullmatch,
+                      int *results, int nresults) const
+{
+    if (nresults <= 0)
+        return match (subject, fullmatch);
+    // Entries with no corresponding match are set to the pattern length.
+    int nomatch = int(m_pattern.length());
+    if (m_kind != General) {
+        size_t begin;
+        bool res = match_literal (subject, fullmatch, begin);
+        for (int r = 0;  r < nresults;  ++r) {
+            if (res && r == 0)
+                results[r] = int(begin);
+            else if (res && r == 1)
+                results[r] = int(begin + m_literal.size());
+            else
+                results[r] = nomatch;
+        }
+        return res;
+    }
+    match_results<string_view::const_iterator> mresults;
+    string_view::const_iterator start = subject.begin();
+    bool res = fullmatch
+             ? regex_match (subject.begin(), subject.end(), mresults, *m_regex)
+             : regex_search (subject.begin(), subject.end(), mresults, *m_regex);
+    for (int r = 0;  r < nresults;  ++r) {
+        if (r/2 < (int)mresults.size()) {
+            if ((r & 1) == 0)
+                results[r] = mresults[r/2].first - start;
+            else
+                results[r] = mresults[r/2].second - start;
+        } else {
+            results[r] = nomatch;
+        }
+    }
+    return res;
+}
+
+
+
 OSL_SHADEOP int
 osl_regex_impl (void *sg_, const char *subject_, void *results, int nresults,
                 const char *pattern, int fullmatch)
 {
     ShaderGlobals *sg = (ShaderGlobals *)sg_;
     ShadingContext *ctx = sg->context;
-    const std::string &subject (ustring::from_unique(subject_).string());
-    match_results<std::string::const_iterator> mresults;
-    const regex &regex (ctx->find_regex (USTR(pattern)));
-    if (nresults > 0) {
-        std::string::const_iterator start = subject.begin();
-        int res = fullmatch ? regex_match (subject, mresults, regex)
-                            : regex_search (subject, mresults, regex);
-        int *m = (int *)results;
-        for (int r = 0;  r < nresults;  ++r) {
-            if (r/2 < (int)mresults.size()) {
-                if ((r & 1) == 0)
-                    m[r] = mresults[r/2].first - start;
-                else
-                    m[r] = mresults[r/2].second - start;
-            } else {
-                m[r] = USTR(pattern).length();
-            }
-        }
-        return res;
-    } else {
-        return fullmatch ? regex_match (subject, regex)
-                         : regex_search (subject, regex);
-    }
+    const CompiledRegex &regex (ctx->find_regex (USTR(pattern)));
+    return regex.match (USTR(subject_), fullmatch, (int *)results, nresults);
 }
 
 
 OSL_SHADEOP const char *
 osl_format (const char* format_str, ...)
 {
+    // Most results are short: format them on the stack, and only make a
+    // std::string for the ones that don't fit.
+    char buf[256];
     va_list args;
     va_start (args, format_str);
+    int n = vsnprintf (buf, sizeof(buf), format_str, args);
+    va_end (args);
+    if (n >= 0 && n < int(sizeof(buf)))
+        return ustring(buf, 0, n).c_str();
+    va_start (args, format_str);
     std::string s = Strutil::vformat (format_str, args);
     va_end (args);
     return ustring(s).c_str();
@@ -195,9 +315,8 @@ osl_printf (ShaderGlobals *sg, const char* format_str, ...)
     std::string newfmt = std::string("llvm: ") + format_str;
     format_str = newfmt.c_str();
 #endif
-    std::string s = Strutil::vformat (format_str, args);
+    sg->context->record_vprintf (ErrorHandler::EH_MESSAGE, format_str, args);
     va_end (args);
-    sg->context->messagef("%s", s);
 }
 
 
@@ -206,9 +325,8 @@ osl_error (ShaderGlobals *sg, const char* format_str, ...)
 {
     va_list args;
     va_start (args, format_str);
-    std::string s = Strutil::vformat (format_str, args);
+    sg->context->record_vprintf (ErrorHandler::EH_ERROR, format_str, args);
     va_end (args);
-    sg->context->errorf("%s", s);
 }
 
 
@@ -218,9 +336,8 @@ osl_warning (ShaderGlobals *sg, const char* format_str, ...)
     if (sg->context->allow_warnings()) {
         va_list args;
         va_start (args, format_str);
-        std::string s = Strutil::vformat (format_str, args);
+        sg->context->record_vprintf (ErrorHandler::EH_WARNING, format_str, args);
         va_end (args);
-        sg->context->warningf("%s", s);
     }
 }
 
@@ -227,6 +227,20 @@ osl_texture_set_subimagename (void *opt, const char *subimagename)
     ((TextureOpt *)opt)->subimagename = USTR(subimagename);
 }
 
+// Decode mode names that weren't known when the shader was JITed; the
+// generated code stores the results directly into the TextureOpt.
+OSL_SHADEOP int
+osl_texture_decode_wrapmode (const char *name)
+{
+    return (int) TextureOpt::decode_wrapmode (USTR(name));
+}
+
+OSL_SHADEOP int
+osl_texture_decode_interpmode (const char *name)
+{
+    return tex_interp_to_code (USTR(name));
+}
+
 OSL_SHADEOP void
 osl_texture_set_missingcolor_arena (void *opt, const void *missing)
 {
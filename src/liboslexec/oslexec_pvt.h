@@ -30,11 +30,19 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <cstdarg>
+#include <atomic>
 #include <stack>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <map>
 #include <memory>
 #include <list>
+#include <deque>
 #include <set>
+#include <tuple>
 #include <unordered_map>
 
 #include <boost/thread/tss.hpp>   /* for thread_specific_ptr */
@@ -46,6 +54,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <OpenImageIO/ustring.h>
 #include <OpenImageIO/thread.h>
+#include <OpenImageIO/timer.h>
 #include <OpenImageIO/paramlist.h>
 #include <OpenImageIO/refcnt.h>
 #include <OpenImageIO/color.h>
@@ -61,6 +70,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <OSL/oslclosure.h>
 #include <OSL/dual.h>
 #include <OSL/dual_vec.h>
+#include <OSL/llvm_util.h>
 #include "osl_pvt.h"
 #include "constantpool.h"
 #include "opcolor.h"
@@ -98,13 +108,219 @@ OSL_NAMESPACE_ENTER
 
 
 
+/// A compiled regular expression, as used by regex_search and
+/// regex_match.  Patterns that are just a literal string (optionally
+/// anchored with '^' and/or '$') -- by far the most common kind seen in
+/// shaders -- are matched with simple string comparisons; anything else
+/// goes through the full regex engine.  Once constructed, a CompiledRegex
+/// is immutable and may be shared by any number of threads.
+class CompiledRegex {
+public:
+    explicit CompiledRegex (ustring pattern);
+
+    /// Is the pattern found in (or, if fullmatch, does it match all of)
+    /// the subject?
+    bool match (string_view subject, bool fullmatch) const;
+
+    /// Like match(), but also fill in results[0..nresults-1] with the
+    /// begin/end offsets of the whole match and each subexpression,
+    /// exactly as osl_regex_impl expects.
+    bool match (string_view subject, bool fullmatch,
+                int *results, int nresults) const;
+
+    /// Is this pattern handled without the regex engine?
+    bool is_literal () const { return m_kind != General; }
+
+private:
+    enum Kind { General, Literal, Prefix, Suffix, Exact };
+    bool match_literal (string_view subject, bool fullmatch,
+                        size_t &begin) const;
+
+    ustring m_pattern;                  ///< The original pattern
+    Kind m_kind;                        ///< How to match it
+    std::string m_literal;              ///< Unescaped literal text
+    std::unique_ptr<regex> m_regex;     ///< Compiled regex (General only)
+};
+
+
+
+namespace pvt {
+
+class ShadingSystemImpl;
+
+/// Totals for one site of the detailed execution profile ("profile" >=
+/// 2): a layer of a group, or one instrumented op within a layer.
+/// Times are in nanoseconds.
+struct ProfileTotal {
+    long long count = 0;        ///< Times it was executed
+    long long ticks = 0;        ///< Total time, including anything nested
+    long long self_ticks = 0;   ///< Excluding nested layers and ops
+};
+
+/// One thread's profile counters, indexed by site ID (see
+/// ShadingSystemImpl::profile_site).  Only the owning thread writes them,
+/// so there are no locks or atomic read-modify-writes, but any thread
+/// may read them at any time to gather stats.  Counters live in
+/// fixed-size chunks that never move once allocated.
+class ProfileCounters {
+public:
+    ProfileCounters () {
+        for (auto&& c : m_chunks)
+            c.store (nullptr, std::memory_order_relaxed);
+    }
+    ~ProfileCounters () {
+        for (auto&& c : m_chunks)
+            delete [] c.load (std::memory_order_relaxed);
+    }
+    ProfileCounters (const ProfileCounters &) = delete;
+    const ProfileCounters & operator= (const ProfileCounters &) = delete;
+
+    /// Called by the owning thread only.
+    void add (int site, long long ticks, long long self_ticks) {
+        int c = site / chunk_size;
+        if (site < 0 || c >= max_chunks)
+            return;
+        Counter *chunk = m_chunks[c].load (std::memory_order_relaxed);
+        if (! chunk) {
+            chunk = new Counter[chunk_size];
+            m_chunks[c].store (chunk, std::memory_order_release);
+        }
+        Counter &counter (chunk[site % chunk_size]);
+        auto bump = [](std::atomic<long long> &v, long long x) {
+            v.store (v.load (std::memory_order_relaxed) + x,
+                     std::memory_order_relaxed);
+        };
+        bump (counter.count, 1);
+        bump (counter.ticks, ticks);
+        bump (counter.self_ticks, self_ticks);
+    }
+
+    /// Add the counters for sites [0,totals.size()) into totals.  Safe
+    /// to call from any thread.
+    void accumulate (std::vector<ProfileTotal> &totals) const {
+        for (size_t site = 0;  site < totals.size();  ++site) {
+            size_t c = site / chunk_size;
+            if (c >= max_chunks)
+                break;
+            const Counter *chunk = m_chunks[c].load (std::memory_order_acquire);
+            if (! chunk) {
+                site = (c+1) * chunk_size - 1;  // skip the missing chunk
+                continue;
+            }
+            const Counter &counter (chunk[site % chunk_size]);
+            totals[site].count += counter.count.load (std::memory_order_relaxed);
+            totals[site].ticks += counter.ticks.load (std::memory_order_relaxed);
+            totals[site].self_ticks += counter.self_ticks.load (std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Counter {
+        std::atomic<long long> count {0};
+        std::atomic<long long> ticks {0};
+        std::atomic<long long> self_ticks {0};
+    };
+    static const int chunk_size = 1024;
+    static const int max_chunks = 256;
+    std::atomic<Counter *> m_chunks[max_chunks];
+};
+
+/// A profile site being timed (see PerThreadInfo::profile_begin).
+struct ProfileFrame {
+    int site;
+    long long start;            ///< Clock reading when it began
+    long long child_ticks;      ///< Time spent in nested sites
+};
+
+/// Execution statistics gathered by one thread (see PerThreadInfo::stats).
+/// As with ProfileCounters, only the owning thread writes them and any
+/// thread may read them, so counting is as cheap as a plain increment and
+/// threads never fight over the cache line of a shared counter.
+/// ShadingSystemImpl::thread_stats() adds up all the threads.
+class ThreadStats {
+public:
+    enum Stat {
+        layers_executed,
+        shading_time_ticks,
+        async_jit_not_ready,
+        get_userdata_calls,
+        getattribute_calls,
+        getattribute_cache_hits,
+        getattribute_ticks,         ///< Time in getattribute
+        getattribute_fail_ticks,    ///<   ... when it failed
+        noise_calls,
+        pointcloud_searches,
+        pointcloud_searches_total_results,
+        pointcloud_max_results,     ///< The max, not the sum, of threads
+        pointcloud_failures,
+        pointcloud_gets,
+        pointcloud_writes,
+        nstats
+    };
+
+    /// Sums of the stats of some threads.
+    struct Totals {
+        long long value[nstats] = { };
+        long long operator[] (Stat s) const { return value[s]; }
+    };
+
+    ThreadStats () {
+        for (auto&& v : m_value)
+            v.store (0, std::memory_order_relaxed);
+    }
+    ThreadStats (const ThreadStats &) = delete;
+    const ThreadStats & operator= (const ThreadStats &) = delete;
+
+    /// Called by the owning thread only.
+    void add (Stat s, long long x) {
+        m_value[s].store (m_value[s].load (std::memory_order_relaxed) + x,
+                          std::memory_order_relaxed);
+    }
+    void add_max (Stat s, long long x) {
+        if (x > m_value[s].load (std::memory_order_relaxed))
+            m_value[s].store (x, std::memory_order_relaxed);
+    }
+
+    /// Add our stats into totals.  Safe to call from any thread.
+    void accumulate (Totals &totals) const {
+        for (int s = 0;  s < nstats;  ++s) {
+            long long v = m_value[s].load (std::memory_order_relaxed);
+            if (s == pointcloud_max_results)
+                totals.value[s] = std::max (totals.value[s], v);
+            else
+                totals.value[s] += v;
+        }
+    }
+
+private:
+    std::atomic<long long> m_value[nstats];
+};
+
+}  // namespace pvt
+
+
+
 struct PerThreadInfo
 {
-    PerThreadInfo ();
+    PerThreadInfo (pvt::ShadingSystemImpl *shadingsys = nullptr);
     ~PerThreadInfo ();
     ShadingContext *pop_context ();  ///< Get the pool top and then pop
 
     std::stack<ShadingContext *> context_pool;
+
+    /// Start and stop timing a site of the detailed profile.  The sites
+    /// nest (layers call layers and ops, and a shader may trace rays that
+    /// shade other points on this thread), so only the time not spent in
+    /// nested sites counts as a site's self time.
+    void profile_begin (int site);
+    void profile_end ();
+
+    pvt::ThreadStats stats;                    ///< This thread's stats
+    pvt::ProfileCounters profile_counters;     ///< This thread's profile
+    std::vector<pvt::ProfileFrame> profile_stack;  ///< Sites being timed
+    /// The ShadingSystem that gathers our stats (or NULL once it's gone).
+    /// Changed only under a lock, since the two may be destroyed at once.
+    pvt::ShadingSystemImpl *shadingsys;
 };
 
 
@@ -121,7 +337,9 @@ typedef std::shared_ptr<ShaderInstance> ShaderInstanceRef;
 class Dictionary;
 class RuntimeOptimizer;
 class BackendLLVM;
+class JITObjectCache;
 struct ConnectedParam;
+struct GroupSpecialization;
 
 void print_closure (std::ostream &out, const ClosureColor *closure, ShadingSystemImpl *ss);
 
@@ -211,6 +429,48 @@ struct AttributeNeeded {
     }
 };
 
+// A getattribute() lookup whose arguments are all known after runtime
+// optimization. When the same lookup is made more than once in a group,
+// the context keeps its result for the rest of the execution, so the
+// renderer is only asked once (see ShaderGroup::getattribute_lookups).
+struct AttributeLookup {
+    ustring object;        ///< Object name (empty for the current object)
+    ustring name;          ///< Attribute name
+    TypeDesc type;         ///< Type of the destination
+    int index = -1;        ///< Array element, or -1 for the whole value
+    bool derivs = false;   ///< Does the destination have derivs?
+    size_t offset = 0;     ///< Where the context keeps the cached value
+
+    AttributeLookup () {}
+    AttributeLookup (ustring object, ustring name, TypeDesc type,
+                     int index, bool derivs)
+        : object(object), name(name), type(type), index(index),
+          derivs(derivs) {}
+
+    /// Bytes needed to hold the value (and derivs, if any).
+    size_t size () const { return type.size() * (derivs ? 3 : 1); }
+
+    // Order lookups (ignoring where they're cached), so that identical
+    // ones can be found with a map.
+    friend bool operator< (const AttributeLookup &a, const AttributeLookup &b) {
+        if (a.name != b.name)
+            return a.name < b.name;
+        if (a.object != b.object)
+            return a.object < b.object;
+        if (a.type.basetype != b.type.basetype)
+            return a.type.basetype < b.type.basetype;
+        if (a.type.aggregate != b.type.aggregate)
+            return a.type.aggregate < b.type.aggregate;
+        if (a.type.vecsemantics != b.type.vecsemantics)
+            return a.type.vecsemantics < b.type.vecsemantics;
+        if (a.type.arraylen != b.type.arraylen)
+            return a.type.arraylen < b.type.arraylen;
+        if (a.index != b.index)
+            return a.index < b.index;
+        return a.derivs < b.derivs;
+    }
+};
+
 // Prefix for OSL shade op declarations. Make them local visibility, but
 // "C" linkage (no C++ name mangling).
 #define OSL_SHADEOP extern "C" OSL_DLL_LOCAL
@@ -392,6 +652,9 @@ public:
     bool range_checking() const { return m_range_checking; }
     void range_checking(bool b) { m_range_checking = b; }
 
+    /// The code of the master, before any instance optimization.
+    const OpcodeVec & ops () const { return m_ops; }
+
 private:
     ShadingSystemImpl &m_shadingsys;    ///< Back-ptr to the shading system
     ShaderType m_shadertype;            ///< Type of shader
@@ -561,6 +824,27 @@ public:
     const void* get_symbol (ShadingContext &ctx, ustring layername,
                             ustring symbolname, TypeDesc &type);
 
+    /// Return the process-wide compiled regex for the given pattern,
+    /// compiling it the first time it's requested.  Thread-safe; the
+    /// returned object is immutable and lives as long as the
+    /// ShadingSystem.
+    const CompiledRegex & find_regex (ustring r);
+
+    /// Return the Dictionary (parsed XML documents and cached queries for
+    /// dict_find/dict_value) shared by all contexts, creating it on first
+    /// use, and the generation it belongs to.  See dictionary.cpp.
+    std::shared_ptr<Dictionary> dictionary (int &generation);
+
+    /// Drop the current Dictionary; contexts still using it keep it alive
+    /// until they next look up the current one.
+    void invalidate_dictionaries ();
+
+    /// Bumped by each invalidate_dictionaries, so that contexts can tell
+    /// cheaply whether the Dictionary they hold is still current.
+    int dictionary_generation () const {
+        return m_dictionary_generation.load (std::memory_order_acquire);
+    }
+
 //    void operator delete (void *todel) { ::delete ((char *)todel); }
 
     /// Is the shading system in debug mode, and if so, how verbose?
@@ -603,6 +887,11 @@ public:
     bool allow_shader_replacement() const { return m_allow_shader_replacement; }
     ustring commonspace_synonym () const { return m_commonspace_synonym; }
 
+    /// Return the JIT object cache, or an empty pointer if there is none.
+    std::shared_ptr<JITObjectCache> jit_cache () const {
+        return std::atomic_load (&m_jit_cache);
+    }
+
     ustring debug_groupname() const { return m_debug_groupname; }
     ustring debug_layername() const { return m_debug_layername; }
 
@@ -616,11 +905,80 @@ public:
     /// (at least the ones that can't be overridden by the geometry).
     void optimize_group (ShaderGroup &group, ShadingContext *ctx);
 
+    /// Queue the group to be optimized and JITed in the background, if
+    /// it isn't already compiled or queued, and return immediately.
+    void optimize_group_async (ShaderGroup &group);
+
+    /// For a group compiled at the fast tier of tiered JIT, queue it to be
+    /// recompiled in the background at full optimization (if not already
+    /// queued), and return immediately.
+    void tier_up_group_async (ShaderGroup &group);
+
+    /// Recompile a fast-tier group at full optimization, replacing its
+    /// compiled entry points, using ctx to report errors.
+    void tier_up_group (ShaderGroup &group, ShadingContext *ctx);
+
     /// After doing all optimization and code JIT, we can clean up by
     /// deleting the instances' code and arguments, and paring their
     /// symbol tables down to just parameters.
     void group_post_jit_cleanup (ShaderGroup &group);
 
+    /// If the "jit_memory_budget" option is set, note that the given
+    /// group was just JITed, and if the JITed code of all groups exceeds
+    /// the budget, free the code of the groups executed least recently
+    /// (other than the given one) until it doesn't.  Groups that are
+    /// executing, or being compiled, are left alone.
+    void enforce_jit_memory_budget (ShaderGroup &keep);
+
+    /// Move the group to the most recently used end of the JIT memory
+    /// budget's LRU list (adding it if it isn't there), or take it out.
+    void jit_lru_touch (ShaderGroup &group);
+    void jit_lru_remove (ShaderGroup &group);
+
+    /// Keep track of every context, so we can tell which groups are
+    /// being executed.
+    void register_context (ShadingContext *ctx);
+    void unregister_context (ShadingContext *ctx);
+
+    /// Is any context executing the group (see ShadingContext::pin_group)?
+    bool group_pinned (const ShaderGroup &group) const;
+
+    /// Free the JITed code of the group, which must be locked, leaving
+    /// it to be compiled again the next time it's executed.  Return
+    /// false, and leave it be, if it's being executed.
+    bool evict_group (ShaderGroup &group);
+
+    /// Return a string that is the same for groups that are identical in
+    /// everything that their optimized code depends on (except the
+    /// options).  The group must be locked and not yet optimized.
+    std::string group_key (const ShaderGroup &group) const;
+
+    /// Return the key under which identical groups may take the
+    /// specialization of the first one (see GroupSpecialization), or an
+    /// empty string if the "opt_specialization_cache" option is off.
+    std::string specialization_key (const ShaderGroup &group) const;
+
+    /// Return the specialization saved under the key, or an empty
+    /// reference if there is none.
+    std::shared_ptr<GroupSpecialization> find_specialization (const std::string &key);
+
+    /// Save the specialization of a group under the key, forgetting the
+    /// oldest one if there are already as many as the
+    /// "opt_specialization_cache" option allows.
+    void add_specialization (const std::string &key,
+                             std::shared_ptr<GroupSpecialization> spec);
+
+    /// Return the key under which identical groups share their optimized
+    /// and compiled code (if "opt_share_groups" is on), or an empty
+    /// string if the group can't share.  It must be called before the
+    /// group, which must be locked, is optimized.
+    std::string group_share_key (const ShaderGroup &group) const;
+
+    /// Make the group, which must be locked and not yet optimized, use
+    /// the optimized instances and compiled code of source, an
+    /// identical group that was already optimized.
+    void adopt_group_code (ShaderGroup &group, const ShaderGroup &source);
+
     int *alloc_int_constants (size_t n) { return m_int_pool.alloc (n); }
     float *alloc_float_constants (size_t n) { return m_float_pool.alloc (n); }
     ustring *alloc_string_constants (size_t n) { return m_string_pool.alloc (n); }
@@ -641,7 +999,13 @@ public:
 
     int raytype_bit (ustring name);
 
-    void optimize_all_groups (int nthreads=0, int mythread=0, int totalthreads=1);
+    void optimize_all_groups (int nthreads=0, OIIO::thread_pool *pool=NULL);
+    void optimize_all_groups_async (std::function<void(ShaderGroup*,bool)> ready,
+                                    OIIO::thread_pool *pool=NULL);
+    void wait_for_jit ();
+
+    /// Estimate the relative cost of optimizing and JITing the group.
+    static size_t group_compile_cost (const ShaderGroup &group);
 
     typedef std::unordered_map<ustring,OpDescriptor,ustringHash> OpDescriptorMap;
 
@@ -655,7 +1019,9 @@ public:
             return NULL;
     }
 
-    void pointcloud_stats (int search, int get, int results, int writes=0);
+    /// Count pointcloud calls in the calling thread's stats.
+    void pointcloud_stats (PerThreadInfo *threadinfo, int search, int get,
+                           int results, int writes=0);
 
     /// Is the named symbol among the renderer outputs?
     bool is_renderer_output (ustring layername, ustring paramname,
@@ -665,8 +1031,6 @@ public:
     /// archive.
     bool archive_shadergroup (ShaderGroup& group, string_view filename);
 
-    void count_noise () { m_stat_noise_calls += 1; }
-
     ColorSystem& colorsystem() { return m_colorsystem; }
 
     template <typename Color> bool
@@ -697,12 +1061,32 @@ private:
     PerThreadInfo *get_perthread_info () const {
         PerThreadInfo *p = m_perthread_info.get ();
         if (! p) {
-            p = new PerThreadInfo;
+            p = new PerThreadInfo (const_cast<ShadingSystemImpl *>(this));
             m_perthread_info.reset (p);
         }
         return p;
     }
 
+    /// Keep track of every PerThreadInfo we made, so that getstats can
+    /// gather their stats and profile counters.
+    void register_thread_info (PerThreadInfo *threadinfo);
+    void unregister_thread_info (PerThreadInfo *threadinfo);
+
+    /// Add up the execution stats of all threads, past and present.
+    ThreadStats::Totals thread_stats () const;
+
+    /// Return the ID of a site of the detailed execution profile: the
+    /// given layer of the group (if opnum < 0) or one of its ops.
+    /// Registers the site the first time it is asked for.
+    int profile_site (const ShaderGroup &group, int layer, int opnum);
+
+    /// Return the detailed execution profile as "text", "json", or
+    /// "trace" (Chrome trace event format).
+    std::string profile_report (string_view format) const;
+
+    /// Gather the totals of every profile site, from all threads.
+    void profile_totals (std::vector<ProfileTotal> &totals) const;
+
     /// Set up LLVM -- make sure we have a Context, Module, ExecutionEngine,
     /// retained JITMemoryManager, etc.
     void SetupLLVM ();
@@ -719,6 +1103,17 @@ private:
 
     typedef std::map<ustring,ShaderMaster::ref> ShaderNameMap;
     ShaderNameMap m_shader_masters;       ///< name -> shader masters map
+    /// Masters currently being loaded by some thread, so that other
+    /// threads asking for the same one can wait for it.
+    std::map<ustring,std::shared_future<ShaderMaster::ref> > m_shader_masters_loading;
+    mutable mutex m_shader_masters_mutex; ///< Guards the two maps above
+    int m_masters_loading;                ///< Loads in progress (m_stat_mutex)
+    void master_load_begin ();
+    void master_load_end (double loadtime);
+    /// Time spent loading masters, summed over threads and by the wall
+    /// clock (safe to call while other threads are loading).
+    double master_load_time () const;
+    double master_load_wall_time () const;
 
     ConstantPool<int> m_int_pool;
     ConstantPool<Float> m_float_pool;
@@ -746,6 +1141,11 @@ private:
     bool m_unknown_coordsys_error;        ///< Error to use unknown xform name?
     bool m_connection_error;              ///< Error for ConnectShaders to fail?
     bool m_greedyjit;                     ///< JIT as much as we can?
+    bool m_async_jit;                     ///< JIT in background, don't wait?
+    int m_tiered_jit;                     ///< Execs before full-opt recompile
+    int m_jit_memory_budget;              ///< Max MB of JITed code (0=any)
+    bool m_getattribute_cache;            ///< Share repeated getattribute calls?
+    bool m_flat_closures;                 ///< Build ClosureLists, not trees?
     bool m_countlayerexecs;               ///< Count number of layer execs?
     bool m_relaxed_param_typecheck;       ///< Allow parameters to be set from isomorphic types (same data layout)
     int m_max_warnings_per_thread;        ///< How many warnings to display per thread before giving up?
@@ -762,10 +1162,13 @@ private:
     bool m_opt_mix;                       ///< Special 'mix' optimizations
     char m_opt_merge_instances;           ///< Merge identical instances?
     bool m_opt_merge_instances_with_userdata; ///< Merge identical instances if they have userdata?
+    bool m_opt_share_groups;              ///< Share code of identical groups?
+    int m_opt_specialization_cache;       ///< Max group specializations kept
     bool m_opt_fold_getattribute;         ///< Constant-fold getattribute()?
     bool m_opt_middleman;                 ///< Middle-man optimization?
     bool m_opt_texture_handle;            ///< Use texture handles?
     bool m_opt_seed_bblock_aliases;       ///< Turn on basic block alias seeds
+    bool m_opt_message_slots;             ///< Fixed slots for known messages
     bool m_optimize_nondebug;             ///< Fully optimize non-debug!
     int m_opt_passes;                     ///< Opt passes per layer
     int m_llvm_optimize;                  ///< OSL optimization strategy
@@ -780,6 +1183,8 @@ private:
     ustring m_only_groupname;             ///< Name of sole group to compile
     ustring m_archive_groupname;          ///< Name of group to pickle/archive
     ustring m_archive_filename;           ///< Name of filename for group archive
+    ustring m_jit_cache_dir;              ///< Directory for JIT object cache
+    std::shared_ptr<JITObjectCache> m_jit_cache; ///< JIT object cache
     std::string m_searchpath;             ///< Shader search path
     std::vector<std::string> m_searchpath_dirs; ///< All searchpath dirs
     ustring m_commonspace_synonym;        ///< Synonym for "common" space
@@ -814,11 +1219,22 @@ private:
     atomic_int m_stat_groupinstances;     ///< Stat: total inst in all groups
     atomic_int m_stat_instances_compiled; ///< Stat: instances compiled
     atomic_int m_stat_groups_compiled;    ///< Stat: groups compiled
+    atomic_int m_stat_groups_tiered_up;   ///< Stat: groups recompiled at full opt
+    atomic_int m_stat_groups_evicted;     ///< Stat: groups whose code was freed
+    atomic_int m_stat_groups_rejitted;    ///< Stat: evicted groups JITed again
+    atomic_int m_stat_groups_shared;      ///< Stat: groups sharing code
+    atomic_int m_stat_specializations_reused; ///< Stat: groups not specialized
+    double m_stat_jit_tier0_time;         ///< Stat: LLVM time, fast tier
+    double m_stat_jit_tier1_time;         ///< Stat: LLVM time, full-opt tier
     atomic_int m_stat_empty_instances;    ///< Stat: shaders empty after opt
     atomic_int m_stat_merged_inst;        ///< Stat: number of merged instances
     atomic_int m_stat_merged_inst_opt;    ///< Stat: merged insts after opt
     atomic_int m_stat_empty_groups;       ///< Stat: groups empty after opt
     atomic_int m_stat_regexes;            ///< Stat: how many regex's compiled
+    atomic_int m_stat_dict_documents;     ///< Stat: dictionaries parsed
+    atomic_int m_stat_dict_nodes;         ///< Stat: dictionary nodes found
+    atomic_int m_stat_dict_queries;       ///< Stat: dictionary queries cached
+    atomic_ll m_stat_dict_memory;         ///< Stat: approx dictionary memory
     atomic_int m_stat_preopt_syms;        ///< Stat: pre-optimization symbols
     atomic_int m_stat_postopt_syms;       ///< Stat: post-optimization symbols
     atomic_int m_stat_syms_with_derivs;   ///< Stat: post-opt syms with derivs
@@ -829,7 +1245,8 @@ private:
     atomic_int m_stat_global_connections; ///< Stat: global connections elim'd
     atomic_int m_stat_tex_calls_codegened;///< Stat: total texture calls
     atomic_int m_stat_tex_calls_as_handles;///< Stat: texture calls with handles
-    double m_stat_master_load_time;       ///< Stat: time loading masters
+    double m_stat_master_load_time;       ///< Stat: time loading masters (sum over threads)
+    OIIO::Timer m_stat_master_load_wall_timer; ///< Stat: wall time loading masters
     double m_stat_optimization_time;      ///< Stat: time spent optimizing
     double m_stat_opt_locking_time;       ///<   locking time
     double m_stat_specialization_time;    ///<   runtime specialization time
@@ -839,19 +1256,10 @@ private:
     double m_stat_llvm_opt_time;          ///<     llvm IR optimization time
     double m_stat_llvm_jit_time;          ///<     llvm JIT time
     double m_stat_inst_merge_time;        ///< Stat: time merging instances
-    double m_stat_getattribute_time;      ///< Stat: time spent in getattribute
-    double m_stat_getattribute_fail_time; ///< Stat: time spent in getattribute
-    atomic_ll m_stat_getattribute_calls;  ///< Stat: Number of getattribute
-    atomic_ll m_stat_get_userdata_calls;  ///< Stat: # of get_userdata calls
-    atomic_ll m_stat_noise_calls;         ///< Stat: # of noise calls
-    long long m_stat_pointcloud_searches;
-    long long m_stat_pointcloud_searches_total_results;
-    int m_stat_pointcloud_max_results;
-    int m_stat_pointcloud_failures;
-    long long m_stat_pointcloud_gets;
-    long long m_stat_pointcloud_writes;
-    atomic_ll m_stat_layers_executed;     ///< Total layers executed
-    atomic_ll m_stat_total_shading_time_ticks; ///< Total shading time (ticks)
+    double m_stat_group_share_time_saved; ///< Stat: opt time of shared groups
+    double m_stat_specialization_time_saved; ///< Stat: time of reused specializations
+    // N.B. Stats counted while shading live in each PerThreadInfo's
+    // ThreadStats, so that threads don't contend to update them.
 
     int m_stat_max_llvm_local_mem;        ///< Stat: max LLVM local mem
     PeakCounter<off_t> m_stat_memory;     ///< Stat: all shading system memory
@@ -866,11 +1274,26 @@ private:
     PeakCounter<off_t> m_stat_mem_inst_syms;
     PeakCounter<off_t> m_stat_mem_inst_paramvals;
     PeakCounter<off_t> m_stat_mem_inst_connections;
+    PeakCounter<off_t> m_stat_mem_specializations; ///< Stat: saved specializations
 
     mutable spin_mutex m_stat_mutex;     ///< Mutex for non-atomic stats
     ClosureRegistry m_closure_registry;
     std::vector<std::weak_ptr<ShaderGroup> > m_all_shader_groups;
     mutable spin_mutex m_all_shader_groups_mutex;
+    // Complete groups not yet claimed by optimize_all_groups[_async]
+    // (some may have been compiled by other means since).
+    std::vector<std::weak_ptr<ShaderGroup> > m_groups_to_compile;
+    spin_mutex m_groups_to_compile_mutex;
+    // Optimized groups whose code identical groups may share, by
+    // group_share_key.  Cleared when any option changes.
+    std::unordered_map<std::string,std::weak_ptr<ShaderGroup> > m_shared_groups;
+    mutable spin_mutex m_shared_groups_mutex;
+    // Saved group specializations, by specialization_key, and the order
+    // they were saved in.  Cleared when any option changes.
+    std::unordered_map<std::string,std::shared_ptr<GroupSpecialization> > m_specializations;
+    std::deque<std::string> m_specialization_order;
+    mutable spin_mutex m_specializations_mutex;
+    void clear_specializations ();     // Call with m_specializations_mutex held
 
     // State for entering shader groups -- this is only for the
     // non-threadsafe calls to Parameter/etc that don't take a group
@@ -879,9 +1302,57 @@ private:
 
     atomic_int m_groups_to_compile_count;
     atomic_int m_threads_currently_compiling;
+
+    // Batches of groups being compiled by optimize_all_groups[_async].
+    struct JITQueue;
+    std::shared_ptr<JITQueue> make_jit_queue ();
+    std::shared_ptr<JITQueue> make_jit_queue (ShaderGroup &group);
+    void run_jit_queue (JITQueue &queue);
+    void push_jit_queue (std::shared_ptr<JITQueue> queue, int ntasks,
+                         OIIO::thread_pool *pool);
+    std::vector<std::shared_ptr<JITQueue> > m_jit_queues; ///< Background
+    std::mutex m_jit_queues_mutex;
+    atomic_ll m_jit_epoch;                ///< Advances each budget check
+    // Groups holding JITed code, least recently executed first, for the
+    // JIT memory budget.  Protected by m_jit_lru_mutex.
+    std::list<ShaderGroup *> m_jit_lru;
+    mutex m_jit_lru_mutex;
+    std::vector<ShadingContext *> m_all_contexts;
+    mutable mutex m_all_contexts_mutex;
     mutable std::map<ustring,long long> m_group_profile_times;
+    // Detailed (per layer and op) profile, protected by m_profile_mutex.
+    struct ProfileSite {
+        ustring groupname;
+        int groupid;
+        int layer;
+        ustring layername;
+        ustring shadername;
+        ustring opname;         ///< Empty for the layer as a whole
+        ustring sourcefile;
+        int sourceline;
+    };
+    mutable mutex m_profile_mutex;
+    std::vector<ProfileSite> m_profile_sites;
+    std::map<std::tuple<int,int,int>,int> m_profile_site_ids;
+    // The threads' stats and profile counters, protected by
+    // m_thread_info_mutex (not m_profile_mutex, so that reading the stats
+    // doesn't wait on compiles registering profile sites).
+    mutable mutex m_thread_info_mutex;
+    std::vector<PerThreadInfo *> m_all_thread_info;
+    std::vector<ProfileTotal> m_profile_retired; ///< From threads now gone
+    ThreadStats::Totals m_thread_stats_retired;  ///< From threads now gone
     // N.B. group_profile_times is protected by m_stat_mutex.
 
+    typedef std::unordered_map<ustring, std::unique_ptr<CompiledRegex>,
+                               ustringHash> RegexCache;
+    RegexCache m_regex_cache;            ///< Compiled regex's, all contexts
+    spin_mutex m_regex_cache_mutex;
+
+    std::shared_ptr<Dictionary> m_dictionary;  ///< Shared by all contexts
+    std::atomic<int> m_dictionary_generation;
+    spin_mutex m_dictionary_mutex;             ///< Guards m_dictionary
+    void free_dict_resources ();
+
     friend class OSL::ShadingContext;
     friend class ShaderMaster;
     friend class ShaderInstance;
@@ -956,6 +1427,46 @@ struct Connection {
 typedef std::vector<Connection> ConnectionVec;
 
 
+
+/// The result of the runtime specialization of a whole shader group
+/// (see RuntimeOptimizer::run): the optimized code, symbols and param
+/// values of each layer, and how its connections ended up.  Groups
+/// identical to the one it came from may take it rather than optimizing
+/// all over again (see ShadingSystemImpl::find_specialization).
+struct GroupSpecialization {
+    struct Layer {
+        ShaderMaster::ref master;      ///< Keeps master data alive
+        SymbolVec symbols;
+        OpcodeVec ops;
+        std::vector<int> args;
+        std::vector<int> iparams;
+        std::vector<float> fparams;
+        std::vector<ustring> sparams;
+        ConnectionVec connections;
+        int firstparam, lastparam;
+        int maincodebegin, maincodeend;
+        int Psym, Nsym;
+        bool writes_globals, userdata_params, outgoing_connections;
+        bool renderer_outputs, merged_unused;
+    };
+    std::vector<Layer> layers;
+    size_t preopt_syms = 0;            ///< Symbols before optimization
+    size_t preopt_ops = 0;             ///< Ops before optimization
+    double time = 0;                   ///< How long it took
+
+    /// Approximate memory held by the saved layers, in bytes.
+    off_t memory () const {
+        off_t mem = vectorbytes (layers);
+        for (auto &l : layers)
+            mem += vectorbytes (l.symbols) + vectorbytes (l.ops)
+                 + vectorbytes (l.args) + vectorbytes (l.iparams)
+                 + vectorbytes (l.fparams) + vectorbytes (l.sparams)
+                 + vectorbytes (l.connections);
+        return mem;
+    }
+};
+
+
 /// Macro to loop over just the params & output params of an instance,
 /// with each iteration providing a Symbol& to symbolref.  Use like this:
 ///        FOREACH_PARAM (Symbol &s, inst) { ... stuff with s... }
@@ -1254,6 +1765,17 @@ public:
     /// equivalent, in that they may be merged into a single instance?
     bool mergeable (const ShaderInstance &b, const ShaderGroup &g) const;
 
+    /// Save the optimized code, symbols, param values and connections
+    /// of the instance, or restore them in an identical (unoptimized)
+    /// instance.
+    void save_specialization (GroupSpecialization::Layer &layer) const;
+    void restore_specialization (const GroupSpecialization::Layer &layer);
+
+    /// Hash of the things that mergeable() compares.  Instances that are
+    /// mergeable always have the same hash, so only instances with the
+    /// same hash need to be compared.
+    size_t merge_hash () const;
+
 private:
     ShaderMaster::ref m_master;         ///< Reference to the master
     SymOverrideInfoVec m_instoverrides; ///< Instance parameter info
@@ -1395,6 +1917,58 @@ private:
     SimplePool<1024> message_data;
 };
 
+/// Fixed storage in the group data for a message whose name (and type)
+/// is known when the group is compiled.  The JITed setmessage/getmessage
+/// read and write these directly, and only call out of line to report
+/// errors or to note a query that came before the message was set.  The
+/// message data immediately follows the header.
+struct MessageSlot {
+    enum State { Empty = 0, Queried = 1, Set = 2 };
+
+    const char* sourcefile; ///< source file of the op that set (or queried) it
+    int state;              ///< one of State; cleared by group init
+    int layeridx;           ///< layer that set (or queried) the message
+    int sourceline;         ///< source line of the op that set (or queried) it
+
+    char* data() { return (char*)(this + 1); }
+
+    /// Bytes of group data needed by a slot holding a message of the
+    /// given type, padded so the next slot stays aligned.
+    static int slot_size (const TypeDesc &type) {
+        const size_t align = alignof(MessageSlot);
+        return int((sizeof(MessageSlot) + type.size() + align - 1) & ~(align - 1));
+    }
+};
+
+
+
+/// What optimizing a ShaderGroup finds out about what it reads and needs
+/// from the renderer.  It's a base of ShaderGroup, so that a group adopting
+/// the code of an identical one can take all of it in one assignment (see
+/// ShadingSystemImpl::adopt_group_code).
+struct ShaderGroupNeeds {
+    int m_raytype_queries = -1;      ///< Bitmask of raytypes queried
+    int m_globals_read = 0;
+    int m_globals_write = 0;
+    std::vector<ustring> m_textures_needed;
+    std::vector<ustring> m_closures_needed;
+    std::vector<ustring> m_globals_needed;  // semi-deprecated
+    std::vector<ustring> m_userdata_names;
+    std::vector<TypeDesc> m_userdata_types;
+    std::vector<int> m_userdata_offsets;
+    std::vector<char> m_userdata_derivs;
+    std::vector<int> m_userdata_layers;
+    std::vector<void*> m_userdata_init_vals;
+    std::vector<ustring> m_attributes_needed;
+    std::vector<ustring> m_attribute_scopes;
+    bool m_unknown_textures_needed = false;
+    bool m_unknown_closures_needed = false;
+    bool m_unknown_attributes_needed = false;
+    std::vector<AttributeLookup> m_getattribute_lookups;
+    std::map<AttributeLookup,int> m_getattribute_slots; ///< Lookup -> index
+    size_t m_getattribute_cache_size = 0;
+};
+
 
 }; // namespace pvt
 
@@ -1402,7 +1976,7 @@ private:
 
 /// A ShaderGroup consists of one or more layers (each of which is a
 /// ShaderInstance), and the connections among them.
-class ShaderGroup {
+class ShaderGroup : private pvt::ShaderGroupNeeds {
 public:
     ShaderGroup (string_view name);
     ShaderGroup (const ShaderGroup &g, string_view name);
@@ -1410,7 +1984,10 @@ public:
 
     /// Clear the layers
     ///
-    void clear () { m_layers.clear ();  m_optimized = 0;  m_executions = 0; }
+    void clear () {
+        m_layers.clear ();  m_optimized = 0;  m_executions = 0;
+        m_jit_tier = 0;  m_tier_executions = 0;
+    }
 
     /// Append a new shader instance on to the end of this group
     ///
@@ -1447,11 +2024,16 @@ public:
         m_llvm_compiled_init = func;
     }
     RunLLVMGroupFunc llvm_compiled_layer (int layer) const {
-        return layer < (int)m_llvm_compiled_layers.size()
-                            ? m_llvm_compiled_layers[layer] : NULL;
+        return layer < m_llvm_compiled_nlayers
+                            ? m_llvm_compiled_layers[layer].load() : NULL;
     }
     void llvm_compiled_layer (int layer, RunLLVMGroupFunc func) {
-        m_llvm_compiled_layers.resize ((size_t)nlayers(), NULL);
+        if (m_llvm_compiled_nlayers != nlayers()) {
+            m_llvm_compiled_layers.reset (new std::atomic<RunLLVMGroupFunc>[nlayers()]);
+            m_llvm_compiled_nlayers = nlayers();
+            for (int i = 0;  i < m_llvm_compiled_nlayers;  ++i)
+                m_llvm_compiled_layers[i] = nullptr;
+        }
         if (layer < nlayers())
             m_llvm_compiled_layers[layer] = func;
     }
@@ -1464,6 +2046,36 @@ public:
         m_does_nothing = new_val;
     }
 
+    /// The getattribute() lookups that appear more than once in the
+    /// group (only if the "getattribute_cache" option is on).  Each
+    /// execution makes each of them only once.
+    const std::vector<AttributeLookup> & getattribute_lookups () const {
+        return m_getattribute_lookups;
+    }
+    /// Bytes a context needs to keep the results of getattribute_lookups.
+    size_t getattribute_cache_size () const {
+        return m_getattribute_cache_size;
+    }
+    /// Return the index of the identical entry of getattribute_lookups,
+    /// or -1 if there is none.
+    int find_getattribute_lookup (const AttributeLookup &lookup) const {
+        auto found = m_getattribute_slots.find (lookup);
+        return found != m_getattribute_slots.end() ? found->second : -1;
+    }
+
+    /// Keep the memory holding JITed code of the group.  It is freed
+    /// with the group, or when the group's code is evicted.
+    void add_jit_memory (const LLVM_Util::JITMemoryRef &mem) {
+        m_jit_memory.push_back (mem);
+    }
+    /// Bytes of JITed code and data held for the group.
+    size_t jit_memory_size () const {
+        size_t size = 0;
+        for (auto&& mem : m_jit_memory)
+            size += LLVM_Util::jit_memory_size (mem);
+        return size;
+    }
+
     long long int executions () const { return m_executions; }
 
     void start_running () {
@@ -1476,6 +2088,8 @@ public:
     ustring name () const { return m_name; }
 
     std::string serialize () const;
+    /// Like serialize(), for a caller that already holds the lock.
+    std::string serialize_locked () const;
 
     void lock () const { m_mutex.lock(); }
     void unlock () const { m_mutex.unlock(); }
@@ -1532,44 +2146,49 @@ private:
     // Put all the things that are read-only (after optimization) and
     // needed on every shade execution at the front of the struct, as much
     // together on one cache line as possible.
-    volatile int m_optimized = 0;    ///< Is it already optimized?
+    std::atomic<int> m_optimized {0}; ///< Is it already optimized?
     bool m_does_nothing = false;     ///< Is the shading group just func() { return; }
     size_t m_llvm_groupdata_size = 0;///< Heap size needed for its groupdata
     int m_id;                        ///< Unique ID for the group
     int m_num_entry_layers = 0;      ///< Number of marked entry layers
-    RunLLVMGroupFunc m_llvm_compiled_version = nullptr;
-    RunLLVMGroupFunc m_llvm_compiled_init = nullptr;
-    std::vector<RunLLVMGroupFunc> m_llvm_compiled_layers;
+    // The compiled entry points are atomic because tiered JIT replaces
+    // them while other threads may be executing the group.
+    std::atomic<RunLLVMGroupFunc> m_llvm_compiled_version {nullptr};
+    std::atomic<RunLLVMGroupFunc> m_llvm_compiled_init {nullptr};
+    std::unique_ptr<std::atomic<RunLLVMGroupFunc>[]> m_llvm_compiled_layers;
+    int m_llvm_compiled_nlayers = 0;
     std::vector<ShaderInstanceRef> m_layers;
     ustring m_name;
     int m_exec_repeat = 1;           ///< How many times to execute group
-    int m_raytype_queries = -1;      ///< Bitmask of raytypes queried
     int m_raytypes_on = 0;           ///< Bitmask of raytypes we assume to be on
     int m_raytypes_off = 0;          ///< Bitmask of raytypes we assume to be off
     mutable mutex m_mutex;           ///< Thread-safe optimization
-    int m_globals_read = 0;
-    int m_globals_write = 0;
-    std::vector<ustring> m_textures_needed;
-    std::vector<ustring> m_closures_needed;
-    std::vector<ustring> m_globals_needed;  // semi-deprecated
-    std::vector<ustring> m_userdata_names;
-    std::vector<TypeDesc> m_userdata_types;
-    std::vector<int> m_userdata_offsets;
-    std::vector<char> m_userdata_derivs;
-    std::vector<int> m_userdata_layers;
-    std::vector<void*> m_userdata_init_vals;
-    std::vector<ustring> m_attributes_needed;
-    std::vector<ustring> m_attribute_scopes;
     std::vector<ustring> m_renderer_outputs; ///< Names of renderer outputs
-    bool m_unknown_textures_needed;
-    bool m_unknown_closures_needed;
-    bool m_unknown_attributes_needed;
     atomic_ll m_executions {0};       ///< Number of times the group executed
     atomic_ll m_stat_total_shading_time_ticks {0}; ///< Total shading time (ticks)
 
     // PTX assembly for compiled ShaderGroup
     std::string m_llvm_ptx_compiled_version;
 
+    atomic_int m_jit_queued {0};          ///< Queued for background JIT?
+    atomic_int m_jit_tier {0};            ///< 1 = fast tier, 2 = recompiling
+    atomic_ll m_tier_executions {0};      ///< Executions while fast tier
+
+    // JITed code, and what we need to know to evict it (see
+    // ShadingSystemImpl::enforce_jit_memory_budget).  Every JIT of the
+    // group adds memory here, and it is all kept until the group is
+    // destroyed or evicted, since threads may still be running the code
+    // that tiered JIT replaced.
+    std::vector<LLVM_Util::JITMemoryRef> m_jit_memory;
+    atomic_ll m_jit_last_used {0};        ///< JIT epoch of last execution
+    std::list<ShaderGroup *>::iterator m_jit_lru_pos; ///< Place in the LRU
+    ShadingSystemImpl *m_jit_lru_owner = nullptr;  ///< Whose LRU it's in
+    atomic_int m_jit_evicted {0};         ///< Code freed, recompile on use?
+    bool m_jit_evictable = false;         ///< Kept the code to JIT it again?
+
+    std::weak_ptr<ShaderGroup> m_self;    ///< Ref to ourself, for sharing
+    double m_optimize_time = 0;           ///< Time it took to optimize
+
     ParamValueList m_pending_params;      ///< Pending Parameter() values
     ustring m_group_use;                  ///< "Usage" of group
     bool m_complete = false;              ///< Successfully ShaderGroupEnd?
@@ -1643,6 +2262,43 @@ public:
         return add;
     }
 
+    ClosureList *closure_list_allot (int ncomps, const ClosureComponent **comps) {
+        ClosureList *list = (ClosureList *) m_closure_pool.alloc(sizeof(ClosureList), alignof(ClosureList));
+        list->id = ClosureColor::LIST;
+        list->ncomps = ncomps;
+        list->comps = comps;
+        return list;
+    }
+
+    // The array of component pointers behind ClosureLists, with room to
+    // grow.  Lists sharing it see only their own first ncomps; one whose
+    // ncomps is all of "used" may be extended in place.
+    struct ClosureListStorage {
+        int used;
+        int capacity;
+        const ClosureComponent **comps () {
+            return reinterpret_cast<const ClosureComponent **>(this + 1);
+        }
+        static ClosureListStorage *of (const ClosureComponent* const* comps) {
+            return reinterpret_cast<ClosureListStorage *>(const_cast<const ClosureComponent **>(comps)) - 1;
+        }
+    };
+    static_assert (sizeof(ClosureListStorage) % alignof(ClosureComponent *) == 0,
+                   "ClosureListStorage must keep the pointers after it aligned");
+
+    ClosureListStorage *closure_list_storage_allot (int capacity) {
+        size_t needed = sizeof(ClosureListStorage) + capacity * sizeof(ClosureComponent *);
+        ClosureListStorage *storage = (ClosureListStorage *) m_closure_pool.alloc(needed, alignof(ClosureComponent *));
+        storage->used = 0;
+        storage->capacity = capacity;
+        return storage;
+    }
+
+    // With "flat_closures", multiplying and adding closures makes
+    // ClosureComponents and ClosureLists rather than a tree.
+    const ClosureColor *closure_mul_flat (const Color3 &w, const ClosureColor *c);
+    const ClosureColor *closure_add_flat (const ClosureColor *a, const ClosureColor *b);
+
 
     /// Find the named symbol in the (already-executed!) stack of shaders of
     /// the given use. If a layer is given, search just that layer. If no
@@ -1658,9 +2314,10 @@ public:
     const void *symbol_data (const Symbol &sym) const;
 
     /// Return a reference to a compiled regular expression for the
-    /// given string, being careful to cache already-created ones so we
-    /// aren't constantly compiling new ones.
-    const regex & find_regex (ustring r);
+    /// given string.  The compiled regex is shared by all contexts (see
+    /// ShadingSystemImpl::find_regex); the context remembers the ones it
+    /// has already looked up, so repeated use never needs a lock.
+    const CompiledRegex & find_regex (ustring r);
 
     /// Return a pointer to the shading group for this context.
     ///
@@ -1690,6 +2347,15 @@ public:
                             int array_lookup, int index,
                             TypeDesc attr_type, void *attr_dest);
 
+    /// Like osl_get_attribute, for the group's getattribute_lookups()
+    /// entry 'slot': only the first such call of each execution asks
+    /// the renderer, later ones copy the answer it gave.
+    bool osl_get_attribute_shared (ShaderGlobals *sg, int slot,
+                                   int dest_derivs, ustring obj_name,
+                                   ustring attr_name, int array_lookup,
+                                   int index, TypeDesc attr_type,
+                                   void *attr_dest);
+
     PerThreadInfo *thread_info () const { return m_threadinfo; }
 
     TextureSystem::Perthread *texture_thread_info () const {
@@ -1720,13 +2386,25 @@ public:
     void clear_runtime_stats () {
         m_stat_get_userdata_calls = 0;
         m_stat_layers_executed = 0;
+        m_stat_getattribute_calls = 0;
+        m_stat_getattribute_cache_hits = 0;
+        m_stat_getattribute_ticks = 0;
+        m_stat_getattribute_fail_ticks = 0;
     }
 
-    // Transfer the per-execution stats from this context to the shading
-    // system.
+    // Transfer the per-execution stats from this context to our thread's
+    // stats.
     void record_runtime_stats () {
-        shadingsys().m_stat_get_userdata_calls += m_stat_get_userdata_calls;
-        shadingsys().m_stat_layers_executed += m_stat_layers_executed;
+        pvt::ThreadStats &stats (thread_info()->stats);
+        stats.add (pvt::ThreadStats::get_userdata_calls, m_stat_get_userdata_calls);
+        stats.add (pvt::ThreadStats::layers_executed, m_stat_layers_executed);
+        stats.add (pvt::ThreadStats::shading_time_ticks, m_ticks);
+        if (m_stat_getattribute_calls) {
+            stats.add (pvt::ThreadStats::getattribute_calls, m_stat_getattribute_calls);
+            stats.add (pvt::ThreadStats::getattribute_cache_hits, m_stat_getattribute_cache_hits);
+            stats.add (pvt::ThreadStats::getattribute_ticks, m_stat_getattribute_ticks);
+            stats.add (pvt::ThreadStats::getattribute_fail_ticks, m_stat_getattribute_fail_ticks);
+        }
     }
 
     bool allow_warnings() {
@@ -1741,9 +2419,15 @@ public:
     }
 
     // Record an error (or warning, printf, etc.)
-    void record_error (ErrorHandler::ErrCode code, const std::string &text) const;
+    void record_error (ErrorHandler::ErrCode code, string_view text) const;
+    // Record an error (or warning, printf, etc.), formatting it with
+    // vsnprintf straight into the buffer.
+    void record_vprintf (ErrorHandler::ErrCode code, const char *fmt,
+                         va_list args) const;
     // Process all the recorded errors, warnings, printfs
     void process_errors () const;
+    // How many errors (not warnings or printfs) have been recorded, ever.
+    int errors_recorded () const { return m_errors_recorded; }
 
     template<typename... Args>
     inline void errorf(const char* fmt, const Args&... args) const {
@@ -1765,22 +2449,39 @@ public:
         record_error(ErrorHandler::EH_MESSAGE, Strutil::sprintf (fmt, args...));
     }
 
-private:
+    /// The group we're executing, whose code must not be evicted (see
+    /// pin_group), or NULL.
+    const ShaderGroup *pinned_group () const { return m_pinned_group; }
 
-    void free_dict_resources ();
+    // With a JIT memory budget, keep the group's code from being evicted
+    // while we execute it (and note that it was used), until unpinned.
+    // Only this context writes the pin, so executing costs no contention
+    // with other threads; the evictor looks at every context's.
+    void pin_group (ShaderGroup &group);
+    void unpin_group () { m_pinned_group = nullptr; }
+
+private:
 
     ShadingSystemImpl &m_shadingsys;    ///< Backpointer to shadingsys
     RendererServices *m_renderer;       ///< Ptr to renderer services
     PerThreadInfo *m_threadinfo;        ///< Ptr to our thread's info
     mutable TextureSystem::Perthread *m_texture_thread_info; ///< Ptr to texture thread info
     ShaderGroup *m_group;               ///< Ptr to shader group
+    std::atomic<ShaderGroup *> m_pinned_group {nullptr}; ///< Group we pinned
+    int m_tier_executions = 0;          ///< Fast tier runs not yet counted
     std::vector<char> m_heap;           ///< Heap memory
-    typedef std::unordered_map<ustring, std::unique_ptr<regex>, ustringHash> RegexMap;
-    RegexMap m_regex_map;               ///< Compiled regex's
+    typedef std::unordered_map<ustring, const CompiledRegex*, ustringHash> RegexMap;
+    RegexMap m_regex_map;               ///< Regex's this context has used
     MessageList m_messages;             ///< Message blackboard
+    std::vector<char> m_getattribute_state; ///< Per lookup: 0=not yet, 1=ok, 2=failed
+    std::vector<char> m_getattribute_cache; ///< Values of shared lookups
     int m_max_warnings;                 ///< To avoid processing too many warnings
     int m_stat_get_userdata_calls;      ///< Number of calls to get_userdata
     int m_stat_layers_executed;         ///< Number of layers executed
+    int m_stat_getattribute_calls;      ///< Renderer getattribute calls
+    int m_stat_getattribute_cache_hits; ///< getattribute calls avoided
+    long long m_stat_getattribute_ticks;      ///< Time in getattribute
+    long long m_stat_getattribute_fail_ticks; ///<   ... when it failed
     long long m_ticks;                  ///< Time executing the shader
 
     TextureOpt m_textureopt;            ///< texture call options
@@ -1790,11 +2491,29 @@ private:
     SimplePool<20 * 1024> m_closure_pool;
     SimplePool<64 * 1024> m_scratch_pool;
 
-    Dictionary *m_dictionary;
-
-    // Buffering of error messages and printfs
-    typedef std::pair<ErrorHandler::ErrCode, std::string> ErrorItem;
+    // The Dictionary used by dict_find/dict_next/dict_value.  It is
+    // looked up again only at the first dictionary call of an execution,
+    // so that node IDs stay valid for the whole execution even if the
+    // dictionaries are invalidated meanwhile.
+    std::shared_ptr<Dictionary> m_dictionary;
+    int m_dictionary_generation = -1;
+    bool m_dictionary_checked = false;  ///< Looked it up this execution?
+    Dictionary *dictionary ();
+
+    // Note the end of a message just appended to m_buffered_text.
+    void end_record (ErrorHandler::ErrCode code) const;
+
+    // Buffering of error messages and printfs: the text of all of them
+    // back to back in one string (so recording one rarely allocates),
+    // and the kind and end of each.  Each still reaches the ErrorHandler
+    // as a message of its own.
+    struct ErrorItem {
+        ErrorHandler::ErrCode code;
+        size_t end;             ///< end of its text in m_buffered_text
+    };
+    mutable std::string m_buffered_text;
     mutable std::vector<ErrorItem> m_buffered_errors;
+    mutable int m_errors_recorded = 0;
 };
 
 
@@ -1914,6 +2633,11 @@ public:
     /// For debugging, express A's constant value as a string.
     static std::string const_value_as_string (const Symbol &A);
 
+    /// If op is a getattribute whose object name, attribute name, and
+    /// array index (if any) are all constant, describe it in lookup and
+    /// return true.
+    bool getattribute_lookup (const Opcode &op, AttributeLookup &lookup);
+
     /// Set up m_in_conditional[] to be true for all ops that are inside of
     /// conditionals, false for all unconditionally-executed ops,
     /// m_in_loop[] to be true for all ops that are inside a loop, and
@@ -0,0 +1,437 @@
+/*
+Copyright (c) 2009-2019 Sony Pictures Imageworks Inc., et al.
+All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+* Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+* Neither the name of Sony Pictures Imageworks nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <OpenImageIO/strutil.h>
+
+#include "osoreader.h"
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {   // OSL::pvt
+
+
+namespace {   // anon
+
+// Helper: sequential reader of the unaligned values in a binary OSO.
+class BinaryInput {
+public:
+    BinaryInput (const char *begin, const char *end)
+        : m_next(begin), m_end(end) { }
+
+    bool ok () const { return m_ok; }
+
+    template<typename T> T get () {
+        T val = T();
+        if (m_next + sizeof(T) <= m_end) {
+            memcpy (&val, m_next, sizeof(T));
+            m_next += sizeof(T);
+        } else {
+            m_ok = false;
+        }
+        return val;
+    }
+
+    const char *bytes (size_t n) {
+        const char *b = m_next;
+        if (m_next + n <= m_end)
+            m_next += n;
+        else
+            m_ok = false;
+        return b;
+    }
+
+private:
+    const char *m_next, *m_end;
+    bool m_ok = true;
+};
+
+
+
+// An OSOReader that, rather than doing anything with what it reads,
+// records the calls as binary OSO.
+class OSOBinaryWriter : public OSOReader {
+public:
+    OSOBinaryWriter (ErrorHandler *errhandler) : OSOReader (errhandler) { }
+
+    virtual void version (const char *specid, int major, int minor) {
+        event (OSOBinary::EventVersion);
+        str (specid);
+        put<int32_t> (major);
+        put<int32_t> (minor);
+    }
+    virtual void shader (const char *shadertype, const char *name) {
+        event (OSOBinary::EventShader);
+        str (shadertype);
+        str (name);
+    }
+    virtual void symbol (SymType symtype, TypeSpec typespec, const char *name) {
+        event (OSOBinary::EventSymbol);
+        put<uint8_t> (uint8_t(symtype));
+        TypeDesc elem = typespec.simpletype().elementtype();
+        if (typespec.is_structure_based()) {
+            put<uint8_t> (2);
+            str (typespec.structspec()->name().c_str());
+        } else {
+            put<uint8_t> (typespec.is_closure_based() ? 1 : 0);
+            put<uint8_t> (elem.basetype);
+            put<uint8_t> (elem.aggregate);
+            put<uint8_t> (elem.vecsemantics);
+        }
+        put<int32_t> (typespec.simpletype().arraylen);
+        str (name);
+    }
+    virtual void symdefault (int def) {
+        event (OSOBinary::EventSymdefInt);
+        put<int32_t> (def);
+    }
+    virtual void symdefault (float def) {
+        event (OSOBinary::EventSymdefFloat);
+        put<float> (def);
+    }
+    virtual void symdefault (const char *def) {
+        event (OSOBinary::EventSymdefString);
+        str (def);
+    }
+    virtual void parameter_done () {
+        event (OSOBinary::EventParameterDone);
+    }
+    virtual void hint (string_view hintstring) {
+        event (OSOBinary::EventHint);
+        str (hintstring);
+    }
+    virtual void codemarker (const char *name) {
+        event (OSOBinary::EventCodemarker);
+        str (name);
+    }
+    virtual void codeend () {
+        event (OSOBinary::EventCodeend);
+    }
+    virtual void instruction (int label, const char *opcode) {
+        event (OSOBinary::EventInstruction);
+        put<int32_t> (label);
+        str (opcode);
+    }
+    virtual void instruction_arg (const char *name) {
+        event (OSOBinary::EventInstructionArg);
+        str (name);
+    }
+    virtual void instruction_jump (int target) {
+        event (OSOBinary::EventInstructionJump);
+        put<int32_t> (target);
+    }
+    virtual void instruction_end () {
+        event (OSOBinary::EventInstructionEnd);
+    }
+
+    // Assemble the complete binary OSO.
+    void finish (std::string &out) {
+        event (OSOBinary::EventEnd);
+        out.clear ();
+        out.append (OSOBinary::Magic, sizeof(OSOBinary::Magic));
+        append<uint32_t> (out, OSOBinary::Version);
+        append<uint32_t> (out, OSOBinary::ByteOrderMark);
+        append<uint32_t> (out, uint32_t(m_nstrings));
+        append<uint32_t> (out, uint32_t(m_strings.size()));
+        out += m_strings;
+        append<uint32_t> (out, uint32_t(m_events.size()));
+        out += m_events;
+    }
+
+private:
+    template<typename T> static void append (std::string &out, T val) {
+        out.append ((const char *)&val, sizeof(T));
+    }
+    template<typename T> void put (T val) { append (m_events, val); }
+    void event (OSOBinary::Event e) { put<uint8_t> (uint8_t(e)); }
+
+    // Record a string as its index in the string table, adding it to
+    // the table if it's not there yet.
+    void str (string_view s) {
+        std::string key (s);
+        auto found = m_string_index.find (key);
+        uint32_t index;
+        if (found != m_string_index.end()) {
+            index = found->second;
+        } else {
+            index = uint32_t(m_nstrings++);
+            m_string_index[key] = index;
+            m_strings.append (s.data(), s.size());
+            m_strings += '\0';
+        }
+        put<uint32_t> (index);
+    }
+
+    std::string m_events;
+    std::string m_strings;
+    size_t m_nstrings = 0;
+    std::unordered_map<std::string, uint32_t> m_string_index;
+};
+
+}   // anon namespace
+
+
+
+bool
+OSOReader::is_binary (string_view buffer)
+{
+    return buffer.size() >= sizeof(OSOBinary::Magic)
+        && ! memcmp (buffer.data(), OSOBinary::Magic, sizeof(OSOBinary::Magic));
+}
+
+
+
+bool
+OSOReader::parse_binary (string_view buffer)
+{
+    if (! is_binary (buffer)) {
+        m_err.error ("Not a binary oso");
+        return false;
+    }
+    BinaryInput in (buffer.data() + sizeof(OSOBinary::Magic),
+                    buffer.data() + buffer.size());
+    uint32_t version = in.get<uint32_t>();
+    uint32_t byteorder = in.get<uint32_t>();
+    if (! in.ok() || version != OSOBinary::Version
+          || byteorder != OSOBinary::ByteOrderMark) {
+        m_err.error ("Unsupported binary oso (version %d)", (int)version);
+        return false;
+    }
+
+    // The string table is used in place; just find where each one starts.
+    uint32_t nstrings = in.get<uint32_t>();
+    uint32_t strbytes = in.get<uint32_t>();
+    const char *strtab = in.bytes (strbytes);
+    if (! in.ok() || (strbytes && strtab[strbytes-1] != 0)) {
+        m_err.error ("Corrupt binary oso (string table)");
+        return false;
+    }
+    std::vector<const char *> strings;
+    strings.reserve (nstrings);
+    for (const char *s = strtab, *e = strtab + strbytes;  s < e;  s += strlen(s) + 1)
+        strings.push_back (s);
+    if (strings.size() != nstrings) {
+        m_err.error ("Corrupt binary oso (string table)");
+        return false;
+    }
+
+    uint32_t eventbytes = in.get<uint32_t>();
+    const char *events = in.bytes (eventbytes);
+    if (! in.ok()) {
+        m_err.error ("Corrupt binary oso (truncated)");
+        return false;
+    }
+    in = BinaryInput (events, events + eventbytes);
+    bool bad_string = false;
+    auto str = [&]() -> const char * {
+        uint32_t i = in.get<uint32_t>();
+        if (i < strings.size())
+            return strings[i];
+        bad_string = true;
+        return "";
+    };
+
+    // Each event is read in full, and only passed on if all of it was
+    // there (and its strings are in the table), so that nothing from a
+    // truncated or corrupt stream ever reaches the callbacks.
+    auto good = [&]() { return in.ok() && ! bad_string; };
+    for (;;) {
+        uint8_t e = in.get<uint8_t>();
+        if (! good())
+            break;
+        switch (e) {
+        case OSOBinary::EventVersion: {
+            const char *specid = str();
+            int major = in.get<int32_t>();
+            int minor = in.get<int32_t>();
+            if (! good())
+                break;
+            version (specid, major, minor);
+            continue;
+        }
+        case OSOBinary::EventShader: {
+            const char *shadertype = str();
+            const char *name = str();
+            if (! good())
+                break;
+            shader (shadertype, name);
+            continue;
+        }
+        case OSOBinary::EventSymbol: {
+            SymType symtype = (SymType) in.get<uint8_t>();
+            uint8_t kind = in.get<uint8_t>();
+            TypeSpec typespec;
+            if (kind == 2) {
+                typespec = TypeSpec (str(), 0);
+            } else {
+                TypeDesc elem;
+                elem.basetype = in.get<uint8_t>();
+                elem.aggregate = in.get<uint8_t>();
+                elem.vecsemantics = in.get<uint8_t>();
+                typespec = TypeSpec (elem, kind == 1);
+            }
+            int arraylen = in.get<int32_t>();
+            const char *name = str();
+            if (! good() || kind > 2 || symtype > SymTypeConst)
+                break;
+            if (arraylen)
+                typespec.make_array (arraylen);
+            if (symtype == SymTypeTemp && stop_parsing_at_temp_symbols())
+                return true;
+            symbol (symtype, typespec, name);
+            continue;
+        }
+        case OSOBinary::EventSymdefInt: {
+            int i = in.get<int32_t>();
+            if (! good())
+                break;
+            symdefault (i);
+            continue;
+        }
+        case OSOBinary::EventSymdefFloat: {
+            float f = in.get<float>();
+            if (! good())
+                break;
+            symdefault (f);
+            continue;
+        }
+        case OSOBinary::EventSymdefString: {
+            const char *str_val = str();
+            if (! good())
+                break;
+            symdefault (str_val);
+            continue;
+        }
+        case OSOBinary::EventParameterDone:
+            parameter_done ();
+            continue;
+        case OSOBinary::EventHint: {
+            const char *hintstring = str();
+            if (! good())
+                break;
+            hint (hintstring);
+            continue;
+        }
+        case OSOBinary::EventCodemarker: {
+            const char *name = str();
+            if (! good())
+                break;
+            if (! parse_code_section())
+                return true;
+            codemarker (name);
+            continue;
+        }
+        case OSOBinary::EventCodeend:
+            codeend ();
+            continue;
+        case OSOBinary::EventInstruction: {
+            int label = in.get<int32_t>();
+            const char *opcode = str();
+            if (! good())
+                break;
+            instruction (label, opcode);
+            continue;
+        }
+        case OSOBinary::EventInstructionArg: {
+            const char *name = str();
+            if (! good())
+                break;
+            instruction_arg (name);
+            continue;
+        }
+        case OSOBinary::EventInstructionJump: {
+            int target = in.get<int32_t>();
+            if (! good())
+                break;
+            instruction_jump (target);
+            continue;
+        }
+        case OSOBinary::EventInstructionEnd:
+            instruction_end ();
+            continue;
+        case OSOBinary::EventEnd:
+            return true;
+        default:
+            m_err.error ("Corrupt binary oso (unknown event %d)", (int)e);
+            return false;
+        }
+        break;   // an event was cut short or named a bad string
+    }
+    if (! in.ok())
+        m_err.error ("Corrupt binary oso (truncated)");
+    else if (bad_string)
+        m_err.error ("Corrupt binary oso (bad string index)");
+    else
+        m_err.error ("Corrupt binary oso (bad symbol)");
+    return false;
+}
+
+
+
+bool
+OSOReader::text_to_binary (const std::string &text, std::string &binary,
+                           std::string &errmessage)
+{
+    // Collect any errors from the parse into errmessage.
+    class StringErrorHandler : public ErrorHandler {
+    public:
+        StringErrorHandler (std::string &msg) : m_msg(msg) { }
+        virtual void operator() (int errcode, const std::string &msg) {
+            if (errcode >= EH_ERROR) {
+                if (m_msg.size())
+                    m_msg += '\n';
+                m_msg += msg;
+            }
+        }
+    private:
+        std::string &m_msg;
+    };
+    errmessage.clear ();
+    if (is_binary (text)) {
+        binary = text;   // Already binary
+        return true;
+    }
+    StringErrorHandler errhandler (errmessage);
+    OSOBinaryWriter writer (&errhandler);
+    if (! writer.parse_memory (text)) {
+        if (errmessage.empty())
+            errmessage = "Failed to parse oso";
+        return false;
+    }
+    writer.finish (binary);
+    return true;
+}
+
+
+}; // namespace pvt
+OSL_NAMESPACE_EXIT
@@ -68,6 +68,21 @@ public:
     /// an unrecoverable error reading.
     virtual bool parse_memory (const std::string &buffer);
 
+    /// Call the various callbacks for OSO in the compact binary form (see
+    /// OSOBinary below).  parse_file and parse_memory do this themselves
+    /// when handed binary OSO.  Unlike parsing text, this needs no lock,
+    /// so many threads may read binary OSO at once.
+    bool parse_binary (string_view buffer);
+
+    /// Does the buffer hold binary (rather than text) OSO?
+    static bool is_binary (string_view buffer);
+
+    /// Convert text OSO to the equivalent binary OSO.  Return true if
+    /// successful, false (and leave an explanation in errmessage) if the
+    /// text could not be parsed.
+    static bool text_to_binary (const std::string &text, std::string &binary,
+                                std::string &errmessage);
+
     /// Declare the shader version.
     ///
     virtual void version (const char *specid, int major, int minor) { }
@@ -155,5 +170,50 @@ private:
 OSL_PRAGMA_WARNING_POP
 
 
+
+/// Binary OSO is a recording of the sequence of OSOReader callbacks that
+/// parsing the equivalent text OSO would make, so that reading it back
+/// just replays them, with no lexing, no parsing, and no conversion of
+/// numbers from text.  The layout is:
+///
+///     char     magic[4]      "OSOB"
+///     uint32   version       OSOBinary::Version
+///     uint32   byteorder     0x01020304, as written by this machine
+///     uint32   nstrings      number of strings in the string table
+///     uint32   strbytes      size of the string table
+///     char     strings[]     nstrings NUL-terminated strings, packed
+///     uint32   eventbytes    size of the event stream
+///     uint8    events[]      the recorded callbacks
+///
+/// Each event is a one-byte Event tag, followed by its arguments: uint32
+/// string table indices for strings, and raw int32/float for numbers.
+/// Symbol types are a uint8 kind (0=simple, 1=closure, 2=struct), then
+/// either the uint8 basetype, aggregate, and vecsemantics of the element
+/// type, or the string index of the struct name, then an int32 array
+/// length.  Multi-byte values are unaligned and in native byte order.
+namespace OSOBinary {
+    static const char Magic[4] = { 'O', 'S', 'O', 'B' };
+    enum { Version = 1 };
+    const uint32_t ByteOrderMark = 0x01020304;
+    enum Event {
+        EventVersion = 1,   // specid, major, minor
+        EventShader,        // shadertype, name
+        EventSymbol,        // symtype, typespec, name
+        EventSymdefInt,     // value
+        EventSymdefFloat,   // value
+        EventSymdefString,  // value
+        EventParameterDone,
+        EventHint,          // hintstring
+        EventCodemarker,    // name
+        EventCodeend,
+        EventInstruction,   // label, opcode
+        EventInstructionArg,    // name
+        EventInstructionJump,   // target
+        EventInstructionEnd,
+        EventEnd
+    };
+};
+
+
 }; // namespace pvt
 OSL_NAMESPACE_EXIT
@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <cstdarg>
+#include <atomic>
 
 #include "oslexec_pvt.h"
 using namespace OSL;
@@ -58,6 +59,14 @@ public:
     const Partio::ParticlesData* read_access() const { OSL_DASSERT(!m_write); return m_partio_cloud; }
     Partio::ParticlesDataMutable* write_access() const { OSL_DASSERT(m_write); return m_partio_cloud; }
 
+    // Look up an attribute of a cloud opened for reading.  Unlike
+    // m_attributes[name], this never modifies the map, so it is safe to
+    // call from many threads at once.
+    Partio::ParticleAttribute *find_attribute (ustring name) const {
+        AttributeMap::const_iterator found = m_attributes.find (name);
+        return found != m_attributes.end() ? found->second.get() : NULL;
+    }
+
     ustring m_filename;
 private:
     // hide just this field, because we want to control how it is accessed
@@ -77,6 +86,15 @@ static PointCloudMap pointclouds;
 static spin_mutex pointcloudmap_mutex;
 static ustring u_position ("position");
 
+// Lock-free index of the clouds in the map above, so that the lookup done
+// by every pointcloud_search/get call doesn't need pointcloudmap_mutex.
+// Slots are filled (while holding the mutex) but never cleared or
+// changed, and PointClouds are never destroyed before exit, so readers
+// can probe without locking.  If the table fills up, the remaining
+// clouds are found through the locked map as before.
+static const int PointCloudTableSize = 256;   // must be a power of 2
+static std::atomic<PointCloud *> pointcloud_table[PointCloudTableSize];
+
 
 // some helper classes to make the sort easy
 typedef std::pair<float,int> SortedPointRecord;  // dist,index
@@ -93,6 +111,18 @@ PointCloud::get (ustring filename, bool write)
 {
     if (filename.empty())
         return NULL;
+
+    // Fast path: probe the lock-free table.
+    size_t hash = filename.hash();
+    for (int i = 0;  i < PointCloudTableSize;  ++i) {
+        PointCloud *pc = pointcloud_table[(hash + i) & (PointCloudTableSize-1)]
+                             .load (std::memory_order_acquire);
+        if (! pc)
+            break;
+        if (pc->m_filename == filename)
+            return pc;
+    }
+
     spin_lock lock (pointcloudmap_mutex);
     PointCloudMap::const_iterator found = pointclouds.find(filename);
     if (found != pointclouds.end())
@@ -108,6 +138,14 @@ PointCloud::get (ustring filename, bool write)
     }
     PointCloud *pc = new PointCloud (filename, partio_cloud, write);
     pointclouds[filename].reset (pc);
+    // Publish to the lock-free table, after the cloud is fully set up.
+    for (int i = 0;  i < PointCloudTableSize;  ++i) {
+        std::atomic<PointCloud *> &slot (pointcloud_table[(hash + i) & (PointCloudTableSize-1)]);
+        if (! slot.load (std::memory_order_relaxed)) {
+            slot.store (pc, std::memory_order_release);
+            break;
+        }
+    }
     return pc;
 }
 
@@ -224,6 +262,35 @@ TypeDescOfPartioType (const Partio::ParticleAttribute *ptype)
     return type;
 }
 
+
+
+// Find up to max_points points within radius of center, returning their
+// indices and squared distances (optionally sorted nearest first), and
+// the number found. If sorting, the caller supplies sorted, temp space
+// for max_points records, so that a batch can reuse it for every search.
+int
+find_points (const Partio::ParticlesData *cloud,
+             const OSL::Vec3 &center, float radius, int max_points,
+             SortedPointRecord *sorted, Partio::ParticleIndex *indices,
+             float *dist2)
+{
+    float finalRadius;
+    int count = cloud->findNPoints (&center[0], max_points, radius,
+                                    indices, dist2, &finalRadius);
+
+    // If sorting, sort the distances and indices at the same time.
+    if (sorted && count > 1) {
+        for (int i = 0;  i < count;  ++i)
+            sorted[i] = SortedPointRecord (dist2[i], indices[i]);
+        std::sort (sorted, sorted+count, SortedPointCompare());
+        for (int i = 0;  i < count;  ++i) {
+            dist2[i] = sorted[i].first;
+            indices[i] = sorted[i].second;
+        }
+    }
+    return count;
+}
+
 #endif
 
 }  // anon namespace
@@ -260,7 +327,7 @@ RendererServices::pointcloud_search (ShaderGlobals *sg,
     // found point's positions.
     Partio::ParticleAttribute *pos_attr = NULL;
     if (derivs_offset) {
-        pos_attr = pc->m_attributes[u_position].get();
+        pos_attr = pc->find_attribute (u_position);
         if (! pos_attr)
             return 0;   // No "position" attribute -- fail
     }
@@ -276,22 +343,12 @@ RendererServices::pointcloud_search (ShaderGlobals *sg,
     if (! dist2)  // If not supplied, allocate our own
         dist2 = (float *)sg->context->alloc_scratch (max_points*sizeof(float), sizeof(float));
 
-    float finalRadius;
-    int count = cloud->findNPoints (&center[0], max_points, radius,
-                                    indices, dist2, &finalRadius);
+    SortedPointRecord *sorted = NULL;
+    if (sort)
+        sorted = (SortedPointRecord *) sg->context->alloc_scratch (max_points * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
 
-    // If sorting, allocate some temp space and sort the distances and
-    // indices at the same time.
-    if (sort && count > 1) {
-        SortedPointRecord *sorted = (SortedPointRecord *) sg->context->alloc_scratch (count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
-        for (int i = 0;  i < count;  ++i)
-            sorted[i] = SortedPointRecord (dist2[i], indices[i]);
-        std::sort (sorted, sorted+count, SortedPointCompare());
-        for (int i = 0;  i < count;  ++i) {
-            dist2[i] = sorted[i].first;
-            indices[i] = sorted[i].second;
-        }
-    }
+    int count = find_points (cloud, center, radius, max_points,
+                             sorted, indices, dist2);
 
     if (out_distances) {
         // Convert the squared distances to straight distances
@@ -334,6 +391,61 @@ RendererServices::pointcloud_search (ShaderGlobals *sg,
 
 
 
+int
+RendererServices::pointcloud_search_batch (ShaderGlobals *sg,
+                                           ustring filename, int npoints,
+                                           const OSL::Vec3 *centers,
+                                           float radius, int max_points,
+                                           bool sort, size_t *out_indices,
+                                           float *out_distances,
+                                           int *out_counts)
+{
+    for (int p = 0;  p < npoints;  ++p)
+        out_counts[p] = 0;
+#ifdef USE_PARTIO
+    if (filename.empty() || npoints <= 0)
+        return 0;
+    // Resolve the cloud just once for the whole batch.
+    PointCloud *pc = PointCloud::get(filename);
+    const Partio::ParticlesData *cloud = pc ? pc->read_access() : NULL;
+    if (cloud == NULL) { // The file failed to load
+        sg->context->errorf("pointcloud_search: could not open \"%s\"", filename);
+        return 0;
+    }
+    if (cloud->numParticles() == 0)
+       return 0;
+
+    // As in pointcloud_search, we rely on size_t and ParticleIndex being
+    // the same size.
+    float *dist2 = out_distances;
+    if (! dist2)  // If not supplied, allocate our own
+        dist2 = (float *)sg->context->alloc_scratch (max_points*sizeof(float), sizeof(float));
+    // One sort buffer serves every search in the batch.
+    SortedPointRecord *sorted = NULL;
+    if (sort)
+        sorted = (SortedPointRecord *) sg->context->alloc_scratch (max_points * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
+
+    int total = 0;
+    for (int p = 0;  p < npoints;  ++p) {
+        Partio::ParticleIndex *indices = (Partio::ParticleIndex *)out_indices + size_t(p) * max_points;
+        float *d2 = out_distances ? dist2 + size_t(p) * max_points : dist2;
+        int count = find_points (cloud, centers[p], radius, max_points,
+                                 sorted, indices, d2);
+        if (out_distances) {
+            for (int i = 0; i < count; ++i)
+                d2[i] = sqrtf(d2[i]);
+        }
+        out_counts[p] = count;
+        total += count;
+    }
+    return total;
+#else
+    return 0;
+#endif
+}
+
+
+
 int
 RendererServices::pointcloud_get (ShaderGlobals *sg,
                                   ustring filename, size_t *indices, int count,
@@ -357,7 +469,7 @@ RendererServices::pointcloud_get (ShaderGlobals *sg,
     }
 
     // lookup the ParticleAttribute pointer needed for a query
-    Partio::ParticleAttribute *attr = pc->m_attributes[attr_name].get();
+    Partio::ParticleAttribute *attr = pc->find_attribute (attr_name);
     if (! attr) {
         sg->context->errorf("Accessing unexisting attribute %s in pointcloud \"%s\"", attr_name, filename);
         return 0;
@@ -517,7 +629,7 @@ osl_pointcloud_search (ShaderGlobals *sg, const char *filename, void *center, fl
         for(int i = 0; i < count; ++i)
             ((int *)out_indices)[i] = indices[i];
 
-    shadingsys.pointcloud_stats (1, 0, count);
+    shadingsys.pointcloud_stats (sg->context->thread_info(), 1, 0, count);
 
     return count;
 }
@@ -536,7 +648,7 @@ osl_pointcloud_get (ShaderGlobals *sg, const char *filename, void *in_indices, i
     for (int i = 0; i < count; ++i)
         indices[i] = ((int *)in_indices)[i];
 
-    shadingsys.pointcloud_stats (0, 1, 0);
+    shadingsys.pointcloud_stats (sg->context->thread_info(), 0, 1, 0);
 
     return sg->renderer->pointcloud_get (sg, USTR(filename), (size_t *)indices, count, USTR(attr_name),
                                          TYPEDESC(attr_type), out_data);
@@ -565,7 +677,7 @@ osl_pointcloud_write (ShaderGlobals *sg, const char *filename, const Vec3 *pos,
     if (shadingsys.no_pointcloud()) // Debug mode to skip pointcloud expense
         return 0;
 
-    shadingsys.pointcloud_stats (0, 0, 0, 1);
+    shadingsys.pointcloud_stats (sg->context->thread_info(), 0, 0, 0, 1);
     return sg->renderer->pointcloud_write (sg, USTR(filename), *pos,
                                            nattribs, names, types, values);
 }
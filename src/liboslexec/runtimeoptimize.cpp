@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <vector>
+#include <algorithm>
 #include <cstdio>
 #include <cmath>
 
@@ -123,7 +124,7 @@ RuntimeOptimizer::RuntimeOptimizer (ShadingSystemImpl &shadingsys,
       m_pass(0),
       m_next_newconst(0), m_next_newtemp(0),
       m_stat_opt_locking_time(0), m_stat_specialization_time(0),
-      m_stop_optimizing(false),
+      m_stop_optimizing(false), m_renderer_folds(false),
       m_raytypes_on(group.raytypes_on()), m_raytypes_off(group.raytypes_off())
 {
     memset ((char *)&m_shaderglobals, 0, sizeof(ShaderGlobals));
@@ -781,6 +782,41 @@ OSOProcessorBase::is_nonzero (const Symbol &A)
 
 
 
+bool
+OSOProcessorBase::getattribute_lookup (const Opcode &op,
+                                       AttributeLookup &lookup)
+{
+    // Same argument conventions as llvm_gen_getattribute
+    int nargs = op.nargs();
+    if (nargs < 3 || nargs > 5)
+        return false;
+    bool array_lookup = opargsym(op,nargs-2)->typespec().is_int();
+    bool object_lookup = opargsym(op,2)->typespec().is_string() && nargs >= 4;
+    const Symbol &Attribute (*opargsym (op, object_lookup ? 2 : 1));
+    const Symbol &Destination (*opargsym (op, nargs-1));
+    if (! Attribute.is_constant())
+        return false;
+    lookup = AttributeLookup();
+    if (object_lookup) {
+        const Symbol &ObjectName (*opargsym (op, 1));
+        if (! ObjectName.is_constant())
+            return false;
+        lookup.object = *(const ustring *)ObjectName.data();
+    }
+    if (array_lookup) {
+        const Symbol &Index (*opargsym (op, nargs-2));
+        if (! Index.is_constant())
+            return false;
+        lookup.index = *(const int *)Index.data();
+    }
+    lookup.name = *(const ustring *)Attribute.data();
+    lookup.type = Destination.typespec().simpletype();
+    lookup.derivs = Destination.has_derivs();
+    return true;
+}
+
+
+
 std::string
 OSOProcessorBase::const_value_as_string (const Symbol &A)
 {
@@ -1833,13 +1869,17 @@ void
 RuntimeOptimizer::catalog_symbol_writes (int opbegin, int opend,
                                          FastIntSet &syms)
 {
+    // Gather first and insert as one range: inserting one at a time into
+    // the flat set is quadratic in the size of a big loop body.
+    std::vector<int> writes;
     for (int i = opbegin; i < opend; ++i) {
         const Opcode &op (inst()->ops()[i]);
         for (int a = 0, nargs = op.nargs();  a < nargs;  ++a) {
             if (op.argwrite(a))
-                syms.insert (oparg (op, a));
+                writes.push_back (oparg (op, a));
         }
     }
+    syms.insert (writes.begin(), writes.end());
 }
 
 
@@ -2446,7 +2486,7 @@ RuntimeOptimizer::track_variable_lifetimes ()
 }
 
 
-// This has O(n^2) memory usage, so only for debugging
+// Print the dependency graph of each instance, only for debugging
 //#define DEBUG_SYMBOL_DEPENDENCIES
 
 // Add to the dependency map that "symbol A depends on symbol B".
@@ -2455,13 +2495,7 @@ RuntimeOptimizer::add_dependency (SymDependency &dmap, int A, int B)
 {
     OSL_DASSERT (A < (int)inst()->symbols().size());
     OSL_DASSERT (B < (int)inst()->symbols().size());
-    dmap[A].insert (B);
-
-#ifdef DEBUG_SYMBOL_DEPENDENCIES
-    // Unification -- make all of B's dependencies be dependencies of A.
-    for (auto&& r : dmap[B])
-        dmap[A].insert (r);
-#endif
+    dmap.add (A, B);
 }
 
 
@@ -2488,21 +2522,27 @@ RuntimeOptimizer::syms_used_in_op (Opcode &op, std::vector<int> &rsyms,
 static const int DerivSym = -1;
 
 
-// Recursively mark symbols that have derivatives from dependency map
+// Mark every symbol reachable from d in the dependency map as needing
+// derivatives.  This walks the graph with an explicit stack rather than
+// recursion, since dependency chains in big shaders can be very long.
 void
-RuntimeOptimizer::mark_symbol_derivatives (SymDependency &symdeps, SymIntSet &visited, int d)
-{
-    for (auto&& r : symdeps[d]) {
-        if (visited.find(r) == visited.end()) {
-            visited.insert(r);
-            
-            Symbol *s = inst()->symbol(r);
-
-            if (! s->typespec().is_closure_based() && 
-                    s->typespec().elementtype().is_floatbased())
-                s->has_derivs (true);
-
-            mark_symbol_derivatives(symdeps, visited, r);
+RuntimeOptimizer::mark_symbol_derivatives (const SymDependency &symdeps, int d)
+{
+    std::vector<bool> visited (symdeps.nsyms(), false);
+    std::vector<int> stack;
+    stack.push_back (d);
+    while (! stack.empty()) {
+        int s = stack.back();
+        stack.pop_back ();
+        for (const int *r = symdeps.begin(s), *e = symdeps.end(s);  r != e;  ++r) {
+            if (visited[*r])
+                continue;
+            visited[*r] = true;
+            Symbol *sym = inst()->symbol(*r);
+            if (! sym->typespec().is_closure_based() &&
+                    sym->typespec().elementtype().is_floatbased())
+                sym->has_derivs (true);
+            stack.push_back (*r);
         }
     }
 }
@@ -2517,6 +2557,7 @@ void
 RuntimeOptimizer::track_variable_dependencies ()
 {
     SymDependency symdeps;
+    symdeps.reset ((int)inst()->symbols().size());
 
     // It's important to note that this is simplistically conservative
     // in that it overestimates dependencies.  To see why this is the
@@ -2546,8 +2587,6 @@ RuntimeOptimizer::track_variable_dependencies ()
     // cause them to be reassigned in exactly the way that confuses this
     // analysis).
 
-    symdeps.clear ();
-
     std::vector<int> read, written;
     bool forcederivs = shadingsys().force_derivs();
     // Loop over all ops...
@@ -2614,8 +2653,8 @@ RuntimeOptimizer::track_variable_dependencies ()
     }
 
     // Mark all symbols needing derivatives as such
-    SymIntSet visited;
-    mark_symbol_derivatives (symdeps, visited, DerivSym);
+    symdeps.finalize ();
+    mark_symbol_derivatives (symdeps, DerivSym);
 
     // Only some globals are allowed to have derivatives
     for (auto&& s : inst()->symbols()) {
@@ -2633,38 +2672,37 @@ RuntimeOptimizer::track_variable_dependencies ()
 
     std::cerr << "track_variable_dependencies\n";
     std::cerr << "\nDependencies:\n";
-    for (auto&& m : symdeps) {
-        if (m.first == DerivSym)
+    for (int m = DerivSym;  m < symdeps.nsyms();  ++m) {
+        if (symdeps.begin(m) == symdeps.end(m))
+            continue;
+        if (m == DerivSym)
             std::cerr << "$derivs depends on ";
         else
-            std::cerr << inst->symbol(m.first)->mangled() << " depends on ";
-        for (auto&& d : m.second) {
-            if (d == DerivSym)
-                std::cerr << "$derivs ";
-            else
-                std::cerr << inst->symbol(d)->mangled() << ' ';
-        }
+            std::cerr << inst()->symbol(m)->mangled() << " depends on ";
+        for (const int *d = symdeps.begin(m);  d != symdeps.end(m);  ++d)
+            std::cerr << inst()->symbol(*d)->mangled() << ' ';
         std::cerr << "\n";
     }
     std::cerr << "\n\n";
 
     // Invert the dependency
     SymDependency influences;
-    for (auto&& m : symdeps)
-        for (auto&& d : m.second)
-            influences[d].insert (m.first);
+    influences.reset (symdeps.nsyms());
+    for (int m = DerivSym;  m < symdeps.nsyms();  ++m)
+        for (const int *d = symdeps.begin(m);  d != symdeps.end(m);  ++d)
+            influences.add (*d, m);
+    influences.finalize ();
 
     std::cerr << "\nReverse dependencies:\n";
-    for (auto&& m : influences) {
-        if (m.first == DerivSym)
-            std::cerr << "$derivs contrbutes to ";
-        else
-            std::cerr << inst->symbol(m.first)->mangled() << " contributes to ";
-        for (auto&& d : m.second) {
-            if (d == DerivSym)
+    for (int m = 0;  m < influences.nsyms();  ++m) {
+        if (influences.begin(m) == influences.end(m))
+            continue;
+        std::cerr << inst()->symbol(m)->mangled() << " contributes to ";
+        for (const int *d = influences.begin(m);  d != influences.end(m);  ++d) {
+            if (*d == DerivSym)
                 std::cerr << "$derivs ";
             else
-                std::cerr << inst->symbol(d)->mangled() << ' ';
+                std::cerr << inst()->symbol(*d)->mangled() << ' ';
         }
         std::cerr << "\n";
     }
@@ -3014,16 +3052,9 @@ RuntimeOptimizer::printinst (std::ostream &out) const
 
 
 void
-RuntimeOptimizer::run ()
+RuntimeOptimizer::specialize (size_t &old_nsyms, size_t &old_nops)
 {
-    Timer rop_timer;
     int nlayers = (int) group().nlayers ();
-    if (debug())
-        shadingcontext()->infof("About to optimize shader group %s (%d layers):",
-                           group().name(), nlayers);
-    if (debug())
-        std::cout << "About to optimize shader group " << group().name() << "\n";
-
     for (int layer = 0;  layer < nlayers;  ++layer) {
         set_inst (layer);
         // These need to happen before merge_instances
@@ -3032,7 +3063,8 @@ RuntimeOptimizer::run ()
     }
 
     // Inventory the network and print pre-optimized debug info
-    size_t old_nsyms = 0, old_nops = 0;
+    old_nsyms = 0;
+    old_nops = 0;
     for (int layer = 0;  layer < nlayers;  ++layer) {
         set_inst (layer);
         if (debug() /* && optimize() >= 1*/) {
@@ -3106,7 +3138,6 @@ RuntimeOptimizer::run ()
     shadingsys().merge_instances (group(), true);
 
     // Get rid of nop instructions and unused symbols.
-    size_t new_nsyms = 0, new_nops = 0, new_deriv_syms = 0;
     for (int layer = 0;  layer < nlayers;  ++layer) {
         set_inst (layer);
         if (inst()->unused())
@@ -3122,10 +3153,50 @@ RuntimeOptimizer::run ()
             printinst (std::cout);
             std::cout << "\n--------------------------------\n" << std::endl;
         }
-        new_nsyms += inst()->symbols().size();
-        new_nops += inst()->ops().size();
     }
+}
+
 
+
+void
+RuntimeOptimizer::run ()
+{
+    Timer rop_timer;
+    int nlayers = (int) group().nlayers ();
+    if (debug())
+        shadingcontext()->infof("About to optimize shader group %s (%d layers):",
+                           group().name(), nlayers);
+    if (debug())
+        std::cout << "About to optimize shader group " << group().name() << "\n";
+
+    // A group identical to one we optimized before can take its result.
+    std::string spec_key;
+    if (! debug())
+        spec_key = shadingsys().specialization_key (group());
+    std::shared_ptr<GroupSpecialization> spec;
+    if (spec_key.size())
+        spec = shadingsys().find_specialization (spec_key);
+    size_t old_nsyms = 0, old_nops = 0;
+    if (spec) {
+        for (int layer = 0;  layer < nlayers;  ++layer)
+            group()[layer]->restore_specialization (spec->layers[layer]);
+        old_nsyms = spec->preopt_syms;
+        old_nops = spec->preopt_ops;
+    } else {
+        specialize (old_nsyms, old_nops);
+        if (spec_key.size() && ! m_renderer_folds) {
+            spec = std::make_shared<GroupSpecialization>();
+            spec->layers.resize (nlayers);
+            for (int layer = 0;  layer < nlayers;  ++layer)
+                group()[layer]->save_specialization (spec->layers[layer]);
+            spec->preopt_syms = old_nsyms;
+            spec->preopt_ops = old_nops;
+            spec->time = rop_timer();
+            shadingsys().add_specialization (spec_key, spec);
+        }
+    }
+
+    size_t new_nsyms = 0, new_nops = 0, new_deriv_syms = 0;
     m_unknown_textures_needed = false;
     m_unknown_closures_needed = false;
     m_unknown_attributes_needed = false;
@@ -3136,11 +3207,18 @@ RuntimeOptimizer::run ()
     m_globals_needed.clear();
     m_userdata_needed.clear();
     m_attributes_needed.clear();
+    m_getattribute_lookups.clear();
+    // Constant getattribute lookups, in the order first seen, with how
+    // many times each one appears; and where each is in that list.
+    std::vector<std::pair<AttributeLookup,int>> getattribute_lookups;
+    std::map<AttributeLookup,int> getattribute_lookup_index;
     bool does_nothing = true;
     for (int layer = 0;  layer < nlayers;  ++layer) {
         set_inst (layer);
         if (inst()->unused())
             continue;  // no need to print or gather stats for unused layers
+        new_nsyms += inst()->symbols().size();
+        new_nops += inst()->ops().size();
         FOREACH_SYM (Symbol &s, inst()) {
             // set the layer numbers
             s.layer (layer);
@@ -3227,10 +3305,26 @@ RuntimeOptimizer::run ()
                 } else { // sym1 not constant
                     m_unknown_attributes_needed = true;
                 }
+                AttributeLookup lookup;
+                if (shadingsys().m_getattribute_cache &&
+                      getattribute_lookup (op, lookup)) {
+                    auto found = getattribute_lookup_index.find (lookup);
+                    if (found != getattribute_lookup_index.end()) {
+                        getattribute_lookups[found->second].second += 1;
+                    } else {
+                        getattribute_lookup_index[lookup] = int(getattribute_lookups.size());
+                        getattribute_lookups.emplace_back (lookup, 1);
+                    }
+                }
             }
         }
     }
     group().does_nothing (does_nothing);
+    // Lookups made more than once (in any layers) will share one call
+    // to the renderer per execution.
+    for (auto&& g : getattribute_lookups)
+        if (g.second > 1)
+            m_getattribute_lookups.push_back (g.first);
 
     m_stat_specialization_time = rop_timer();
     {
@@ -3274,6 +3368,11 @@ RuntimeOptimizer::run ()
             if (m_unknown_attributes_needed)
                 shadingcontext()->infof("    Also may construct attribute names on the fly.");
         }
+        if (m_getattribute_lookups.size()) {
+            shadingcontext()->infof("Group shares repeated getattribute calls:");
+            for (auto&& a : m_getattribute_lookups)
+                shadingcontext()->infof("    %s %s %s", a.object, a.name, a.type);
+        }
     }
 }
 
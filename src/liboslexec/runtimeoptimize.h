@@ -34,7 +34,6 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/container/flat_map.hpp>
 #include <boost/container/flat_set.hpp>
-#define USE_FLAT_MAP 1
 
 #include "oslexec_pvt.h"
 using namespace OSL;
@@ -45,13 +44,64 @@ OSL_NAMESPACE_ENTER
 
 namespace pvt {   // OSL::pvt
 
-#if USE_FLAT_MAP
 typedef boost::container::flat_map<int,int> FastIntMap;
 typedef boost::container::flat_set<int> FastIntSet;
-#else
-typedef std::map<int,int> FastIntMap;
-typedef std::set<int> FastIntSet;
-#endif
+
+
+
+/// Symbol dependency graph: for each symbol, the list of symbols it
+/// depends on.  Edges are accumulated with add(), then finalize() packs
+/// them into compressed sparse rows (one offset array plus one flat
+/// array of dependencies), so the whole graph costs two allocations no
+/// matter how many symbols the shader has.  Row -1 is valid and is used
+/// for the pseudo-symbol that stands for "needs derivatives".
+class SymDependency {
+public:
+    /// Discard all edges and prepare for a graph of nsyms symbols.
+    void reset (int nsyms) {
+        m_nsyms = nsyms;
+        m_edges.clear ();
+        m_begin.clear ();
+        m_deps.clear ();
+    }
+
+    int nsyms () const { return m_nsyms; }
+
+    /// Record that symbol A depends on symbol B.
+    void add (int A, int B) {
+        OSL_DASSERT (A >= -1 && A < m_nsyms && B >= -1 && B < m_nsyms);
+        m_edges.emplace_back (A, B);
+    }
+
+    /// Pack the edges added so far into rows.  Must be called before
+    /// begin()/end() are used.
+    void finalize () {
+        m_begin.assign (m_nsyms + 2, 0);
+        for (auto&& e : m_edges)
+            ++m_begin[e.first + 2];
+        for (int i = 2;  i < m_nsyms + 2;  ++i)
+            m_begin[i] += m_begin[i-1];
+        // Now row A starts at m_begin[A+1].  Filling it advances that to
+        // where the row ends, so shift the offsets back up a slot after.
+        m_deps.resize (m_edges.size());
+        for (auto&& e : m_edges)
+            m_deps[m_begin[e.first + 1]++] = e.second;
+        for (int i = m_nsyms + 1;  i > 0;  --i)
+            m_begin[i] = m_begin[i-1];
+        m_begin[0] = 0;
+        std::vector<std::pair<int,int>>().swap (m_edges);
+    }
+
+    /// Range of the symbols that A depends on (possibly with repeats).
+    const int *begin (int A) const { return m_deps.data() + m_begin[A + 1]; }
+    const int *end (int A) const { return m_deps.data() + m_begin[A + 2]; }
+
+private:
+    int m_nsyms = 0;
+    std::vector<std::pair<int,int>> m_edges;  // unpacked (A, B) pairs
+    std::vector<int> m_begin;   // row A is m_deps[m_begin[A+1] .. m_begin[A+2])
+    std::vector<int> m_deps;
+};
 
 
 
@@ -65,6 +115,12 @@ public:
 
     virtual void run ();
 
+    /// Copy the code of each layer of the group from its master,
+    /// optimize it, and merge identical instances -- the heavy lifting
+    /// of run().  Return the numbers of symbols and ops before
+    /// optimization.
+    void specialize (size_t &old_nsyms, size_t &old_nops);
+
     virtual void set_inst (int layer);
 
     virtual void set_debug ();
@@ -78,6 +134,12 @@ public:
     int raytypes_on ()  const { return m_raytypes_on; }
     int raytypes_off () const { return m_raytypes_off; }
 
+    /// Note that a constant fold used an answer from the renderer (an
+    /// attribute, texture info, named matrix, or point cloud), which it
+    /// may give differently later, so the result must not be reused by
+    /// an identical group as a saved specialization.
+    void renderer_fold () { m_renderer_folds = true; }
+
     /// Optimize one layer of a group, given what we know about its
     /// instance variables and connections.
     void optimize_instance ();
@@ -306,11 +368,6 @@ public:
     void track_variable_lifetimes ();
     void track_variable_lifetimes (const SymbolPtrVec &allsymptrs);
 
-    /// For each symbol, have a list of the symbols it depends on (or that
-    /// depends on it).
-    typedef std::set<int> SymIntSet;
-    typedef std::map<int, SymIntSet> SymDependency;
-
     void syms_used_in_op (Opcode &op,
                           std::vector<int> &rsyms, std::vector<int> &wsyms);
 
@@ -318,7 +375,7 @@ public:
 
     void add_dependency (SymDependency &dmap, int A, int B);
 
-    void mark_symbol_derivatives (SymDependency &symdeps, SymIntSet &visited, int d);
+    void mark_symbol_derivatives (const SymDependency &symdeps, int d);
 
     void mark_outgoing_connections ();
 
@@ -446,6 +503,7 @@ private:
     int m_globals_read = 0;
     int m_globals_write = 0;
     std::set<AttributeNeeded> m_attributes_needed;
+    std::vector<AttributeLookup> m_getattribute_lookups; ///< Repeated getattributes
     bool m_unknown_textures_needed;
     bool m_unknown_closures_needed;
     bool m_unknown_attributes_needed;
@@ -453,6 +511,7 @@ private:
     double m_stat_opt_locking_time;       ///<   locking time
     double m_stat_specialization_time;    ///<   specialization time
     bool m_stop_optimizing;           ///< for debugging
+    bool m_renderer_folds;            ///< Folded a renderer's answer?
     int m_raytypes_on;                ///< Ray types known to be on
     int m_raytypes_off;               ///< Ray types known to be off
 
@@ -32,6 +32,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <fstream>
 #include <cstdlib>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #include "oslexec_pvt.h"
 #include <OSL/genclosure.h>
@@ -424,6 +426,14 @@ ShadingSystem::getstats (int level) const
 
 
 
+std::string
+ShadingSystem::profile_report (string_view format) const
+{
+    return m_impl->profile_report (format);
+}
+
+
+
 void
 ShadingSystem::register_closure (string_view name, int id,
                                  const ClosureParam *params,
@@ -500,9 +510,34 @@ ShadingSystem::raytype_bit (ustring name)
 
 
 void
-ShadingSystem::optimize_all_groups (int nthreads)
+ShadingSystem::optimize_all_groups (int nthreads, OIIO::thread_pool *pool)
+{
+    return m_impl->optimize_all_groups (nthreads, pool);
+}
+
+
+
+void
+ShadingSystem::optimize_all_groups_async (std::function<void(ShaderGroup*,bool)> ready,
+                                          OIIO::thread_pool *pool)
+{
+    m_impl->optimize_all_groups_async (ready, pool);
+}
+
+
+
+void
+ShadingSystem::wait_for_jit ()
 {
-    return m_impl->optimize_all_groups (nthreads);
+    m_impl->wait_for_jit ();
+}
+
+
+
+void
+ShadingSystem::invalidate_dictionaries ()
+{
+    m_impl->invalidate_dictionaries ();
 }
 
 
@@ -676,8 +711,19 @@ ShadingSystem::convert_value (void *dst, TypeDesc dsttype,
 
 
 
-PerThreadInfo::PerThreadInfo ()
+// Guards every PerThreadInfo::shadingsys.  A thread info may outlive its
+// ShadingSystem, so this can't be a mutex of the ShadingSystem: the thread
+// info would have to read the pointer to find the mutex.  Held while
+// unregistering, so the ShadingSystem can't go away in the middle.
+static mutex thread_info_shadingsys_mutex;
+
+
+
+PerThreadInfo::PerThreadInfo (pvt::ShadingSystemImpl *shadingsys)
+    : shadingsys(shadingsys)
 {
+    if (shadingsys)
+        shadingsys->register_thread_info (this);
 }
 
 
@@ -686,6 +732,42 @@ PerThreadInfo::~PerThreadInfo ()
 {
     while (! context_pool.empty())
         delete pop_context ();
+    lock_guard lock (thread_info_shadingsys_mutex);
+    if (shadingsys)
+        shadingsys->unregister_thread_info (this);
+}
+
+
+
+// Clock for the detailed profile, in nanoseconds.
+static inline long long
+profile_clock ()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+void
+PerThreadInfo::profile_begin (int site)
+{
+    profile_stack.push_back ({ site, profile_clock(), 0 });
+}
+
+
+
+void
+PerThreadInfo::profile_end ()
+{
+    if (profile_stack.empty())
+        return;
+    pvt::ProfileFrame frame = profile_stack.back();
+    profile_stack.pop_back ();
+    long long ticks = profile_clock() - frame.start;
+    if (! profile_stack.empty())
+        profile_stack.back().child_ticks += ticks;
+    profile_counters.add (frame.site, ticks, ticks - frame.child_ticks);
 }
 
 
@@ -725,7 +807,11 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
       m_error_repeats(false),
       m_range_checking(true),
       m_unknown_coordsys_error(true), m_connection_error(true),
-      m_greedyjit(false), m_countlayerexecs(false),
+      m_greedyjit(false), m_async_jit(false), m_tiered_jit(0),
+      m_jit_memory_budget(0),
+      m_getattribute_cache(false),
+      m_flat_closures(false),
+      m_countlayerexecs(false),
       m_relaxed_param_typecheck(false),
       m_max_warnings_per_thread(100),
       m_profile(0),
@@ -736,9 +822,10 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
       m_opt_peephole(true), m_opt_coalesce_temps(true),
       m_opt_assign(true), m_opt_mix(true),
       m_opt_merge_instances(1), m_opt_merge_instances_with_userdata(true),
+      m_opt_share_groups(false), m_opt_specialization_cache(0),
       m_opt_fold_getattribute(true),
       m_opt_middleman(true), m_opt_texture_handle(true),
-      m_opt_seed_bblock_aliases(true),
+      m_opt_seed_bblock_aliases(true), m_opt_message_slots(true),
       m_optimize_nondebug(false),
       m_opt_passes(10),
       m_llvm_optimize(0),
@@ -757,11 +844,14 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
       m_opt_warnings(0),
       m_gpu_opt_error(0),
       m_colorspace("Rec709"),
+      m_stat_master_load_wall_timer(OIIO::Timer::DontStartNow),
       m_stat_opt_locking_time(0), m_stat_specialization_time(0),
       m_stat_total_llvm_time(0),
       m_stat_llvm_setup_time(0), m_stat_llvm_irgen_time(0),
       m_stat_llvm_opt_time(0), m_stat_llvm_jit_time(0),
-      m_stat_inst_merge_time(0),
+      m_stat_inst_merge_time(0), m_stat_group_share_time_saved(0),
+      m_stat_specialization_time_saved(0),
+      m_stat_jit_tier0_time(0), m_stat_jit_tier1_time(0),
       m_stat_max_llvm_local_mem(0)
 {
     m_stat_shaders_loaded = 0;
@@ -770,11 +860,23 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
     m_stat_groupinstances = 0;
     m_stat_instances_compiled = 0;
     m_stat_groups_compiled = 0;
+    m_stat_groups_tiered_up = 0;
+    m_stat_groups_evicted = 0;
+    m_stat_groups_rejitted = 0;
+    m_stat_groups_shared = 0;
+    m_stat_specializations_reused = 0;
+    m_jit_epoch = 0;
     m_stat_empty_instances = 0;
     m_stat_merged_inst = 0;
     m_stat_merged_inst_opt = 0;
     m_stat_empty_groups = 0;
     m_stat_regexes = 0;
+    m_masters_loading = 0;
+    m_stat_dict_documents = 0;
+    m_stat_dict_nodes = 0;
+    m_stat_dict_queries = 0;
+    m_stat_dict_memory = 0;
+    m_dictionary_generation = 0;
     m_stat_preopt_syms = 0;
     m_stat_postopt_syms = 0;
     m_stat_syms_with_derivs = 0;
@@ -787,19 +889,6 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
     m_stat_tex_calls_as_handles = 0;
     m_stat_master_load_time = 0;
     m_stat_optimization_time = 0;
-    m_stat_getattribute_time = 0;
-    m_stat_getattribute_fail_time = 0;
-    m_stat_getattribute_calls = 0;
-    m_stat_get_userdata_calls = 0;
-    m_stat_noise_calls = 0;
-    m_stat_pointcloud_searches = 0;
-    m_stat_pointcloud_searches_total_results = 0;
-    m_stat_pointcloud_max_results = 0;
-    m_stat_pointcloud_failures = 0;
-    m_stat_pointcloud_gets = 0;
-    m_stat_pointcloud_writes = 0;
-    m_stat_layers_executed = 0;
-    m_stat_total_shading_time_ticks = 0;
 
     m_groups_to_compile_count = 0;
     m_threads_currently_compiling = 0;
@@ -985,7 +1074,7 @@ shading_system_setup_op_descriptors (ShadingSystemImpl::OpDescriptorMap& op_desc
     OP (psnoise,     noise,               noise,         true,      0);
     OP (radians,     generic,             radians,       true,      0);
     OP (raytype,     raytype,             raytype,       true,      0);
-    OP (regex_match, regex,               none,          false,     0);
+    OP (regex_match, regex,               regex_search,  false,     0);
     OP (regex_search, regex,              regex_search,  false,     0);
     OP (return,      return,              none,          false,     0);
     OP (round,       generic,             none,          true,      0);
@@ -1091,7 +1180,25 @@ ShadingSystemImpl::query_closure(const char **name, int *id,
 
 ShadingSystemImpl::~ShadingSystemImpl ()
 {
+    // Background JIT tasks refer to us, so they must finish first.
+    wait_for_jit ();
     printstats ();
+    free_dict_resources ();
+    {
+        // Any thread infos still around must no longer report to us.
+        lock_guard link_lock (thread_info_shadingsys_mutex);
+        lock_guard lock (m_thread_info_mutex);
+        for (auto t : m_all_thread_info)
+            t->shadingsys = nullptr;
+        m_all_thread_info.clear ();
+    }
+    {
+        // Groups that outlive us must not try to leave our LRU.
+        lock_guard lock (m_jit_lru_mutex);
+        for (auto g : m_jit_lru)
+            g->m_jit_lru_owner = nullptr;
+        m_jit_lru.clear ();
+    }
     // N.B. just let m_texsys go -- if we asked for one to be created,
     // we asked for a shared one.
 
@@ -1110,14 +1217,37 @@ bool
 ShadingSystemImpl::attribute (string_view name, TypeDesc type,
                               const void *val)
 {
+    // Options may change the code we generate for a group, so when one
+    // does, groups optimized from now on can't share the code of (or
+    // reuse specializations made for) earlier ones.  Setting an option to
+    // the value it already has, or one that only matters at runtime or
+    // for reporting (ATTR_SET_NOCODE), keeps them.
+    auto code_options_changed = [&]() {
+        {
+            spin_lock lock (m_shared_groups_mutex);
+            m_shared_groups.clear ();
+        }
+        spin_lock lock (m_specializations_mutex);
+        clear_specializations ();
+    };
 #define ATTR_SET(_name,_ctype,_dst)                                     \
+    if (name == _name && type == OIIO::BaseTypeFromC<_ctype>::value) {  \
+        if (_dst != *(_ctype *)(val))                                   \
+            code_options_changed ();                                    \
+        _dst = *(_ctype *)(val);                                        \
+        return true;                                                    \
+    }
+#define ATTR_SET_NOCODE(_name,_ctype,_dst)                              \
     if (name == _name && type == OIIO::BaseTypeFromC<_ctype>::value) {  \
         _dst = *(_ctype *)(val);                                        \
         return true;                                                    \
     }
 #define ATTR_SET_STRING(_name,_dst)                                     \
     if (name == _name && type == TypeDesc::STRING) {                    \
-        _dst = ustring (*(const char **)val);                           \
+        ustring v (*(const char **)val);                                \
+        if (_dst != v)                                                  \
+            code_options_changed ();                                    \
+        _dst = v;                                                       \
         return true;                                                    \
     }
 
@@ -1126,14 +1256,14 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
     }
 
     lock_guard guard (m_mutex);  // Thread safety
-    ATTR_SET ("statistics:level", int, m_statslevel);
+    ATTR_SET_NOCODE ("statistics:level", int, m_statslevel);
     ATTR_SET ("debug", int, m_debug);
     ATTR_SET ("lazylayers", int, m_lazylayers);
     ATTR_SET ("lazyglobals", int, m_lazyglobals);
     ATTR_SET ("lazyunconnected", int, m_lazyunconnected);
     ATTR_SET ("lazy_userdata", int, m_lazy_userdata);
     ATTR_SET ("userdata_isconnected", int, m_userdata_isconnected);
-    ATTR_SET ("clearmemory", int, m_clearmemory);
+    ATTR_SET_NOCODE ("clearmemory", int, m_clearmemory);
     ATTR_SET ("debug_nan", int, m_debugnan);
     ATTR_SET ("debugnan", int, m_debugnan);  // back-compatible alias
     ATTR_SET ("debug_uninit", int, m_debug_uninit);
@@ -1151,10 +1281,13 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
     ATTR_SET ("opt_mix", int, m_opt_mix);
     ATTR_SET ("opt_merge_instances", int, m_opt_merge_instances);
     ATTR_SET ("opt_merge_instances_with_userdata", int, m_opt_merge_instances_with_userdata);
+    ATTR_SET_NOCODE ("opt_share_groups", int, m_opt_share_groups);
+    ATTR_SET_NOCODE ("opt_specialization_cache", int, m_opt_specialization_cache);
     ATTR_SET ("opt_fold_getattribute", int, m_opt_fold_getattribute);
     ATTR_SET ("opt_middleman", int, m_opt_middleman);
     ATTR_SET ("opt_texture_handle", int, m_opt_texture_handle);
     ATTR_SET ("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
+    ATTR_SET ("opt_message_slots", int, m_opt_message_slots);
     ATTR_SET ("opt_passes", int, m_opt_passes);
     ATTR_SET ("optimize_nondebug", int, m_optimize_nondebug);
     ATTR_SET ("llvm_optimize", int, m_llvm_optimize);
@@ -1167,18 +1300,23 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
     ATTR_SET ("unknown_coordsys_error", int, m_unknown_coordsys_error);
     ATTR_SET ("connection_error", int, m_connection_error);
     ATTR_SET ("greedyjit", int, m_greedyjit);
+    ATTR_SET ("async_jit", int, m_async_jit);
+    ATTR_SET ("tiered_jit", int, m_tiered_jit);
+    ATTR_SET ("jit_memory_budget", int, m_jit_memory_budget);
+    ATTR_SET ("getattribute_cache", int, m_getattribute_cache);
+    ATTR_SET ("flat_closures", int, m_flat_closures);
     ATTR_SET ("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_SET ("countlayerexecs", int, m_countlayerexecs);
-    ATTR_SET ("max_warnings_per_thread", int, m_max_warnings_per_thread);
+    ATTR_SET_NOCODE ("max_warnings_per_thread", int, m_max_warnings_per_thread);
     ATTR_SET ("max_local_mem_KB", int, m_max_local_mem_KB);
-    ATTR_SET ("compile_report", int, m_compile_report);
+    ATTR_SET_NOCODE ("compile_report", int, m_compile_report);
     ATTR_SET ("buffer_printf", int, m_buffer_printf);
     ATTR_SET ("no_noise", int, m_no_noise);
     ATTR_SET ("no_pointcloud", int, m_no_pointcloud);
     ATTR_SET ("force_derivs", int, m_force_derivs);
     ATTR_SET ("allow_shader_replacement", int, m_allow_shader_replacement);
     ATTR_SET ("exec_repeat", int, m_exec_repeat);
-    ATTR_SET ("opt_warnings", int, m_opt_warnings);
+    ATTR_SET_NOCODE ("opt_warnings", int, m_opt_warnings);
     ATTR_SET ("gpu_opt_error", int, m_gpu_opt_error);
     ATTR_SET_STRING ("commonspace", m_commonspace_synonym);
     ATTR_SET_STRING ("debug_groupname", m_debug_groupname);
@@ -1194,8 +1332,27 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
         OIIO::Filesystem::searchpath_split (m_searchpath, m_searchpath_dirs);
         return true;
     }
+    if (name == "jit_cache_dir" && type == TypeDesc::STRING) {
+        ustring dir (*(const char **)val);
+        std::shared_ptr<JITObjectCache> cache;
+        if (dir.size()) {
+            std::string err;
+            if (! OIIO::Filesystem::is_directory (dir) &&
+                ! OIIO::Filesystem::create_directory (dir, err)) {
+                errorf("Could not create jit_cache_dir \"%s\": %s", dir, err);
+                return false;
+            }
+            cache.reset (new JITObjectCache (dir.string()));
+        }
+        m_jit_cache_dir = dir;
+        std::atomic_store (&m_jit_cache, cache);
+        return true;
+    }
     if (name == "colorspace" && type == TypeDesc::STRING) {
         ustring c = ustring (*(const char **)val);
+        if (c == m_colorspace)
+            return true;
+        code_options_changed ();
         if (colorsystem().set_colorspace(c))
             m_colorspace = c;
         else
@@ -1205,15 +1362,21 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
     if (name == "raytypes" && type.basetype == TypeDesc::STRING) {
         OSL_ASSERT (type.numelements() <= 32 &&
                     "ShaderGlobals.raytype is an int, max of 32 raytypes");
-        m_raytypes.clear ();
+        std::vector<ustring> raytypes;
         for (size_t i = 0;  i < type.numelements();  ++i)
-            m_raytypes.emplace_back(((const char **)val)[i]);
+            raytypes.emplace_back(((const char **)val)[i]);
+        if (raytypes != m_raytypes)
+            code_options_changed ();
+        m_raytypes.swap (raytypes);
         return true;
     }
     if (name == "renderer_outputs" && type.basetype == TypeDesc::STRING) {
-        m_renderer_outputs.clear ();
+        std::vector<ustring> outputs;
         for (size_t i = 0;  i < type.numelements();  ++i)
-            m_renderer_outputs.emplace_back(((const char **)val)[i]);
+            outputs.emplace_back(((const char **)val)[i]);
+        if (outputs != m_renderer_outputs)
+            code_options_changed ();
+        m_renderer_outputs.swap (outputs);
         return true;
     }
     if (name == "lib_bitcode" && type.basetype == TypeDesc::UINT8) {
@@ -1221,6 +1384,7 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
             errorf("Invalid bitcode size: %d", type.arraylen);
             return false;
         }
+        code_options_changed ();
         m_lib_bitcode.clear();
         if (type.arraylen) {
             const char* bytes = static_cast<const char*>(val);
@@ -1234,11 +1398,12 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
         // seen" error and warning lists.
         m_errseen.clear();
         m_warnseen.clear();
-        ATTR_SET ("error_repeats", int, m_error_repeats);
+        ATTR_SET_NOCODE ("error_repeats", int, m_error_repeats);
     }
 
     return false;
 #undef ATTR_SET
+#undef ATTR_SET_NOCODE
 #undef ATTR_SET_STRING
 }
 
@@ -1286,10 +1451,13 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("opt_mix", int, m_opt_mix);
     ATTR_DECODE ("opt_merge_instances", int, m_opt_merge_instances);
     ATTR_DECODE ("opt_merge_instances_with_userdata", int, m_opt_merge_instances_with_userdata);
+    ATTR_DECODE ("opt_share_groups", int, m_opt_share_groups);
+    ATTR_DECODE ("opt_specialization_cache", int, m_opt_specialization_cache);
     ATTR_DECODE ("opt_fold_getattribute", int, m_opt_fold_getattribute);
     ATTR_DECODE ("opt_middleman", int, m_opt_middleman);
     ATTR_DECODE ("opt_texture_handle", int, m_opt_texture_handle);
     ATTR_DECODE ("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
+    ATTR_DECODE ("opt_message_slots", int, m_opt_message_slots);
     ATTR_DECODE ("opt_passes", int, m_opt_passes);
     ATTR_DECODE ("optimize_nondebug", int, m_optimize_nondebug);
     ATTR_DECODE ("llvm_optimize", int, m_llvm_optimize);
@@ -1304,6 +1472,11 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("unknown_coordsys_error", int, m_unknown_coordsys_error);
     ATTR_DECODE ("connection_error", int, m_connection_error);
     ATTR_DECODE ("greedyjit", int, m_greedyjit);
+    ATTR_DECODE ("async_jit", int, m_async_jit);
+    ATTR_DECODE ("tiered_jit", int, m_tiered_jit);
+    ATTR_DECODE ("jit_memory_budget", int, m_jit_memory_budget);
+    ATTR_DECODE ("getattribute_cache", int, m_getattribute_cache);
+    ATTR_DECODE ("flat_closures", int, m_flat_closures);
     ATTR_DECODE ("countlayerexecs", int, m_countlayerexecs);
     ATTR_DECODE ("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_DECODE ("max_warnings_per_thread", int, m_max_warnings_per_thread);
@@ -1315,6 +1488,7 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE_STRING ("only_groupname", m_only_groupname);
     ATTR_DECODE_STRING ("archive_groupname", m_archive_groupname);
     ATTR_DECODE_STRING ("archive_filename", m_archive_filename);
+    ATTR_DECODE_STRING ("jit_cache_dir", m_jit_cache_dir);
     ATTR_DECODE ("max_local_mem_KB", int, m_max_local_mem_KB);
     ATTR_DECODE ("compile_report", int, m_compile_report);
     ATTR_DECODE ("buffer_printf", int, m_buffer_printf);
@@ -1330,12 +1504,27 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("stat:groups", int, m_stat_groups);
     ATTR_DECODE ("stat:instances_compiled", int, m_stat_instances_compiled);
     ATTR_DECODE ("stat:groups_compiled", int, m_stat_groups_compiled);
+    ATTR_DECODE ("stat:async_jit_not_ready", long long, thread_stats()[ThreadStats::async_jit_not_ready]);
+    ATTR_DECODE ("stat:groups_tiered_up", int, m_stat_groups_tiered_up);
+    ATTR_DECODE ("stat:groups_evicted", int, m_stat_groups_evicted);
+    ATTR_DECODE ("stat:groups_rejitted", int, m_stat_groups_rejitted);
+    ATTR_DECODE ("stat:groups_shared", int, m_stat_groups_shared);
+    ATTR_DECODE ("stat:group_share_time_saved", float, m_stat_group_share_time_saved);
+    ATTR_DECODE ("stat:specializations_reused", int, m_stat_specializations_reused);
+    ATTR_DECODE ("stat:specialization_time_saved", float, m_stat_specialization_time_saved);
+    ATTR_DECODE ("stat:jit_memory", long long, LLVM_Util::total_jit_memory_held());
+    ATTR_DECODE ("stat:jit_tier0_time", float, m_stat_jit_tier0_time);
+    ATTR_DECODE ("stat:jit_tier1_time", float, m_stat_jit_tier1_time);
     ATTR_DECODE ("stat:empty_instances", int, m_stat_empty_instances);
     ATTR_DECODE ("stat:merged_inst", int, m_stat_merged_inst);
     ATTR_DECODE ("stat:merged_inst_opt", int, m_stat_merged_inst_opt);
     ATTR_DECODE ("stat:empty_groups", int, m_stat_empty_groups);
     ATTR_DECODE ("stat:instances", int, m_stat_groupinstances);
     ATTR_DECODE ("stat:regexes", int, m_stat_regexes);
+    ATTR_DECODE ("stat:dictionary_documents", int, m_stat_dict_documents);
+    ATTR_DECODE ("stat:dictionary_nodes", int, m_stat_dict_nodes);
+    ATTR_DECODE ("stat:dictionary_queries", int, m_stat_dict_queries);
+    ATTR_DECODE ("stat:dictionary_memory", long long, m_stat_dict_memory);
     ATTR_DECODE ("stat:preopt_syms", int, m_stat_preopt_syms);
     ATTR_DECODE ("stat:postopt_syms", int, m_stat_postopt_syms);
     ATTR_DECODE ("stat:syms_with_derivs", int, m_stat_syms_with_derivs);
@@ -1346,7 +1535,8 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("stat:global_connections", int, m_stat_global_connections);
     ATTR_DECODE ("stat:tex_calls_codegened", int, m_stat_tex_calls_codegened);
     ATTR_DECODE ("stat:tex_calls_as_handles", int, m_stat_tex_calls_as_handles);
-    ATTR_DECODE ("stat:master_load_time", float, m_stat_master_load_time);
+    ATTR_DECODE ("stat:master_load_time", float, master_load_time());
+    ATTR_DECODE ("stat:master_load_wall_time", float, master_load_wall_time());
     ATTR_DECODE ("stat:optimization_time", float, m_stat_optimization_time);
     ATTR_DECODE ("stat:opt_locking_time", float, m_stat_opt_locking_time);
     ATTR_DECODE ("stat:specialization_time", float, m_stat_specialization_time);
@@ -1356,15 +1546,22 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("stat:llvm_opt_time", float, m_stat_llvm_opt_time);
     ATTR_DECODE ("stat:llvm_jit_time", float, m_stat_llvm_jit_time);
     ATTR_DECODE ("stat:inst_merge_time", float, m_stat_inst_merge_time);
-    ATTR_DECODE ("stat:getattribute_calls", long long, m_stat_getattribute_calls);
-    ATTR_DECODE ("stat:get_userdata_calls", long long, m_stat_get_userdata_calls);
-    ATTR_DECODE ("stat:noise_calls", long long, m_stat_noise_calls);
-    ATTR_DECODE ("stat:pointcloud_searches", long long, m_stat_pointcloud_searches);
-    ATTR_DECODE ("stat:pointcloud_gets", long long, m_stat_pointcloud_gets);
-    ATTR_DECODE ("stat:pointcloud_writes", long long, m_stat_pointcloud_writes);
-    ATTR_DECODE ("stat:pointcloud_searches_total_results", long long, m_stat_pointcloud_searches_total_results);
-    ATTR_DECODE ("stat:pointcloud_max_results", int, m_stat_pointcloud_max_results);
-    ATTR_DECODE ("stat:pointcloud_failures", int, m_stat_pointcloud_failures);
+    std::shared_ptr<JITObjectCache> jitcache = jit_cache();
+    ATTR_DECODE ("stat:jit_cache_hits", long long, jitcache ? jitcache->hits() : 0);
+    ATTR_DECODE ("stat:jit_cache_misses", long long, jitcache ? jitcache->misses() : 0);
+    ATTR_DECODE ("stat:jit_cache_uncacheable", long long, jitcache ? jitcache->uncacheable() : 0);
+    ATTR_DECODE ("stat:jit_cache_bytes_read", long long, jitcache ? jitcache->bytes_read() : 0);
+    ATTR_DECODE ("stat:jit_cache_bytes_written", long long, jitcache ? jitcache->bytes_written() : 0);
+    ATTR_DECODE ("stat:getattribute_calls", long long, thread_stats()[ThreadStats::getattribute_calls]);
+    ATTR_DECODE ("stat:getattribute_cache_hits", long long, thread_stats()[ThreadStats::getattribute_cache_hits]);
+    ATTR_DECODE ("stat:get_userdata_calls", long long, thread_stats()[ThreadStats::get_userdata_calls]);
+    ATTR_DECODE ("stat:noise_calls", long long, thread_stats()[ThreadStats::noise_calls]);
+    ATTR_DECODE ("stat:pointcloud_searches", long long, thread_stats()[ThreadStats::pointcloud_searches]);
+    ATTR_DECODE ("stat:pointcloud_gets", long long, thread_stats()[ThreadStats::pointcloud_gets]);
+    ATTR_DECODE ("stat:pointcloud_writes", long long, thread_stats()[ThreadStats::pointcloud_writes]);
+    ATTR_DECODE ("stat:pointcloud_searches_total_results", long long, thread_stats()[ThreadStats::pointcloud_searches_total_results]);
+    ATTR_DECODE ("stat:pointcloud_max_results", int, thread_stats()[ThreadStats::pointcloud_max_results]);
+    ATTR_DECODE ("stat:pointcloud_failures", int, thread_stats()[ThreadStats::pointcloud_failures]);
     ATTR_DECODE ("stat:memory_current", long long, m_stat_memory.current());
     ATTR_DECODE ("stat:memory_peak", long long, m_stat_memory.peak());
     ATTR_DECODE ("stat:mem_master_current", long long, m_stat_mem_master.current());
@@ -1387,6 +1584,8 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("stat:mem_inst_paramvals_peak", long long, m_stat_mem_inst_paramvals.peak());
     ATTR_DECODE ("stat:mem_inst_connections_current", long long, m_stat_mem_inst_connections.current());
     ATTR_DECODE ("stat:mem_inst_connections_peak", long long, m_stat_mem_inst_connections.peak());
+    ATTR_DECODE ("stat:mem_specializations_current", long long, m_stat_mem_specializations.current());
+    ATTR_DECODE ("stat:mem_specializations_peak", long long, m_stat_mem_specializations.peak());
 
     if (name == "colorsystem" && type.basetype == TypeDesc::PTR) {
         *(void**)val = &colorsystem();
@@ -1484,6 +1683,15 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
         *(int *)val = group->raytype_queries();
         return true;
     }
+    if (name == "ready" && type == TypeDesc::TypeInt) {
+        *(int *)val = group->optimized() ? 1 : 0;
+        return true;
+    }
+    if (name == "jit_memory" && type == TypeDesc::INT64) {
+        lock_guard lock (group->m_mutex);
+        *(long long *)val = (long long) group->jit_memory_size();
+        return true;
+    }
     if (name == "num_entry_layers" && type.basetype == TypeDesc::INT) {
         int n = 0;
         for (int i = 0;  i < group->nlayers();  ++i)
@@ -1716,18 +1924,21 @@ ShadingSystemImpl::message (const std::string &msg) const
 
 
 void
-ShadingSystemImpl::pointcloud_stats (int search, int get, int results,
-                                     int writes)
+ShadingSystemImpl::pointcloud_stats (PerThreadInfo *threadinfo, int search,
+                                     int get, int results, int writes)
 {
-    spin_lock lock (m_stat_mutex);
-    m_stat_pointcloud_searches += search;
-    m_stat_pointcloud_gets += get;
-    m_stat_pointcloud_searches_total_results += results;
-    if (search && ! results)
-        ++m_stat_pointcloud_failures;
-    m_stat_pointcloud_max_results = std::max (m_stat_pointcloud_max_results,
-                                              results);
-    m_stat_pointcloud_writes += writes;
+    ThreadStats &stats (threadinfo->stats);
+    if (search) {
+        stats.add (ThreadStats::pointcloud_searches, search);
+        stats.add (ThreadStats::pointcloud_searches_total_results, results);
+        stats.add_max (ThreadStats::pointcloud_max_results, results);
+        if (! results)
+            stats.add (ThreadStats::pointcloud_failures, 1);
+    }
+    if (get)
+        stats.add (ThreadStats::pointcloud_gets, get);
+    if (writes)
+        stats.add (ThreadStats::pointcloud_writes, writes);
 }
 
 
@@ -1757,6 +1968,7 @@ ShadingSystemImpl::getstats (int level) const
         out << "  No shaders requested or loaded\n";
         return out.str();
     }
+    ThreadStats::Totals exec_stats = thread_stats();
 
     std::string opt;
 #define BOOLOPT(name) opt += Strutil::sprintf(#name "=%d ", m_##name)
@@ -1783,6 +1995,9 @@ ShadingSystemImpl::getstats (int level) const
     BOOLOPT (error_repeats);
     BOOLOPT (range_checking);
     BOOLOPT (greedyjit);
+    BOOLOPT (async_jit);
+    INTOPT (tiered_jit);
+    INTOPT (jit_memory_budget);
     BOOLOPT (countlayerexecs);
     BOOLOPT (opt_simplify_param);
     BOOLOPT (opt_constant_fold);
@@ -1795,10 +2010,13 @@ ShadingSystemImpl::getstats (int level) const
     BOOLOPT (opt_mix);
     INTOPT  (opt_merge_instances);
     BOOLOPT (opt_merge_instances_with_userdata);
+    BOOLOPT (opt_share_groups);
+    INTOPT  (opt_specialization_cache);
     BOOLOPT (opt_fold_getattribute);
     BOOLOPT (opt_middleman);
     BOOLOPT (opt_texture_handle);
     BOOLOPT (opt_seed_bblock_aliases);
+    BOOLOPT (opt_message_slots);
     INTOPT  (opt_passes);
     INTOPT (no_noise);
     INTOPT (no_pointcloud);
@@ -1811,6 +2029,7 @@ ShadingSystemImpl::getstats (int level) const
     STROPT (debug_layername);
     STROPT (archive_groupname);
     STROPT (archive_filename);
+    STROPT (jit_cache_dir);
 #undef BOOLOPT
 #undef INTOPT
 #undef STROPT
@@ -1822,7 +2041,9 @@ ShadingSystemImpl::getstats (int level) const
     out << "    Masters:   " << m_stat_shaders_loaded << "\n";
     out << "    Instances: " << m_stat_instances << "\n";
     out << "  Time loading masters: "
-        << Strutil::timeintervalformat (m_stat_master_load_time, 2) << "\n";
+        << Strutil::timeintervalformat (master_load_time(), 2)
+        << " (" << Strutil::timeintervalformat (master_load_wall_time(), 2)
+        << " wall clock)\n";
     out << "  Shading groups:   " << m_stat_groups << "\n";
     out << "    Total instances in all groups: " << m_stat_groupinstances << "\n";
     float iperg = (float)m_stat_groupinstances/std::max((int)m_stat_groups,1);
@@ -1830,7 +2051,8 @@ ShadingSystemImpl::getstats (int level) const
         << Strutil::sprintf ("%.1f", iperg) << "\n";
     out << "  Shading contexts: " << m_stat_contexts << "\n";
     if (m_countlayerexecs)
-        out << "  Total layers executed: " << m_stat_layers_executed << "\n";
+        out << "  Total layers executed: "
+            << exec_stats[ThreadStats::layers_executed] << "\n";
 
 #if 0
     long long totalexec = m_layers_executed_uncond + m_layers_executed_lazy +
@@ -1851,10 +2073,18 @@ ShadingSystemImpl::getstats (int level) const
 
     out << "  Compiled " << m_stat_groups_compiled << " groups, "
         << m_stat_instances_compiled << " instances\n";
+    if (m_async_jit)
+        out << "  Executions skipped awaiting async JIT: "
+            << exec_stats[ThreadStats::async_jit_not_ready] << "\n";
     out << "  Merged " << (m_stat_merged_inst+m_stat_merged_inst_opt)
         << " instances (" << m_stat_merged_inst << " initial, "
         << m_stat_merged_inst_opt << " after opt) in "
         << Strutil::timeintervalformat (m_stat_inst_merge_time, 2) << "\n";
+    if (m_stat_groups_shared)
+        out << "  Shared the code of " << m_stat_groups_shared
+            << " groups with identical groups (saving "
+            << Strutil::timeintervalformat (m_stat_group_share_time_saved, 2)
+            << ")\n";
     if (m_stat_instances_compiled > 0)
         out << "  After optimization, " << m_stat_empty_instances
             << " empty instances ("
@@ -1887,6 +2117,11 @@ ShadingSystemImpl::getstats (int level) const
         << Strutil::timeintervalformat (m_stat_opt_locking_time, 2) << "\n";
     out << "    runtime specialization:    "
         << Strutil::timeintervalformat (m_stat_specialization_time, 2) << "\n";
+    if (m_stat_specializations_reused)
+        out << "      reused for " << m_stat_specializations_reused
+            << " identical groups (saving "
+            << Strutil::timeintervalformat (m_stat_specialization_time_saved, 2)
+            << ")\n";
     if (m_stat_total_llvm_time > 0.0) {
         out << "    LLVM setup:                "
             << Strutil::timeintervalformat (m_stat_llvm_setup_time, 2) << "\n";
@@ -1897,32 +2132,71 @@ ShadingSystemImpl::getstats (int level) const
         out << "    LLVM JIT:                  "
             << Strutil::timeintervalformat (m_stat_llvm_jit_time, 2) << "\n";
     }
+    if (m_tiered_jit) {
+        out << "  Tiered JIT: " << m_stat_groups_tiered_up
+            << " groups recompiled at full optimization\n";
+        out << "    Fast tier LLVM time:       "
+            << Strutil::timeintervalformat (m_stat_jit_tier0_time, 2) << "\n";
+        out << "    Full tier LLVM time:       "
+            << Strutil::timeintervalformat (m_stat_jit_tier1_time, 2) << "\n";
+    }
+    if (m_jit_memory_budget) {
+        out << "  JIT memory budget " << m_jit_memory_budget << " MB: "
+            << m_stat_groups_evicted << " groups evicted, "
+            << m_stat_groups_rejitted << " JITed again\n";
+    }
+    if (std::shared_ptr<JITObjectCache> jitcache = jit_cache()) {
+        out << "  JIT object cache: " << jitcache->hits() << " hits, "
+            << jitcache->misses() << " misses, "
+            << jitcache->uncacheable() << " uncacheable ("
+            << Strutil::memformat (jitcache->bytes_read()) << " read, "
+            << Strutil::memformat (jitcache->bytes_written()) << " written)\n";
+    }
 
     out << "  Texture calls compiled: "
         << (int)m_stat_tex_calls_codegened
         << " (" << (int)m_stat_tex_calls_as_handles << " used handles)\n";
     out << "  Regex's compiled: " << m_stat_regexes << "\n";
+    if (m_stat_dict_documents) {
+        out << "  Dictionaries: " << m_stat_dict_documents << " documents, "
+            << m_stat_dict_nodes << " nodes, " << m_stat_dict_queries
+            << " cached queries (~"
+            << Strutil::memformat (m_stat_dict_memory) << ")\n";
+    }
     out << "  Largest generated function local memory size: "
         << m_stat_max_llvm_local_mem/1024 << " KB\n";
-    if (m_stat_getattribute_calls) {
-        out << "  getattribute calls: " << m_stat_getattribute_calls << " ("
-            << Strutil::timeintervalformat (m_stat_getattribute_time, 2) << ")\n";
+    if (exec_stats[ThreadStats::getattribute_calls]) {
+        double time = OIIO::Timer::seconds (exec_stats[ThreadStats::getattribute_ticks]);
+        double failtime = OIIO::Timer::seconds (exec_stats[ThreadStats::getattribute_fail_ticks]);
+        out << "  getattribute calls: "
+            << exec_stats[ThreadStats::getattribute_calls] << " ("
+            << Strutil::timeintervalformat (time, 2) << ")\n";
         out << "     (fail time "
-            << Strutil::timeintervalformat (m_stat_getattribute_fail_time, 2) << ")\n";
+            << Strutil::timeintervalformat (failtime, 2) << ")\n";
     }
-    out << "  Number of get_userdata calls: " << m_stat_get_userdata_calls << "\n";
+    if (exec_stats[ThreadStats::getattribute_cache_hits])
+        out << "  getattribute calls shared: "
+            << exec_stats[ThreadStats::getattribute_cache_hits] << "\n";
+    out << "  Number of get_userdata calls: "
+        << exec_stats[ThreadStats::get_userdata_calls] << "\n";
     if (profile() > 1)
-        out << "  Number of noise calls: " << m_stat_noise_calls << "\n";
-    if (m_stat_pointcloud_searches || m_stat_pointcloud_writes) {
+        out << "  Number of noise calls: "
+            << exec_stats[ThreadStats::noise_calls] << "\n";
+    long long pc_searches = exec_stats[ThreadStats::pointcloud_searches];
+    long long pc_writes = exec_stats[ThreadStats::pointcloud_writes];
+    if (pc_searches || pc_writes) {
         out << "  Pointcloud operations:\n";
-        out << "    pointcloud_search calls: " << m_stat_pointcloud_searches << "\n";
-        out << "      max query results: " << m_stat_pointcloud_max_results << "\n";
-        double avg = m_stat_pointcloud_searches ?
-            (double)m_stat_pointcloud_searches_total_results/(double)m_stat_pointcloud_searches : 0.0;
+        out << "    pointcloud_search calls: " << pc_searches << "\n";
+        out << "      max query results: "
+            << exec_stats[ThreadStats::pointcloud_max_results] << "\n";
+        double avg = pc_searches ?
+            (double)exec_stats[ThreadStats::pointcloud_searches_total_results]/(double)pc_searches : 0.0;
         out << "      average query results: " << Strutil::sprintf ("%.1f", avg) << "\n";
-        out << "      failures: " << m_stat_pointcloud_failures << "\n";
-        out << "    pointcloud_get calls: " << m_stat_pointcloud_gets << "\n";
-        out << "    pointcloud_write calls: " << m_stat_pointcloud_writes << "\n";
+        out << "      failures: "
+            << exec_stats[ThreadStats::pointcloud_failures] << "\n";
+        out << "    pointcloud_get calls: "
+            << exec_stats[ThreadStats::pointcloud_gets] << "\n";
+        out << "    pointcloud_write calls: " << pc_writes << "\n";
     }
     out << "  Memory total: " << m_stat_memory.memstat() << '\n';
     out << "    Master memory: " << m_stat_mem_master.memstat() << '\n';
@@ -1935,6 +2209,9 @@ ShadingSystemImpl::getstats (int level) const
     out << "        Instance syms:         " << m_stat_mem_inst_syms.memstat() << '\n';
     out << "        Instance param values: " << m_stat_mem_inst_paramvals.memstat() << '\n';
     out << "        Instance connections:  " << m_stat_mem_inst_connections.memstat() << '\n';
+    if (m_opt_specialization_cache > 0 || m_stat_mem_specializations.peak())
+        out << "    Saved specializations: "
+            << m_stat_mem_specializations.memstat() << '\n';
 
     size_t jitmem = LLVM_Util::total_jit_memory_held();
     out << "    LLVM JIT memory: " << Strutil::memformat(jitmem) << '\n';
@@ -1942,7 +2219,7 @@ ShadingSystemImpl::getstats (int level) const
     if (m_profile) {
         out << "  Execution profile:\n";
         out << "    Total shader execution time: "
-            << Strutil::timeintervalformat(OIIO::Timer::seconds(m_stat_total_shading_time_ticks), 2)
+            << Strutil::timeintervalformat(OIIO::Timer::seconds(exec_stats[ThreadStats::shading_time_ticks]), 2)
             << " (sum of all threads)\n";
         // Account for times of any groups that haven't yet been destroyed
         {
@@ -1973,6 +2250,8 @@ ShadingSystemImpl::getstats (int level) const
                     << ' ' << (i->first.size() ? i->first.c_str() : "<unnamed group>") << "\n";
             }
         }
+        if (m_profile >= 2)
+            out << profile_report ("text");
 
     }
 
@@ -1981,6 +2260,243 @@ ShadingSystemImpl::getstats (int level) const
 
 
 
+int
+ShadingSystemImpl::profile_site (const ShaderGroup &group, int layer, int opnum)
+{
+    lock_guard lock (m_profile_mutex);
+    auto key = std::make_tuple (group.id(), layer, opnum);
+    auto found = m_profile_site_ids.find (key);
+    if (found != m_profile_site_ids.end())
+        return found->second;
+    const ShaderInstance *inst = group[layer];
+    ProfileSite site;
+    site.groupname = group.name();
+    site.groupid = group.id();
+    site.layer = layer;
+    site.layername = inst->layername();
+    site.shadername = ustring(inst->shadername());
+    site.sourceline = 0;
+    if (opnum >= 0) {
+        const Opcode &op (inst->ops()[opnum]);
+        site.opname = op.opname();
+        site.sourcefile = op.sourcefile();
+        site.sourceline = op.sourceline();
+    }
+    int id = (int) m_profile_sites.size();
+    m_profile_sites.push_back (site);
+    m_profile_site_ids[key] = id;
+    return id;
+}
+
+
+
+void
+ShadingSystemImpl::profile_totals (std::vector<ProfileTotal> &totals) const
+{
+    size_t nsites;
+    {
+        lock_guard lock (m_profile_mutex);
+        nsites = m_profile_sites.size();
+    }
+    lock_guard lock (m_thread_info_mutex);
+    totals = m_profile_retired;
+    totals.resize (nsites);
+    for (auto t : m_all_thread_info)
+        t->profile_counters.accumulate (totals);
+}
+
+
+
+static std::string
+json_string (string_view str)
+{
+    std::string r ("\"");
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            r += '\\';
+        if ((unsigned char)c < ' ')
+            r += Strutil::sprintf ("\\u%04x", int(c));
+        else
+            r += c;
+    }
+    r += '"';
+    return r;
+}
+
+
+
+std::string
+ShadingSystemImpl::profile_report (string_view format) const
+{
+    std::vector<ProfileTotal> totals;
+    profile_totals (totals);
+    std::vector<ProfileSite> sites;
+    {
+        lock_guard lock (m_profile_mutex);
+        sites.assign (m_profile_sites.begin(),
+                      m_profile_sites.begin() + totals.size());
+    }
+    auto seconds = [](long long ns) { return double(ns) * 1.0e-9; };
+    auto site_name = [&](const ProfileSite &site) {
+        std::string name = Strutil::sprintf ("%s layer %d \"%s\" (%s)",
+                                site.groupname.size() ? site.groupname.c_str()
+                                                      : "<unnamed group>",
+                                site.layer, site.layername, site.shadername);
+        if (! site.opname.empty())
+            name += Strutil::sprintf (": %s at %s:%d", site.opname,
+                                      site.sourcefile, site.sourceline);
+        return name;
+    };
+
+    std::ostringstream out;
+    out.imbue (std::locale::classic());  // force C locale
+    if (format == "text") {
+        std::vector<int> order;
+        for (int i = 0, n = (int)sites.size();  i < n;  ++i)
+            if (totals[i].count)
+                order.push_back (i);
+        std::sort (order.begin(), order.end(), [&](int a, int b) {
+            return totals[a].self_ticks > totals[b].self_ticks;
+        });
+        if (order.size() > 10)
+            order.resize (10);
+        if (order.size())
+            out << "    Most expensive layers and ops (self time):\n";
+        for (int i : order)
+            out << "      "
+                << Strutil::timeintervalformat (seconds(totals[i].self_ticks), 2)
+                << ' ' << site_name (sites[i]) << ", "
+                << totals[i].count << (! sites[i].opname.empty() ? " calls\n" : " runs\n");
+        return out.str();
+    }
+
+    // Sort the sites by group, then layer; the layer comes before its ops.
+    std::vector<int> order;
+    for (int i = 0, n = (int)sites.size();  i < n;  ++i)
+        if (totals[i].count)
+            order.push_back (i);
+    std::stable_sort (order.begin(), order.end(), [&](int a, int b) {
+        if (sites[a].groupid != sites[b].groupid)
+            return sites[a].groupid < sites[b].groupid;
+        if (sites[a].layer != sites[b].layer)
+            return sites[a].layer < sites[b].layer;
+        return sites[a].opname.empty() && ! sites[b].opname.empty();
+    });
+
+    if (format == "json") {
+        out << "{\n  \"groups\": [";
+        int group = -1, layer = -1;
+        const char *close_layer = "";
+        for (int i : order) {
+            const ProfileSite &site (sites[i]);
+            const ProfileTotal &total (totals[i]);
+            if (site.groupid != group) {
+                if (group >= 0)
+                    out << close_layer << "\n    ] },";
+                out << "\n    { \"name\": " << json_string (site.groupname)
+                    << ", \"id\": " << site.groupid << ", \"layers\": [";
+                group = site.groupid;
+                layer = -1;
+                close_layer = "";
+            }
+            if (site.layer != layer || site.opname.empty()) {
+                out << close_layer << (layer >= 0 ? "," : "")
+                    << "\n      { \"layer\": " << site.layer
+                    << ", \"name\": " << json_string (site.layername)
+                    << ", \"shader\": " << json_string (site.shadername);
+                if (site.opname.empty())
+                    out << ", \"count\": " << total.count
+                        << ", \"seconds\": " << seconds(total.ticks)
+                        << ", \"self_seconds\": " << seconds(total.self_ticks);
+                out << ", \"ops\": [";
+                layer = site.layer;
+                close_layer = " ] }";
+                if (site.opname.empty())
+                    continue;
+            } else {
+                out << ",";
+            }
+            out << "\n        { \"op\": " << json_string (site.opname)
+                << ", \"source\": " << json_string (Strutil::sprintf ("%s:%d",
+                                         site.sourcefile, site.sourceline))
+                << ", \"count\": " << total.count
+                << ", \"seconds\": " << seconds(total.ticks)
+                << ", \"self_seconds\": " << seconds(total.self_ticks) << " }";
+        }
+        if (group >= 0)
+            out << close_layer << "\n    ] }";
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+    if (format == "trace") {
+        // The profile has totals, not a timeline, so lay each group out
+        // as a flame chart on its own row: its layers one after another,
+        // each containing its ops.
+        out << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        const char *sep = "\n";
+        auto event = [&](const std::string &name, const char *cat, int tid,
+                         double ts, double dur, long long count) {
+            out << sep << "  { \"name\": " << json_string (name)
+                << ", \"cat\": \"" << cat << "\", \"ph\": \"X\", \"pid\": 1"
+                << ", \"tid\": " << tid << ", \"ts\": " << ts
+                << ", \"dur\": " << dur
+                << ", \"args\": { \"count\": " << count << " } }";
+            sep = ",\n";
+        };
+        int group = -1;
+        double cursor = 0.0;   // in microseconds, as the format wants
+        for (size_t o = 0;  o < order.size();  ) {
+            const ProfileSite &site (sites[order[o]]);
+            if (site.groupid != group) {
+                group = site.groupid;
+                cursor = 0.0;
+                out << sep << "  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1"
+                    << ", \"tid\": " << group << ", \"args\": { \"name\": "
+                    << json_string (site.groupname.size() ? site.groupname.string()
+                                                          : std::string("<unnamed group>"))
+                    << " } }";
+                sep = ",\n";
+            }
+            // Gather this layer's entries: the layer itself (if it was
+            // timed), then its ops.
+            size_t end = o;
+            long long layer_ticks = 0, layer_count = 0;
+            while (end < order.size() && sites[order[end]].groupid == group &&
+                   sites[order[end]].layer == site.layer) {
+                const ProfileTotal &t (totals[order[end]]);
+                if (! sites[order[end]].opname.empty())
+                    layer_ticks += t.ticks;
+                else {
+                    layer_ticks += t.self_ticks;
+                    layer_count = t.count;
+                }
+                ++end;
+            }
+            event (Strutil::sprintf ("%s (%s)", site.layername, site.shadername),
+                   "layer", group, cursor, layer_ticks * 1.0e-3, layer_count);
+            double opcursor = cursor;
+            for ( ;  o < end;  ++o) {
+                const ProfileSite &s (sites[order[o]]);
+                const ProfileTotal &t (totals[order[o]]);
+                if (s.opname.empty())
+                    continue;
+                event (Strutil::sprintf ("%s %s:%d", s.opname, s.sourcefile,
+                                         s.sourceline),
+                       "op", group, opcursor, t.ticks * 1.0e-3, t.count);
+                opcursor += t.ticks * 1.0e-3;
+            }
+            cursor += layer_ticks * 1.0e-3;
+        }
+        out << "\n] }\n";
+        return out.str();
+    }
+
+    return std::string();
+}
+
+
+
 void
 ShadingSystemImpl::printstats () const
 {
@@ -2023,6 +2539,7 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname)
 {
     ShaderGroupRef group (new ShaderGroup(groupname));
     group->m_exec_repeat = m_exec_repeat;
+    group->m_self = group;
     {
         // Record the group in the SS's census of all extant groups
         spin_lock lock (m_all_shader_groups_mutex);
@@ -2090,6 +2607,23 @@ ShadingSystemImpl::ShaderGroupEnd (ShaderGroup& group)
         archive_shadergroup (group, filename);
     }
 
+    if (! group.m_complete) {
+        // Note it as waiting for optimize_all_groups.  Every time the
+        // list doubles in size, forget the groups that were compiled
+        // (or released) since.
+        spin_lock lock (m_groups_to_compile_mutex);
+        size_t n = m_groups_to_compile.size();
+        if (n && (n & (n-1)) == 0) {
+            m_groups_to_compile.erase (
+                std::remove_if (m_groups_to_compile.begin(), m_groups_to_compile.end(),
+                                [](const std::weak_ptr<ShaderGroup> &g) {
+                                    ShaderGroupRef group = g.lock();
+                                    return ! group || group->optimized();
+                                }),
+                m_groups_to_compile.end());
+        }
+        m_groups_to_compile.push_back (group.m_self);
+    }
     group.m_complete = true;
     return true;
 }
@@ -2616,7 +3150,52 @@ ShadingSystemImpl::ReParameter (ShaderGroup &group, string_view layername_,
 PerThreadInfo *
 ShadingSystemImpl::create_thread_info()
 {
-    return new PerThreadInfo;
+    return new PerThreadInfo (this);
+}
+
+
+
+void
+ShadingSystemImpl::register_thread_info (PerThreadInfo *threadinfo)
+{
+    lock_guard lock (m_thread_info_mutex);
+    m_all_thread_info.push_back (threadinfo);
+}
+
+
+
+void
+ShadingSystemImpl::unregister_thread_info (PerThreadInfo *threadinfo)
+{
+    size_t nsites;
+    {
+        lock_guard lock (m_profile_mutex);
+        nsites = m_profile_sites.size();
+    }
+    lock_guard lock (m_thread_info_mutex);
+    auto found = std::find (m_all_thread_info.begin(),
+                            m_all_thread_info.end(), threadinfo);
+    if (found == m_all_thread_info.end())
+        return;
+    m_all_thread_info.erase (found);
+    // Don't lose the stats and profile of threads that are done.
+    threadinfo->stats.accumulate (m_thread_stats_retired);
+    // Sites are only ever added, so never shrink what's retired.
+    if (m_profile_retired.size() < nsites)
+        m_profile_retired.resize (nsites);
+    threadinfo->profile_counters.accumulate (m_profile_retired);
+}
+
+
+
+ThreadStats::Totals
+ShadingSystemImpl::thread_stats () const
+{
+    lock_guard lock (m_thread_info_mutex);
+    ThreadStats::Totals totals = m_thread_stats_retired;
+    for (auto t : m_all_thread_info)
+        t->stats.accumulate (totals);
+    return totals;
 }
 
 
@@ -2657,6 +3236,9 @@ ShadingSystemImpl::release_context (ShadingContext *ctx)
     if (! ctx)
         return;
     ctx->process_errors ();
+    // If it was left executing a group (execute_init without
+    // execute_cleanup), it isn't anymore.
+    ctx->unpin_group ();
     ctx->thread_info()->context_pool.push (ctx);
 }
 
@@ -2693,6 +3275,29 @@ ShadingSystemImpl::execute (ShadingContext *ctx, ShaderGroup &group,
 
 
 
+const CompiledRegex &
+ShadingSystemImpl::find_regex (ustring r)
+{
+    {
+        spin_lock lock (m_regex_cache_mutex);
+        RegexCache::const_iterator found = m_regex_cache.find (r);
+        if (found != m_regex_cache.end())
+            return *found->second;
+    }
+    // Compile without holding the lock. If another thread beat us to
+    // it, keep theirs and discard ours.
+    std::unique_ptr<CompiledRegex> reg (new CompiledRegex (r));
+    spin_lock lock (m_regex_cache_mutex);
+    std::unique_ptr<CompiledRegex> &entry (m_regex_cache[r]);
+    if (! entry) {
+        entry = std::move (reg);
+        m_stat_regexes += 1;
+    }
+    return *entry;
+}
+
+
+
 const void *
 ShadingSystemImpl::get_symbol (ShadingContext &ctx, ustring layername,
                                ustring symbolname, TypeDesc &type)
@@ -2865,7 +3470,9 @@ void
 ShadingSystemImpl::group_post_jit_cleanup (ShaderGroup &group)
 {
     // Once we're generated the IR, we really don't need the ops and args,
-    // and we only need the syms that include the params.
+    // and we only need the syms that include the params.  (Without them,
+    // we could never JIT the group again.)
+    group.m_jit_evictable = false;
     off_t symmem = 0;
     size_t connectionmem = 0;
     for (int layer = 0;  layer < group.nlayers();  ++layer) {
@@ -2932,6 +3539,28 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx)
 
     double locking_time = timer();
 
+    // If an identical group was already optimized, use its code rather
+    // than optimizing and JITing the same code again.
+    std::string share_key = group_share_key (group);
+    ShaderGroupRef source;
+    if (share_key.size()) {
+        spin_lock lock (m_shared_groups_mutex);
+        auto found = m_shared_groups.find (share_key);
+        if (found != m_shared_groups.end())
+            source = found->second.lock();
+    }
+    if (source) {
+        adopt_group_code (group, *source);
+        group.m_optimized = true;
+        spin_lock stat_lock (m_stat_mutex);
+        m_stat_optimization_time += timer();
+        m_stat_opt_locking_time += locking_time;
+        m_stat_group_share_time_saved += source->m_optimize_time;
+        m_stat_groups_shared += 1;
+        m_groups_to_compile_count -= 1;
+        return;
+    }
+
     bool ctx_allocated = false;
     PerThreadInfo *thread_info = nullptr;
     if (! ctx) {
@@ -2939,6 +3568,34 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx)
         ctx = get_context(thread_info);
         ctx_allocated = true;
     }
+
+    if (group.m_jit_evicted) {
+        // We optimized the group before, and its instances still have the
+        // optimized code, but its JITed code was evicted to stay within
+        // the JIT memory budget.  All we need to do is JIT it again.
+        BackendLLVM lljitter (*this, group, ctx);
+        lljitter.run ();
+        group.m_jit_evicted = 0;
+        if (ctx_allocated) {
+            release_context(ctx);
+            destroy_thread_info(thread_info);
+        }
+        group.m_optimized = true;
+        {
+            spin_lock stat_lock (m_stat_mutex);
+            m_stat_optimization_time += timer();
+            m_stat_opt_locking_time += locking_time;
+            m_stat_total_llvm_time += lljitter.m_stat_total_llvm_time;
+            m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+            m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+            m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+            m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+            m_stat_groups_rejitted += 1;
+        }
+        enforce_jit_memory_budget (group);
+        return;
+    }
+
     RuntimeOptimizer rop (*this, group, ctx);
     rop.run ();
     rop.police_failed_optimizations();
@@ -2973,11 +3630,33 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx)
         group.m_attributes_needed.push_back (f.name);
         group.m_attribute_scopes.push_back (f.scope);
     }
+    group.m_getattribute_lookups = rop.m_getattribute_lookups;
+    group.m_getattribute_slots.clear ();
+    group.m_getattribute_cache_size = 0;
+    for (size_t i = 0, e = group.m_getattribute_lookups.size(); i < e; ++i) {
+        AttributeLookup &a (group.m_getattribute_lookups[i]);
+        a.offset = group.m_getattribute_cache_size;
+        group.m_getattribute_cache_size += OIIO::round_to_multiple_of_pow2 (a.size(), size_t(16));
+        group.m_getattribute_slots[a] = int(i);
+    }
 
     BackendLLVM lljitter (*this, group, ctx);
+    // With tiered JIT, compile quickly now, and keep the instance code
+    // around so that we can recompile at full optimization if the group
+    // turns out to be executed a lot.
+    bool fast_tier = m_tiered_jit > 0 && ! lljitter.use_optix();
+    if (fast_tier)
+        lljitter.llvm_optimize (-1);
     lljitter.run ();
+    group.m_jit_evictable = true;
 
-    group_post_jit_cleanup (group);
+    // Keep the instance code of groups compiled at the fast tier, and of
+    // all groups if the JIT memory budget may evict them, so that we can
+    // JIT them again.
+    if (fast_tier && ! group.does_nothing())
+        group.m_jit_tier = 1;
+    else if (! m_jit_memory_budget)
+        group_post_jit_cleanup (group);
 
     if (ctx_allocated) {
         release_context(ctx);
@@ -2985,6 +3664,23 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx)
     }
 
     group.m_optimized = true;
+    group.m_optimize_time = timer();
+    if (share_key.size()) {
+        spin_lock lock (m_shared_groups_mutex);
+        m_shared_groups[share_key] = group.m_self;
+        // Every time the cache doubles in size, forget the groups that
+        // no longer exist.
+        size_t n = m_shared_groups.size();
+        if ((n & (n-1)) == 0) {
+            for (auto g = m_shared_groups.begin(); g != m_shared_groups.end(); ) {
+                if (g->second.expired())
+                    g = m_shared_groups.erase (g);
+                else
+                    ++g;
+            }
+        }
+    }
+    enforce_jit_memory_budget (group);
     spin_lock stat_lock (m_stat_mutex);
     m_stat_optimization_time += timer();
     m_stat_opt_locking_time += locking_time + rop.m_stat_opt_locking_time;
@@ -2994,6 +3690,8 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx)
     m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
     m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
     m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+    if (fast_tier)
+        m_stat_jit_tier0_time += lljitter.m_stat_total_llvm_time;
     m_stat_max_llvm_local_mem = std::max (m_stat_max_llvm_local_mem,
                                           lljitter.m_llvm_local_mem);
     m_stat_groups_compiled += 1;
@@ -3003,55 +3701,574 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx)
 
 
 
-static void optimize_all_groups_wrapper (ShadingSystemImpl *ss, int mythread, int totalthreads)
+void
+ShadingSystemImpl::tier_up_group (ShaderGroup &group, ShadingContext *ctx)
 {
-    ss->optimize_all_groups (1, mythread, totalthreads);
+    OIIO::Timer timer;
+    lock_guard lock (group.m_mutex);
+    if (group.m_jit_tier == 0)
+        return;    // somebody already did it
+
+    // The instances were already optimized and still have their code, so
+    // all we need to do is generate LLVM IR from them again, this time
+    // at full optimization. The new code must lay out the groupdata just
+    // like the old (BackendLLVM checks, and keeps the old code if not),
+    // so the new entry points are safe to swap in while other threads
+    // are still executing the old ones (which the group keeps until it's
+    // destroyed or evicted).
+    BackendLLVM lljitter (*this, group, ctx);
+    lljitter.run ();
+    if (! m_jit_memory_budget)
+        group_post_jit_cleanup (group);
+    group.m_jit_tier = 0;
+    enforce_jit_memory_budget (group);
+
+    // The group was already counted as optimized and JITed, so the time
+    // spent recompiling it is only counted as full tier time.
+    spin_lock stat_lock (m_stat_mutex);
+    m_stat_jit_tier1_time += timer();
+    if (lljitter.groupdata_layout_changed ())
+        return;    // the fast tier code is still in use
+    m_stat_groups_tiered_up += 1;
 }
 
 
 
 void
-ShadingSystemImpl::optimize_all_groups (int nthreads, int mythread, int totalthreads)
+ShadingSystemImpl::enforce_jit_memory_budget (ShaderGroup &keep)
 {
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
-    if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min ((int)std::thread::hardware_concurrency(),
-                             (int)m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_threads_currently_compiling)
-            return;   // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
-        m_threads_currently_compiling += nthreads;
-        for (int t = 0;  t < nthreads;  ++t)
-            threads.add_thread (new std::thread (optimize_all_groups_wrapper, this, t, nthreads));
-        threads.join_all ();
-        m_threads_currently_compiling -= nthreads;
+    if (m_jit_memory_budget <= 0)
         return;
+    // Groups used from now on will touch the LRU again, so they'll be
+    // known to be more recent than any we might evict.
+    ++m_jit_epoch;
+    jit_lru_touch (keep);
+    size_t budget = size_t(m_jit_memory_budget) * 1024 * 1024;
+
+    // Take groups from the least recently used end, rotating each to the
+    // other end: ones we evict leave the list, and ones we can't evict
+    // right now are in use anyway.  Give up once we've tried them all.
+    size_t ntries;
+    {
+        lock_guard lock (m_jit_lru_mutex);
+        ntries = m_jit_lru.size();
     }
+    for (size_t tries = 0;  tries < ntries &&
+             LLVM_Util::total_jit_memory_held() > budget;  ++tries) {
+        ShaderGroupRef group;
+        {
+            lock_guard lock (m_jit_lru_mutex);
+            if (m_jit_lru.empty())
+                break;
+            ShaderGroup *g = m_jit_lru.front();
+            m_jit_lru.splice (m_jit_lru.end(), m_jit_lru, m_jit_lru.begin());
+            if (g != &keep)
+                group = g->m_self.lock();   // NULL if being destroyed
+        }
+        // Don't wait for groups that somebody is busy compiling.
+        if (! group || ! group->m_mutex.try_lock())
+            continue;
+        evict_group (*group);
+        group->m_mutex.unlock ();
+    }
+}
+
 
-    // And here's the single thread case
-    size_t ngroups = 0;
+
+void
+ShadingSystemImpl::jit_lru_touch (ShaderGroup &group)
+{
+    lock_guard lock (m_jit_lru_mutex);
+    if (group.m_jit_lru_owner) {
+        m_jit_lru.splice (m_jit_lru.end(), m_jit_lru, group.m_jit_lru_pos);
+    } else {
+        group.m_jit_lru_pos = m_jit_lru.insert (m_jit_lru.end(), &group);
+        group.m_jit_lru_owner = this;
+    }
+}
+
+
+
+void
+ShadingSystemImpl::jit_lru_remove (ShaderGroup &group)
+{
+    lock_guard lock (m_jit_lru_mutex);
+    if (group.m_jit_lru_owner) {
+        m_jit_lru.erase (group.m_jit_lru_pos);
+        group.m_jit_lru_owner = nullptr;
+    }
+}
+
+
+
+void
+ShadingSystemImpl::register_context (ShadingContext *ctx)
+{
+    lock_guard lock (m_all_contexts_mutex);
+    m_all_contexts.push_back (ctx);
+}
+
+
+
+void
+ShadingSystemImpl::unregister_context (ShadingContext *ctx)
+{
+    lock_guard lock (m_all_contexts_mutex);
+    auto found = std::find (m_all_contexts.begin(), m_all_contexts.end(), ctx);
+    if (found != m_all_contexts.end())
+        m_all_contexts.erase (found);
+}
+
+
+
+bool
+ShadingSystemImpl::group_pinned (const ShaderGroup &group) const
+{
+    lock_guard lock (m_all_contexts_mutex);
+    for (auto ctx : m_all_contexts)
+        if (ctx->pinned_group() == &group)
+            return true;
+    return false;
+}
+
+
+
+bool
+ShadingSystemImpl::evict_group (ShaderGroup &group)
+{
+    if (! group.optimized() || ! group.m_jit_evictable
+          || group.does_nothing() || group.m_jit_memory.empty()
+          || group_pinned (group))
+        return false;
+    // Executing threads pin the group before they check whether it's
+    // optimized, so once we have marked it unoptimized, either we see
+    // their pin or they see the mark and will wait to compile it again.
+    group.m_optimized = 0;
+    if (group_pinned (group)) {
+        group.m_optimized = 1;
+        return false;
+    }
+    group.llvm_compiled_version (nullptr);
+    group.llvm_compiled_init (nullptr);
+    for (int layer = 0;  layer < group.nlayers();  ++layer)
+        group.llvm_compiled_layer (layer, nullptr);
+    group.m_jit_memory.clear ();   // frees the code
+    group.m_jit_tier = 0;
+    group.m_tier_executions = 0;
+    group.m_jit_queued = 0;
+    group.m_jit_evicted = 1;
+    m_stat_groups_evicted += 1;
+    jit_lru_remove (group);
+    return true;
+}
+
+
+
+std::string
+ShadingSystemImpl::group_key (const ShaderGroup &group) const
+{
+    std::ostringstream key;
+    key.imbue (std::locale::classic());  // force C locale
+    key << group.serialize_locked ();
+    // Tell apart masters that were replaced but have the same name.
+    for (int layer = 0, nl = group.nlayers();  layer < nl;  ++layer)
+        key << (const void *)group[layer]->master() << ' '
+            << group[layer]->entry_layer() << '\n';
+    key << "raytypes " << group.raytypes_on() << ' ' << group.raytypes_off()
+        << " repeat " << group.m_exec_repeat << " outputs";
+    for (auto&& name : group.m_renderer_outputs)
+        key << ' ' << name;
+    return key.str();
+}
+
+
+
+std::string
+ShadingSystemImpl::specialization_key (const ShaderGroup &group) const
+{
+    if (m_opt_specialization_cache <= 0 || optimize() < 1)
+        return std::string();
+    return group_key (group);
+}
+
+
+
+std::shared_ptr<GroupSpecialization>
+ShadingSystemImpl::find_specialization (const std::string &key)
+{
+    std::shared_ptr<GroupSpecialization> spec;
     {
-        spin_lock lock (m_all_shader_groups_mutex);
-        ngroups = m_all_shader_groups.size();
+        spin_lock lock (m_specializations_mutex);
+        auto found = m_specializations.find (key);
+        if (found != m_specializations.end())
+            spec = found->second;
     }
+    if (spec) {
+        spin_lock lock (m_stat_mutex);
+        m_stat_specializations_reused += 1;
+        m_stat_specialization_time_saved += spec->time;
+    }
+    return spec;
+}
+
+
+
+void
+ShadingSystemImpl::add_specialization (const std::string &key,
+                                       std::shared_ptr<GroupSpecialization> spec)
+{
+    off_t mem = spec->memory() + 2 * off_t(key.capacity());
+    spin_lock lock (m_specializations_mutex);
+    if (! m_specializations.emplace (key, spec).second)
+        return;   // another thread beat us to it
+    m_specialization_order.push_back (key);
+    while ((int)m_specialization_order.size() > m_opt_specialization_cache) {
+        const std::string &oldest (m_specialization_order.front());
+        auto found = m_specializations.find (oldest);
+        mem -= found->second->memory() + 2 * off_t(oldest.capacity());
+        m_specializations.erase (found);
+        m_specialization_order.pop_front ();
+    }
+    spin_lock statlock (m_stat_mutex);
+    m_stat_mem_specializations += mem;
+    m_stat_memory += mem;
+}
+
+
+
+void
+ShadingSystemImpl::clear_specializations ()
+{
+    off_t mem = 0;
+    for (auto &s : m_specializations)
+        mem += s.second->memory() + 2 * off_t(s.first.capacity());
+    m_specializations.clear ();
+    m_specialization_order.clear ();
+    spin_lock statlock (m_stat_mutex);
+    m_stat_mem_specializations -= mem;
+    m_stat_memory -= mem;
+}
+
+
+
+std::string
+ShadingSystemImpl::group_share_key (const ShaderGroup &group) const
+{
+    // Groups can only share code that won't change once compiled (as it
+    // would with tiered JIT or the JIT memory budget), that isn't compiled
+    // for a GPU, and that doesn't refer to the group itself (as per-op
+    // profiling does).
+    if (! m_opt_share_groups || optimize() < 1 || m_tiered_jit ||
+        m_jit_memory_budget || m_profile >= 2 ||
+        renderer()->supports ("OptiX"))
+        return std::string();
+
+    // Parameters that aren't lockgeom may be changed with ReParameter(),
+    // which would change them for the other groups sharing the instance,
+    // too.
+    for (int layer = 0, nl = group.nlayers();  layer < nl;  ++layer) {
+        const ShaderInstance *inst = group[layer];
+        for (int p = inst->firstparam();  p < inst->lastparam();  ++p) {
+            bool lockgeom = inst->m_instoverrides.size()
+                          ? inst->instoverride(p)->lockgeom()
+                          : inst->mastersymbol(p)->lockgeom();
+            if (! lockgeom)
+                return std::string();
+        }
+    }
+    return group_key (group);
+}
+
+
+
+void
+ShadingSystemImpl::adopt_group_code (ShaderGroup &group,
+                                     const ShaderGroup &source)
+{
+    // The source won't change any more (see group_share_key), so we
+    // don't need to lock it.  Identical groups have the same entry
+    // layers, so besides the optimized layers and the code, all we need
+    // is what optimizing the source found out.
+    group.m_layers = source.m_layers;
+    static_cast<ShaderGroupNeeds &>(group) = source;
+    group.m_does_nothing = source.m_does_nothing;
+    group.m_llvm_groupdata_size = source.m_llvm_groupdata_size;
+    group.m_jit_memory = source.m_jit_memory;
+    group.llvm_compiled_init (source.llvm_compiled_init());
+    group.llvm_compiled_version (source.llvm_compiled_version());
+    for (int layer = 0;  layer < source.m_llvm_compiled_nlayers;  ++layer)
+        group.llvm_compiled_layer (layer, source.llvm_compiled_layer(layer));
+}
+
+
+
+// A batch of shader groups to be optimized and JITed by any number of
+// threads. The groups are sorted most expensive first, and each thread
+// claims the next one as soon as it finishes with its last, so the big
+// groups get started early and no thread is left idle while another
+// still has a long list ahead of it. Pool tasks working on the queue
+// are counted, and waiting on the queue waits for all of them to have
+// returned, so the ShadingSystem (whose destructor waits) outlives them.
+struct ShadingSystemImpl::JITQueue {
+    std::vector<std::weak_ptr<ShaderGroup> > groups;
+    std::function<void(ShaderGroup*, bool)> ready;
+    bool tier_up = false;     // Recompile fast-tier groups, not optimize
+    atomic_int next { 0 };    // Next group to claim
+    std::mutex mutex;
+    std::condition_variable cv;
+    int workers = 0;          // Threads inside run_jit_queue (under mutex)
+    int tasks = 0;            // Pool tasks not yet returned (under mutex)
+
+    // Push a pool task that works on the queue.
+    void push_task (ShadingSystemImpl *ss, OIIO::thread_pool *pool,
+                    std::shared_ptr<JITQueue> self) {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            ++tasks;
+        }
+        pool->push ([ss,self](int /*id*/){
+            ss->run_jit_queue (*self);
+            std::lock_guard<std::mutex> lock (self->mutex);
+            if (--self->tasks == 0)
+                self->cv.notify_all ();
+        });
+    }
+
+    // Register a worker, unless there's nothing left to claim.
+    bool begin_work () {
+        std::lock_guard<std::mutex> lock (mutex);
+        if (next >= (int)groups.size())
+            return false;
+        ++workers;
+        return true;
+    }
+    void end_work () {
+        std::lock_guard<std::mutex> lock (mutex);
+        if (--workers == 0)
+            cv.notify_all ();
+    }
+    // Has every group been claimed, and every worker and task finished?
+    bool done () {
+        std::lock_guard<std::mutex> lock (mutex);
+        return workers == 0 && tasks == 0 && next >= (int)groups.size();
+    }
+    // Wait until every group has been claimed, and every worker is done
+    // and every task has returned.
+    void wait () {
+        std::unique_lock<std::mutex> lock (mutex);
+        cv.wait (lock, [&](){
+            return workers == 0 && tasks == 0 && next >= (int)groups.size();
+        });
+    }
+};
+
+
+
+size_t
+ShadingSystemImpl::group_compile_cost (const ShaderGroup &group)
+{
+    // Optimization and JIT time are dominated by the amount of code, so
+    // count the ops of each layer's master, plus a fixed amount of
+    // overhead for each layer.
+    size_t cost = 0;
+    for (int i = 0, n = group.nlayers();  i < n;  ++i)
+        cost += group[i]->master()->ops().size() + 16;
+    return cost;
+}
+
+
+
+std::shared_ptr<ShadingSystemImpl::JITQueue>
+ShadingSystemImpl::make_jit_queue ()
+{
+    // Claim all the groups waiting to be compiled.
+    std::vector<std::weak_ptr<ShaderGroup> > pending;
+    {
+        spin_lock lock (m_groups_to_compile_mutex);
+        pending.swap (m_groups_to_compile);
+    }
+    std::vector<ShaderGroupRef> groups;
+    for (auto&& g : pending) {
+        ShaderGroupRef group = g.lock();
+        if (group && ! group->optimized() && ! group->m_jit_evicted)
+            groups.push_back (group);
+    }
+    std::vector<std::pair<size_t,size_t> > order;  // (cost, index)
+    order.reserve (groups.size());
+    for (size_t i = 0, e = groups.size();  i < e;  ++i)
+        order.emplace_back (group_compile_cost (*groups[i]), i);
+    std::stable_sort (order.begin(), order.end(),
+                      [](const std::pair<size_t,size_t> &a,
+                         const std::pair<size_t,size_t> &b) {
+                          return a.first > b.first;
+                      });
+    auto queue = std::make_shared<JITQueue>();
+    queue->groups.reserve (order.size());
+    for (auto&& o : order)
+        queue->groups.emplace_back (groups[o.second]);
+    return queue;
+}
+
+
+
+std::shared_ptr<ShadingSystemImpl::JITQueue>
+ShadingSystemImpl::make_jit_queue (ShaderGroup &group)
+{
+    auto queue = std::make_shared<JITQueue>();
+    if (! group.m_self.expired())
+        queue->groups.push_back (group.m_self);
+    return queue;
+}
+
+
+
+void
+ShadingSystemImpl::push_jit_queue (std::shared_ptr<JITQueue> queue,
+                                   int ntasks, OIIO::thread_pool *pool)
+{
+    if (! pool)
+        pool = OIIO::default_thread_pool ();
+    {
+        std::lock_guard<std::mutex> lock (m_jit_queues_mutex);
+        // Forget about earlier batches that have finished
+        m_jit_queues.erase (std::remove_if (m_jit_queues.begin(), m_jit_queues.end(),
+                                [](const std::shared_ptr<JITQueue> &q) {
+                                    return q->done();
+                                }),
+                            m_jit_queues.end());
+        m_jit_queues.push_back (queue);
+    }
+    ntasks = std::max (1, std::min (ntasks, pool->size()));
+    for (int t = 0;  t < ntasks;  ++t)
+        queue->push_task (this, pool, queue);
+}
+
+
+
+void
+ShadingSystemImpl::run_jit_queue (JITQueue &queue)
+{
+    if (! queue.begin_work ())
+        return;
     PerThreadInfo* threadinfo = create_thread_info();
     ShadingContext* ctx = get_context(threadinfo);
-    for (size_t i = 0;  i < ngroups;  ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock (m_all_shader_groups_mutex);
-                group = m_all_shader_groups[i].lock();
-            }
-            if (group && group->m_complete)
-                optimize_group (*group, ctx);
+    for (int i;  (i = queue.next++) < (int)queue.groups.size();  ) {
+        ShaderGroupRef group = queue.groups[i].lock();
+        if (! group)
+            continue;   // the group was released before we got to it
+        int nerrors = ctx->errors_recorded ();
+        if (queue.tier_up)
+            tier_up_group (*group, ctx);
+        else
+            optimize_group (*group, ctx);
+        if (queue.ready) {
+            // It failed if it raised errors or was left without code.
+            bool ok = group->optimized() && ctx->errors_recorded() == nerrors
+                      && (group->does_nothing() || group->llvm_compiled_init()
+                          || ! group->m_llvm_ptx_compiled_version.empty());
+            queue.ready (group.get(), ok);
         }
     }
     release_context(ctx);
     destroy_thread_info(threadinfo);
+    queue.end_work ();
+}
+
+
+
+void
+ShadingSystemImpl::optimize_all_groups (int nthreads, OIIO::thread_pool *pool)
+{
+    if (m_threads_currently_compiling)
+        return;   // never mind, somebody else is already JITing them all
+
+    std::shared_ptr<JITQueue> queue = make_jit_queue ();
+    int ngroups = (int) queue->groups.size();
+    if (! ngroups)
+        return;
+    if (nthreads < 1)  // threads <= 0 means use all hardware available
+        nthreads = pool ? pool->size() + 1
+                        : (int)std::thread::hardware_concurrency();
+    nthreads = std::max (1, std::min (nthreads, ngroups));
+
+    // The calling thread works on the queue too, and the others just
+    // help out.
+    m_threads_currently_compiling += nthreads;
+    if (pool) {
+        for (int t = 1;  t < nthreads;  ++t)
+            queue->push_task (this, pool, queue);
+        run_jit_queue (*queue);
+        queue->wait ();
+    } else {
+        OIIO::thread_group threads;
+        for (int t = 1;  t < nthreads;  ++t)
+            threads.add_thread (new std::thread ([this,queue](){
+                run_jit_queue (*queue);
+            }));
+        run_jit_queue (*queue);
+        threads.join_all ();
+    }
+    m_threads_currently_compiling -= nthreads;
+}
+
+
+
+void
+ShadingSystemImpl::optimize_all_groups_async (std::function<void(ShaderGroup*,bool)> ready,
+                                              OIIO::thread_pool *pool)
+{
+    std::shared_ptr<JITQueue> queue = make_jit_queue ();
+    int ngroups = (int) queue->groups.size();
+    if (! ngroups)
+        return;
+    queue->ready = ready;
+    push_jit_queue (queue, ngroups, pool);
+}
+
+
+
+void
+ShadingSystemImpl::optimize_group_async (ShaderGroup &group)
+{
+    if (group.optimized() || group.m_jit_queued.exchange (1))
+        return;    // already compiled, or somebody already queued it
+
+    std::shared_ptr<JITQueue> queue = make_jit_queue (group);
+    if (queue->groups.empty()) {
+        // Not a group we know about; all we can do is compile it now.
+        optimize_group (group, nullptr);
+        return;
+    }
+    push_jit_queue (queue, 1, nullptr);
+}
+
+
+
+void
+ShadingSystemImpl::tier_up_group_async (ShaderGroup &group)
+{
+    int fast_tier = 1;
+    if (! group.m_jit_tier.compare_exchange_strong (fast_tier, 2))
+        return;    // not fast tier, or somebody already queued it
+    std::shared_ptr<JITQueue> queue = make_jit_queue (group);
+    if (queue->groups.empty())
+        return;
+    queue->tier_up = true;
+    push_jit_queue (queue, 1, nullptr);
+}
+
+
+
+void
+ShadingSystemImpl::wait_for_jit ()
+{
+    std::vector<std::shared_ptr<JITQueue> > queues;
+    {
+        std::lock_guard<std::mutex> lock (m_jit_queues_mutex);
+        queues.swap (m_jit_queues);
+    }
+    for (auto&& queue : queues)
+        queue->wait ();
 }
 
 
@@ -3078,13 +4295,14 @@ ShadingSystemImpl::merge_instances (ShaderGroup &group, bool post_opt)
     // general shading and lookdev approach of the studio.  But it was
     // very helpful for us in many cases.
     //
-    // The basic loop below looks very inefficient, O(n^2) in number of
-    // instances in the group. But it's really not -- a few seconds (sum
-    // of all threads) for even our very complex scenes. This is because
-    // most potential pairs have a very fast rejection case if they are
-    // not using the same master.  Since there's no appreciable cost to
-    // the brute force approach, it seems silly to have a complex scheme
-    // to try to reduce the number of pairings.
+    // Comparing every pair of layers is O(n^2) in the number of
+    // instances in the group, which adds up for groups with thousands of
+    // layers.  Instead, we visit the layers in order and look up each one
+    // by its ShaderInstance::merge_hash() among the earlier layers we
+    // kept, only calling mergeable() for layers with the same hash.  A
+    // layer's connections only come from earlier layers, so by the time
+    // we visit it, all merges that rewire them have already been done,
+    // and layers downstream of merged layers merge in turn.
 
     if (! m_opt_merge_instances || optimize() < 1)
         return 0;
@@ -3100,64 +4318,76 @@ ShadingSystemImpl::merge_instances (ShaderGroup &group, bool post_opt)
         if (! group[layer]->unused())
             group[layer]->evaluate_writes_globals_and_userdata_params ();
 
+    // Layers that other layers may be merged into, by merge_hash.
+    std::unordered_multimap<size_t,int> kept;
+
     // Loop over all layers...
-    for (int a = 0;  a < nlayers-1;  ++a) {
-        if (group[a]->unused() || group[a]->entry_layer()) // Don't merge a layer that's not used
-            continue;                                      // or if it's an entry layer
-        // Check all later layers...
-        for (int b = a+1;  b < nlayers;  ++b) {
-            if (group[b]->unused())    // Don't merge a layer that's not used
-                continue;
-            if (b == nlayers-1)   // Don't merge the last layer -- causes
-                continue;         // many tears because it's the group entry
+    for (int b = 0;  b < nlayers;  ++b) {
+        if (group[b]->unused())    // Don't merge a layer that's not used
+            continue;
+        size_t hash = group[b]->merge_hash ();
+
+        // Find an earlier layer a that b is mergeable with (identical).
+        // All the heavy lifting is done by ShaderInstance::mergeable().
+        // Don't merge the last layer -- causes many tears because it's
+        // the group entry.
+        int a = -1;
+        if (b != nlayers-1) {
+            auto range = kept.equal_range (hash);
+            for (auto k = range.first;  k != range.second;  ++k) {
+                if ((a < 0 || k->second < a) &&
+                    group[k->second]->mergeable (*group[b], group))
+                    a = k->second;
+            }
+        }
+        if (a < 0) {
+            // Other layers may be merged into b, unless it's an entry
+            // layer.
+            if (! group[b]->entry_layer())
+                kept.emplace (hash, b);
+            continue;
+        }
 
-            // Now we have two used layers, a and b, to examine.
-            // See if they are mergeable (identical).  All the heavy
-            // lifting is done by ShaderInstance::mergeable().
-            if (! group[a]->mergeable (*group[b], group))
+        // The two nodes a and b are mergeable, so merge them.
+        ShaderInstance *A = group[a];
+        ShaderInstance *B = group[b];
+        ++merges;
+
+        // We'll keep A, get rid of B.  For all layers later than B,
+        // check its incoming connections and replace all references
+        // to B with references to A.
+        for (int j = b+1;  j < nlayers;  ++j) {
+            ShaderInstance *inst = group[j];
+            if (inst->unused())  // don't bother if it's unused
                 continue;
-
-            // The two nodes a and b are mergeable, so merge them.
-            ShaderInstance *A = group[a];
-            ShaderInstance *B = group[b];
-            ++merges;
-
-            // We'll keep A, get rid of B.  For all layers later than B,
-            // check its incoming connections and replace all references
-            // to B with references to A.
-            for (int j = b+1;  j < nlayers;  ++j) {
-                ShaderInstance *inst = group[j];
-                if (inst->unused())  // don't bother if it's unused
-                    continue;
-                for (int c = 0, ce = inst->nconnections();  c < ce;  ++c) {
-                    Connection &con = inst->connection(c);
-                    if (con.srclayer == b) {
-                        con.srclayer = a;
-                        A->outgoing_connections (true);
-                        if (A->symbols().size() && B->symbols().size()) {
-                            OSL_DASSERT (A->symbol(con.src.param)->name() ==
-                                         B->symbol(con.src.param)->name());
-                        }
+            for (int c = 0, ce = inst->nconnections();  c < ce;  ++c) {
+                Connection &con = inst->connection(c);
+                if (con.srclayer == b) {
+                    con.srclayer = a;
+                    A->outgoing_connections (true);
+                    if (A->symbols().size() && B->symbols().size()) {
+                        OSL_DASSERT (A->symbol(con.src.param)->name() ==
+                                     B->symbol(con.src.param)->name());
                     }
                 }
             }
+        }
 
-            // Mark parameters of B as no longer connected
-            for (int p = B->firstparam();  p < B->lastparam();  ++p) {
-                if (B->symbols().size())
-                    B->symbol(p)->connected_down(false);
-                if (B->m_instoverrides.size())
-                    B->instoverride(p)->connected_down(false);
-            }
-            // B won't be used, so mark it as having no outgoing
-            // connections and clear its incoming connections (which are
-            // no longer used).
-            OSL_DASSERT (B->merged_unused() == false);
-            B->outgoing_connections (false);
-            connectionmem += B->clear_connections ();
-            B->m_merged_unused = true;
-            OSL_DASSERT (B->unused());
+        // Mark parameters of B as no longer connected
+        for (int p = B->firstparam();  p < B->lastparam();  ++p) {
+            if (B->symbols().size())
+                B->symbol(p)->connected_down(false);
+            if (B->m_instoverrides.size())
+                B->instoverride(p)->connected_down(false);
         }
+        // B won't be used, so mark it as having no outgoing
+        // connections and clear its incoming connections (which are
+        // no longer used).
+        OSL_DASSERT (B->merged_unused() == false);
+        B->outgoing_connections (false);
+        connectionmem += B->clear_connections ();
+        B->m_merged_unused = true;
+        OSL_DASSERT (B->unused());
     }
 
     {
@@ -3180,16 +4410,52 @@ ShadingSystemImpl::merge_instances (ShaderGroup &group, bool post_opt)
 
 #if OIIO_HAS_COLORPROCESSOR
 
-OIIO::ColorProcessorHandle
+OCIOColorSystem::OCIOColorSystem ()
+{
+    for (auto& slot : m_processor_table)
+        slot.store (nullptr, std::memory_order_relaxed);
+}
+
+
+
+const OIIO::ColorProcessor *
 OCIOColorSystem::load_transform (StringParam fromspace, StringParam tospace)
 {
-    if (fromspace != m_last_colorproc_fromspace ||
-        tospace != m_last_colorproc_tospace) {
-        m_last_colorproc = m_colorconfig.createColorProcessor (fromspace, tospace);
-        m_last_colorproc_fromspace = fromspace;
-        m_last_colorproc_tospace = tospace;
+    ustring from (fromspace), to (tospace);
+    size_t hash = from.hash() * 31 + to.hash();
+
+    // Fast path: probe the lock-free table.
+    for (int i = 0;  i < ProcessorTableSize;  ++i) {
+        const ProcessorEntry *e = m_processor_table[(hash + i) & (ProcessorTableSize-1)]
+                                      .load (std::memory_order_acquire);
+        if (! e)
+            break;
+        if (e->fromspace == from && e->tospace == to)
+            return e->processor.get();
+    }
+
+    // Make the processor without holding the lock, since that may be
+    // slow (OCIO may read LUT files).  If several threads race to make
+    // the same one, the first to insert it wins and the rest are freed.
+    std::unique_ptr<ProcessorEntry> entry (new ProcessorEntry);
+    entry->fromspace = from;
+    entry->tospace = to;
+    entry->processor = m_colorconfig.createColorProcessor (fromspace, tospace);
+
+    OIIO::spin_lock lock (m_processors_mutex);
+    for (auto& e : m_processors)   // Maybe added since we looked, or
+        if (e->fromspace == from && e->tospace == to)  // the table is full
+            return e->processor.get();
+    const ProcessorEntry *e = entry.get();
+    m_processors.emplace_back (std::move(entry));
+    for (int i = 0;  i < ProcessorTableSize;  ++i) {
+        std::atomic<const ProcessorEntry *> &slot (m_processor_table[(hash + i) & (ProcessorTableSize-1)]);
+        if (! slot.load (std::memory_order_relaxed)) {
+            slot.store (e, std::memory_order_release);
+            break;
+        }
     }
-    return m_last_colorproc;
+    return e->processor.get();
 }
 
 #endif
@@ -3200,11 +4466,7 @@ template <> bool
 ShadingSystemImpl::ocio_transform (StringParam fromspace, StringParam tospace,
                                    const Color3& C, Color3& Cout) {
 #if OIIO_HAS_COLORPROCESSOR
-    OIIO::ColorProcessorHandle cp;
-    {
-        lock_guard lock (m_mutex);
-        cp = m_ocio_system.load_transform(fromspace, tospace);
-    }
+    const OIIO::ColorProcessor *cp = m_ocio_system.load_transform (fromspace, tospace);
     if (cp) {
         Cout = C;
         cp->apply ((float *)&Cout);
@@ -3220,12 +4482,7 @@ template <> bool
 ShadingSystemImpl::ocio_transform (StringParam fromspace, StringParam tospace,
                                    const Dual2<Color3>& C, Dual2<Color3>& Cout) {
 #if OIIO_HAS_COLORPROCESSOR
-    OIIO::ColorProcessorHandle cp;
-    {
-        lock_guard lock (m_mutex);
-        cp = m_ocio_system.load_transform(fromspace, tospace);
-    }
-
+    const OIIO::ColorProcessor *cp = m_ocio_system.load_transform (fromspace, tospace);
     if (cp) {
         // Use finite differencing to approximate the derivative. Make 3
         // color values to convert.
@@ -3610,6 +4867,29 @@ OSL_SHADEOP int osl_get_attribute(void *sg_,
 
 
 
+OSL_SHADEOP int osl_get_attribute_shared(void *sg_,
+                             int   slot,
+                             int   dest_derivs,
+                             void *obj_name_,
+                             void *attr_name_,
+                             int   array_lookup,
+                             int   index,
+                             const void *attr_type,
+                             void *attr_dest)
+{
+    ShaderGlobals *sg   = (ShaderGlobals *)sg_;
+    const ustring &obj_name  = USTR(obj_name_);
+    const ustring &attr_name = USTR(attr_name_);
+
+    return sg->context->osl_get_attribute_shared (sg, slot,
+                                           dest_derivs, obj_name, attr_name,
+                                           array_lookup, index,
+                                           *(const TypeDesc *)attr_type,
+                                           attr_dest);
+}
+
+
+
 OSL_SHADEOP int
 osl_bind_interpolated_param (void *sg_, const void *name, long long type,
                              int userdata_has_derivs, void *userdata_data,
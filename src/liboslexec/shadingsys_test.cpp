@@ -0,0 +1,1208 @@
+/*
+Copyright (c) 2009-2019 Sony Pictures Imageworks Inc., et al.
+All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+* Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+* Neither the name of Sony Pictures Imageworks nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Tests of the ShadingSystem API calls that testshade doesn't exercise:
+// shaders are compiled from memory, and groups built, executed and
+// inspected directly.
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/color.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/thread.h>
+#include <OpenImageIO/unittest.h>
+
+#include <OSL/oslcomp.h>
+#include <OSL/oslexec.h>
+#include <OSL/oslquery.h>
+#include <OSL/rendererservices.h>
+
+using namespace OSL;
+
+
+static bool verbose = false;
+static std::string stdoslpath;
+
+
+
+// Collect the errors the shading system reports, so tests can check for
+// them (or their absence).
+class TestErrorHandler final : public ErrorHandler {
+public:
+    virtual void operator() (int errcode, const std::string &msg) {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        if (verbose)
+            std::cout << msg << "\n";
+        if (errcode == EH_ERROR || errcode == EH_SEVERE)
+            m_errors.push_back (msg);
+        else if (errcode == EH_MESSAGE)
+            m_messages.push_back (msg);
+    }
+    std::vector<std::string> errors () {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        return m_errors;
+    }
+    std::vector<std::string> messages () {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        return m_messages;
+    }
+    void clear () {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_errors.clear ();
+        m_messages.clear ();
+    }
+private:
+    std::mutex m_mutex;
+    std::vector<std::string> m_errors;
+    std::vector<std::string> m_messages;
+};
+
+
+
+// Compile OSL source and load the result into the shading system under
+// the given name.
+static bool
+load_shader (ShadingSystem &ss, string_view name, string_view source)
+{
+    OSLCompiler compiler;
+    std::string osobuffer;
+    std::vector<std::string> options;
+    if (! compiler.compile_buffer (source, osobuffer, options, stdoslpath)) {
+        std::cerr << "Could not compile \"" << name << "\"\n";
+        return false;
+    }
+    return ss.LoadMemoryCompiledShader (name, osobuffer);
+}
+
+
+
+// Make a group of just the named shader, with its "result" output kept.
+static ShaderGroupRef
+make_group (ShadingSystem &ss, string_view shadername,
+            string_view groupname = string_view())
+{
+    ShaderGroupRef group = ss.ShaderGroupBegin (groupname);
+    ss.Shader (*group, "surface", shadername, "layer1");
+    ss.ShaderGroupEnd (*group);
+    const char *outputs[] = { "result" };
+    ss.attribute (group.get(), "renderer_outputs",
+                  TypeDesc(TypeDesc::STRING, 1), outputs);
+    return group;
+}
+
+
+
+static void
+init_globals (ShaderGlobals &sg, float u)
+{
+    memset ((char *)&sg, 0, sizeof(ShaderGlobals));
+    sg.u = u;
+    sg.dudx = 1.0f;
+    sg.v = 0.5f;
+    sg.dvdy = 1.0f;
+}
+
+
+
+// Execute the group at a point with the given u, and return the value of
+// its float output "result" (or -1 if it didn't run).
+static float
+shade (ShadingSystem &ss, ShadingContext &ctx, ShaderGroup &group, float u)
+{
+    ShaderGlobals sg;
+    init_globals (sg, u);
+    if (! ss.execute (ctx, group, sg))
+        return -1.0f;
+    TypeDesc type;
+    const float *result = (const float *) ss.get_symbol (ctx, ustring("result"), type);
+    return result ? *result : -1.0f;
+}
+
+static float
+shade (ShadingSystem &ss, ShaderGroup &group, float u)
+{
+    PerThreadInfo *thread_info = ss.create_thread_info ();
+    ShadingContext *ctx = ss.get_context (thread_info);
+    float r = shade (ss, *ctx, group, u);
+    ss.release_context (ctx);
+    ss.destroy_thread_info (thread_info);
+    return r;
+}
+
+
+
+static const char *small_shader =
+    "shader small (output float result = 0) { result = 2 * u; }\n";
+
+// Needs 16 KB of local storage for its array.
+static const char *big_shader =
+    "shader big (output float result = 0) {\n"
+    "    float a[4096];\n"
+    "    for (int i = 0; i < 4096; ++i)\n"
+    "        a[i] = u * i;\n"
+    "    result = a[int(u * 4095)];\n"
+    "}\n";
+
+
+
+// optimize_all_groups_async must call ready for every group, telling it
+// which ones failed to compile, and wait_for_jit must not return while
+// any of its tasks are still running.
+static void
+test_async_jit_ready ()
+{
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    {
+        ShadingSystem ss (&rend, nullptr, &errhandler);
+        ss.attribute ("max_local_mem_KB", 8);
+        OIIO_CHECK_ASSERT (load_shader (ss, "small", small_shader));
+        OIIO_CHECK_ASSERT (load_shader (ss, "big", big_shader));
+        ShaderGroupRef smallgroup = make_group (ss, "small", "smallgroup");
+        ShaderGroupRef biggroup = make_group (ss, "big", "biggroup");
+
+        std::mutex mutex;
+        std::map<ShaderGroup*,bool> ready;
+        OIIO::thread_pool pool;
+        pool.resize (2);
+        ss.optimize_all_groups_async ([&](ShaderGroup *group, bool ok) {
+            std::lock_guard<std::mutex> lock (mutex);
+            OIIO_CHECK_ASSERT (ready.find(group) == ready.end());
+            ready[group] = ok;
+        }, &pool);
+        ss.wait_for_jit ();
+        OIIO_CHECK_EQUAL (ready.size(), size_t(2));
+        OIIO_CHECK_ASSERT (ready[smallgroup.get()]);
+        OIIO_CHECK_ASSERT (! ready[biggroup.get()]);
+        OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(1));
+
+        // Already compiled, so a second round has nothing to do.
+        ready.clear ();
+        ss.optimize_all_groups_async ([&](ShaderGroup *group, bool ok) {
+            std::lock_guard<std::mutex> lock (mutex);
+            ready[group] = ok;
+        }, &pool);
+        ss.wait_for_jit ();
+        OIIO_CHECK_EQUAL (ready.size(), size_t(0));
+
+        OIIO_CHECK_EQUAL (shade (ss, *smallgroup, 0.25f), 0.5f);
+    }
+
+    // Destroying the ShadingSystem waits for the tasks it queued.
+    {
+        ShadingSystem ss (&rend, nullptr, &errhandler);
+        OIIO_CHECK_ASSERT (load_shader (ss, "small", small_shader));
+        std::vector<ShaderGroupRef> groups;
+        for (int i = 0;  i < 8;  ++i)
+            groups.push_back (make_group (ss, "small"));
+        ss.optimize_all_groups_async (nullptr);
+    }
+}
+
+
+
+// With option "async_jit", executing a group that isn't compiled yet
+// queues it and returns without running it; once the background JIT is
+// done, the group runs normally. Groups made after the JIT is started
+// are still picked up by the next optimize_all_groups.
+static void
+test_async_jit_execute ()
+{
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    ss.attribute ("async_jit", 1);
+    OIIO_CHECK_ASSERT (load_shader (ss, "small", small_shader));
+    ShaderGroupRef group = make_group (ss, "small");
+
+    PerThreadInfo *thread_info = ss.create_thread_info ();
+    ShadingContext *ctx = ss.get_context (thread_info);
+    long long not_ready = 0;
+    float r = shade (ss, *ctx, *group, 0.25f);
+    if (r < 0.0f)
+        ++not_ready;   // not compiled yet
+    else
+        OIIO_CHECK_EQUAL (r, 0.5f);
+    ss.wait_for_jit ();
+    OIIO_CHECK_EQUAL (shade (ss, *ctx, *group, 0.25f), 0.5f);
+    long long stat = -1;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:async_jit_not_ready",
+                                        TypeDesc::LONGLONG, &stat));
+    OIIO_CHECK_EQUAL (stat, not_ready);
+
+    // Already queued by the execute, so there's nothing left to claim.
+    int nready = 0;
+    ss.optimize_all_groups_async ([&](ShaderGroup *, bool) { ++nready; });
+    ss.wait_for_jit ();
+    OIIO_CHECK_EQUAL (nready, 0);
+
+    // A new group is waiting, though, and executes after optimize_all_groups.
+    ShaderGroupRef group2 = make_group (ss, "small");
+    ss.optimize_all_groups (2);
+    OIIO_CHECK_EQUAL (shade (ss, *ctx, *group2, 0.5f), 1.0f);
+
+    ss.release_context (ctx);
+    ss.destroy_thread_info (thread_info);
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+}
+
+
+
+// With option "tiered_jit", a group first compiled at the fast tier is
+// recompiled at full optimization after it has run that many times, and
+// gives the same results before and after.
+static void
+test_tiered_jit ()
+{
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    ss.attribute ("tiered_jit", 4);
+    OIIO_CHECK_ASSERT (load_shader (ss, "tiered",
+        "shader tiered (float scale = 3 [[ int lockgeom=0 ]],\n"
+        "               output float result = 0) {\n"
+        "    float a[8];\n"
+        "    for (int i = 0; i < 8; ++i)\n"
+        "        a[i] = scale * i;\n"
+        "    result = a[int(u * 8)] + u;\n"
+        "}\n"));
+    ShaderGroupRef group = make_group (ss, "tiered");
+
+    PerThreadInfo *thread_info = ss.create_thread_info ();
+    ShadingContext *ctx = ss.get_context (thread_info);
+    for (int i = 0;  i < 64;  ++i) {
+        float u = ((i % 8) + 0.5f) / 8.0f;
+        OIIO_CHECK_EQUAL (shade (ss, *ctx, *group, u), 3.0f * (i % 8) + u);
+        if (i == 31)
+            ss.wait_for_jit ();   // be sure the second half is full tier
+    }
+    ss.release_context (ctx);
+    ss.destroy_thread_info (thread_info);
+
+    int tiered_up = 0;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:groups_tiered_up", tiered_up));
+    OIIO_CHECK_EQUAL (tiered_up, 1);
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+}
+
+
+
+// RendererServices::pointcloud_search_batch must find, for each center,
+// the same points as a pointcloud_search around that center alone.
+static void
+test_pointcloud_search_batch ()
+{
+#ifdef USE_PARTIO
+    // An 8x8 grid of points in z=0, written as a Houdini ASCII geo file.
+    const int res = 8, npts = res * res;
+    ustring filename ("pointcloud_batch_test.geo");
+    {
+        std::ofstream geo (filename.string());
+        geo << "PGEOMETRY V5\n"
+            << "NPoints " << npts << " NPrims 1\n"
+            << "NPointGroups 0 NPrimGroups 0\n"
+            << "NPointAttrib 1 NVertexAttrib 0 NPrimAttrib 1 NAttrib 0\n"
+            << "PointAttrib\n"
+            << "u 1 float 0\n";
+        for (int i = 0;  i < npts;  ++i)
+            geo << float(i % res) / res << ' ' << float(i / res) / res
+                << " 0 1 (" << float(i % res) / res << ")\n";
+        geo << "PrimitiveAttrib\n"
+            << "generator 1 index 1 papi\n"
+            << "Part " << npts;
+        for (int i = 0;  i < npts;  ++i)
+            geo << ' ' << i;
+        geo << " [0]\nbeginExtra\nendExtra\n";
+        OIIO_CHECK_ASSERT (geo.good());
+    }
+
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    PerThreadInfo *thread_info = ss.create_thread_info ();
+    ShadingContext *ctx = ss.get_context (thread_info);
+    ShaderGlobals sg;
+    init_globals (sg, 0.5f);
+    sg.context = ctx;
+    sg.renderer = &rend;
+
+    // Centers inside, at the edge of, and well outside the grid.
+    const int ncenters = 10, maxpoints = 6;
+    const float radius = 0.2f;
+    std::vector<Vec3> centers;
+    for (int i = 0;  i < ncenters;  ++i)
+        centers.emplace_back (float(i) / 7.0f - 0.2f, 0.5f - float(i) / 20.0f, 0.0f);
+    centers.back() = Vec3 (5.0f, 5.0f, 5.0f);
+
+    for (int sorted = 0;  sorted < 2;  ++sorted) {
+        for (int with_dist = 0;  with_dist < 2;  ++with_dist) {
+            std::vector<size_t> indices (ncenters * maxpoints, ~size_t(0));
+            std::vector<float> distances (ncenters * maxpoints, -1.0f);
+            std::vector<int> counts (ncenters, -1);
+            int total = rend.pointcloud_search_batch (&sg, filename, ncenters,
+                                &centers[0], radius, maxpoints, sorted,
+                                &indices[0], with_dist ? &distances[0] : nullptr,
+                                &counts[0]);
+            int expected_total = 0;
+            for (int c = 0;  c < ncenters;  ++c) {
+                size_t ind[maxpoints];
+                float dist[maxpoints];
+                int n = rend.pointcloud_search (&sg, filename, centers[c],
+                                                radius, maxpoints, sorted,
+                                                ind, dist, 0);
+                OIIO_CHECK_EQUAL (counts[c], n);
+                expected_total += n;
+                for (int i = 0;  i < n && i < counts[c];  ++i) {
+                    OIIO_CHECK_EQUAL (indices[c*maxpoints+i], ind[i]);
+                    if (with_dist)
+                        OIIO_CHECK_EQUAL (distances[c*maxpoints+i], dist[i]);
+                }
+            }
+            OIIO_CHECK_EQUAL (total, expected_total);
+            OIIO_CHECK_ASSERT (total > 0);
+            OIIO_CHECK_EQUAL (counts.back(), 0);   // the center far outside
+        }
+    }
+
+    // A missing cloud finds nothing, for every center, and is an error.
+    std::vector<size_t> indices (ncenters * maxpoints);
+    std::vector<int> counts (ncenters, -1);
+    OIIO_CHECK_EQUAL (rend.pointcloud_search_batch (&sg, ustring("no_such_cloud.geo"),
+                                ncenters, &centers[0], radius, maxpoints,
+                                true, &indices[0], nullptr, &counts[0]), 0);
+    for (int c = 0;  c < ncenters;  ++c)
+        OIIO_CHECK_EQUAL (counts[c], 0);
+
+    ss.release_context (ctx);
+    ss.destroy_thread_info (thread_info);
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(1));
+    OIIO::Filesystem::remove (filename.string());
+#endif
+}
+
+
+
+// Many threads asking for the same master at once must all get it, with
+// the file read just once; a missing one must fail for every thread
+// without any of them waiting forever; and of several threads preloading
+// the same name, exactly one may succeed.
+static void
+test_concurrent_loading ()
+{
+    const int nthreads = 8;
+    OSLCompiler compiler;
+    std::string oso;
+    std::vector<std::string> options;
+    OIIO_CHECK_ASSERT (compiler.compile_buffer (small_shader, oso, options,
+                                                stdoslpath));
+    {
+        std::ofstream file ("loadtest.oso");
+        file << oso;
+    }
+
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    std::vector<ShaderGroupRef> groups (nthreads);
+    std::vector<int> found (nthreads, -1), preloaded (nthreads, -1);
+    {
+        OIIO::thread_group threads;
+        for (int t = 0;  t < nthreads;  ++t)
+            threads.add_thread (new std::thread ([&,t](){
+                groups[t] = ss.ShaderGroupBegin ();
+                ss.Shader (*groups[t], "surface", "loadtest", "layer1");
+                ss.ShaderGroupEnd (*groups[t]);
+                ShaderGroupRef missing = ss.ShaderGroupBegin ();
+                found[t] = ss.Shader (*missing, "surface", "no_such_shader", "layer1");
+                ss.ShaderGroupEnd (*missing);
+                preloaded[t] = ss.LoadMemoryCompiledShader ("preloaded", oso);
+            }));
+        threads.join_all ();
+    }
+
+    const char *outputs[] = { "result" };
+    for (int t = 0;  t < nthreads;  ++t) {
+        ss.attribute (groups[t].get(), "renderer_outputs",
+                      TypeDesc(TypeDesc::STRING, 1), outputs);
+        OIIO_CHECK_EQUAL (shade (ss, *groups[t], 0.25f), 0.5f);
+        OIIO_CHECK_EQUAL (found[t], 0);
+    }
+    int npreloaded = 0;
+    for (int p : preloaded)
+        npreloaded += p;
+    OIIO_CHECK_EQUAL (npreloaded, 1);
+    int masters = 0;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:masters", masters));
+    OIIO_CHECK_EQUAL (masters, 2);   // loadtest and preloaded
+    float loadtime = -1.0f, walltime = -1.0f;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:master_load_time", loadtime));
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:master_load_wall_time", walltime));
+    OIIO_CHECK_ASSERT (loadtime > 0.0f && walltime > 0.0f);
+    OIIO_CHECK_ASSERT (errhandler.errors().size() > 0);  // no_such_shader
+
+    OIIO::Filesystem::remove ("loadtest.oso");
+}
+
+
+
+// Dictionaries are read once and shared, so a changed file isn't seen
+// until invalidate_dictionaries, after which it is read again.
+static void
+test_invalidate_dictionaries ()
+{
+    const char *filename = "dict_test.xml";
+    auto write_dict = [&](int x) {
+        std::ofstream file (filename);
+        file << "<dict><value x=\"" << x << "\"/></dict>\n";
+    };
+    write_dict (1);
+
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    OIIO_CHECK_ASSERT (load_shader (ss, "dict",
+        "shader dict (output float result = 0) {\n"
+        "    int node = dict_find (\"dict_test.xml\", \"//value\");\n"
+        "    float x = -1;\n"
+        "    dict_value (node, \"x\", x);\n"
+        "    result = x;\n"
+        "}\n"));
+    ShaderGroupRef group = make_group (ss, "dict");
+    PerThreadInfo *thread_info = ss.create_thread_info ();
+    ShadingContext *ctx = ss.get_context (thread_info);
+
+    OIIO_CHECK_EQUAL (shade (ss, *ctx, *group, 0.5f), 1.0f);
+    write_dict (2);
+    OIIO_CHECK_EQUAL (shade (ss, *ctx, *group, 0.5f), 1.0f);  // cached
+    long long memory = 0;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:dictionary_memory",
+                                        TypeDesc::LONGLONG, &memory));
+    OIIO_CHECK_ASSERT (memory > 0);
+
+    ss.invalidate_dictionaries ();
+    OIIO_CHECK_EQUAL (shade (ss, *ctx, *group, 0.5f), 2.0f);
+    OIIO_CHECK_EQUAL (shade (ss, *group, 0.5f), 2.0f);   // another context
+    int documents = 0;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:dictionary_documents", documents));
+    OIIO_CHECK_EQUAL (documents, 2);
+    // The old dictionary was freed when ctx let go of it.
+    long long memory2 = 0;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:dictionary_memory",
+                                        TypeDesc::LONGLONG, &memory2));
+    OIIO_CHECK_EQUAL (memory2, memory);
+
+    ss.release_context (ctx);
+    ss.destroy_thread_info (thread_info);
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+    OIIO::Filesystem::remove (filename);
+}
+
+
+
+// Color conversions that go through OCIO must give the same results
+// when many threads ask for the same (not yet cached) processor at once.
+static void
+test_ocio_processor_cache ()
+{
+#if OIIO_HAS_COLORPROCESSOR
+    OIIO::ColorConfig config;
+    OIIO::ColorProcessorHandle proc = config.createColorProcessor ("Rec709", "linear");
+    if (! proc)
+        return;   // No such conversion in this OIIO/OCIO configuration
+
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    OIIO_CHECK_ASSERT (load_shader (ss, "ocio",
+        "shader ocio (output float result = 0) {\n"
+        "    result = transformc (\"Rec709\", \"linear\", color(u))[0];\n"
+        "}\n"));
+    ShaderGroupRef group = make_group (ss, "ocio");
+    ss.optimize_group (group.get(), nullptr);
+
+    const int nthreads = 8, nshades = 16;
+    std::vector<float> results (nthreads * nshades, -1.0f);
+    {
+        OIIO::thread_group threads;
+        for (int t = 0;  t < nthreads;  ++t)
+            threads.add_thread (new std::thread ([&,t](){
+                PerThreadInfo *thread_info = ss.create_thread_info ();
+                ShadingContext *ctx = ss.get_context (thread_info);
+                for (int i = 0;  i < nshades;  ++i)
+                    results[t*nshades+i] = shade (ss, *ctx, *group,
+                                                  (i + 0.5f) / nshades);
+                ss.release_context (ctx);
+                ss.destroy_thread_info (thread_info);
+            }));
+        threads.join_all ();
+    }
+    for (int t = 0;  t < nthreads;  ++t)
+        for (int i = 0;  i < nshades;  ++i) {
+            float c[3];
+            c[0] = c[1] = c[2] = (i + 0.5f) / nshades;
+            proc->apply (c);
+            OIIO_CHECK_EQUAL (results[t*nshades+i], c[0]);
+        }
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+#endif
+}
+
+
+
+// A renderer that answers getattribute("scale") with 10*u, and counts how
+// often it's asked anything.
+class CountingRenderer final : public RendererServices {
+public:
+    virtual bool get_attribute (ShaderGlobals *sg, bool derivatives,
+                                ustring object, TypeDesc type, ustring name,
+                                void *val) {
+        ++calls;
+        if (name == "scale" && type == TypeDesc::FLOAT) {
+            *(float *)val = 10.0f * sg->u;
+            if (derivatives)
+                ((float *)val)[1] = ((float *)val)[2] = 0.0f;
+            return true;
+        }
+        return false;
+    }
+    std::atomic<int> calls {0};
+};
+
+
+
+// With getattribute_cache on, repeating a constant getattribute lookup
+// within one execution must ask the renderer only once, count the
+// repeats as shared, and still give each point its own answer.
+static void
+test_getattribute_shared ()
+{
+    const char *src =
+        "shader shared (output float result = 0) {\n"
+        "    float a = -1, b = -1, c = -1;\n"
+        "    int ok = getattribute (\"scale\", a);\n"
+        "    ok += getattribute (\"scale\", b);\n"
+        "    ok += getattribute (\"missing\", c);\n"
+        "    ok += getattribute (\"missing\", c);\n"
+        "    result = a + b + 100 * ok + c;\n"
+        "}\n";
+    const int npoints = 8;
+    for (int cache = 0;  cache < 2;  ++cache) {
+        TestErrorHandler errhandler;
+        CountingRenderer rend;
+        ShadingSystem ss (&rend, nullptr, &errhandler);
+        ss.attribute ("getattribute_cache", cache);
+        ss.attribute ("opt_fold_getattribute", 0);
+        ss.attribute ("profile", 1);   // so the contexts record their stats
+        OIIO_CHECK_ASSERT (load_shader (ss, "shared", src));
+        ShaderGroupRef group = make_group (ss, "shared");
+
+        PerThreadInfo *thread_info = ss.create_thread_info ();
+        ShadingContext *ctx = ss.get_context (thread_info);
+        for (int i = 0;  i < npoints;  ++i) {
+            float u = (i + 0.5f) / npoints;
+            OIIO_CHECK_EQUAL (shade (ss, *ctx, *group, u), 20.0f * u + 200.0f - 1.0f);
+        }
+        ss.release_context (ctx);
+        ss.destroy_thread_info (thread_info);
+
+        // Two distinct lookups per point, each made twice.
+        long long calls = 0, hits = 0;
+        OIIO_CHECK_ASSERT (ss.getattribute ("stat:getattribute_calls",
+                                            TypeDesc::LONGLONG, &calls));
+        OIIO_CHECK_ASSERT (ss.getattribute ("stat:getattribute_cache_hits",
+                                            TypeDesc::LONGLONG, &hits));
+        OIIO_CHECK_EQUAL (rend.calls.load(), (cache ? 2 : 4) * npoints);
+        OIIO_CHECK_EQUAL (calls, (long long)rend.calls.load());
+        OIIO_CHECK_EQUAL (hits, cache ? 2 * npoints : 0);
+        OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+    }
+}
+
+
+
+// At profile level 2, profile_report must describe the layer and its ops
+// in each format, counting the runs of every thread, including threads
+// whose PerThreadInfo is already gone.
+static void
+test_profile_report ()
+{
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    ss.attribute ("profile", 2);
+    OIIO_CHECK_ASSERT (load_shader (ss, "profiled",
+        "shader profiled (output float result = 0) {\n"
+        "    for (int i = 0; i < 4; ++i)\n"
+        "        result += noise (u + i);\n"
+        "}\n"));
+    ShaderGroupRef group = make_group (ss, "profiled", "profiled_group");
+
+    const int nthreads = 4, nshades = 16;
+    OIIO::thread_group threads;
+    for (int t = 0;  t < nthreads;  ++t)
+        threads.add_thread (new std::thread ([&]() {
+            for (int i = 0;  i < nshades;  ++i)
+                shade (ss, *group, (i + 0.5f) / nshades);
+        }));
+    // One thread info still alive when the report is made.
+    PerThreadInfo *thread_info = ss.create_thread_info ();
+    ShadingContext *ctx = ss.get_context (thread_info);
+    shade (ss, *ctx, *group, 0.5f);
+    ss.release_context (ctx);
+    threads.join_all ();
+    const int nruns = nthreads * nshades + 1;
+
+    std::string text = ss.profile_report ("text");
+    std::string json = ss.profile_report ("json");
+    std::string trace = ss.profile_report ("trace");
+    if (verbose)
+        std::cout << text << "\n" << json << "\n" << trace << "\n";
+    ss.destroy_thread_info (thread_info);
+
+    OIIO_CHECK_ASSERT (Strutil::contains (text, "Most expensive layers and ops"));
+    OIIO_CHECK_ASSERT (Strutil::contains (text, "profiled_group layer 0 \"layer1\" (profiled)"));
+    OIIO_CHECK_ASSERT (Strutil::contains (text, Strutil::sprintf (", %d runs\n", nruns)));
+    OIIO_CHECK_ASSERT (Strutil::contains (text, Strutil::sprintf (", %d calls\n", 4 * nruns)));
+
+    OIIO_CHECK_ASSERT (Strutil::starts_with (json, "{\n  \"groups\": ["));
+    OIIO_CHECK_ASSERT (Strutil::contains (json, "\"name\": \"profiled_group\""));
+    OIIO_CHECK_ASSERT (Strutil::contains (json, "{ \"layer\": 0, \"name\": \"layer1\", \"shader\": \"profiled\""));
+    OIIO_CHECK_ASSERT (Strutil::contains (json, Strutil::sprintf ("\"count\": %d,", nruns)));
+    OIIO_CHECK_ASSERT (Strutil::contains (json, "{ \"op\": \"noise\""));
+    OIIO_CHECK_ASSERT (Strutil::contains (json, Strutil::sprintf ("\"count\": %d,", 4 * nruns)));
+    OIIO_CHECK_ASSERT (Strutil::ends_with (json, "  ]\n}\n"));
+
+    OIIO_CHECK_ASSERT (Strutil::starts_with (trace, "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": ["));
+    OIIO_CHECK_ASSERT (Strutil::contains (trace, "\"ph\": \"M\""));
+    OIIO_CHECK_ASSERT (Strutil::contains (trace, "\"args\": { \"name\": \"profiled_group\" }"));
+    OIIO_CHECK_ASSERT (Strutil::contains (trace, "\"cat\": \"layer\", \"ph\": \"X\""));
+    OIIO_CHECK_ASSERT (Strutil::contains (trace, "\"cat\": \"op\", \"ph\": \"X\""));
+    OIIO_CHECK_ASSERT (Strutil::contains (trace, Strutil::sprintf ("\"args\": { \"count\": %d } }", 4 * nruns)));
+
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+}
+
+
+
+// getstats and the "stat:" attributes must add up the stats of every
+// thread, both those still shading and those whose PerThreadInfo is gone,
+// and may be read while threads shade.
+static void
+test_thread_stats ()
+{
+    TestErrorHandler errhandler;
+    CountingRenderer rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    ss.attribute ("opt_fold_getattribute", 0);
+    ss.attribute ("profile", 1);   // so the contexts record their stats
+    OIIO_CHECK_ASSERT (load_shader (ss, "stats",
+        "shader stats (output float result = 0) {\n"
+        "    getattribute (\"scale\", result);\n"
+        "}\n"));
+    ShaderGroupRef group = make_group (ss, "stats");
+
+    // Odd threads keep their thread info until after the first count.
+    const int nthreads = 8, nshades = 32;
+    std::vector<PerThreadInfo *> kept (nthreads, nullptr);
+    std::atomic<int> running (nthreads);
+    OIIO::thread_group threads;
+    for (int t = 0;  t < nthreads;  ++t)
+        threads.add_thread (new std::thread ([&,t]() {
+            PerThreadInfo *thread_info = ss.create_thread_info ();
+            ShadingContext *ctx = ss.get_context (thread_info);
+            for (int i = 0;  i < nshades;  ++i) {
+                float u = (i + 0.5f) / nshades;
+                OIIO_CHECK_EQUAL (shade (ss, *ctx, *group, u), 10.0f * u);
+            }
+            ss.release_context (ctx);
+            if (t & 1)
+                kept[t] = thread_info;
+            else
+                ss.destroy_thread_info (thread_info);
+            --running;
+        }));
+    // Meanwhile, the totals must only ever grow.
+    long long last = 0;
+    while (running) {
+        long long calls = 0;
+        ss.getattribute ("stat:getattribute_calls", TypeDesc::LONGLONG, &calls);
+        OIIO_CHECK_ASSERT (calls >= last && calls <= nthreads * nshades);
+        last = calls;
+        ss.getstats (5);
+    }
+    threads.join_all ();
+
+    const long long expected = nthreads * nshades;
+    long long calls = 0;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:getattribute_calls",
+                                        TypeDesc::LONGLONG, &calls));
+    OIIO_CHECK_EQUAL (calls, expected);
+    OIIO_CHECK_EQUAL (rend.calls.load(), expected);
+    OIIO_CHECK_ASSERT (Strutil::contains (ss.getstats (5),
+                           Strutil::sprintf ("getattribute calls: %lld (", expected)));
+
+    // Nothing is lost as the rest of the threads' infos go away.
+    for (auto thread_info : kept)
+        if (thread_info)
+            ss.destroy_thread_info (thread_info);
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:getattribute_calls",
+                                        TypeDesc::LONGLONG, &calls));
+    OIIO_CHECK_EQUAL (calls, expected);
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+}
+
+
+
+// With a JIT memory budget, the code of the groups executed least
+// recently is freed, and JITed again when they're next executed -- but
+// never while a context is executing the group.
+static void
+test_jit_memory_budget ()
+{
+    // Enough code that a few dozen groups fill the 1 MB budget.
+    std::string src = "shader budget (output float result = 0) {\n";
+    for (int i = 0;  i < 400;  ++i)
+        src += Strutil::sprintf ("    result += sin (u * %d) * cos (v + %d);\n",
+                                 i + 1, i);
+    src += "}\n";
+
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    ss.attribute ("jit_memory_budget", 1);
+    OIIO_CHECK_ASSERT (load_shader (ss, "budget", src));
+
+    auto jit_memory = [&](const ShaderGroupRef &group) {
+        long long mem = -1;
+        ss.getattribute (group.get(), "jit_memory", TypeDesc::INT64, &mem);
+        return mem;
+    };
+    auto stat = [&](const char *name) {
+        int val = -1;
+        ss.getattribute (name, val);
+        return val;
+    };
+    // Every group runs the same code, so must get the same answer.
+    std::vector<ShaderGroupRef> groups;
+    float expected = 0.0f;
+    auto add_groups = [&](size_t n) {
+        for (size_t i = 0;  i < n;  ++i) {
+            groups.push_back (make_group (ss, "budget"));
+            float r = shade (ss, *groups.back(), 0.25f);
+            if (groups.size() == 1)
+                expected = r;
+            OIIO_CHECK_EQUAL (r, expected);
+            OIIO_CHECK_ASSERT (jit_memory (groups.back()) > 0);
+        }
+    };
+
+    // Fill the budget until the first eviction, which must be the group
+    // used least recently.
+    while (stat ("stat:groups_evicted") == 0 && groups.size() < 1000)
+        add_groups (1);
+    const size_t nfit = groups.size();
+    OIIO_CHECK_EQUAL (stat ("stat:groups_evicted"), 1);
+    OIIO_CHECK_EQUAL (jit_memory (groups[0]), 0);
+    OIIO_CHECK_ASSERT (jit_memory (groups[1]) > 0);
+    long long held = 0;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:jit_memory", TypeDesc::LONGLONG, &held));
+    OIIO_CHECK_ASSERT (held > 0 && held <= 1024 * 1024);
+
+    // Executing it again JITs it again.
+    OIIO_CHECK_EQUAL (shade (ss, *groups[0], 0.25f), expected);
+    OIIO_CHECK_EQUAL (stat ("stat:groups_rejitted"), 1);
+    OIIO_CHECK_ASSERT (jit_memory (groups[0]) > 0);
+
+    // A group left executing (execute_init without execute_cleanup)
+    // keeps its code however many groups are JITed after it...
+    PerThreadInfo *thread_info = ss.create_thread_info ();
+    ShadingContext *ctx = ss.get_context (thread_info);
+    ShaderGlobals sg;
+    init_globals (sg, 0.25f);
+    OIIO_CHECK_ASSERT (ss.execute_init (*ctx, *groups[0], sg));
+    add_groups (2 * nfit);
+    OIIO_CHECK_ASSERT (jit_memory (groups[0]) > 0);
+
+    // ...but once its context is released, it's evicted like any other.
+    ss.release_context (ctx);
+    add_groups (2 * nfit);
+    OIIO_CHECK_EQUAL (jit_memory (groups[0]), 0);
+    ss.destroy_thread_info (thread_info);
+
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+}
+
+
+
+// With opt_share_groups, a group identical to one already optimized uses
+// its code (and counts in the stats); groups that differ, or that follow
+// a change of an option affecting the code, compile their own.
+static void
+test_share_groups ()
+{
+    const char *src =
+        "shader scaled (float scale = 1, output float result = 0) {\n"
+        "    result = scale * u;\n"
+        "}\n";
+    auto scaled_group = [](ShadingSystem &ss, float scale) {
+        ShaderGroupRef group = ss.ShaderGroupBegin ();
+        ss.Parameter (*group, "scale", TypeDesc::FLOAT, &scale);
+        ss.Shader (*group, "surface", "scaled", "layer1");
+        ss.ShaderGroupEnd (*group);
+        const char *outputs[] = { "result" };
+        ss.attribute (group.get(), "renderer_outputs",
+                      TypeDesc(TypeDesc::STRING, 1), outputs);
+        return group;
+    };
+    auto shared = [](ShadingSystem &ss) {
+        int n = -1;
+        ss.getattribute ("stat:groups_shared", n);
+        return n;
+    };
+
+    // Off by default.
+    {
+        RendererServices rend;
+        ShadingSystem ss (&rend);
+        OIIO_CHECK_ASSERT (load_shader (ss, "scaled", src));
+        ShaderGroupRef a = scaled_group (ss, 2.0f), b = scaled_group (ss, 2.0f);
+        OIIO_CHECK_EQUAL (shade (ss, *a, 0.25f), 0.5f);
+        OIIO_CHECK_EQUAL (shade (ss, *b, 0.25f), 0.5f);
+        OIIO_CHECK_EQUAL (shared (ss), 0);
+    }
+
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    ss.attribute ("opt_share_groups", 1);
+    OIIO_CHECK_ASSERT (load_shader (ss, "scaled", src));
+    std::vector<ShaderGroupRef> groups;
+    auto run = [&](float scale) {
+        groups.push_back (scaled_group (ss, scale));
+        return shade (ss, *groups.back(), 0.25f);
+    };
+
+    OIIO_CHECK_EQUAL (run (2.0f), 0.5f);
+    OIIO_CHECK_EQUAL (shared (ss), 0);
+    OIIO_CHECK_EQUAL (run (2.0f), 0.5f);      // identical: shares
+    OIIO_CHECK_EQUAL (shared (ss), 1);
+    float saved = -1.0f;
+    OIIO_CHECK_ASSERT (ss.getattribute ("stat:group_share_time_saved", saved));
+    OIIO_CHECK_ASSERT (saved > 0.0f);
+    OIIO_CHECK_ASSERT (Strutil::contains (ss.getstats (5), "Shared the code of 1 "));
+
+    OIIO_CHECK_EQUAL (run (3.0f), 0.75f);     // different value: doesn't
+    OIIO_CHECK_EQUAL (shared (ss), 1);
+
+    // Options that don't change the code, or setting one to the value it
+    // already has, keep what can be shared...
+    int llvm_optimize = -1;
+    ss.getattribute ("llvm_optimize", llvm_optimize);
+    ss.attribute ("llvm_optimize", llvm_optimize);
+    ss.attribute ("statistics:level", 1);
+    ss.attribute ("statistics:level", 0);
+    OIIO_CHECK_EQUAL (run (2.0f), 0.5f);
+    OIIO_CHECK_EQUAL (shared (ss), 2);
+
+    // ...but changing one that does forgets it.
+    ss.attribute ("llvm_optimize", llvm_optimize ? 0 : 1);
+    OIIO_CHECK_EQUAL (run (2.0f), 0.5f);
+    OIIO_CHECK_EQUAL (shared (ss), 2);
+    OIIO_CHECK_EQUAL (run (2.0f), 0.5f);      // shares the new code
+    OIIO_CHECK_EQUAL (shared (ss), 3);
+
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+}
+
+
+
+// With "opt_specialization_cache" on, a group identical to one optimized
+// before takes its specialization and gives the same results, even when
+// its parameters aren't lockgeom (so it can't share the code); a group
+// whose parameter values differ optimizes its own.
+static void
+test_specialization_cache ()
+{
+    const char *src =
+        "shader scaled (float scale = 1, output float result = 0) {\n"
+        "    result = scale * u;\n"
+        "}\n";
+    auto scaled_group = [](ShadingSystem &ss, float scale) {
+        ShaderGroupRef group = ss.ShaderGroupBegin ();
+        ss.Parameter (*group, "scale", TypeDesc::FLOAT, &scale,
+                      false /* lockgeom */);
+        ss.Shader (*group, "surface", "scaled", "layer1");
+        ss.ShaderGroupEnd (*group);
+        const char *outputs[] = { "result" };
+        ss.attribute (group.get(), "renderer_outputs",
+                      TypeDesc(TypeDesc::STRING, 1), outputs);
+        return group;
+    };
+    auto reused = [](ShadingSystem &ss) {
+        int n = -1;
+        ss.getattribute ("stat:specializations_reused", n);
+        return n;
+    };
+    auto memory = [](ShadingSystem &ss) {
+        long long mem = -1;
+        ss.getattribute ("stat:mem_specializations_current", mem);
+        return mem;
+    };
+
+    // Off by default.
+    {
+        RendererServices rend;
+        ShadingSystem ss (&rend);
+        OIIO_CHECK_ASSERT (load_shader (ss, "scaled", src));
+        ShaderGroupRef a = scaled_group (ss, 2.0f), b = scaled_group (ss, 2.0f);
+        OIIO_CHECK_EQUAL (shade (ss, *a, 0.25f), 0.5f);
+        OIIO_CHECK_EQUAL (shade (ss, *b, 0.25f), 0.5f);
+        OIIO_CHECK_EQUAL (reused (ss), 0);
+        OIIO_CHECK_EQUAL (memory (ss), 0);
+    }
+
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    ss.attribute ("opt_specialization_cache", 4);
+    OIIO_CHECK_ASSERT (load_shader (ss, "scaled", src));
+    std::vector<ShaderGroupRef> groups;
+    auto run = [&](float scale, float u) {
+        groups.push_back (scaled_group (ss, scale));
+        return shade (ss, *groups.back(), u);
+    };
+
+    OIIO_CHECK_EQUAL (run (2.0f, 0.25f), 0.5f);
+    OIIO_CHECK_EQUAL (reused (ss), 0);
+    OIIO_CHECK_ASSERT (memory (ss) > 0);
+    OIIO_CHECK_EQUAL (run (2.0f, 0.25f), 0.5f);   // identical: hits
+    OIIO_CHECK_EQUAL (reused (ss), 1);
+    OIIO_CHECK_EQUAL (shade (ss, *groups[0], 0.75f),
+                      shade (ss, *groups[1], 0.75f));
+    OIIO_CHECK_EQUAL (shade (ss, *groups[1], 0.75f), 1.5f);
+
+    OIIO_CHECK_EQUAL (run (3.0f, 0.25f), 0.75f);  // different value: misses
+    OIIO_CHECK_EQUAL (reused (ss), 1);
+    OIIO_CHECK_EQUAL (run (3.0f, 0.5f), 1.5f);    // but is saved in turn
+    OIIO_CHECK_EQUAL (reused (ss), 2);
+
+    // Changing an option that affects the code forgets them all, along
+    // with their memory.
+    int llvm_optimize = -1;
+    ss.getattribute ("llvm_optimize", llvm_optimize);
+    ss.attribute ("llvm_optimize", llvm_optimize ? 0 : 1);
+    OIIO_CHECK_EQUAL (memory (ss), 0);
+    OIIO_CHECK_EQUAL (run (2.0f, 0.25f), 0.5f);
+    OIIO_CHECK_EQUAL (reused (ss), 2);
+
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+}
+
+
+
+// Each printf of a shader reaches the ErrorHandler as one message, in
+// order, whether or not printf output is buffered (including lines too
+// long for the buffer's spare room).  Buffered, the messages of one
+// execution stay together even when other threads are printing too.
+static void
+test_buffered_printf ()
+{
+    const std::string longtext (1000, 'x');
+    std::string src =
+        "shader printer (output float result = 0) {\n"
+        "    for (int i = 0;  i < 4;  ++i)\n"
+        "        printf (\"%g %d\\n\", u, i);\n"
+        "    printf (\"%g " + longtext + "\\n\", u);\n"
+        "    result = u;\n"
+        "}\n";
+    const int nprintfs = 5;
+    auto expected = [&](float u, int i) {
+        return i < nprintfs - 1 ? Strutil::sprintf ("%g %d\n", u, i)
+                                : Strutil::sprintf ("%g %s\n", u, longtext);
+    };
+
+    for (int buffer = 0;  buffer <= 1;  ++buffer) {
+        TestErrorHandler errhandler;
+        RendererServices rend;
+        ShadingSystem ss (&rend, nullptr, &errhandler);
+        ss.attribute ("buffer_printf", buffer);
+        OIIO_CHECK_ASSERT (load_shader (ss, "printer", src));
+        ShaderGroupRef group = make_group (ss, "printer");
+
+        OIIO_CHECK_EQUAL (shade (ss, *group, 0.25f), 0.25f);
+        std::vector<std::string> messages = errhandler.messages ();
+        OIIO_CHECK_EQUAL (messages.size(), size_t(nprintfs));
+        for (int i = 0;  i < nprintfs && i < (int)messages.size();  ++i)
+            OIIO_CHECK_EQUAL (messages[i], expected (0.25f, i));
+        errhandler.clear ();
+
+        if (! buffer)
+            continue;
+        const int nthreads = 4, npoints = 50;
+        OIIO::thread_group threads;
+        for (int t = 0;  t < nthreads;  ++t)
+            threads.add_thread (new std::thread ([&,t]() {
+                PerThreadInfo *thread_info = ss.create_thread_info ();
+                ShadingContext *ctx = ss.get_context (thread_info);
+                for (int p = 0;  p < npoints;  ++p)
+                    shade (ss, *ctx, *group, float(t * npoints + p));
+                ss.release_context (ctx);
+                ss.destroy_thread_info (thread_info);
+            }));
+        threads.join_all ();
+        messages = errhandler.messages ();
+        OIIO_CHECK_EQUAL (messages.size(), size_t(nthreads * npoints * nprintfs));
+        int together = 0;
+        for (size_t m = 0;  m + nprintfs <= messages.size();  m += nprintfs) {
+            float u = Strutil::from_string<float> (messages[m]);
+            bool ok = true;
+            for (int i = 0;  i < nprintfs;  ++i)
+                ok &= (messages[m+i] == expected (u, i));
+            together += ok;
+        }
+        OIIO_CHECK_EQUAL (together, nthreads * npoints);
+        OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+    }
+}
+
+
+
+// A binary oso that is cut short anywhere, or names a string that isn't in
+// its string table, must fail to load with an error, rather than handing
+// the loader made-up values.
+static void
+test_corrupt_binary_oso ()
+{
+    const char *src =
+        "shader corrupt (float scale = 2, string name = \"abc\",\n"
+        "                output float result = 0) {\n"
+        "    result = scale * u;\n"
+        "    if (name == \"xyz\")\n"
+        "        result = 0;\n"
+        "}\n";
+    OSLCompiler compiler;
+    std::string osotext, binary, err;
+    std::vector<std::string> options;
+    OIIO_CHECK_ASSERT (compiler.compile_buffer (src, osotext, options, stdoslpath));
+    OIIO_CHECK_ASSERT (oso_text_to_binary (osotext, binary, err));
+
+    TestErrorHandler errhandler;
+    RendererServices rend;
+    ShadingSystem ss (&rend, nullptr, &errhandler);
+    OIIO_CHECK_ASSERT (ss.LoadMemoryCompiledShader ("whole", binary));
+    OIIO_CHECK_EQUAL (errhandler.errors().size(), size_t(0));
+
+    // Past the magic, version and byte order mark, every cut is corrupt.
+    int nbad = 0;
+    for (size_t n = 12;  n < binary.size();  ++n) {
+        errhandler.clear ();
+        bool ok = ss.LoadMemoryCompiledShader (Strutil::sprintf ("cut%d", n),
+                                               string_view (binary.data(), n));
+        std::vector<std::string> errors = errhandler.errors ();
+        bool reported = errors.size() &&
+                        Strutil::starts_with (errors[0], "Corrupt binary oso");
+        nbad += (ok || ! reported);
+    }
+    OIIO_CHECK_EQUAL (nbad, 0);
+
+    // The header (magic, version, byte order mark, string count and size)
+    // is followed by the string table, the size of the events, and the
+    // events, the first of which is the version: its event code, then the
+    // index of its spec string.  Point that past the end of the table.
+    uint32_t nstrings, strbytes;
+    memcpy (&nstrings, &binary[12], 4);
+    memcpy (&strbytes, &binary[16], 4);
+    std::string badstring = binary;
+    memcpy (&badstring[20 + strbytes + 4 + 1], &nstrings, 4);
+    errhandler.clear ();
+    OIIO_CHECK_ASSERT (! ss.LoadMemoryCompiledShader ("badstring", badstring));
+    std::vector<std::string> errors = errhandler.errors ();
+    OIIO_CHECK_ASSERT (errors.size() &&
+                       Strutil::contains (errors[0], "bad string index"));
+}
+
+
+
+static void
+getargs (int argc, char *argv[])
+{
+    bool help = false;
+    OIIO::ArgParse ap;
+    ap.options ("shadingsys_test\n"
+                OIIO_INTRO_STRING "\n"
+                "Usage:  shadingsys_test [options]",
+                "--help", &help, "Print help message",
+                "-v", &verbose, "Verbose mode",
+                "--stdosl %s", &stdoslpath, "Path to stdosl.h",
+                NULL);
+    if (ap.parse (argc, (const char**)argv) < 0) {
+        std::cerr << ap.geterror() << std::endl;
+        ap.usage ();
+        exit (EXIT_FAILURE);
+    }
+    if (help) {
+        ap.usage ();
+        exit (EXIT_FAILURE);
+    }
+}
+
+
+
+int
+main (int argc, char *argv[])
+{
+    getargs (argc, argv);
+
+    test_async_jit_ready ();
+    test_async_jit_execute ();
+    test_tiered_jit ();
+    test_pointcloud_search_batch ();
+    test_concurrent_loading ();
+    test_invalidate_dictionaries ();
+    test_ocio_processor_cache ();
+    test_getattribute_shared ();
+    test_profile_report ();
+    test_thread_stats ();
+    test_jit_memory_budget ();
+    test_share_groups ();
+    test_specialization_cache ();
+    test_buffered_printf ();
+    test_corrupt_binary_oso ();
+
+    return unit_test_failures;
+}
@@ -456,4 +456,13 @@ OSLQuery::open_bytecode (string_view buffer)
     return ok;
 }
 
+
+
+bool
+oso_text_to_binary (const std::string &osotext, std::string &binary,
+                    std::string &errmessage)
+{
+    return OSOReader::text_to_binary (osotext, binary, errmessage);
+}
+
 OSL_NAMESPACE_EXIT
@@ -27,18 +27,25 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <cstring>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/thread.h>
 
 #include <OSL/oslcomp.h>
 #include <OSL/oslexec.h>
+#include <OSL/oslquery.h>
 using namespace OSL;
 
 
@@ -49,10 +56,11 @@ usage ()
     std::cout <<
         "oslc -- Open Shading Language compiler " OSL_LIBRARY_VERSION_STRING "\n"
         OSL_COPYRIGHT_STRING "\n"
-        "Usage:  oslc [options] file\n"
+        "Usage:  oslc [options] file [file ...]\n"
         "  Options:\n"
         "\t--help         Print this usage message\n"
-        "\t-o filename    Specify output filename\n"
+        "\t-o filename    Specify output filename (only with a single file)\n"
+        "\t-j N           Compile multiple files using N threads (0 = all cores)\n"
         "\t-v             Verbose mode\n"
         "\t-q             Quiet mode\n"
         "\t-Ipath         Add path to the #include search path\n"
@@ -64,6 +72,7 @@ usage ()
         "\t-Werror        Treat all warnings as errors\n"
         "\t-embed-source  Embed preprocessed source in the oso file\n"
         "\t-buffer        (debugging) Force compile from buffer\n"
+        "\t-binary        Write compact binary oso (faster to load)\n"
         "\t-MD, -MMD      Write a depfile containing headers used, to a file\n"
         "\t-M, -MM        Like -MD, but write depfile to stdout\n"
         "\t-MF filename   Specify the name of the depfile to output (for -MD, -MMD)\n"
@@ -111,6 +120,61 @@ public:
 };
 
 static OSLC_ErrorHandler default_oslc_error_handler;
+
+
+
+// Compile one shader, reporting success or failure on the console.
+static bool
+compile_shader (const std::string &shader_path,
+                const std::vector<std::string> &args,
+                bool quiet, bool compile_from_buffer, bool binary_oso)
+{
+    OSLCompiler compiler (&default_oslc_error_handler);
+    bool ok = true;
+    if (compile_from_buffer || binary_oso) {
+        // Compile to a buffer -- either forced, for debugging purposes,
+        // or so that we can convert it to binary before writing.
+        std::string sourcecode;
+        ok = OIIO::Filesystem::read_text_file (shader_path, sourcecode);
+        std::string osobuffer;
+        if (ok)
+            ok = compiler.compile_buffer (sourcecode, osobuffer, args, "",
+                                          shader_path);
+        if (ok && binary_oso) {
+            std::string binary, err;
+            ok = oso_text_to_binary (osobuffer, binary, err);
+            if (ok)
+                osobuffer.swap (binary);
+            else
+                std::cerr << err << "\n";
+        }
+        if (ok) {
+            std::ofstream file;
+            OIIO::Filesystem::open (file, compiler.output_filename(),
+                                    std::ios::out | std::ios::binary);
+            if (file.good()) {
+                file << osobuffer;
+                file.close ();
+            }
+        }
+    } else {
+        // Ordinary compile from file
+        ok = compiler.compile (shader_path, args);
+    }
+
+    // One write per line, so messages from concurrent compiles don't
+    // get interleaved mid-line.
+    if (ok) {
+        if (!quiet)
+            std::cout << OIIO::Strutil::sprintf ("Compiled %s -> %s\n",
+                             shader_path, compiler.output_filename());
+    }
+    else {
+        std::cout << OIIO::Strutil::sprintf ("FAILED %s\n", shader_path);
+    }
+    return ok;
+}
+
 } // anonymous namespace
 
 
@@ -138,7 +202,10 @@ main (int argc, const char *argv[])
     std::vector<std::string> args;
     bool quiet = false;
     bool compile_from_buffer = false;
-    std::string shader_path;
+    bool binary_oso = false;
+    bool has_output_filename = false;
+    int nthreads = 1;
+    std::vector<std::string> shader_paths;
 
     // Parse arguments from command line
     for (int a = 1;  a < argc;  ++a) {
@@ -181,6 +248,14 @@ main (int argc, const char *argv[])
             args.emplace_back(argv[a]);
             ++a;
             args.emplace_back(argv[a]);
+            has_output_filename = true;
+        }
+        else if (! strcmp (argv[a], "-j") && a < argc-1
+                 && isdigit (argv[a+1][0])) {
+            nthreads = atoi (argv[++a]);
+        }
+        else if (! strncmp (argv[a], "-j", 2) && isdigit (argv[a][2])) {
+            nthreads = atoi (argv[a]+2);
         }
         else if (argv[a][0] == '-' &&
                  (argv[a][1] == 'D' || argv[a][1] == 'U' || argv[a][1] == 'I')) {
@@ -189,49 +264,52 @@ main (int argc, const char *argv[])
         else if (!strcmp(argv[a], "-buffer")) {
             compile_from_buffer = true;
         }
+        else if (!strcmp(argv[a], "-binary") || !strcmp(argv[a], "--binary")) {
+            binary_oso = true;
+        }
         else {
             // Shader to compile
-            shader_path = argv[a];
+            shader_paths.emplace_back (argv[a]);
         }
     }
 
-    if (shader_path.empty ()) {
+    if (shader_paths.empty ()) {
         std::cout << "ERROR: Missing shader path" << "\n\n";
         usage ();
         return EXIT_FAILURE;
     }
+    if (shader_paths.size() > 1 && has_output_filename) {
+        std::cout << "ERROR: -o may only be used when compiling one file\n";
+        return EXIT_FAILURE;
+    }
 
-    OSLCompiler compiler (&default_oslc_error_handler);
-    bool ok = true;
-    if (compile_from_buffer) {
-        // Force a compile-from-buffer for debugging purposes
-        std::string sourcecode;
-        ok = OIIO::Filesystem::read_text_file (shader_path, sourcecode);
-        std::string osobuffer;
-        if (ok)
-            ok = compiler.compile_buffer (sourcecode, osobuffer, args, "",
-                                          shader_path);
-        if (ok) {
-            std::ofstream file;
-            OIIO::Filesystem::open (file, compiler.output_filename());
-            if (file.good()) {
-                file << osobuffer;
-                file.close ();
-            }
+    // Compile all the files, handing them out to the worker threads one
+    // at a time.  Preprocessing, which is the bulk of the work, runs
+    // concurrently; the compilers serialize parsing internally, and
+    // share a cache of the headers they've read.
+    if (nthreads <= 0)
+        nthreads = std::max (1, int(std::thread::hardware_concurrency()));
+    nthreads = std::min (nthreads, int(shader_paths.size()));
+    std::atomic<size_t> next_shader (0);
+    std::atomic<int> nfailed (0);
+    auto worker = [&]() {
+        for (size_t i; (i = next_shader++) < shader_paths.size(); ) {
+            if (! compile_shader (shader_paths[i], args, quiet,
+                                  compile_from_buffer, binary_oso))
+                ++nfailed;
         }
+    };
+    if (nthreads == 1) {
+        worker ();
     } else {
-        // Ordinary compile from file
-        ok = compiler.compile (shader_path, args);
+        std::vector<std::thread> threads;
+        for (int t = 0;  t < nthreads;  ++t)
+            threads.emplace_back (worker);
+        for (auto&& t : threads)
+            t.join ();
     }
 
-    if (ok) {
-        if (!quiet)
-            std::cout << "Compiled " << shader_path << " -> " << compiler.output_filename() << "\n";
-    }
-    else {
-        std::cout << "FAILED " << shader_path << "\n";
+    if (nfailed)
         return EXIT_FAILURE;
-    }
-
     return EXIT_SUCCESS;
 }
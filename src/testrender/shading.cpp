@@ -694,6 +694,11 @@ void process_closure (ShadingResult& result, const ClosureColor* closure, const
            process_closure(result, closure->as_add()->closureB, w, light_only);
            break;
        }
+       case ClosureColor::LIST: {
+           for (auto comp : *closure->as_list())
+               process_closure(result, comp, w, light_only);
+           break;
+       }
        default: {
            const ClosureComponent* comp = closure->as_comp();
            Color3 cw = w * comp->w;
@@ -754,6 +759,12 @@ Vec3 process_background_closure(const ClosureColor* closure) {
                return process_background_closure(closure->as_add()->closureA) +
                       process_background_closure(closure->as_add()->closureB);
            }
+           case ClosureColor::LIST: {
+               Vec3 sum (0, 0, 0);
+               for (auto comp : *closure->as_list())
+                   sum += process_background_closure(comp);
+               return sum;
+           }
            case BACKGROUND_ID: {
                return closure->as_comp()->w;
            }
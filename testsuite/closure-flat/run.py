@@ -0,0 +1,6 @@
+#!/usr/bin/env python
+
+# Rerun the closure test, building flat closure lists. The printed
+# closures should come out exactly the same.
+command = oslc("../closure/test.osl")
+command += testshade("-g 2 2 --options flat_closures=1 test")
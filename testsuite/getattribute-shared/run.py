@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Repeated getattribute calls share one renderer lookup per execution,
+# but must still see each shading point's own answer.
+command = testshade("-g 2 2 --options getattribute_cache=1,opt_fold_getattribute=0 test")
+
+# Each of the 4 lookups is repeated once at each of the 4 points, so the
+# shared path must have answered 16 of them.
+command += testshade("-g 2 2 --runstats --options getattribute_cache=1,opt_fold_getattribute=0,profile=1 test | grep 'getattribute calls shared'")
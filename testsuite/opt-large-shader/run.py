@@ -0,0 +1,28 @@
+#!/usr/bin/env python
+
+# Stress the runtime optimizer's per-symbol bookkeeping (dependency
+# tracking, alias maps, lifetimes) with a very large generated shader:
+# a chain of thousands of distinct variables, mixing plain assignment,
+# conditionals, and loops.  Every step adds exactly 1, so the result is
+# exact and the test doubles as a timing benchmark for big shaders.
+# A 1x1 grid shades at u = 0.5 with Dx(u) = 1, so every conditional
+# takes its "+= 1" branch: result = 0.5 + 6000, and since each step only
+# adds constants to a copy, Dx(result) = Dx(u) = 1.
+
+nsteps = 6000
+with open ("large_shader.osl", "w") as f :
+    f.write ("shader large_shader (output float result = 0)\n{\n")
+    f.write ("    float a0 = u;\n")
+    for i in range (1, nsteps+1) :
+        f.write ("    float a%d = a%d;\n" % (i, i-1))
+        if i % 3 == 0 :
+            f.write ("    a%d += 1;\n" % i)
+        elif i % 3 == 1 :
+            f.write ("    if (u > 0.25)\n        a%d += 1;\n    else\n        a%d -= 1;\n" % (i, i))
+        else :
+            f.write ("    for (int j = 0; j < 4; ++j)\n        a%d += 0.25;\n" % i)
+    f.write ("    result = a%d;\n" % nsteps)
+    f.write ("    printf (\"result = %g, Dx(result) = %g\\n\", result, Dx(result));\n")
+    f.write ("}\n")
+
+command += testshade("-g 1 1 large_shader")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Compile several files with one invocation of oslc, in parallel, then
+# make sure each of them came out right.
+compile_osl_files = False
+
+command = oslc ("-q -j 2 a.osl b.osl")
+command += testshade ("a")
+command += testshade ("b")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Compile to the compact binary oso format, then make sure that both
+# oslinfo and testshade can read it.
+compile_osl_files = False
+
+command = oslc ("-q -binary test.osl")
+command += oslinfo ("-v test")
+command += testshade ("test")
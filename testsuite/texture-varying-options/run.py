@@ -0,0 +1,3 @@
+#!/usr/bin/env python
+
+command += testshade("-g 4 4 --center test")